@@ -1,13 +1,35 @@
 #include <Acceleration.h>
 #include <Scene.h>
+#include <Parallel.h>
 
 using namespace Eigen;
 
 namespace PathTracer
 {
-    Bvh::Bvh(const std::vector<Triangle*>& Triangles)
-    : pTriangles{&Triangles}
+    constexpr unsigned kSpatialSplitMaxDepth = 60;
+    constexpr unsigned kSpatialSplitMaxLeafSize = 8;
+    constexpr Float kSpatialSplitTraversalCost = 0.125f;
+
+    static Float SurfaceArea(const Aabb& Box)
+    {
+        return Box.IsEmpty() ? 0 : Box.GetArea();
+    }
+
+    static Aabb Union(const Aabb& A, const Aabb& B)
     {
+        return Aabb(A.Bounds[0].cwiseMin(B.Bounds[0]), A.Bounds[1].cwiseMax(B.Bounds[1]));
+    }
+
+    Bvh::Bvh(const std::vector<Triangle*>& Triangles, const BvhOptions& Options, std::vector<Eigen::Vector3f> Centroids)
+    : pTriangles{&Triangles}, mCentroids{std::move(Centroids)}, mOptions{Options}
+    {
+        if (Options.Builder == BvhBuilder::SpatialSplit)
+        {
+            SpatialSplitBuild(Options);
+
+            return;
+        }
+
         mNodes.resize(2 * Triangles.size() - 1);
         
         mTriangleIndices.resize(Triangles.size());
@@ -17,21 +39,93 @@ namespace PathTracer
         CalcTriangleCentroid();
 
         BuildStructure();
+
+        // a midpoint build rarely uses all 2N - 1 nodes
+        mNodes.resize(mNodesUsed);
+        mNodes.shrink_to_fit();
+    }
+
+    size_t Bvh::GetSizeInBytes() const
+    {
+        return GetVectorBytes(mNodes) + GetVectorBytes(mTriangleIndices) + GetVectorBytes(mCentroids);
+    }
+
+    void Bvh::ReportMemory(MemoryReport& Report) const
+    {
+        Report.Add("BVH nodes", GetVectorBytes(mNodes));
+        Report.Add("BVH triangle indices", GetVectorBytes(mTriangleIndices));
+        Report.Add("BVH centroids", GetVectorBytes(mCentroids));
+
+        if (mPlacement != NumaPlacement::None)
+        {
+            Report.Add("BVH NUMA copies", mPlacedNodes.GetSizeInBytes() + mPlacedIndices.GetSizeInBytes());
+        }
+    }
+
+    size_t Bvh::EstimateSizeInBytes(size_t NumTriangles, const BvhOptions& Options, bool WithCentroids, NumaPlacement Placement)
+    {
+        size_t NumReferences = NumTriangles;
+
+        if (Options.Builder == BvhBuilder::SpatialSplit)
+        {
+            NumReferences += static_cast<size_t>(NumTriangles * std::max(Options.DuplicationBudget, 0.f));
+
+            // the spatial builder never keeps centroids
+            WithCentroids = false;
+        }
+
+        const size_t NumNodes = NumReferences > 0 ? 2 * NumReferences - 1 : 0;
+        const size_t NumCopies = GetNumNumaCopies(Placement, GetNumaTopology());
+
+        return (NumNodes * sizeof(BvhNode) + NumReferences * sizeof(unsigned)) * (1 + NumCopies)
+               + (WithCentroids ? NumTriangles * sizeof(Vector3f) : 0);
+    }
+
+    size_t Bvh::GetPlacementSizeInBytes(NumaPlacement Placement) const
+    {
+        const size_t NumCopies = GetNumNumaCopies(Placement, GetNumaTopology());
+
+        return (mNodes.size() * sizeof(BvhNode) + mTriangleIndices.size() * sizeof(unsigned)) * NumCopies;
+    }
+
+    void Bvh::ReleaseBuildData()
+    {
+        mCentroids = std::vector<Vector3f>();
+
+        mNodes.resize(mNodesUsed);
+        mNodes.shrink_to_fit();
+
+        PlaceForNuma(mPlacement);
+    }
+
+    void Bvh::PlaceForNuma(NumaPlacement Placement)
+    {
+        mPlacement = Placement;
+
+        mPlacedNodes = NumaArray<BvhNode>(mNodes, Placement, GetNumaTopology());
+        mPlacedIndices = NumaArray<unsigned>(mTriangleIndices, Placement, GetNumaTopology());
+    }
+
+    Eigen::Vector3f Bvh::CalcCentroid(const Triangle& aTriangle)
+    {
+        return (aTriangle.GetPosition(0) + aTriangle.GetPosition(1) + aTriangle.GetPosition(2)) * 0.3333333433F;
     }
 
     void Bvh::CalcTriangleCentroid()
     {
         const auto& TriangleList = *pTriangles;
-        
-        constexpr Float x = 1.f / 3;
 
+        if (mCentroids.size() == TriangleList.size())
+        {
+            return;
+        }
+
+        mCentroids.clear();
         mCentroids.reserve(TriangleList.size());
 
         for (size_t Index = 0; Index < TriangleList.size(); Index++)
         {
-            const auto& Triangle = *TriangleList[Index];
-
-            mCentroids.push_back((Triangle.V0.Position + Triangle.V1.Position + Triangle.V2.Position) * 0.3333333433F);
+            mCentroids.push_back(CalcCentroid(*TriangleList[Index]));
         }
     }
     
@@ -41,8 +135,6 @@ namespace PathTracer
         Node.LeftChild = 0;
         Node.NumPrimitives = static_cast<unsigned>(mTriangleIndices.size());
 
-        CalcTriangleCentroid();
-        
         UpdateNodeBounds(mNodes[0]);
         MidPointSplit(mNodes[0]);
     }
@@ -55,9 +147,9 @@ namespace PathTracer
         {
             const auto& Triangle = *TriangleList[mTriangleIndices[Index + Node.LeftChild]];
 
-            Node.BoundingBox.GrowBy(Triangle.V0.Position);
-            Node.BoundingBox.GrowBy(Triangle.V1.Position);
-            Node.BoundingBox.GrowBy(Triangle.V2.Position);
+            Node.BoundingBox.GrowBy(Triangle.GetPosition(0));
+            Node.BoundingBox.GrowBy(Triangle.GetPosition(1));
+            Node.BoundingBox.GrowBy(Triangle.GetPosition(2));
         }
     }
 
@@ -104,9 +196,10 @@ namespace PathTracer
         return LeftChildIndex;
     }
 
-    void Bvh::MidPointSplit(BvhNode& Node)
+    void Bvh::MidPointSplit(BvhNode& Node, unsigned Depth)
     {
-        if (Node.NumPrimitives <= 2)
+        // clustered geometry can halve the box many times over, deeper leaves just get larger
+        if (Node.NumPrimitives <= 2 || Depth >= kBvhMaxDepth)
         {
             return;
         }
@@ -138,33 +231,968 @@ namespace PathTracer
         UpdateNodeBounds(mNodes[LeftChildIndex]);
         UpdateNodeBounds(mNodes[LeftChildIndex + 1]);
         
-        MidPointSplit(mNodes[LeftChildIndex]);
-        MidPointSplit(mNodes[LeftChildIndex + 1]);
+        MidPointSplit(mNodes[LeftChildIndex], Depth + 1);
+        MidPointSplit(mNodes[LeftChildIndex + 1], Depth + 1);
     }
 
-    bool Bvh::Intersect(const Ray& aRay, Intersection& HitResult) const
+    void Bvh::SpatialSplitBuild(const BvhOptions& Options)
+    {
+        const auto& Triangles = *pTriangles;
+
+        mOptions = Options;
+        mOptions.NumBins = std::max(Options.NumBins, 2u);
+
+        std::vector<BvhReference> References(Triangles.size());
+
+        Aabb RootBounds;
+
+        for (size_t Index = 0; Index < Triangles.size(); Index++)
+        {
+            for (unsigned Corner = 0; Corner < 3; Corner++)
+            {
+                References[Index].Bounds.GrowBy(Triangles[Index]->GetPosition(Corner));
+            }
+
+            References[Index].TriangleIndex = static_cast<unsigned>(Index);
+
+            RootBounds.GrowBy(References[Index].Bounds);
+        }
+
+        mRootArea = SurfaceArea(RootBounds);
+        mNumReferences = Triangles.size();
+        mMaxReferences = Triangles.size() + static_cast<size_t>(Triangles.size() * std::max(Options.DuplicationBudget, 0.f));
+
+        mNodes.clear();
+        mNodes.emplace_back();
+
+        mTriangleIndices.clear();
+        mTriangleIndices.reserve(mMaxReferences);
+
+        // the spatial builder works on reference boxes, not centroids
+        mCentroids = std::vector<Vector3f>();
+
+        SpatialSplitNode(0, std::move(References), 0);
+
+        mNodesUsed = static_cast<int>(mNodes.size());
+
+        mNodes.shrink_to_fit();
+        mTriangleIndices.shrink_to_fit();
+    }
+
+    void Bvh::SplitReference(const BvhReference& Reference, int Axis, Float Position, Aabb& Left, Aabb& Right) const
+    {
+        const Triangle& aTriangle = *(*pTriangles)[Reference.TriangleIndex];
+
+        Left = Aabb();
+        Right = Aabb();
+
+        for (unsigned Corner = 0; Corner < 3; Corner++)
+        {
+            const Vector3f V0 = aTriangle.GetPosition(Corner);
+            const Vector3f V1 = aTriangle.GetPosition((Corner + 1) % 3);
+
+            if (V0[Axis] <= Position)
+            {
+                Left.GrowBy(V0);
+            }
+
+            if (V0[Axis] >= Position)
+            {
+                Right.GrowBy(V0);
+            }
+
+            // edge crosses the plane, the crossing point belongs to both sides
+            if ((V0[Axis] < Position && V1[Axis] > Position) || (V0[Axis] > Position && V1[Axis] < Position))
+            {
+                const Float t = std::clamp((Position - V0[Axis]) / (V1[Axis] - V0[Axis]), 0.f, 1.f);
+
+                Vector3f Crossing = V0 + (V1 - V0) * t;
+                Crossing[Axis] = Position;
+
+                Left.GrowBy(Crossing);
+                Right.GrowBy(Crossing);
+            }
+        }
+
+        Left.Bounds[1][Axis] = Position;
+        Right.Bounds[0][Axis] = Position;
+
+        // the reference may already be a clipped part of the triangle
+        Left.Bounds[0] = Left.Bounds[0].cwiseMax(Reference.Bounds.Bounds[0]);
+        Left.Bounds[1] = Left.Bounds[1].cwiseMin(Reference.Bounds.Bounds[1]);
+        Right.Bounds[0] = Right.Bounds[0].cwiseMax(Reference.Bounds.Bounds[0]);
+        Right.Bounds[1] = Right.Bounds[1].cwiseMin(Reference.Bounds.Bounds[1]);
+    }
+
+    void Bvh::SpatialSplitNode(unsigned NodeIndex, std::vector<BvhReference> References, unsigned Depth)
+    {
+        const unsigned NumBins = mOptions.NumBins;
+        const size_t Count = References.size();
+
+        Aabb Bounds, CentroidBounds;
+
+        for (const auto& Reference : References)
+        {
+            Bounds.GrowBy(Reference.Bounds);
+            CentroidBounds.GrowBy((Reference.Bounds.Bounds[0] + Reference.Bounds.Bounds[1]) * 0.5f);
+        }
+
+        mNodes[NodeIndex].BoundingBox = Aabb(Bounds.Bounds[0], Bounds.Bounds[1]);
+
+        auto MakeLeaf = [&]()
+        {
+            mNodes[NodeIndex].LeftChild = static_cast<unsigned>(mTriangleIndices.size());
+            mNodes[NodeIndex].NumPrimitives = static_cast<unsigned>(References.size());
+
+            for (const auto& Reference : References)
+            {
+                mTriangleIndices.push_back(Reference.TriangleIndex);
+            }
+        };
+
+        if (Count <= 2 || Depth >= kSpatialSplitMaxDepth)
+        {
+            MakeLeaf();
+
+            return;
+        }
+
+        const Float NodeArea = SurfaceArea(Bounds);
+
+        Float BestCost = kInfinity;
+        int BestAxis = -1;
+        unsigned BestSplit = 0;
+        bool BestIsSpatial = false;
+
+        struct ObjectBin
+        {
+            Aabb Bounds;
+            unsigned Count = 0;
+        };
+
+        auto CentroidBin = [&](const BvhReference& Reference, int Axis)
+        {
+            const Float Centroid = (Reference.Bounds.Bounds[0][Axis] + Reference.Bounds.Bounds[1][Axis]) * 0.5f;
+            const Float Extent = CentroidBounds.Bounds[1][Axis] - CentroidBounds.Bounds[0][Axis];
+
+            return std::min(NumBins - 1, static_cast<unsigned>((Centroid - CentroidBounds.Bounds[0][Axis]) / Extent * NumBins));
+        };
+
+        // binned object split over the reference centroids
+        for (int Axis = 0; Axis < 3; Axis++)
+        {
+            if (CentroidBounds.Bounds[1][Axis] <= CentroidBounds.Bounds[0][Axis])
+            {
+                continue;
+            }
+
+            std::vector<ObjectBin> Bins(NumBins);
+
+            for (const auto& Reference : References)
+            {
+                ObjectBin& Bin = Bins[CentroidBin(Reference, Axis)];
+
+                Bin.Bounds.GrowBy(Reference.Bounds);
+                Bin.Count++;
+            }
+
+            std::vector<Float> RightCost(NumBins, 0);
+            Aabb RightBounds;
+            unsigned RightCount = 0;
+
+            for (unsigned Bin = NumBins - 1; Bin > 0; Bin--)
+            {
+                RightBounds.GrowBy(Bins[Bin].Bounds);
+                RightCount += Bins[Bin].Count;
+                RightCost[Bin] = SurfaceArea(RightBounds) * RightCount;
+            }
+
+            Aabb LeftBounds;
+            unsigned LeftCount = 0;
+
+            for (unsigned Bin = 1; Bin < NumBins; Bin++)
+            {
+                LeftBounds.GrowBy(Bins[Bin - 1].Bounds);
+                LeftCount += Bins[Bin - 1].Count;
+
+                if (LeftCount == 0 || LeftCount == Count)
+                {
+                    continue;
+                }
+
+                const Float Cost = SurfaceArea(LeftBounds) * LeftCount + RightCost[Bin];
+
+                if (Cost < BestCost)
+                {
+                    BestCost = Cost;
+                    BestAxis = Axis;
+                    BestSplit = Bin;
+                }
+            }
+        }
+
+        // only look for spatial splits where the object split children overlap noticeably
+        Float OverlapArea = 0;
+
+        if (BestAxis != -1)
+        {
+            Aabb LeftBounds, RightBounds;
+
+            for (const auto& Reference : References)
+            {
+                (CentroidBin(Reference, BestAxis) < BestSplit ? LeftBounds : RightBounds).GrowBy(Reference.Bounds);
+            }
+
+            const Aabb Overlap(LeftBounds.Bounds[0].cwiseMax(RightBounds.Bounds[0]), LeftBounds.Bounds[1].cwiseMin(RightBounds.Bounds[1]));
+
+            OverlapArea = SurfaceArea(Overlap);
+        }
+
+        struct SpatialBin
+        {
+            Aabb Bounds;
+            unsigned Entries = 0;
+            unsigned Exits = 0;
+        };
+
+        const size_t ReferencesLeft = mMaxReferences - mNumReferences;
+
+        if ((BestAxis == -1 || OverlapArea > mOptions.OverlapThreshold * mRootArea) && ReferencesLeft > 0)
+        {
+            for (int Axis = 0; Axis < 3; Axis++)
+            {
+                const Float Origin = Bounds.Bounds[0][Axis];
+                const Float BinWidth = (Bounds.Bounds[1][Axis] - Origin) / NumBins;
+
+                if (BinWidth <= 0)
+                {
+                    continue;
+                }
+
+                auto PositionBin = [&](Float Position)
+                {
+                    return std::min(NumBins - 1, static_cast<unsigned>(std::max((Position - Origin) / BinWidth, 0.f)));
+                };
+
+                std::vector<SpatialBin> Bins(NumBins);
+
+                for (const auto& Reference : References)
+                {
+                    const unsigned FirstBin = PositionBin(Reference.Bounds.Bounds[0][Axis]);
+                    const unsigned LastBin = std::max(FirstBin, PositionBin(Reference.Bounds.Bounds[1][Axis]));
+
+                    Aabb Remaining(Reference.Bounds.Bounds[0], Reference.Bounds.Bounds[1]);
+
+                    // chop the reference at every bin boundary it crosses
+                    for (unsigned Bin = FirstBin; Bin < LastBin; Bin++)
+                    {
+                        const BvhReference Part{ Aabb(Remaining.Bounds[0], Remaining.Bounds[1]), Reference.TriangleIndex };
+
+                        Aabb LeftPart, RightPart;
+
+                        SplitReference(Part, Axis, Origin + BinWidth * (Bin + 1), LeftPart, RightPart);
+
+                        Bins[Bin].Bounds.GrowBy(LeftPart);
+                        Remaining = std::move(RightPart);
+                    }
+
+                    Bins[LastBin].Bounds.GrowBy(Remaining);
+                    Bins[FirstBin].Entries++;
+                    Bins[LastBin].Exits++;
+                }
+
+                std::vector<Float> RightCost(NumBins, 0);
+                std::vector<unsigned> RightCounts(NumBins, 0);
+                Aabb RightBounds;
+                unsigned RightCount = 0;
+
+                for (unsigned Bin = NumBins - 1; Bin > 0; Bin--)
+                {
+                    RightBounds.GrowBy(Bins[Bin].Bounds);
+                    RightCount += Bins[Bin].Exits;
+                    RightCost[Bin] = SurfaceArea(RightBounds) * RightCount;
+                    RightCounts[Bin] = RightCount;
+                }
+
+                Aabb LeftBounds;
+                unsigned LeftCount = 0;
+
+                for (unsigned Bin = 1; Bin < NumBins; Bin++)
+                {
+                    LeftBounds.GrowBy(Bins[Bin - 1].Bounds);
+                    LeftCount += Bins[Bin - 1].Entries;
+
+                    if (LeftCount == 0 || RightCounts[Bin] == 0 || LeftCount + RightCounts[Bin] - Count > ReferencesLeft)
+                    {
+                        continue;
+                    }
+
+                    const Float Cost = SurfaceArea(LeftBounds) * LeftCount + RightCost[Bin];
+
+                    if (Cost < BestCost)
+                    {
+                        BestCost = Cost;
+                        BestAxis = Axis;
+                        BestSplit = Bin;
+                        BestIsSpatial = true;
+                    }
+                }
+            }
+        }
+
+        const Float LeafCost = static_cast<Float>(Count);
+        const Float SplitCost = kSpatialSplitTraversalCost + (NodeArea > 0 ? BestCost / NodeArea : 0);
+
+        if (BestAxis == -1 || (Count <= kSpatialSplitMaxLeafSize && LeafCost <= SplitCost))
+        {
+            MakeLeaf();
+
+            return;
+        }
+
+        std::vector<BvhReference> LeftReferences, RightReferences;
+
+        if (!BestIsSpatial)
+        {
+            for (auto& Reference : References)
+            {
+                (CentroidBin(Reference, BestAxis) < BestSplit ? LeftReferences : RightReferences).push_back(std::move(Reference));
+            }
+        }
+        else
+        {
+            const Float Origin = Bounds.Bounds[0][BestAxis];
+            const Float Plane = Origin + (Bounds.Bounds[1][BestAxis] - Origin) / NumBins * BestSplit;
+
+            Aabb LeftBounds, RightBounds;
+            std::vector<BvhReference*> Straddling;
+
+            for (auto& Reference : References)
+            {
+                if (Reference.Bounds.Bounds[1][BestAxis] <= Plane)
+                {
+                    LeftBounds.GrowBy(Reference.Bounds);
+                    LeftReferences.push_back(std::move(Reference));
+                }
+                else if (Reference.Bounds.Bounds[0][BestAxis] >= Plane)
+                {
+                    RightBounds.GrowBy(Reference.Bounds);
+                    RightReferences.push_back(std::move(Reference));
+                }
+                else
+                {
+                    Straddling.push_back(&Reference);
+                }
+            }
+
+            size_t LeftCount = LeftReferences.size() + Straddling.size();
+            size_t RightCount = RightReferences.size() + Straddling.size();
+
+            for (BvhReference* pReference : Straddling)
+            {
+                Aabb LeftPart, RightPart;
+
+                SplitReference(*pReference, BestAxis, Plane, LeftPart, RightPart);
+
+                // reference unsplitting, keep the whole reference on one side when that is cheaper
+                const Float SplitCost = SurfaceArea(Union(LeftBounds, LeftPart)) * LeftCount + SurfaceArea(Union(RightBounds, RightPart)) * RightCount;
+                const Float AllLeftCost = SurfaceArea(Union(LeftBounds, pReference->Bounds)) * LeftCount + SurfaceArea(RightBounds) * (RightCount - 1);
+                const Float AllRightCost = SurfaceArea(LeftBounds) * (LeftCount - 1) + SurfaceArea(Union(RightBounds, pReference->Bounds)) * RightCount;
+
+                if (LeftPart.IsEmpty() || (AllRightCost < SplitCost && AllRightCost <= AllLeftCost))
+                {
+                    RightBounds.GrowBy(pReference->Bounds);
+                    RightReferences.push_back(std::move(*pReference));
+                    LeftCount--;
+                }
+                else if (RightPart.IsEmpty() || AllLeftCost < SplitCost)
+                {
+                    LeftBounds.GrowBy(pReference->Bounds);
+                    LeftReferences.push_back(std::move(*pReference));
+                    RightCount--;
+                }
+                else
+                {
+                    LeftBounds.GrowBy(LeftPart);
+                    RightBounds.GrowBy(RightPart);
+
+                    LeftReferences.push_back(BvhReference{ std::move(LeftPart), pReference->TriangleIndex });
+                    RightReferences.push_back(BvhReference{ std::move(RightPart), pReference->TriangleIndex });
+
+                    mNumReferences++;
+                }
+            }
+        }
+
+        if (LeftReferences.empty() || RightReferences.empty())
+        {
+            References.clear();
+
+            for (auto* pSide : { &LeftReferences, &RightReferences })
+            {
+                for (auto& Reference : *pSide)
+                {
+                    References.push_back(std::move(Reference));
+                }
+            }
+
+            MakeLeaf();
+
+            return;
+        }
+
+        std::vector<BvhReference>().swap(References);
+
+        const unsigned LeftChildIndex = static_cast<unsigned>(mNodes.size());
+
+        mNodes.emplace_back();
+        mNodes.emplace_back();
+
+        mNodes[NodeIndex].LeftChild = LeftChildIndex;
+        mNodes[NodeIndex].NumPrimitives = 0;
+        mNodes[NodeIndex].SplitAxis = BestAxis;
+
+        SpatialSplitNode(LeftChildIndex, std::move(LeftReferences), Depth + 1);
+        SpatialSplitNode(LeftChildIndex + 1, std::move(RightReferences), Depth + 1);
+    }
+
+    constexpr Float kSahTraversalCost = 1.2f;
+    constexpr Float kSahIntersectionCost = 1.f;
+
+    // Flat binary tree with explicit child links, restructured in place
+    struct BvhOptimizer
     {
+        struct Node
+        {
+            Vector3f Min, Max;
+            unsigned Left = 0, Right = 0;
+            unsigned PrimitiveBegin = 0, NumPrimitives = 0;
+            unsigned Height = 0;
+            Float Cost = 0;
+        };
+
+        std::vector<Node> Nodes;
+        std::vector<unsigned> Depths;
+        unsigned TreeletSize;
+
+        static Float Area(const Vector3f& Min, const Vector3f& Max)
+        {
+            const Vector3f Extent = (Max - Min).cwiseMax(0);
+
+            return Extent.x() * Extent.y() + Extent.x() * Extent.z() + Extent.y() * Extent.z();
+        }
+
+        bool IsLeaf(unsigned Index) const { return Nodes[Index].NumPrimitives > 0; }
+
+        void Refit(unsigned Index)
+        {
+            Node& Parent = Nodes[Index];
+            const Node& Left = Nodes[Parent.Left];
+            const Node& Right = Nodes[Parent.Right];
+
+            Parent.Min = Left.Min.cwiseMin(Right.Min);
+            Parent.Max = Left.Max.cwiseMax(Right.Max);
+            Parent.Cost = kSahTraversalCost * Area(Parent.Min, Parent.Max) + Left.Cost + Right.Cost;
+            Parent.Height = 1 + std::max(Left.Height, Right.Height);
+        }
+
+        // A treelet only rearranges what lies below its root, so the depths stay valid
+        // for every root a post-order pass reaches
+        void ComputeDepths()
+        {
+            Depths.assign(Nodes.size(), 0);
+
+            std::vector<unsigned> Stack{ 0 };
+
+            while (!Stack.empty())
+            {
+                const unsigned Index = Stack.back();
+                Stack.pop_back();
+
+                if (!IsLeaf(Index))
+                {
+                    Depths[Nodes[Index].Left] = Depths[Nodes[Index].Right] = Depths[Index] + 1;
+
+                    Stack.push_back(Nodes[Index].Left);
+                    Stack.push_back(Nodes[Index].Right);
+                }
+            }
+        }
+
+        void PostOrder(unsigned Root, std::vector<unsigned>& Order, const std::vector<char>* pStopAt = nullptr) const
+        {
+            std::vector<std::pair<unsigned, bool>> Stack{ { Root, false } };
+
+            while (!Stack.empty())
+            {
+                auto [Index, Expanded] = Stack.back();
+                Stack.pop_back();
+
+                const bool Stop = pStopAt != nullptr && Index != Root && (*pStopAt)[Index];
+
+                if (Expanded || IsLeaf(Index) || Stop)
+                {
+                    if (!Stop)
+                    {
+                        Order.push_back(Index);
+                    }
+
+                    continue;
+                }
+
+                Stack.push_back({ Index, true });
+                Stack.push_back({ Nodes[Index].Right, false });
+                Stack.push_back({ Nodes[Index].Left, false });
+            }
+        }
+
+        bool RestructureTreelet(unsigned Root)
+        {
+            if (IsLeaf(Root))
+            {
+                return false;
+            }
+
+            // treelets below were restructured already, keep the cost and height current
+            // even when this one stays as it is
+            Refit(Root);
+
+            unsigned Leaves[8] = { Nodes[Root].Left, Nodes[Root].Right };
+            unsigned Internals[7] = { Root };
+            unsigned NumLeaves = 2;
+            unsigned NumInternals = 1;
+
+            // grow the treelet by opening the largest internal leaf
+            while (NumLeaves < TreeletSize)
+            {
+                int Largest = -1;
+                Float LargestArea = -1;
+
+                for (unsigned Slot = 0; Slot < NumLeaves; Slot++)
+                {
+                    const Node& Candidate = Nodes[Leaves[Slot]];
+                    const Float CandidateArea = Area(Candidate.Min, Candidate.Max);
+
+                    if (!IsLeaf(Leaves[Slot]) && CandidateArea > LargestArea)
+                    {
+                        Largest = static_cast<int>(Slot);
+                        LargestArea = CandidateArea;
+                    }
+                }
+
+                if (Largest == -1)
+                {
+                    break;
+                }
+
+                const unsigned Opened = Leaves[Largest];
+
+                Internals[NumInternals++] = Opened;
+                Leaves[Largest] = Nodes[Opened].Left;
+                Leaves[NumLeaves++] = Nodes[Opened].Right;
+            }
+
+            if (NumLeaves < 3)
+            {
+                return false;
+            }
+
+            const unsigned NumSubsets = 1u << NumLeaves;
+
+            Float SubsetArea[256];
+            Float SubsetCost[256];
+            unsigned BestPartition[256];
+
+            for (unsigned Subset = 1; Subset < NumSubsets; Subset++)
+            {
+                Vector3f Min(kInfinity, kInfinity, kInfinity), Max = -Min;
+
+                for (unsigned Slot = 0; Slot < NumLeaves; Slot++)
+                {
+                    if (Subset & (1u << Slot))
+                    {
+                        Min = Min.cwiseMin(Nodes[Leaves[Slot]].Min);
+                        Max = Max.cwiseMax(Nodes[Leaves[Slot]].Max);
+                    }
+                }
+
+                SubsetArea[Subset] = Area(Min, Max);
+            }
+
+            // every proper subset is numerically smaller, so one increasing sweep fills the table
+            for (unsigned Subset = 1; Subset < NumSubsets; Subset++)
+            {
+                if (std::popcount(Subset) == 1)
+                {
+                    SubsetCost[Subset] = Nodes[Leaves[std::countr_zero(Subset)]].Cost;
+
+                    continue;
+                }
+
+                const unsigned LowestBit = Subset & (~Subset + 1);
+
+                Float BestCost = kInfinity;
+
+                for (unsigned Part = (Subset - 1) & Subset; Part > 0; Part = (Part - 1) & Subset)
+                {
+                    if ((Part & LowestBit) == 0)
+                    {
+                        continue;
+                    }
+
+                    const Float Cost = SubsetCost[Part] + SubsetCost[Subset ^ Part];
+
+                    if (Cost < BestCost)
+                    {
+                        BestCost = Cost;
+                        BestPartition[Subset] = Part;
+                    }
+                }
+
+                SubsetCost[Subset] = kSahTraversalCost * SubsetArea[Subset] + BestCost;
+            }
+
+            const unsigned FullSet = NumSubsets - 1;
+
+            if (SubsetCost[FullSet] >= Nodes[Root].Cost * (1 - 1e-5f))
+            {
+                return false;
+            }
+
+            auto SubsetHeight = [&](auto& Self, unsigned Subset) -> unsigned
+            {
+                if (std::popcount(Subset) == 1)
+                {
+                    return Nodes[Leaves[std::countr_zero(Subset)]].Height;
+                }
+
+                return 1 + std::max(Self(Self, BestPartition[Subset]), Self(Self, Subset ^ BestPartition[Subset]));
+            };
+
+            // a cheaper but deeper treelet could overflow the traversal stack, one that
+            // is already too deep may still get shallower
+            const unsigned Height = SubsetHeight(SubsetHeight, FullSet);
+
+            if (Depths[Root] + Height > kBvhMaxDepth && Height > Nodes[Root].Height)
+            {
+                return false;
+            }
+
+            unsigned NextInternal = 1;
+
+            auto Rebuild = [&](auto& Self, unsigned Subset, unsigned NodeIndex) -> void
+            {
+                const unsigned Part = BestPartition[Subset];
+                unsigned Children[2];
+                unsigned ChildSubsets[2] = { Part, Subset ^ Part };
+
+                for (int Side = 0; Side < 2; Side++)
+                {
+                    if (std::popcount(ChildSubsets[Side]) == 1)
+                    {
+                        Children[Side] = Leaves[std::countr_zero(ChildSubsets[Side])];
+                    }
+                    else
+                    {
+                        Children[Side] = Internals[NextInternal++];
+
+                        Self(Self, ChildSubsets[Side], Children[Side]);
+                    }
+                }
+
+                Nodes[NodeIndex].Left = Children[0];
+                Nodes[NodeIndex].Right = Children[1];
+
+                Refit(NodeIndex);
+            };
+
+            Rebuild(Rebuild, FullSet, Root);
+
+            return true;
+        }
+    };
+
+    Float Bvh::ComputeSahCost() const
+    {
+        const Float RootArea = SurfaceArea(mNodes[0].BoundingBox);
+
+        if (RootArea <= 0)
+        {
+            return 0;
+        }
+
+        Float Cost = 0;
+
+        std::vector<unsigned> Stack{ 0 };
+
+        while (!Stack.empty())
+        {
+            const BvhNode& Node = mNodes[Stack.back()];
+            Stack.pop_back();
+
+            if (Node.NumPrimitives > 0)
+            {
+                Cost += kSahIntersectionCost * Node.NumPrimitives * SurfaceArea(Node.BoundingBox);
+            }
+            else
+            {
+                Cost += kSahTraversalCost * SurfaceArea(Node.BoundingBox);
+
+                Stack.push_back(Node.LeftChild);
+                Stack.push_back(Node.LeftChild + 1);
+            }
+        }
+
+        return Cost / RootArea;
+    }
+
+    BvhOptimizeReport Bvh::Optimize(const BvhOptimizeOptions& Options)
+    {
+        const auto StartTime = std::chrono::steady_clock::now();
+
+        auto Elapsed = [&]()
+        {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+        };
+
+        auto OutOfTime = [&]()
+        {
+            return Options.TimeBudgetSeconds > 0 && Elapsed() > Options.TimeBudgetSeconds;
+        };
+
+        BvhOptimizeReport Report;
+        Report.SahCostBefore = ComputeSahCost();
+
+        BvhOptimizer Optimizer;
+        Optimizer.TreeletSize = std::clamp(Options.TreeletSize, 3u, 8u);
+
+        // copy the reachable part of mNodes, whatever builder laid it out
+        std::vector<std::pair<unsigned, unsigned>> Stack{ { 0, 0 } };
+        Optimizer.Nodes.emplace_back();
+
+        while (!Stack.empty())
+        {
+            auto [Source, Target] = Stack.back();
+            Stack.pop_back();
+
+            const BvhNode& Node = mNodes[Source];
+
+            Optimizer.Nodes[Target].Min = Node.BoundingBox.Bounds[0];
+            Optimizer.Nodes[Target].Max = Node.BoundingBox.Bounds[1];
+
+            if (Node.NumPrimitives > 0)
+            {
+                Optimizer.Nodes[Target].PrimitiveBegin = Node.LeftChild;
+                Optimizer.Nodes[Target].NumPrimitives = Node.NumPrimitives;
+
+                continue;
+            }
+
+            const unsigned Left = static_cast<unsigned>(Optimizer.Nodes.size());
+
+            Optimizer.Nodes.emplace_back();
+            Optimizer.Nodes.emplace_back();
+
+            Optimizer.Nodes[Target].Left = Left;
+            Optimizer.Nodes[Target].Right = Left + 1;
+
+            Stack.push_back({ Node.LeftChild, Left });
+            Stack.push_back({ Node.LeftChild + 1, Left + 1 });
+        }
+
+        std::vector<unsigned> Order;
+        Optimizer.PostOrder(0, Order);
+
+        for (unsigned Index : Order)
+        {
+            BvhOptimizer::Node& Node = Optimizer.Nodes[Index];
+
+            if (Node.NumPrimitives > 0)
+            {
+                Node.Cost = kSahIntersectionCost * Node.NumPrimitives * BvhOptimizer::Area(Node.Min, Node.Max);
+            }
+            else
+            {
+                Optimizer.Refit(Index);
+            }
+        }
+
+        const unsigned HeightBefore = Optimizer.Nodes[0].Height;
+
+        const unsigned MaxPasses = std::max(Options.MaxPasses, 1u);
+        const size_t TargetSubtrees = size_t(GetNumWorkerThreads()) * 8;
+
+        for (unsigned Pass = 0; Pass < MaxPasses && !OutOfTime(); Pass++)
+        {
+            // independent subtrees below a frontier are restructured in parallel, the
+            // nodes above it afterwards on this thread. Restructuring moves nodes
+            // across the frontier, so it is recomputed every pass.
+            std::vector<unsigned> Frontier{ 0 };
+
+            while (Frontier.size() < TargetSubtrees)
+            {
+                auto Largest = std::max_element(Frontier.begin(), Frontier.end(), [&](unsigned A, unsigned B)
+                {
+                    const bool LeafA = Optimizer.IsLeaf(A), LeafB = Optimizer.IsLeaf(B);
+
+                    return LeafA != LeafB ? LeafA : Optimizer.Nodes[A].Cost < Optimizer.Nodes[B].Cost;
+                });
+
+                if (Optimizer.IsLeaf(*Largest))
+                {
+                    break;
+                }
+
+                const unsigned Opened = *Largest;
+
+                *Largest = Optimizer.Nodes[Opened].Left;
+                Frontier.push_back(Optimizer.Nodes[Opened].Right);
+            }
+
+            Optimizer.ComputeDepths();
+
+            std::vector<char> IsFrontier(Optimizer.Nodes.size(), 0);
+
+            for (unsigned Index : Frontier)
+            {
+                IsFrontier[Index] = 1;
+            }
+
+            std::vector<unsigned> TopOrder;
+
+            if (!IsFrontier[0])
+            {
+                Optimizer.PostOrder(0, TopOrder, &IsFrontier);
+            }
+
+            std::atomic<unsigned> NumRestructured = 0;
+
+            ParallelFor(Frontier.size(), [&](size_t Slot)
+            {
+                if (OutOfTime())
+                {
+                    return;
+                }
+
+                std::vector<unsigned> SubtreeOrder;
+                Optimizer.PostOrder(Frontier[Slot], SubtreeOrder);
+
+                for (unsigned Index : SubtreeOrder)
+                {
+                    NumRestructured += Optimizer.RestructureTreelet(Index);
+                }
+            });
+
+            for (unsigned Index : TopOrder)
+            {
+                NumRestructured += Optimizer.RestructureTreelet(Index);
+            }
+
+            Report.Passes++;
+
+            if (NumRestructured == 0)
+            {
+                break;
+            }
+        }
+
+        if (Optimizer.Nodes[0].Height > std::max(kBvhMaxDepth, HeightBefore))
+        {
+            throw std::logic_error("BVH restructuring deepened the tree past the traversal stack\n");
+        }
+
+        // write back with siblings adjacent, the near child on the low side of the split axis
+        std::vector<BvhNode> NewNodes(1);
+        std::vector<std::pair<unsigned, unsigned>> WriteStack{ { 0, 0 } };
+
+        while (!WriteStack.empty())
+        {
+            auto [Source, Target] = WriteStack.back();
+            WriteStack.pop_back();
+
+            const BvhOptimizer::Node& Node = Optimizer.Nodes[Source];
+
+            NewNodes[Target].BoundingBox = Aabb(Node.Min, Node.Max);
+
+            if (Node.NumPrimitives > 0)
+            {
+                NewNodes[Target].LeftChild = Node.PrimitiveBegin;
+                NewNodes[Target].NumPrimitives = Node.NumPrimitives;
+
+                continue;
+            }
+
+            unsigned Left = Node.Left, Right = Node.Right;
+
+            const Vector3f CenterDelta = (Optimizer.Nodes[Right].Min + Optimizer.Nodes[Right].Max) - (Optimizer.Nodes[Left].Min + Optimizer.Nodes[Left].Max);
+
+            int SplitAxis = 0;
+            CenterDelta.cwiseAbs().maxCoeff(&SplitAxis);
+
+            if (CenterDelta[SplitAxis] < 0)
+            {
+                std::swap(Left, Right);
+            }
+
+            const unsigned LeftChildIndex = static_cast<unsigned>(NewNodes.size());
+
+            NewNodes.emplace_back();
+            NewNodes.emplace_back();
+
+            NewNodes[Target].LeftChild = LeftChildIndex;
+            NewNodes[Target].SplitAxis = SplitAxis;
+
+            WriteStack.push_back({ Left, LeftChildIndex });
+            WriteStack.push_back({ Right, LeftChildIndex + 1 });
+        }
+
+        mNodes = std::move(NewNodes);
+        mNodesUsed = static_cast<int>(mNodes.size());
+
+        PlaceForNuma(mPlacement);
+
+        Report.SahCostAfter = ComputeSahCost();
+        Report.Seconds = Elapsed();
+
+        return Report;
+    }
+
+    template<typename KernelType>
+    const Triangle* Bvh::Traverse(const Ray& aRay, Float& U, Float& V) const
+    {
+        const BvhNode* pNodes = mPlacedNodes.IsEmpty() ? mNodes.data() : mPlacedNodes.GetData();
+        const unsigned* pIndices = mPlacedIndices.IsEmpty() ? mTriangleIndices.data() : mPlacedIndices.GetData();
+        const Triangle* const* ppTriangles = pTriangles->data();
+
 	    unsigned CurrentNode = 0;
 	    unsigned ToVisitOffset = 0;
-	    unsigned NodesToVisit[64];
+	    unsigned NodesToVisit[kBvhMaxDepth];
 
-		bool HitSomething = false;
+		const Triangle* pHit = nullptr;
 		
 		while (true)
 		{
-			const BvhNode& Node = mNodes[CurrentNode];
+			const BvhNode& Node = pNodes[CurrentNode];
 			
 			if (Node.BoundingBox.Intersect(aRay))
 			{
 				if (Node.NumPrimitives > 0)
 				{
-                    auto& Triangles = *pTriangles;
-
                     for (unsigned Index = 0; Index < Node.NumPrimitives; Index++)
                     {
-                        if (Triangles[mTriangleIndices[Index + Node.LeftChild]]->Intersect(aRay, HitResult))
+                        const Triangle* pTriangle = ppTriangles[pIndices[Index + Node.LeftChild]];
+                        Float HitU, HitV;
+
+                        if (pTriangle->IntersectBarycentric(aRay, HitU, HitV))
                         {
-                            HitSomething = true;
+                            pHit = pTriangle;
+                            U = HitU;
+                            V = HitV;
+
+                            if constexpr (KernelType::kStopAtFirstHit)
+                            {
+                                return pHit;
+                            }
                         }
                     }
 
@@ -200,7 +1228,29 @@ namespace PathTracer
 			}
 		}
 
-		return HitSomething;
+		return pHit;
+    }
+
+    bool Bvh::Intersect(const Ray& aRay, Intersection& HitResult) const
+    {
+        Float U, V;
+        const Triangle* pHit = Traverse<ClosestHitKernel>(aRay, U, V);
+
+        if (!pHit)
+        {
+            return false;
+        }
+
+        pHit->FillIntersection(aRay, U, V, HitResult);
+
+        return true;
+    }
+
+    bool Bvh::Occluded(const Ray& aRay) const
+    {
+        Float U, V;
+
+        return Traverse<AnyHitKernel>(aRay, U, V) != nullptr;
     }
 
 } // namespace PathTracer
\ No newline at end of file
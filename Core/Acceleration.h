@@ -3,9 +3,14 @@
 #include <Pch.h>
 #include <Shape.h>
 #include <Constants.h>
+#include <Memory.h>
+#include <Numa.h>
 
 namespace PathTracer
 {
+    // Traversal defers one node per level on a fixed stack, so no leaf may lie deeper
+    constexpr unsigned kBvhMaxDepth = 64;
+
 	struct BvhNode
 	{
         Aabb BoundingBox;
@@ -14,10 +19,47 @@ namespace PathTracer
         unsigned SplitAxis = 0;
 	};
 
+    enum class BvhBuilder
+    {
+        MidPoint = 1,
+        SpatialSplit = 2,
+    };
+
+    struct BvhOptions
+    {
+        BvhBuilder Builder = BvhBuilder::MidPoint;
+
+        // Spatial split settings, see Stich et al. 2009
+        unsigned NumBins = 32;
+        Float DuplicationBudget = 0.3f;  // extra references allowed, as a fraction of the triangle count
+        Float OverlapThreshold = 1e-5f;  // child overlap relative to the root area before spatial splits are tried
+    };
+
+    struct BvhOptimizeOptions
+    {
+        unsigned MaxPasses = 3;
+        double TimeBudgetSeconds = 0;  // 0 for no limit
+        unsigned TreeletSize = 7;      // leaves per restructured treelet, at most 8, never deepens a leaf past kBvhMaxDepth
+    };
+
+    struct BvhOptimizeReport
+    {
+        Float SahCostBefore = 0;
+        Float SahCostAfter = 0;
+        unsigned Passes = 0;
+        double Seconds = 0;
+    };
+
+    struct BvhReference
+    {
+        Aabb Bounds;
+        unsigned TriangleIndex;
+    };
+
     class Bvh
     {
     public:
-        Bvh(const std::vector<Triangle*>& pTriangles);
+        Bvh(const std::vector<Triangle*>& pTriangles, const BvhOptions& Options = {}, std::vector<Eigen::Vector3f> Centroids = {});
 
 		Bvh(const Bvh&) = delete;
 		Bvh& operator=(const Bvh&) = delete;
@@ -27,22 +69,80 @@ namespace PathTracer
 
         void BuildStructure();
 
+        static Eigen::Vector3f CalcCentroid(const Triangle& aTriangle);
+
         void CalcTriangleCentroid();
         
         void UpdateNodeBounds(BvhNode& Node);
 
         int SplitNode(BvhNode& Node, int SplitAxis, Float SplitPos);
         
-        void MidPointSplit(BvhNode& Node);
+        void MidPointSplit(BvhNode& Node, unsigned Depth = 0);
+
+        // Triangles straddling a spatial split are referenced from both sides,
+        // so mTriangleIndices may hold the same triangle several times
+        void SpatialSplitBuild(const BvhOptions& Options);
 
         bool Intersect(const Ray& aRay, Intersection& HitResult) const;
 
+        // Whether anything lies on the ray before aRay.tMax
+        bool Occluded(const Ray& aRay) const;
+
+        // SAH cost of the tree normalized by the root area
+        Float ComputeSahCost() const;
+
+        // Treelet restructuring (Karras and Aila 2013) on the built tree,
+        // independent of the builder that produced it
+        BvhOptimizeReport Optimize(const BvhOptimizeOptions& Options = {});
+
+        const std::vector<BvhNode>& GetNodes() const { return mNodes; }
+
+        const std::vector<unsigned>& GetTriangleIndices() const { return mTriangleIndices; }
+
+        const std::vector<Triangle*>& GetTriangles() const { return *pTriangles; }
+
+        size_t GetSizeInBytes() const;
+
+        void ReportMemory(MemoryReport& Report) const;
+
+        // Upper bound of what a build for NumTriangles keeps, with and without the centroids,
+        // including the copies a NUMA placement adds
+        static size_t EstimateSizeInBytes(size_t NumTriangles, const BvhOptions& Options, bool WithCentroids,
+                                          NumaPlacement Placement = NumaPlacement::None);
+
+        // What PlaceForNuma would add for the tree as it is now
+        size_t GetPlacementSizeInBytes(NumaPlacement Placement) const;
+
+        // Drops the centroids, which only the builder needs, and trims the node array
+        void ReleaseBuildData();
+
+        // Copies what traversal reads next to the render threads of every NUMA node.
+        // The copies follow later changes to the tree
+        void PlaceForNuma(NumaPlacement Placement);
+
     private:
+        // Returns the triangle the kernel settled on, its hit distance is left in aRay.tMax
+        template<typename KernelType>
+        const Triangle* Traverse(const Ray& aRay, Float& U, Float& V) const;
+
+        void SpatialSplitNode(unsigned NodeIndex, std::vector<BvhReference> References, unsigned Depth);
+
+        void SplitReference(const BvhReference& Reference, int Axis, Float Position, Aabb& Left, Aabb& Right) const;
+
         const std::vector<Triangle*>* pTriangles;
         std::vector<unsigned> mTriangleIndices;
         std::vector<Eigen::Vector3f> mCentroids;
         std::vector<BvhNode> mNodes;
         int mNodesUsed = 1;
+
+        NumaPlacement mPlacement = NumaPlacement::None;
+        NumaArray<BvhNode> mPlacedNodes;
+        NumaArray<unsigned> mPlacedIndices;
+
+        BvhOptions mOptions;
+        Float mRootArea = 0;
+        size_t mNumReferences = 0;
+        size_t mMaxReferences = 0;
     };
 
 } // namespace PathTracer
\ No newline at end of file
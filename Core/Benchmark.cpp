@@ -0,0 +1,312 @@
+#include <Benchmark.h>
+#include <Parallel.h>
+
+using namespace Eigen;
+
+namespace PathTracer
+{
+	constexpr unsigned kSphereRings = 16;
+	constexpr unsigned kSphereSegments = 32;
+	constexpr size_t kSoupTrianglesPerMesh = 100'000;
+
+	static const char* GetSceneName(BenchmarkSceneType SceneType)
+	{
+		return SceneType == BenchmarkSceneType::SphereField ? "sphere_field" : "triangle_soup";
+	}
+
+	// UV sphere with single triangles around the poles
+	static TriangleMesh MakeSphere(const Vector3f& Center, Float Radius)
+	{
+		std::vector<Vertex> Vertices;
+		std::vector<unsigned> Indices;
+
+		for (unsigned Ring = 0; Ring <= kSphereRings; Ring++)
+		{
+			const Float Theta = kPi * Ring / kSphereRings;
+
+			for (unsigned Segment = 0; Segment <= kSphereSegments; Segment++)
+			{
+				const Float Phi = k2Pi * Segment / kSphereSegments;
+				const Vector3f Normal(std::sin(Theta) * std::cos(Phi), std::cos(Theta), std::sin(Theta) * std::sin(Phi));
+
+				Vertices.push_back({ Center + Radius * Normal, Normal });
+			}
+		}
+
+		for (unsigned Ring = 0; Ring < kSphereRings; Ring++)
+		{
+			for (unsigned Segment = 0; Segment < kSphereSegments; Segment++)
+			{
+				const unsigned A = Ring * (kSphereSegments + 1) + Segment;
+				const unsigned B = A + 1;
+				const unsigned C = A + kSphereSegments + 1;
+				const unsigned D = C + 1;
+
+				if (Ring > 0)
+				{
+					Indices.insert(Indices.end(), { A, B, C });
+				}
+
+				if (Ring + 1 < kSphereRings)
+				{
+					Indices.insert(Indices.end(), { B, D, C });
+				}
+			}
+		}
+
+		return TriangleMesh(std::move(Vertices), std::move(Indices));
+	}
+
+	static TriangleMesh MakeLight()
+	{
+		const Vector3f Down(0, -1, 0);
+
+		std::vector<Vertex> Vertices = {
+			{ Vector3f(-0.4f, 1.2f, -0.4f), Down },
+			{ Vector3f(0.4f, 1.2f, -0.4f), Down },
+			{ Vector3f(0.4f, 1.2f, 0.4f), Down },
+			{ Vector3f(-0.4f, 1.2f, 0.4f), Down },
+		};
+
+		TriangleMesh Light(std::move(Vertices), { 0, 1, 2, 0, 2, 3 });
+		Light.SetMaterialIndex(1);
+
+		return Light;
+	}
+
+	std::vector<TriangleMesh> MakeBenchmarkMeshes(BenchmarkSceneType SceneType, size_t NumTriangles, uint32_t Seed)
+	{
+		std::mt19937 Rng(Seed);
+		std::uniform_real_distribution<Float> Distrib(0, 1);
+
+		std::vector<TriangleMesh> Meshes;
+
+		if (SceneType == BenchmarkSceneType::SphereField)
+		{
+			const size_t TrianglesPerSphere = 2 * kSphereSegments * (kSphereRings - 1);
+			const size_t NumSpheres = std::max<size_t>(1, (NumTriangles + TrianglesPerSphere / 2) / TrianglesPerSphere);
+
+			// one sphere per cell of a grid over the box, jittered inside its cell
+			const unsigned CellsPerAxis = static_cast<unsigned>(std::ceil(std::cbrt(static_cast<double>(NumSpheres))));
+			const Float CellSize = 2.f / CellsPerAxis;
+
+			Meshes.reserve(NumSpheres + 1);
+
+			for (size_t Sphere = 0; Sphere < NumSpheres; Sphere++)
+			{
+				const Vector3f Cell(static_cast<Float>(Sphere % CellsPerAxis),
+									static_cast<Float>(Sphere / CellsPerAxis % CellsPerAxis),
+									static_cast<Float>(Sphere / CellsPerAxis / CellsPerAxis));
+
+				const Float Radius = CellSize * (0.2f + 0.2f * Distrib(Rng));
+				const Vector3f Jitter = Vector3f(Distrib(Rng), Distrib(Rng), Distrib(Rng)) * (CellSize - 2 * Radius);
+
+				Meshes.push_back(MakeSphere(Vector3f::Constant(-1) + Cell * CellSize + Vector3f::Constant(Radius) + Jitter, Radius));
+			}
+		}
+		else
+		{
+			// edges around the mean spacing, so density stays alike across sizes
+			const Float Spacing = static_cast<Float>(std::cbrt(8.0 / std::max<size_t>(NumTriangles, 1)));
+
+			for (size_t First = 0; First < NumTriangles; First += kSoupTrianglesPerMesh)
+			{
+				const size_t Count = std::min(kSoupTrianglesPerMesh, NumTriangles - First);
+
+				std::vector<Vertex> Vertices;
+				std::vector<unsigned> Indices(3 * Count);
+
+				Vertices.reserve(3 * Count);
+				std::iota(Indices.begin(), Indices.end(), 0);
+
+				for (size_t Index = 0; Index < Count; Index++)
+				{
+					const Vector3f Center = 2 * Vector3f(Distrib(Rng), Distrib(Rng), Distrib(Rng)) - Vector3f::Ones();
+
+					for (unsigned Corner = 0; Corner < 3; Corner++)
+					{
+						const Vector3f Offset = Spacing * (2 * Vector3f(Distrib(Rng), Distrib(Rng), Distrib(Rng)) - Vector3f::Ones());
+
+						Vertices.push_back({ Center + Offset, Vector3f::Zero() });
+					}
+				}
+
+				TriangleMesh Mesh(std::move(Vertices), std::move(Indices));
+				Mesh.GenerateNormals();
+
+				Meshes.push_back(std::move(Mesh));
+			}
+		}
+
+		Meshes.push_back(MakeLight());
+
+		return Meshes;
+	}
+
+	std::vector<Material> MakeBenchmarkMaterials()
+	{
+		Material Grey;
+		Grey.Diffuse = Vector3f(0.7f, 0.7f, 0.7f);
+
+		Material Light;
+		Light.Diffuse = Vector3f::Zero();
+		Light.Emission = Vector3f(10, 10, 10);
+
+		return { Grey, Light };
+	}
+
+	static std::vector<unsigned> GetThreadCounts(const BenchmarkOptions& Options)
+	{
+		if (!Options.ThreadCounts.empty())
+		{
+			if (std::find(Options.ThreadCounts.begin(), Options.ThreadCounts.end(), 0u) != Options.ThreadCounts.end())
+			{
+				throw std::invalid_argument("Benchmark thread counts must be positive\n");
+			}
+
+			return Options.ThreadCounts;
+		}
+
+		const unsigned MaxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+		std::vector<unsigned> Counts;
+
+		for (unsigned Count = 1; Count < MaxThreads; Count *= 2)
+		{
+			Counts.push_back(Count);
+		}
+
+		Counts.push_back(MaxThreads);
+
+		return Counts;
+	}
+
+	std::vector<BenchmarkResult> RunScalingBenchmark(const BenchmarkOptions& Options)
+	{
+		using Clock = std::chrono::steady_clock;
+
+		auto Seconds = [](Clock::time_point From, Clock::time_point To)
+		{
+			return std::chrono::duration<double>(To - From).count();
+		};
+
+		CamOptions CameraOptions;
+		CameraOptions.LookFrom = Vector3f(0, 0.3f, 3.2f);
+		CameraOptions.LookAt = Vector3f(0, 0, 0);
+		CameraOptions.Up = Vector3f(0, 1, 0);
+		CameraOptions.Resolution = Options.Resolution;
+		CameraOptions.FOVDegrees = 50;
+
+		RenderOptions aRenderOptions;
+		aRenderOptions.SamplesPerPixel = Options.SamplesPerPixel;
+		aRenderOptions.MaxDepth = Options.MaxDepth;
+		aRenderOptions.Seed = Options.Seed;
+		aRenderOptions.ShowProgress = false;
+		aRenderOptions.OutputName.clear();
+
+		const std::vector<unsigned> ThreadCounts = GetThreadCounts(Options);
+		const unsigned PreviousLimit = GetWorkerThreadLimit();
+
+		std::vector<BenchmarkResult> Results;
+
+		for (BenchmarkSceneType SceneType : Options.SceneTypes)
+		{
+			for (size_t NumTriangles : Options.TriangleCounts)
+			{
+				const size_t FirstRun = Results.size();
+
+				for (unsigned NumThreads : ThreadCounts)
+				{
+					SetNumWorkerThreads(NumThreads);
+					ResetPeakResidentBytes();
+
+					BenchmarkResult Result;
+					Result.SceneType = SceneType;
+					Result.NumThreads = NumThreads;
+
+					const auto LoadStart = Clock::now();
+
+					std::vector<TriangleMesh> Meshes = MakeBenchmarkMeshes(SceneType, NumTriangles, Options.Seed);
+
+					const auto BuildStart = Clock::now();
+
+					const Scene BenchmarkScene(std::move(Meshes), MakeBenchmarkMaterials(), Options.BuildOptions);
+
+					const auto BuildEnd = Clock::now();
+
+					Camera BenchmarkCamera(CameraOptions);
+
+					const RenderStats Stats = Render(BenchmarkCamera, BenchmarkScene, aRenderOptions);
+
+					Result.NumTriangles = BenchmarkScene.GetBvh().GetTriangles().size();
+					Result.LoadSeconds = Seconds(LoadStart, BuildStart);
+					Result.BuildSeconds = Seconds(BuildStart, BuildEnd);
+					Result.RenderSeconds = Stats.Seconds;
+					Result.NumRays = Stats.NumRays;
+					Result.MRaysPerSecond = Stats.Seconds > 0 ? Stats.NumRays / Stats.Seconds * 1e-6 : 0;
+					Result.PeakResidentBytes = GetPeakResidentBytes();
+
+					Results.push_back(Result);
+
+					std::cout << GetSceneName(SceneType) << " " << Result.NumTriangles << " triangles, " << NumThreads << " threads: build "
+							  << Result.BuildSeconds << " s, " << Result.MRaysPerSecond << " Mrays/s\n";
+				}
+
+				const auto Baseline = std::min_element(Results.begin() + FirstRun, Results.end(),
+					[](const BenchmarkResult& A, const BenchmarkResult& B) { return A.NumThreads < B.NumThreads; });
+
+				for (size_t Run = FirstRun; Run < Results.size(); Run++)
+				{
+					BenchmarkResult& Result = Results[Run];
+
+					if (Baseline->MRaysPerSecond > 0)
+					{
+						Result.ScalingEfficiency = (Result.MRaysPerSecond / Baseline->MRaysPerSecond) * Baseline->NumThreads / Result.NumThreads;
+					}
+				}
+			}
+		}
+
+		SetNumWorkerThreads(PreviousLimit);
+
+		return Results;
+	}
+
+	void WriteBenchmarkJson(const BenchmarkOptions& Options, const std::vector<BenchmarkResult>& Results, std::ostream& Stream)
+	{
+		const std::ios_base::fmtflags Flags = Stream.flags();
+		const std::streamsize Precision = Stream.precision();
+
+		Stream << std::setprecision(6) << "{\n"
+			   << "  \"benchmark\": \"scaling\",\n"
+			   << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n"
+			   << "  \"resolution\": [" << Options.Resolution.x() << ", " << Options.Resolution.y() << "],\n"
+			   << "  \"samples_per_pixel\": " << Options.SamplesPerPixel << ",\n"
+			   << "  \"max_depth\": " << Options.MaxDepth << ",\n"
+			   << "  \"seed\": " << Options.Seed << ",\n"
+			   << "  \"runs\": [";
+
+		for (size_t Run = 0; Run < Results.size(); Run++)
+		{
+			const BenchmarkResult& Result = Results[Run];
+
+			Stream << (Run > 0 ? "," : "") << "\n    {"
+				   << "\"scene\": \"" << GetSceneName(Result.SceneType) << "\", "
+				   << "\"triangles\": " << Result.NumTriangles << ", "
+				   << "\"threads\": " << Result.NumThreads << ", "
+				   << "\"load_seconds\": " << Result.LoadSeconds << ", "
+				   << "\"build_seconds\": " << Result.BuildSeconds << ", "
+				   << "\"render_seconds\": " << Result.RenderSeconds << ", "
+				   << "\"rays\": " << Result.NumRays << ", "
+				   << "\"mrays_per_second\": " << Result.MRaysPerSecond << ", "
+				   << "\"scaling_efficiency\": " << Result.ScalingEfficiency << ", "
+				   << "\"peak_rss_bytes\": " << Result.PeakResidentBytes << "}";
+		}
+
+		Stream << "\n  ]\n}\n";
+
+		Stream.flags(Flags);
+		Stream.precision(Precision);
+	}
+
+} // namespace PathTracer
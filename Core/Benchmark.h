@@ -0,0 +1,52 @@
+#pragma once
+
+#include <Pch.h>
+#include <Scene.h>
+#include <Render.h>
+
+namespace PathTracer
+{
+	enum class BenchmarkSceneType
+	{
+		SphereField = 1,
+		TriangleSoup = 2,
+	};
+
+	struct BenchmarkOptions
+	{
+		std::vector<size_t> TriangleCounts = { 10'000, 100'000, 1'000'000, 10'000'000 };
+		std::vector<BenchmarkSceneType> SceneTypes = { BenchmarkSceneType::SphereField, BenchmarkSceneType::TriangleSoup };
+		std::vector<unsigned> ThreadCounts;	// empty for 1, 2, 4 ... and every hardware thread
+		Eigen::Vector2i Resolution = Eigen::Vector2i(256, 256);
+		unsigned SamplesPerPixel = 4;
+		unsigned MaxDepth = 4;
+		SceneOptions BuildOptions;
+		uint32_t Seed = 1;
+	};
+
+	// One run of the whole pipeline for a scene size and thread count
+	struct BenchmarkResult
+	{
+		BenchmarkSceneType SceneType;
+		size_t NumTriangles = 0;
+		unsigned NumThreads = 0;
+		double LoadSeconds = 0;		// generating the meshes
+		double BuildSeconds = 0;	// scene setup, the BVH build dominates
+		double RenderSeconds = 0;
+		uint64_t NumRays = 0;
+		double MRaysPerSecond = 0;
+		double ScalingEfficiency = 0;	// speedup over the fewest threads run, per added thread
+		size_t PeakResidentBytes = 0;
+	};
+
+	// Meshes of about NumTriangles inside [-1, 1]^3 plus an area light above
+	// them, material 0 is the diffuse grey and material 1 the light
+	std::vector<TriangleMesh> MakeBenchmarkMeshes(BenchmarkSceneType SceneType, size_t NumTriangles, uint32_t Seed);
+
+	std::vector<Material> MakeBenchmarkMaterials();
+
+	std::vector<BenchmarkResult> RunScalingBenchmark(const BenchmarkOptions& Options);
+
+	void WriteBenchmarkJson(const BenchmarkOptions& Options, const std::vector<BenchmarkResult>& Results, std::ostream& Stream);
+
+} // namespace PathTracer
@@ -1,9 +1,77 @@
 #include <Camera.h>
+#include <Sampler.h>
 
 using namespace Eigen;
 
 namespace PathTracer
 {
+#if defined(PATHTRACER_SSE)
+	constexpr size_t kCameraSimdWidth = 4;
+#else
+	constexpr size_t kCameraSimdWidth = 1;
+#endif
+
+	static uint32_t HashPixel(uint32_t X, uint32_t Y, uint32_t Seed, uint32_t Dimension)
+	{
+		uint32_t Hash = X * 0x8da6b343u ^ Y * 0xd8163841u ^ Seed * 0xcb1ab31fu ^ Dimension * 0x2c1b3c6du;
+
+		Hash ^= Hash >> 16;
+		Hash *= 0x7feb352du;
+		Hash ^= Hash >> 15;
+		Hash *= 0x846ca68bu;
+		Hash ^= Hash >> 16;
+
+		return Hash;
+	}
+
+	static Float HashToFloat01(uint32_t Hash)
+	{
+		return (Hash >> 8) * (1.f / (1u << 24));
+	}
+
+	static Float Wrap01(Float Value)
+	{
+		return Value >= 1 ? Value - 1 : Value;
+	}
+
+	bool CameraProjection::Project(const Vector3f& Point, Vector2f& Pixel) const
+	{
+		const Vector3f Local = Rotation.transpose() * (Point - Origin);
+
+		if (Local.z() >= 0)
+		{
+			return false;
+		}
+
+		const Float ScreenX = Local.x() / -Local.z();
+		const Float ScreenY = Local.y() / -Local.z();
+
+		Pixel.x() = (ScreenX / (FieldOfView * AspectRatio) + 1) * 0.5f * Resolution.x();
+		Pixel.y() = (1 - ScreenY / FieldOfView) * 0.5f * Resolution.y();
+
+		return Pixel.x() >= 0 && Pixel.y() >= 0 && Pixel.x() < Resolution.x() && Pixel.y() < Resolution.y();
+	}
+
+	void CameraRayBatch::Resize(size_t Count)
+	{
+		NumRays = Count;
+
+		const size_t Padded = (Count + kCameraSimdWidth - 1) / kCameraSimdWidth * kCameraSimdWidth;
+
+		for (auto* pArray : {&OriginX, &OriginY, &OriginZ, &DirectionX, &DirectionY, &DirectionZ,
+							 &InvDirectionX, &InvDirectionY, &InvDirectionZ, &ScreenX, &ScreenY, &LensX, &LensY})
+		{
+			pArray->resize(Padded);
+		}
+	}
+
+	Ray CameraRayBatch::GetRay(size_t Index) const
+	{
+		return Ray{Vector3f(OriginX[Index], OriginY[Index], OriginZ[Index]),
+				   Vector3f(DirectionX[Index], DirectionY[Index], DirectionZ[Index]),
+				   Vector3f(InvDirectionX[Index], InvDirectionY[Index], InvDirectionZ[Index])};
+	}
+
 	Camera::Camera(const CamOptions& Options)
 	{
 		// compute basis
@@ -32,8 +100,13 @@ namespace PathTracer
 		mCameraToWorld(3, 2) = 0;
 		mCameraToWorld(3, 3) = 0;
 
+		mRotation = mCameraToWorld.topLeftCorner<3, 3>();
+
 		// image
-		mImage = Image(Options.Resolution.x(), Options.Resolution.y());
+		if (Options.AllocateImage)
+		{
+			mImage = Image(Options.Resolution.x(), Options.Resolution.y());
+		}
 
 		mImageAspectRatio = Options.Resolution.x() / Float(Options.Resolution.y());
 
@@ -45,23 +118,156 @@ namespace PathTracer
 
 		mInvResolution.x() = 1.f / mResolution.x();
 		mInvResolution.y() = 1.f / mResolution.y();
+
+		mLensRadius = Options.LensRadius;
+		mFocusDistance = Options.FocusDistance;
 	}
 
-	Ray Camera::GenerateRay(int Row, int Col, const Eigen::Vector2f& SamplePoint)
+	Ray Camera::GenerateRay(int Row, int Col, const Eigen::Vector2f& SamplePoint, const Eigen::Vector2f& LensPoint) const
 	{
 		const Float PixelXNdc = (Col + SamplePoint.x()) * mInvResolution.x();
 		const Float PixelYNdc = (Row + SamplePoint.y()) * mInvResolution.y();
 
 		const Float PixelXScreen = ( 2 * PixelXNdc - 1) * mFieldOfView * mImageAspectRatio;
 		const Float PixelYScreen = (-2 * PixelYNdc + 1) * mFieldOfView;
-		
-		const Vector4f PixelWorld = mCameraToWorld * Vector4f(PixelXScreen, PixelYScreen, -1, 1);
 
-		Vector3f Direction = Vector3f(PixelWorld.x(), PixelWorld.y(), PixelWorld.z());
+		// the focal plane sits at FocusDistance, a pinhole sees the same direction
+		const Vector3f Lens = mLensRadius * Vector3f(LensPoint.x(), LensPoint.y(), 0);
+		const Vector3f Focus = mFocusDistance * Vector3f(PixelXScreen, PixelYScreen, -1);
 
-		Direction = (Direction - mOrigin).normalized();
-		
-		return Ray{mOrigin, Direction};
+		return Ray{mOrigin + mRotation * Lens, (mRotation * (Focus - Lens)).normalized()};
+	}
+
+	void Camera::GenerateRays(const CameraTile& Tile, unsigned SampleIndex, unsigned NumSamples, uint32_t Seed, CameraRayBatch& Batch) const
+	{
+		const size_t Count = size_t(Tile.Rows) * Tile.Cols;
+
+		Batch.Resize(Count);
+
+		const Float ScaleX = 2 * mInvResolution.x() * mFieldOfView * mImageAspectRatio;
+		const Float ScaleY = -2 * mInvResolution.y() * mFieldOfView;
+
+		size_t Index = 0;
+
+		for (int Row = Tile.BeginRow; Row < Tile.BeginRow + Tile.Rows; Row++)
+		{
+			for (int Col = Tile.BeginCol; Col < Tile.BeginCol + Tile.Cols; Col++, Index++)
+			{
+				const uint32_t PixelHash = HashPixel(Col, Row, Seed, 0);
+				const uint32_t LensHash = HashPixel(Col, Row, Seed, 1);
+
+				// each pixel walks the set from its own start, the samples still cover all of it
+				const unsigned Point = (SampleIndex + HashPixel(Col, Row, Seed, 2)) % NumSamples;
+
+				const Float Stratum = (Point + 0.5f) / NumSamples;
+				const Float Radical = Reverse32bit(Point) * (1.f / 4294967296.f);
+
+				const Float JitterX = Wrap01(Stratum + HashToFloat01(PixelHash));
+				const Float JitterY = Wrap01(Radical + HashToFloat01(PixelHash * 0x9e3779b9u));
+
+				Batch.ScreenX[Index] = (Col + JitterX) * ScaleX - mFieldOfView * mImageAspectRatio;
+				Batch.ScreenY[Index] = (Row + JitterY) * ScaleY + mFieldOfView;
+
+				Vector2f Lens = Vector2f::Zero();
+
+				if (mLensRadius > 0)
+				{
+					// swapped dimensions so the lens does not mirror the pixel jitter
+					Lens = mLensRadius * MapSquareToDisk(Vector2f(Wrap01(Radical + HashToFloat01(LensHash)),
+																  Wrap01(Stratum + HashToFloat01(LensHash * 0x9e3779b9u))));
+				}
+
+				Batch.LensX[Index] = Lens.x();
+				Batch.LensY[Index] = Lens.y();
+			}
+		}
+
+		for (size_t Pad = Count; Pad < Batch.ScreenX.size(); Pad++)
+		{
+			Batch.ScreenX[Pad] = Batch.ScreenY[Pad] = Batch.LensX[Pad] = Batch.LensY[Pad] = 0;
+		}
+
+		const Matrix3f& R = mRotation;
+		const Float Focus = mFocusDistance;
+
+#if defined(PATHTRACER_SSE)
+		const __m128 Zero = _mm_setzero_ps();
+		const __m128 Two = _mm_set1_ps(2.f);
+		const __m128 Half = _mm_set1_ps(0.5f);
+		const __m128 Three = _mm_set1_ps(3.f);
+
+		for (size_t Begin = 0; Begin < Count; Begin += kCameraSimdWidth)
+		{
+			const __m128 LensX = _mm_loadu_ps(&Batch.LensX[Begin]);
+			const __m128 LensY = _mm_loadu_ps(&Batch.LensY[Begin]);
+
+			// camera space direction from the lens point to the focal plane
+			const __m128 LocalX = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(&Batch.ScreenX[Begin]), _mm_set1_ps(Focus)), LensX);
+			const __m128 LocalY = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(&Batch.ScreenY[Begin]), _mm_set1_ps(Focus)), LensY);
+			const __m128 LocalZ = _mm_set1_ps(-Focus);
+
+			auto Rotate = [&](int Axis, __m128 X, __m128 Y, __m128 Z)
+			{
+				return _mm_add_ps(_mm_add_ps(_mm_mul_ps(X, _mm_set1_ps(R(Axis, 0))), _mm_mul_ps(Y, _mm_set1_ps(R(Axis, 1)))),
+								  _mm_mul_ps(Z, _mm_set1_ps(R(Axis, 2))));
+			};
+
+			__m128 DirX = Rotate(0, LocalX, LocalY, LocalZ);
+			__m128 DirY = Rotate(1, LocalX, LocalY, LocalZ);
+			__m128 DirZ = Rotate(2, LocalX, LocalY, LocalZ);
+
+			// rsqrt and rcp are 12 bit estimates, one Newton step brings them to about 22 bits
+			const __m128 LengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(DirX, DirX), _mm_mul_ps(DirY, DirY)), _mm_mul_ps(DirZ, DirZ));
+			__m128 InvLength = _mm_rsqrt_ps(LengthSq);
+			InvLength = _mm_mul_ps(_mm_mul_ps(Half, InvLength), _mm_sub_ps(Three, _mm_mul_ps(LengthSq, _mm_mul_ps(InvLength, InvLength))));
+
+			DirX = _mm_mul_ps(DirX, InvLength);
+			DirY = _mm_mul_ps(DirY, InvLength);
+			DirZ = _mm_mul_ps(DirZ, InvLength);
+
+			auto Reciprocal = [&](__m128 Value)
+			{
+				const __m128 Estimate = _mm_rcp_ps(Value);
+				const __m128 Refined = _mm_mul_ps(Estimate, _mm_sub_ps(Two, _mm_mul_ps(Value, Estimate)));
+
+				// the refinement turns the infinities of axis aligned rays into NaN
+				const __m128 IsZero = _mm_cmpeq_ps(Value, Zero);
+
+				return _mm_or_ps(_mm_and_ps(IsZero, Estimate), _mm_andnot_ps(IsZero, Refined));
+			};
+
+			_mm_storeu_ps(&Batch.DirectionX[Begin], DirX);
+			_mm_storeu_ps(&Batch.DirectionY[Begin], DirY);
+			_mm_storeu_ps(&Batch.DirectionZ[Begin], DirZ);
+
+			_mm_storeu_ps(&Batch.InvDirectionX[Begin], Reciprocal(DirX));
+			_mm_storeu_ps(&Batch.InvDirectionY[Begin], Reciprocal(DirY));
+			_mm_storeu_ps(&Batch.InvDirectionZ[Begin], Reciprocal(DirZ));
+
+			_mm_storeu_ps(&Batch.OriginX[Begin], _mm_add_ps(_mm_set1_ps(mOrigin.x()), Rotate(0, LensX, LensY, Zero)));
+			_mm_storeu_ps(&Batch.OriginY[Begin], _mm_add_ps(_mm_set1_ps(mOrigin.y()), Rotate(1, LensX, LensY, Zero)));
+			_mm_storeu_ps(&Batch.OriginZ[Begin], _mm_add_ps(_mm_set1_ps(mOrigin.z()), Rotate(2, LensX, LensY, Zero)));
+		}
+#else
+		for (size_t Ray = 0; Ray < Count; Ray++)
+		{
+			const Vector3f Lens(Batch.LensX[Ray], Batch.LensY[Ray], 0);
+			const Vector3f Direction = (R * (Focus * Vector3f(Batch.ScreenX[Ray], Batch.ScreenY[Ray], -1) - Lens)).normalized();
+			const Vector3f Origin = mOrigin + R * Lens;
+
+			Batch.DirectionX[Ray] = Direction.x();
+			Batch.DirectionY[Ray] = Direction.y();
+			Batch.DirectionZ[Ray] = Direction.z();
+
+			Batch.InvDirectionX[Ray] = 1 / Direction.x();
+			Batch.InvDirectionY[Ray] = 1 / Direction.y();
+			Batch.InvDirectionZ[Ray] = 1 / Direction.z();
+
+			Batch.OriginX[Ray] = Origin.x();
+			Batch.OriginY[Ray] = Origin.y();
+			Batch.OriginZ[Ray] = Origin.z();
+		}
+#endif
 	}
 
 	void Camera::SetPixelColour(int Row, int Col, const Vector3f& RGB)
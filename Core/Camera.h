@@ -3,6 +3,7 @@
 #include <Pch.h>
 #include <Image.h>
 #include <Ray.h>
+#include <Memory.h>
 
 namespace PathTracer
 {
@@ -13,6 +14,46 @@ namespace PathTracer
 		Eigen::Vector3f Up;
 		Eigen::Vector2i Resolution;
 		Float FOVDegrees;
+		Float LensRadius = 0;		// zero keeps the pinhole
+		Float FocusDistance = 1;
+		bool AllocateImage = true;	// off when the render streams its rows to a file instead
+	};
+
+	// What reprojection needs of a camera once the camera itself is gone
+	struct CameraProjection
+	{
+		// Continuous pixel coordinates of a world point through the pinhole,
+		// false behind the camera or off screen
+		bool Project(const Eigen::Vector3f& Point, Eigen::Vector2f& Pixel) const;
+
+		Eigen::Matrix3f Rotation = Eigen::Matrix3f::Identity();
+		Eigen::Vector3f Origin = Eigen::Vector3f::Zero();
+		Eigen::Vector2i Resolution = Eigen::Vector2i::Zero();
+		Float FieldOfView = 1;
+		Float AspectRatio = 1;
+	};
+
+	// Pixel rectangle, rays of a batch are row major within it
+	struct CameraTile
+	{
+		int BeginRow = 0, BeginCol = 0;
+		int Rows = 0, Cols = 0;
+	};
+
+	// Camera rays of one tile in SoA layout, padded to the SIMD width
+	struct CameraRayBatch
+	{
+		void Resize(size_t Count);
+
+		Ray GetRay(size_t Index) const;
+
+		size_t NumRays = 0;
+		std::vector<Float> OriginX, OriginY, OriginZ;
+		std::vector<Float> DirectionX, DirectionY, DirectionZ;
+		std::vector<Float> InvDirectionX, InvDirectionY, InvDirectionZ;
+
+		// screen and lens positions, filled before the SIMD pass
+		std::vector<Float> ScreenX, ScreenY, LensX, LensY;
 	};
 	
 	class Camera
@@ -43,15 +84,45 @@ namespace PathTracer
 		
 		void SetPixelColour(int Row, int Col, const Eigen::Vector3f& RGB);
 		
-		Ray GenerateRay(int Row, int Col, const Eigen::Vector2f& SamplePoint);
+		// LensPoint is on the unit disk and only matters with a lens radius
+		Ray GenerateRay(int Row, int Col, const Eigen::Vector2f& SamplePoint, const Eigen::Vector2f& LensPoint = Eigen::Vector2f::Zero()) const;
+
+		// Rays of sample SampleIndex out of NumSamples for every pixel of the tile. Pixel and
+		// lens positions come from a Hammersley set rotated per pixel and Seed
+		void GenerateRays(const CameraTile& Tile, unsigned SampleIndex, unsigned NumSamples, uint32_t Seed, CameraRayBatch& Batch) const;
+
+		Image& GetImage() { return mImage; }
+
+		bool HasImage() const { return !mImage.mImageData.empty(); }
+
+		size_t GetSizeInBytes() const
+		{
+			return sizeof(Camera) + GetVectorBytes(mImage.mImageData);
+		}
+
+		CameraProjection GetProjection() const
+		{
+			return {mRotation, mOrigin, mResolution, mFieldOfView, mImageAspectRatio};
+		}
+
+		Float GetLensRadius() const { return mLensRadius; }
+
+		// Angle one pixel subtends at the image centre, seeds the ray cones for texture filtering
+		Float GetPixelSpreadAngle() const
+		{
+			return 2 * mFieldOfView / mResolution.y();
+		}
 	private:
 		Eigen::Matrix4f mCameraToWorld;
+		Eigen::Matrix3f mRotation;
 		Image mImage;
 		Eigen::Vector3f mOrigin;
 		Eigen::Vector2i mResolution;
 		Eigen::Vector2f mInvResolution;
 		Float mImageAspectRatio;
 		Float mFieldOfView;
+		Float mLensRadius = 0;
+		Float mFocusDistance = 1;
 	};
 
 } // namespace PathTracer
@@ -0,0 +1,232 @@
+#include <Checkpoint.h>
+
+namespace PathTracer
+{
+	constexpr char kCheckpointMagic[4] = { 'P', 'T', 'C', 'K' };
+	constexpr uint32_t kCheckpointVersion = 1;
+
+	struct CheckpointHeader
+	{
+		char Magic[4];
+		uint32_t Version;
+		uint32_t Width;
+		uint32_t Height;
+		uint32_t SamplesPerPixel;
+		uint32_t PathSampler;
+		uint32_t Seed;
+	};
+
+	bool RenderCheckpoint::IsRowDone(unsigned Row) const
+	{
+		const auto First = SampleCounts.begin() + size_t(Row) * Width;
+
+		return std::all_of(First, First + Width, [](uint32_t Count) { return Count > 0; });
+	}
+
+	void WriteCheckpoint(const RenderCheckpoint& Checkpoint, std::string_view FileName)
+	{
+		const std::string TempName = std::string(FileName) + ".tmp";
+
+		{
+			std::ofstream Output(TempName, std::ios::binary | std::ios::trunc);
+
+			if (!Output.is_open())
+			{
+				throw std::runtime_error("Failed to open checkpoint file for writing\n");
+			}
+
+			CheckpointHeader Header{};
+			std::memcpy(Header.Magic, kCheckpointMagic, sizeof(Header.Magic));
+			Header.Version = kCheckpointVersion;
+			Header.Width = Checkpoint.Width;
+			Header.Height = Checkpoint.Height;
+			Header.SamplesPerPixel = Checkpoint.SamplesPerPixel;
+			Header.PathSampler = Checkpoint.PathSampler;
+			Header.Seed = Checkpoint.Seed;
+
+			Output.write(reinterpret_cast<const char*>(&Header), sizeof(Header));
+			Output.write(reinterpret_cast<const char*>(Checkpoint.SampleCounts.data()), static_cast<std::streamsize>(Checkpoint.SampleCounts.size() * sizeof(uint32_t)));
+			Output.write(reinterpret_cast<const char*>(Checkpoint.Radiance.data()), static_cast<std::streamsize>(Checkpoint.Radiance.size() * sizeof(Pixel)));
+			Output.flush();
+
+			if (!Output)
+			{
+				throw std::runtime_error("Failed to write checkpoint file\n");
+			}
+		}
+
+		// replaces the previous checkpoint in one step
+		std::filesystem::rename(TempName, std::filesystem::path(FileName));
+	}
+
+	bool ReadCheckpoint(std::string_view FileName, RenderCheckpoint& Checkpoint)
+	{
+		std::ifstream Input(std::string(FileName), std::ios::binary);
+
+		if (!Input.is_open())
+		{
+			return false;
+		}
+
+		CheckpointHeader Header;
+		Input.read(reinterpret_cast<char*>(&Header), sizeof(Header));
+
+		if (!Input || std::memcmp(Header.Magic, kCheckpointMagic, sizeof(Header.Magic)) != 0 || Header.Version != kCheckpointVersion)
+		{
+			throw std::runtime_error("Not a render checkpoint file\n");
+		}
+
+		const size_t NumPixels = size_t(Header.Width) * Header.Height;
+
+		Checkpoint.Width = Header.Width;
+		Checkpoint.Height = Header.Height;
+		Checkpoint.SamplesPerPixel = Header.SamplesPerPixel;
+		Checkpoint.PathSampler = Header.PathSampler;
+		Checkpoint.Seed = Header.Seed;
+		Checkpoint.SampleCounts.resize(NumPixels);
+		Checkpoint.Radiance.resize(NumPixels);
+
+		Input.read(reinterpret_cast<char*>(Checkpoint.SampleCounts.data()), static_cast<std::streamsize>(NumPixels * sizeof(uint32_t)));
+		Input.read(reinterpret_cast<char*>(Checkpoint.Radiance.data()), static_cast<std::streamsize>(NumPixels * sizeof(Pixel)));
+
+		if (!Input)
+		{
+			throw std::runtime_error("Truncated render checkpoint\n");
+		}
+
+		return true;
+	}
+
+	CheckpointWriter::CheckpointWriter(Image& aImage, RenderCheckpoint Initial, const CheckpointOptions& Options)
+	: mImage{aImage}, mState{std::move(Initial)}, mRowDone{std::make_unique<std::atomic<bool>[]>(aImage.mImageHeight)},
+	  mFileName{Options.FileName}, mInterval{Options.IntervalSeconds}
+	{
+		if (mState.Width != aImage.mImageWidth || mState.Height != aImage.mImageHeight)
+		{
+			throw std::logic_error("Checkpoint does not match the image\n");
+		}
+
+		const size_t NumPixels = size_t(mState.Width) * mState.Height;
+
+		mState.SampleCounts.resize(NumPixels, 0);
+
+		for (unsigned Row = 0; Row < mState.Height; Row++)
+		{
+			const bool Done = mState.Radiance.size() == NumPixels && mState.IsRowDone(Row);
+
+			if (Done)
+			{
+				std::copy_n(mState.Radiance.begin() + size_t(Row) * mState.Width, mState.Width, aImage.mImageData.begin() + size_t(Row) * mState.Width);
+			}
+			else
+			{
+				std::fill_n(mState.SampleCounts.begin() + size_t(Row) * mState.Width, mState.Width, 0);
+			}
+
+			mRowDone[Row].store(Done, std::memory_order_relaxed);
+		}
+
+		// the image holds the radiance from here on
+		mState.Radiance = std::vector<Pixel>();
+
+		mThread = std::thread(&CheckpointWriter::Run, this);
+	}
+
+	CheckpointWriter::~CheckpointWriter()
+	{
+		Stop();
+	}
+
+	void CheckpointWriter::PublishRow(unsigned Row, const unsigned* pSampleCounts)
+	{
+		std::copy_n(pSampleCounts, mState.Width, mState.SampleCounts.begin() + size_t(Row) * mState.Width);
+
+		mRowDone[Row].store(true, std::memory_order_release);
+	}
+
+	unsigned CheckpointWriter::GetNumRowsDone() const
+	{
+		unsigned NumDone = 0;
+
+		for (unsigned Row = 0; Row < mState.Height; Row++)
+		{
+			NumDone += IsRowDone(Row);
+		}
+
+		return NumDone;
+	}
+
+	void CheckpointWriter::Finish()
+	{
+		Stop();
+		Write();
+	}
+
+	void CheckpointWriter::Run()
+	{
+		std::unique_lock<std::mutex> Lock(mMutex);
+
+		while (!mStopRequested.wait_for(Lock, mInterval, [this]() { return mStopping; }))
+		{
+			Lock.unlock();
+
+			// a failed write leaves the previous checkpoint, the render goes on
+			try
+			{
+				Write();
+			}
+			catch (const std::exception& Error)
+			{
+				std::cerr << "Checkpoint skipped: " << Error.what();
+			}
+
+			Lock.lock();
+		}
+	}
+
+	void CheckpointWriter::Write()
+	{
+		const size_t NumPixels = size_t(mState.Width) * mState.Height;
+
+		RenderCheckpoint Snapshot;
+		Snapshot.Width = mState.Width;
+		Snapshot.Height = mState.Height;
+		Snapshot.SamplesPerPixel = mState.SamplesPerPixel;
+		Snapshot.PathSampler = mState.PathSampler;
+		Snapshot.Seed = mState.Seed;
+		Snapshot.SampleCounts.resize(NumPixels, 0);
+		Snapshot.Radiance.resize(NumPixels, Pixel{});
+
+		for (unsigned Row = 0; Row < mState.Height; Row++)
+		{
+			if (!IsRowDone(Row))
+			{
+				continue;
+			}
+
+			const size_t First = size_t(Row) * mState.Width;
+
+			std::copy_n(mState.SampleCounts.begin() + First, mState.Width, Snapshot.SampleCounts.begin() + First);
+			std::copy_n(mImage.mImageData.begin() + First, mState.Width, Snapshot.Radiance.begin() + First);
+		}
+
+		WriteCheckpoint(Snapshot, mFileName);
+	}
+
+	void CheckpointWriter::Stop()
+	{
+		{
+			std::lock_guard<std::mutex> Lock(mMutex);
+
+			mStopping = true;
+		}
+
+		mStopRequested.notify_all();
+
+		if (mThread.joinable())
+		{
+			mThread.join();
+		}
+	}
+
+} // namespace PathTracer
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <Pch.h>
+#include <Image.h>
+
+namespace PathTracer
+{
+	struct CheckpointOptions
+	{
+		std::string FileName;			// empty for no checkpoints
+		double IntervalSeconds = 300;
+		bool Resume = false;			// continue from FileName when it holds a checkpoint
+	};
+
+	// What a render has finished so far. Rows are rendered whole, so a row whose
+	// pixels all have samples holds its final radiance and the others start over
+	struct RenderCheckpoint
+	{
+		unsigned Width = 0, Height = 0;
+		unsigned SamplesPerPixel = 0;
+		uint32_t PathSampler = 0;
+		uint32_t Seed = 0;				// the rows' sampler seeds derive from it
+		std::vector<Pixel> Radiance;
+		std::vector<uint32_t> SampleCounts;
+
+		bool IsRowDone(unsigned Row) const;
+	};
+
+	// Goes to FileName.tmp first and is renamed over FileName, a write cut short keeps the last checkpoint
+	void WriteCheckpoint(const RenderCheckpoint& Checkpoint, std::string_view FileName);
+
+	// False when FileName does not exist yet
+	bool ReadCheckpoint(std::string_view FileName, RenderCheckpoint& Checkpoint);
+
+	// Writes the finished rows of a render on its own thread every interval. Render
+	// threads publish a row through an atomic flag and never wait on the disk
+	class CheckpointWriter
+	{
+	public:
+		// Rows that Initial finished are copied into aImage and count as done
+		CheckpointWriter(Image& aImage, RenderCheckpoint Initial, const CheckpointOptions& Options);
+
+		CheckpointWriter(const CheckpointWriter&) = delete;
+		CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+		~CheckpointWriter();
+
+		// The row's pixels must be in the image, pSampleCounts holds Width counts
+		void PublishRow(unsigned Row, const unsigned* pSampleCounts);
+
+		bool IsRowDone(unsigned Row) const { return mRowDone[Row].load(std::memory_order_acquire); }
+
+		unsigned GetNumRowsDone() const;
+
+		// Stops the thread and writes the last checkpoint
+		void Finish();
+
+	private:
+		void Run();
+
+		void Write();
+
+		void Stop();
+
+		const Image& mImage;
+		RenderCheckpoint mState;		// header and sample counts, a row's counts are only touched by its renderer
+		std::unique_ptr<std::atomic<bool>[]> mRowDone;
+		std::string mFileName;
+		std::chrono::duration<double> mInterval;
+		std::mutex mMutex;
+		std::condition_variable mStopRequested;
+		bool mStopping = false;
+		std::thread mThread;
+	};
+
+} // namespace PathTracer
@@ -0,0 +1,407 @@
+#include <CompressedBvh.h>
+#include <Scene.h>
+
+using namespace Eigen;
+
+namespace PathTracer
+{
+	static Float ExponentToScale(int8_t Exponent)
+	{
+		return std::bit_cast<Float>(static_cast<uint32_t>(Exponent + 127) << 23);
+	}
+
+	CompressedBvh::CompressedBvh(const Bvh& Source)
+	: pTriangles{&Source.GetTriangles()}, pSourceIndices{&Source.GetTriangleIndices()}
+	{
+		const unsigned Root = CopyBinaryNode(Source, 0);
+
+		mNodes.emplace_back();
+		mTriangleIndices.reserve(Source.GetTriangleIndices().size());
+
+		EmitNode(Root, 0);
+
+		mNodes.shrink_to_fit();
+		mBuildNodes = std::vector<BuildNode>();
+		pSourceIndices = nullptr;
+	}
+
+	unsigned CompressedBvh::MakeLeaf(const Bvh& Source, unsigned PrimitiveBegin, unsigned NumPrimitives)
+	{
+		const unsigned BuildIndex = static_cast<unsigned>(mBuildNodes.size());
+
+		mBuildNodes.emplace_back();
+
+		if (NumPrimitives > kWideBvhMaxLeafPrimitives)
+		{
+			// leaves the binary builder could not split are cut in half by index
+			const unsigned LeftCount = NumPrimitives / 2;
+
+			const unsigned Left = MakeLeaf(Source, PrimitiveBegin, LeftCount);
+			const unsigned Right = MakeLeaf(Source, PrimitiveBegin + LeftCount, NumPrimitives - LeftCount);
+
+			BuildNode& Node = mBuildNodes[BuildIndex];
+			Node.Left = Left;
+			Node.Right = Right;
+			Node.Min = mBuildNodes[Left].Min.cwiseMin(mBuildNodes[Right].Min);
+			Node.Max = mBuildNodes[Left].Max.cwiseMax(mBuildNodes[Right].Max);
+
+			return BuildIndex;
+		}
+
+		const auto& Triangles = Source.GetTriangles();
+		const auto& Indices = Source.GetTriangleIndices();
+
+		BuildNode& Node = mBuildNodes[BuildIndex];
+		Node.PrimitiveBegin = PrimitiveBegin;
+		Node.NumPrimitives = NumPrimitives;
+		Node.Min = Vector3f(kInfinity, kInfinity, kInfinity);
+		Node.Max = -Node.Min;
+
+		for (unsigned Index = PrimitiveBegin; Index < PrimitiveBegin + NumPrimitives; Index++)
+		{
+			const Triangle& aTriangle = *Triangles[Indices[Index]];
+
+			for (unsigned Corner = 0; Corner < 3; Corner++)
+			{
+				const Vector3f Position = aTriangle.GetPosition(Corner);
+
+				Node.Min = Node.Min.cwiseMin(Position);
+				Node.Max = Node.Max.cwiseMax(Position);
+			}
+		}
+
+		return BuildIndex;
+	}
+
+	unsigned CompressedBvh::CopyBinaryNode(const Bvh& Source, unsigned NodeIndex)
+	{
+		const BvhNode& Node = Source.GetNodes()[NodeIndex];
+
+		if (Node.NumPrimitives > 0)
+		{
+			return MakeLeaf(Source, Node.LeftChild, Node.NumPrimitives);
+		}
+
+		const unsigned BuildIndex = static_cast<unsigned>(mBuildNodes.size());
+
+		mBuildNodes.emplace_back();
+
+		const unsigned Left = CopyBinaryNode(Source, Node.LeftChild);
+		const unsigned Right = CopyBinaryNode(Source, Node.LeftChild + 1);
+
+		BuildNode& NewNode = mBuildNodes[BuildIndex];
+		NewNode.Left = Left;
+		NewNode.Right = Right;
+		NewNode.Min = Node.BoundingBox.Bounds[0];
+		NewNode.Max = Node.BoundingBox.Bounds[1];
+
+		return BuildIndex;
+	}
+
+	void CompressedBvh::QuantizeChildren(CompressedBvhNode& Node, const std::vector<unsigned>& Children)
+	{
+		Vector3f Lo(kInfinity, kInfinity, kInfinity);
+		Vector3f Hi = -Lo;
+
+		for (unsigned Child : Children)
+		{
+			Lo = Lo.cwiseMin(mBuildNodes[Child].Min);
+			Hi = Hi.cwiseMax(mBuildNodes[Child].Max);
+		}
+
+		for (int Axis = 0; Axis < 3; Axis++)
+		{
+			int Exponent = -100;
+
+			if (Hi[Axis] > Lo[Axis])
+			{
+				std::frexp((Hi[Axis] - Lo[Axis]) / 255, &Exponent);
+				Exponent = std::clamp(Exponent, -100, 100);
+			}
+
+			// grow the cell size until every child fits in 8 bits after outward rounding
+			for (;; Exponent++)
+			{
+				const Float Scale = ExponentToScale(static_cast<int8_t>(Exponent));
+
+				bool Fits = true;
+
+				for (size_t Slot = 0; Slot < Children.size() && Fits; Slot++)
+				{
+					const BuildNode& Child = mBuildNodes[Children[Slot]];
+
+					Float QLo = std::floor((Child.Min[Axis] - Lo[Axis]) / Scale);
+					Float QHi = std::ceil((Child.Max[Axis] - Lo[Axis]) / Scale);
+
+					while (QLo > 0 && Lo[Axis] + QLo * Scale > Child.Min[Axis])
+					{
+						QLo--;
+					}
+
+					while (Lo[Axis] + QHi * Scale < Child.Max[Axis])
+					{
+						QHi++;
+					}
+
+					if (QHi > 255)
+					{
+						Fits = false;
+						break;
+					}
+
+					Node.QLo[Axis][Slot] = static_cast<uint8_t>(QLo);
+					Node.QHi[Axis][Slot] = static_cast<uint8_t>(QHi);
+				}
+
+				if (Fits)
+				{
+					break;
+				}
+			}
+
+			Node.Origin[Axis] = Lo[Axis];
+			Node.Exponent[Axis] = static_cast<int8_t>(Exponent);
+		}
+	}
+
+	void CompressedBvh::EmitNode(unsigned BuildIndex, unsigned NodeIndex)
+	{
+		std::vector<unsigned> Children;
+
+		if (mBuildNodes[BuildIndex].NumPrimitives > 0)
+		{
+			Children.push_back(BuildIndex);
+		}
+		else
+		{
+			Children.push_back(mBuildNodes[BuildIndex].Left);
+			Children.push_back(mBuildNodes[BuildIndex].Right);
+		}
+
+		// open the largest inner child until the node is full
+		while (Children.size() < kWideBvhWidth)
+		{
+			int Largest = -1;
+			Float LargestArea = -1;
+
+			for (size_t Slot = 0; Slot < Children.size(); Slot++)
+			{
+				const BuildNode& Child = mBuildNodes[Children[Slot]];
+
+				if (Child.NumPrimitives > 0)
+				{
+					continue;
+				}
+
+				const Vector3f Extent = Child.Max - Child.Min;
+				const Float Area = Extent.x() * Extent.y() + Extent.x() * Extent.z() + Extent.y() * Extent.z();
+
+				if (Area > LargestArea)
+				{
+					Largest = static_cast<int>(Slot);
+					LargestArea = Area;
+				}
+			}
+
+			if (Largest == -1)
+			{
+				break;
+			}
+
+			const BuildNode& Opened = mBuildNodes[Children[Largest]];
+
+			Children[Largest] = Opened.Left;
+			Children.push_back(Opened.Right);
+		}
+
+		const unsigned ChildBaseIndex = static_cast<unsigned>(mNodes.size());
+
+		unsigned NumInner = 0;
+
+		for (unsigned Child : Children)
+		{
+			NumInner += mBuildNodes[Child].NumPrimitives == 0;
+		}
+
+		mNodes.resize(mNodes.size() + NumInner);
+
+		CompressedBvhNode& Node = mNodes[NodeIndex];
+		Node = CompressedBvhNode{};
+		Node.ChildBaseIndex = ChildBaseIndex;
+		Node.PrimitiveBaseIndex = static_cast<unsigned>(mTriangleIndices.size());
+
+		QuantizeChildren(Node, Children);
+
+		const auto& SourceIndices = *pSourceIndices;
+
+		for (size_t Slot = 0; Slot < Children.size(); Slot++)
+		{
+			const BuildNode& Child = mBuildNodes[Children[Slot]];
+
+			if (Child.NumPrimitives > 0)
+			{
+				Node.Meta[Slot] = static_cast<uint8_t>(Child.NumPrimitives);
+
+				mTriangleIndices.insert(mTriangleIndices.end(), SourceIndices.begin() + Child.PrimitiveBegin,
+										SourceIndices.begin() + Child.PrimitiveBegin + Child.NumPrimitives);
+			}
+			else
+			{
+				Node.InnerMask |= static_cast<uint8_t>(1u << Slot);
+			}
+		}
+
+		unsigned InnerRank = 0;
+
+		for (unsigned Child : Children)
+		{
+			if (mBuildNodes[Child].NumPrimitives == 0)
+			{
+				EmitNode(Child, ChildBaseIndex + InnerRank++);
+			}
+		}
+	}
+
+	size_t CompressedBvh::GetSizeInBytes() const
+	{
+		return mNodes.capacity() * sizeof(CompressedBvhNode) + mTriangleIndices.capacity() * sizeof(unsigned);
+	}
+
+	template<typename KernelType>
+	const Triangle* CompressedBvh::Traverse(const Ray& aRay, Float& U, Float& V) const
+	{
+		const Triangle* const* ppTriangles = pTriangles->data();
+
+		unsigned NodesToVisit[256];
+		unsigned ToVisitOffset = 0;
+
+		NodesToVisit[ToVisitOffset++] = 0;
+
+		const Triangle* pHit = nullptr;
+
+		while (ToVisitOffset > 0)
+		{
+			const CompressedBvhNode& Node = mNodes[NodesToVisit[--ToVisitOffset]];
+
+			Float Scale[3];
+
+			for (int Axis = 0; Axis < 3; Axis++)
+			{
+				Scale[Axis] = ExponentToScale(Node.Exponent[Axis]);
+			}
+
+			Float InnerDistances[kWideBvhWidth];
+			unsigned InnerNodes[kWideBvhWidth];
+			unsigned NumInnerHits = 0;
+
+			unsigned InnerRank = 0;
+			unsigned PrimitiveOffset = Node.PrimitiveBaseIndex;
+
+			for (unsigned Slot = 0; Slot < kWideBvhWidth; Slot++)
+			{
+				const bool IsInner = (Node.InnerMask >> Slot) & 1;
+
+				if (!IsInner && Node.Meta[Slot] == 0)
+				{
+					continue;
+				}
+
+				Float TMin = kEpsilon;
+				Float TMax = aRay.tMax;
+
+				for (int Axis = 0; Axis < 3; Axis++)
+				{
+					const Float Lo = Node.Origin[Axis] + Node.QLo[Axis][Slot] * Scale[Axis];
+					const Float Hi = Node.Origin[Axis] + Node.QHi[Axis][Slot] * Scale[Axis];
+
+					const Float Near = aRay.IsDirectionNeg[Axis] ? Hi : Lo;
+					const Float Far = aRay.IsDirectionNeg[Axis] ? Lo : Hi;
+
+					TMin = std::max(TMin, (Near - aRay.Origin[Axis]) * aRay.InvDirection[Axis]);
+					TMax = std::min(TMax, (Far - aRay.Origin[Axis]) * aRay.InvDirection[Axis]);
+				}
+
+				const bool Hit = TMin <= TMax;
+
+				if (IsInner)
+				{
+					if (Hit)
+					{
+						InnerDistances[NumInnerHits] = TMin;
+						InnerNodes[NumInnerHits++] = Node.ChildBaseIndex + InnerRank;
+					}
+
+					InnerRank++;
+				}
+				else
+				{
+					if (Hit)
+					{
+						for (unsigned Index = 0; Index < Node.Meta[Slot]; Index++)
+						{
+							const Triangle* pTriangle = ppTriangles[mTriangleIndices[PrimitiveOffset + Index]];
+							Float HitU, HitV;
+
+							if (pTriangle->IntersectBarycentric(aRay, HitU, HitV))
+							{
+								pHit = pTriangle;
+								U = HitU;
+								V = HitV;
+
+								if constexpr (KernelType::kStopAtFirstHit)
+								{
+									return pHit;
+								}
+							}
+						}
+					}
+
+					PrimitiveOffset += Node.Meta[Slot];
+				}
+			}
+
+			// sort far to near so the nearest child is popped first, any hit takes them as they come
+			if constexpr (!KernelType::kStopAtFirstHit)
+			{
+				for (unsigned i = 1; i < NumInnerHits; i++)
+				{
+					for (unsigned j = i; j > 0 && InnerDistances[j - 1] < InnerDistances[j]; j--)
+					{
+						std::swap(InnerDistances[j - 1], InnerDistances[j]);
+						std::swap(InnerNodes[j - 1], InnerNodes[j]);
+					}
+				}
+			}
+
+			for (unsigned i = 0; i < NumInnerHits; i++)
+			{
+				NodesToVisit[ToVisitOffset++] = InnerNodes[i];
+			}
+		}
+
+		return pHit;
+	}
+
+	bool CompressedBvh::Intersect(const Ray& aRay, Intersection& HitResult) const
+	{
+		Float U, V;
+		const Triangle* pHit = Traverse<ClosestHitKernel>(aRay, U, V);
+
+		if (!pHit)
+		{
+			return false;
+		}
+
+		pHit->FillIntersection(aRay, U, V, HitResult);
+
+		return true;
+	}
+
+	bool CompressedBvh::Occluded(const Ray& aRay) const
+	{
+		Float U, V;
+
+		return Traverse<AnyHitKernel>(aRay, U, V) != nullptr;
+	}
+
+} // namespace PathTracer
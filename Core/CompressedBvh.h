@@ -0,0 +1,75 @@
+#pragma once
+
+#include <Pch.h>
+#include <Shape.h>
+#include <Constants.h>
+#include <Acceleration.h>
+
+namespace PathTracer
+{
+	constexpr unsigned kWideBvhWidth = 8;
+	constexpr unsigned kWideBvhMaxLeafPrimitives = 15;
+
+	// 8-wide node, child boxes are stored as 8-bit offsets in a per node frame
+	// of Origin + q * 2^Exponent, rounded outwards so a decoded box always
+	// contains the original one
+	struct CompressedBvhNode
+	{
+		float Origin[3];
+		int8_t Exponent[3];
+		uint8_t InnerMask;
+		uint32_t ChildBaseIndex;
+		uint32_t PrimitiveBaseIndex;
+		uint8_t Meta[kWideBvhWidth]; // leaf primitive count, 0 for empty or inner slots
+		uint8_t QLo[3][kWideBvhWidth];
+		uint8_t QHi[3][kWideBvhWidth];
+	};
+
+	static_assert(sizeof(CompressedBvhNode) == 80);
+
+	class CompressedBvh
+	{
+	public:
+		CompressedBvh(const Bvh& Source);
+
+		CompressedBvh(const CompressedBvh&) = delete;
+		CompressedBvh& operator=(const CompressedBvh&) = delete;
+
+		CompressedBvh(CompressedBvh&&) = default;
+		CompressedBvh& operator=(CompressedBvh&&) = default;
+
+		~CompressedBvh() = default;
+
+		bool Intersect(const Ray& aRay, Intersection& HitResult) const;
+
+		bool Occluded(const Ray& aRay) const;
+
+		size_t GetSizeInBytes() const;
+
+	private:
+		template<typename KernelType>
+		const Triangle* Traverse(const Ray& aRay, Float& U, Float& V) const;
+
+		struct BuildNode
+		{
+			Eigen::Vector3f Min, Max;
+			unsigned Left = 0, Right = 0;
+			unsigned PrimitiveBegin = 0, NumPrimitives = 0;
+		};
+
+		unsigned CopyBinaryNode(const Bvh& Source, unsigned NodeIndex);
+
+		unsigned MakeLeaf(const Bvh& Source, unsigned PrimitiveBegin, unsigned NumPrimitives);
+
+		void EmitNode(unsigned BuildIndex, unsigned NodeIndex);
+
+		void QuantizeChildren(CompressedBvhNode& Node, const std::vector<unsigned>& Children);
+
+		const std::vector<Triangle*>* pTriangles;
+		const std::vector<unsigned>* pSourceIndices;
+		std::vector<CompressedBvhNode> mNodes;
+		std::vector<unsigned> mTriangleIndices;
+		std::vector<BuildNode> mBuildNodes;
+	};
+
+} // namespace PathTracer
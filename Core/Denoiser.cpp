@@ -0,0 +1,233 @@
+#include <Denoiser.h>
+#include <Parallel.h>
+
+using namespace Eigen;
+
+namespace PathTracer
+{
+	constexpr Float kAtrousKernel[5] = {1.f / 16, 1.f / 4, 3.f / 8, 1.f / 4, 1.f / 16};
+	constexpr Float kMinAlbedo = 1e-3f;
+	constexpr Float kWeightEpsilon = 1e-4f;
+
+	using ConstRowMap = Map<const ArrayXf>;
+
+	FeatureBuffers::FeatureBuffers(unsigned Width, unsigned Height)
+	: Width{Width}, Height{Height}
+	{
+		const size_t NumPixels = size_t(Width) * Height;
+
+		Normals.assign(NumPixels, Vector3f::Zero());
+		Albedo.assign(NumPixels, Vector3f::Ones());
+		Depth.assign(NumPixels, 0);
+		Variance.assign(NumPixels, 0);
+	}
+
+	// Planar copies so every kernel tap is a contiguous run of floats per row
+	struct DenoiserPlanes
+	{
+		DenoiserPlanes(size_t NumPixels)
+		: Red(NumPixels), Green(NumPixels), Blue(NumPixels), Variance(NumPixels) {}
+
+		std::vector<Float> Red, Green, Blue, Variance;
+	};
+
+	struct DenoiserFeatures
+	{
+		DenoiserFeatures(size_t NumPixels)
+		: NormalX(NumPixels), NormalY(NumPixels), NormalZ(NumPixels), Depth(NumPixels), DepthGradX(NumPixels), DepthGradY(NumPixels) {}
+
+		std::vector<Float> NormalX, NormalY, NormalZ, Depth, DepthGradX, DepthGradY;
+	};
+
+	static void FilterRow(unsigned Row, unsigned Step, unsigned Width, unsigned Height, const DenoiserOptions& Options,
+						  const DenoiserFeatures& Features, const DenoiserPlanes& Input, const std::vector<Float>& SmoothVariance, DenoiserPlanes& Output)
+	{
+		const size_t RowBegin = size_t(Row) * Width;
+
+		ArrayXf SumWeight = ArrayXf::Zero(Width);
+		ArrayXf SumRed = ArrayXf::Zero(Width);
+		ArrayXf SumGreen = ArrayXf::Zero(Width);
+		ArrayXf SumBlue = ArrayXf::Zero(Width);
+		ArrayXf SumVariance = ArrayXf::Zero(Width);
+
+		for (int TapY = -2; TapY <= 2; TapY++)
+		{
+			const int SourceRow = static_cast<int>(Row) + TapY * static_cast<int>(Step);
+
+			if (SourceRow < 0 || SourceRow >= static_cast<int>(Height))
+			{
+				continue;
+			}
+
+			const size_t SourceRowBegin = size_t(SourceRow) * Width;
+
+			for (int TapX = -2; TapX <= 2; TapX++)
+			{
+				const int Offset = TapX * static_cast<int>(Step);
+				const int Begin = std::max(0, -Offset);
+				const int End = std::min(static_cast<int>(Width), static_cast<int>(Width) - Offset);
+
+				if (End <= Begin)
+				{
+					continue;
+				}
+
+				const Index Count = End - Begin;
+
+				auto Center = [&](const std::vector<Float>& Plane) { return ConstRowMap(Plane.data() + RowBegin + Begin, Count); };
+				auto Tap = [&](const std::vector<Float>& Plane) { return ConstRowMap(Plane.data() + SourceRowBegin + Begin + Offset, Count); };
+
+				const Float KernelWeight = kAtrousKernel[TapX + 2] * kAtrousKernel[TapY + 2];
+
+				ArrayXf Weight;
+
+				if (TapX == 0 && TapY == 0)
+				{
+					Weight = ArrayXf::Constant(Count, KernelWeight);
+				}
+				else
+				{
+					const ArrayXf NormalDot = Center(Features.NormalX) * Tap(Features.NormalX)
+											+ Center(Features.NormalY) * Tap(Features.NormalY)
+											+ Center(Features.NormalZ) * Tap(Features.NormalZ);
+
+					const ArrayXf NormalWeight = (NormalDot > 0).select((NormalDot.max(kWeightEpsilon).log() * Options.NormalSigma).exp(), 0.f);
+
+					const ArrayXf DepthScale = Options.DepthSigma * (Center(Features.DepthGradX).abs() * std::abs(Offset)
+											 + Center(Features.DepthGradY).abs() * std::abs(TapY * static_cast<int>(Step))) + kWeightEpsilon;
+
+					const ArrayXf DepthWeight = (-(Center(Features.Depth) - Tap(Features.Depth)).abs() / DepthScale).exp();
+
+					const ArrayXf CenterLuminance = 0.2126f * Center(Input.Red) + 0.7152f * Center(Input.Green) + 0.0722f * Center(Input.Blue);
+					const ArrayXf TapLuminance = 0.2126f * Tap(Input.Red) + 0.7152f * Tap(Input.Green) + 0.0722f * Tap(Input.Blue);
+
+					const ArrayXf LuminanceWeight = (-(CenterLuminance - TapLuminance).abs()
+												  / (Options.ColorSigma * Center(SmoothVariance).sqrt() + kWeightEpsilon)).exp();
+
+					Weight = KernelWeight * NormalWeight * DepthWeight * LuminanceWeight;
+				}
+
+				SumWeight.segment(Begin, Count) += Weight;
+				SumRed.segment(Begin, Count) += Weight * Tap(Input.Red);
+				SumGreen.segment(Begin, Count) += Weight * Tap(Input.Green);
+				SumBlue.segment(Begin, Count) += Weight * Tap(Input.Blue);
+				SumVariance.segment(Begin, Count) += Weight.square() * Tap(Input.Variance);
+			}
+		}
+
+		Map<ArrayXf>(Output.Red.data() + RowBegin, Width) = SumRed / SumWeight;
+		Map<ArrayXf>(Output.Green.data() + RowBegin, Width) = SumGreen / SumWeight;
+		Map<ArrayXf>(Output.Blue.data() + RowBegin, Width) = SumBlue / SumWeight;
+		Map<ArrayXf>(Output.Variance.data() + RowBegin, Width) = SumVariance / SumWeight.square();
+	}
+
+	// 3x3 Gaussian over the variance, single pixel estimates are too noisy to steer the weights
+	static void SmoothVarianceRow(unsigned Row, unsigned Width, unsigned Height, const std::vector<Float>& Variance, std::vector<Float>& Result)
+	{
+		constexpr Float kGaussian[2] = {0.25f, 0.125f};
+
+		for (unsigned Col = 0; Col < Width; Col++)
+		{
+			Float Sum = 0, SumWeight = 0;
+
+			for (int TapY = -1; TapY <= 1; TapY++)
+			{
+				for (int TapX = -1; TapX <= 1; TapX++)
+				{
+					const int X = static_cast<int>(Col) + TapX;
+					const int Y = static_cast<int>(Row) + TapY;
+
+					if (X < 0 || Y < 0 || X >= static_cast<int>(Width) || Y >= static_cast<int>(Height))
+					{
+						continue;
+					}
+
+					const Float Weight = kGaussian[std::abs(TapX)] * kGaussian[std::abs(TapY)];
+
+					Sum += Weight * Variance[size_t(Y) * Width + X];
+					SumWeight += Weight;
+				}
+			}
+
+			Result[size_t(Row) * Width + Col] = Sum / SumWeight;
+		}
+	}
+
+	void Denoise(Image& aImage, const FeatureBuffers& Features, const DenoiserOptions& Options)
+	{
+		const unsigned Width = aImage.mImageWidth;
+		const unsigned Height = aImage.mImageHeight;
+		const size_t NumPixels = size_t(Width) * Height;
+
+		if (Features.Width != Width || Features.Height != Height || Features.Normals.size() != NumPixels || Features.Albedo.size() != NumPixels
+			|| Features.Depth.size() != NumPixels || Features.Variance.size() != NumPixels)
+		{
+			throw std::logic_error("Feature buffers do not match the image\n");
+		}
+
+		DenoiserFeatures Planar(NumPixels);
+		DenoiserPlanes Current(NumPixels), Next(NumPixels);
+
+		for (size_t Pixel = 0; Pixel < NumPixels; Pixel++)
+		{
+			const Vector3f Albedo = Features.Albedo[Pixel].cwiseMax(kMinAlbedo);
+
+			Current.Red[Pixel] = aImage.mImageData[Pixel].RGB[0] / Albedo.x();
+			Current.Green[Pixel] = aImage.mImageData[Pixel].RGB[1] / Albedo.y();
+			Current.Blue[Pixel] = aImage.mImageData[Pixel].RGB[2] / Albedo.z();
+
+			// variance was measured on the modulated colour
+			const Float AlbedoLuminance = 0.2126f * Albedo.x() + 0.7152f * Albedo.y() + 0.0722f * Albedo.z();
+
+			Current.Variance[Pixel] = Features.Variance[Pixel] / (AlbedoLuminance * AlbedoLuminance);
+
+			Planar.NormalX[Pixel] = Features.Normals[Pixel].x();
+			Planar.NormalY[Pixel] = Features.Normals[Pixel].y();
+			Planar.NormalZ[Pixel] = Features.Normals[Pixel].z();
+			Planar.Depth[Pixel] = Features.Depth[Pixel];
+		}
+
+		for (unsigned Row = 0; Row < Height; Row++)
+		{
+			for (unsigned Col = 0; Col < Width; Col++)
+			{
+				const size_t Left = size_t(Row) * Width + (Col > 0 ? Col - 1 : Col);
+				const size_t Right = size_t(Row) * Width + std::min(Col + 1, Width - 1);
+				const size_t Up = size_t(Row > 0 ? Row - 1 : Row) * Width + Col;
+				const size_t Down = size_t(std::min(Row + 1, Height - 1)) * Width + Col;
+
+				Planar.DepthGradX[size_t(Row) * Width + Col] = 0.5f * (Planar.Depth[Right] - Planar.Depth[Left]);
+				Planar.DepthGradY[size_t(Row) * Width + Col] = 0.5f * (Planar.Depth[Down] - Planar.Depth[Up]);
+			}
+		}
+
+		std::vector<Float> SmoothVariance(NumPixels);
+
+		for (unsigned Iteration = 0; Iteration < Options.Iterations; Iteration++)
+		{
+			const unsigned Step = 1u << Iteration;
+
+			ParallelFor(Height, [&](size_t Row)
+			{
+				SmoothVarianceRow(static_cast<unsigned>(Row), Width, Height, Current.Variance, SmoothVariance);
+			});
+
+			ParallelFor(Height, [&](size_t Row)
+			{
+				FilterRow(static_cast<unsigned>(Row), Step, Width, Height, Options, Planar, Current, SmoothVariance, Next);
+			});
+
+			std::swap(Current, Next);
+		}
+
+		for (size_t Pixel = 0; Pixel < NumPixels; Pixel++)
+		{
+			const Vector3f Albedo = Features.Albedo[Pixel].cwiseMax(kMinAlbedo);
+
+			aImage.mImageData[Pixel].RGB[0] = Current.Red[Pixel] * Albedo.x();
+			aImage.mImageData[Pixel].RGB[1] = Current.Green[Pixel] * Albedo.y();
+			aImage.mImageData[Pixel].RGB[2] = Current.Blue[Pixel] * Albedo.z();
+		}
+	}
+
+} // namespace PathTracer
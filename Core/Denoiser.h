@@ -0,0 +1,44 @@
+#pragma once
+
+#include <Pch.h>
+#include <Image.h>
+
+namespace PathTracer
+{
+	struct DenoiserOptions
+	{
+		unsigned Iterations = 5;
+		Float ColorSigma = 4;	// in standard deviations of the pixel luminance
+		Float NormalSigma = 128;
+		Float DepthSigma = 1;
+	};
+
+	// First hit features averaged over the pixel samples, plus the variance of
+	// the pixel mean luminance
+	struct FeatureBuffers
+	{
+		FeatureBuffers() = default;
+
+		FeatureBuffers(unsigned Width, unsigned Height);
+
+		FeatureBuffers(const FeatureBuffers&) = delete;
+		FeatureBuffers& operator=(const FeatureBuffers&) = delete;
+
+		FeatureBuffers(FeatureBuffers&&) = default;
+		FeatureBuffers& operator=(FeatureBuffers&&) = default;
+
+		~FeatureBuffers() = default;
+
+		unsigned Width = 0, Height = 0;
+		std::vector<Eigen::Vector3f> Normals;	// zero where nothing was hit
+		std::vector<Eigen::Vector3f> Albedo;
+		std::vector<Float> Depth;
+		std::vector<Float> Variance;
+	};
+
+	// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) with the
+	// variance guided luminance weight of SVGF. Lighting is filtered with the
+	// albedo divided out so texture detail survives
+	void Denoise(Image& aImage, const FeatureBuffers& Features, const DenoiserOptions& Options = {});
+
+} // namespace PathTracer
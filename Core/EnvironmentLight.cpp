@@ -0,0 +1,209 @@
+#include <EnvironmentLight.h>
+#include <Light.h>
+#include <Parallel.h>
+
+using namespace Eigen;
+
+namespace PathTracer
+{
+	AliasTable::AliasTable(const Float* pWeights, size_t Count)
+	: mEntries(Count)
+	{
+		double Total = 0;
+
+		for (size_t Index = 0; Index < Count; Index++)
+		{
+			Total += std::max<Float>(0, pWeights[Index]);
+		}
+
+		mTotalWeight = static_cast<Float>(Total);
+
+		if (Total <= 0)
+		{
+			return;
+		}
+
+		std::vector<unsigned> Small, Large;
+		std::vector<double> Scaled(Count);
+
+		for (size_t Index = 0; Index < Count; Index++)
+		{
+			const double Pmf = std::max<Float>(0, pWeights[Index]) / Total;
+
+			mEntries[Index].Pmf = static_cast<Float>(Pmf);
+			Scaled[Index] = Pmf * Count;
+
+			(Scaled[Index] < 1 ? Small : Large).push_back(static_cast<unsigned>(Index));
+		}
+
+		while (!Small.empty() && !Large.empty())
+		{
+			const unsigned Under = Small.back();
+			const unsigned Over = Large.back();
+
+			Small.pop_back();
+
+			mEntries[Under].Threshold = static_cast<Float>(Scaled[Under]);
+			mEntries[Under].Alias = Over;
+
+			// the large entry fills the rest of the small one's slot
+			Scaled[Over] -= 1 - Scaled[Under];
+
+			if (Scaled[Over] < 1)
+			{
+				Large.pop_back();
+				Small.push_back(Over);
+			}
+		}
+
+		// what is left is 1 up to rounding
+		for (unsigned Index : Small)
+		{
+			mEntries[Index].Threshold = 1;
+			mEntries[Index].Alias = Index;
+		}
+
+		for (unsigned Index : Large)
+		{
+			mEntries[Index].Threshold = 1;
+			mEntries[Index].Alias = Index;
+		}
+	}
+
+	unsigned AliasTable::Sample(Float U, Float& Pmf, Float& Remapped) const
+	{
+		const Float Scaled = U * mEntries.size();
+		const unsigned Index = std::min(static_cast<unsigned>(Scaled), static_cast<unsigned>(mEntries.size() - 1));
+		const Float Offset = Scaled - Index;
+
+		const Entry& aEntry = mEntries[Index];
+		unsigned Picked = Index;
+
+		if (Offset < aEntry.Threshold)
+		{
+			Remapped = Offset / aEntry.Threshold;
+		}
+		else
+		{
+			Picked = aEntry.Alias;
+			Remapped = (Offset - aEntry.Threshold) / (1 - aEntry.Threshold);
+		}
+
+		Remapped = std::min(Remapped, 0x1.fffffep-1f);
+		Pmf = mEntries[Picked].Pmf;
+
+		return Picked;
+	}
+
+	EnvironmentLight::EnvironmentLight(const Texture& Map, Float Scale)
+	: mMap{Map}, mScale{Scale}, mWidth{Map.GetWidth()}, mHeight{Map.GetHeight()}, mRows(Map.GetHeight())
+	{
+		std::vector<Float> RowWeights(mHeight);
+
+		ParallelFor(mHeight, [&](size_t Row)
+		{
+			// texels shrink towards the poles, sin theta at the row centre keeps them in proportion
+			const Float SinTheta = std::sin(kPi * (Row + 0.5f) / mHeight);
+
+			std::vector<Float> Weights(mWidth);
+
+			for (unsigned Col = 0; Col < mWidth; Col++)
+			{
+				Weights[Col] = Luminance(mMap.Texel(0, Col, static_cast<int>(Row))) * SinTheta;
+			}
+
+			mRows[Row] = AliasTable(Weights.data(), Weights.size());
+			RowWeights[Row] = mRows[Row].GetTotalWeight();
+		});
+
+		mMarginal = AliasTable(RowWeights.data(), RowWeights.size());
+	}
+
+	void EnvironmentLight::ToTexel(const Vector3f& Direction, unsigned& X, unsigned& Y) const
+	{
+		const Float Theta = std::acos(std::clamp<Float>(Direction.y(), -1, 1));
+
+		Float Phi = std::atan2(Direction.z(), Direction.x());
+
+		if (Phi < 0)
+		{
+			Phi += k2Pi;
+		}
+
+		X = std::min(static_cast<unsigned>(Phi / k2Pi * mWidth), mWidth - 1);
+		Y = std::min(static_cast<unsigned>(Theta / kPi * mHeight), mHeight - 1);
+	}
+
+	Vector3f EnvironmentLight::Le(const Vector3f& Direction) const
+	{
+		unsigned X, Y;
+		ToTexel(Direction, X, Y);
+
+		// nearest texel, so the radiance is as piecewise constant as the distribution
+		return mScale * mMap.Texel(0, X, Y);
+	}
+
+	bool EnvironmentLight::Sample(const Vector2f& U, EnvironmentSample& Result) const
+	{
+		if (mMarginal.GetTotalWeight() <= 0)
+		{
+			return false;
+		}
+
+		Float RowPmf, ColPmf, V, W;
+
+		const unsigned Row = mMarginal.Sample(U.y(), RowPmf, V);
+		const unsigned Col = mRows[Row].Sample(U.x(), ColPmf, W);
+
+		const Float Theta = kPi * (Row + V) / mHeight;
+		const Float Phi = k2Pi * (Col + W) / mWidth;
+		const Float SinTheta = std::sin(Theta);
+
+		if (SinTheta <= 0 || RowPmf * ColPmf <= 0)
+		{
+			return false;
+		}
+
+		Result.Direction = Vector3f(SinTheta * std::cos(Phi), std::cos(Theta), SinTheta * std::sin(Phi));
+		Result.Radiance = mScale * mMap.Texel(0, Col, Row);
+
+		// texel density over the map, then the lat-long Jacobian 2 pi^2 sin theta
+		Result.Pdf = RowPmf * ColPmf * mWidth * mHeight / (2 * kPi * kPi * SinTheta);
+
+		return true;
+	}
+
+	Float EnvironmentLight::Pdf(const Vector3f& Direction) const
+	{
+		if (mMarginal.GetTotalWeight() <= 0)
+		{
+			return 0;
+		}
+
+		// accurate near the poles, unlike sqrt(1 - y^2)
+		const Float SinTheta = std::sqrt(Direction.x() * Direction.x() + Direction.z() * Direction.z());
+
+		if (SinTheta <= 0)
+		{
+			return 0;
+		}
+
+		unsigned X, Y;
+		ToTexel(Direction, X, Y);
+
+		return mMarginal.GetPmf(Y) * mRows[Y].GetPmf(X) * mWidth * mHeight / (2 * kPi * kPi * SinTheta);
+	}
+
+	size_t EnvironmentLight::GetSizeInBytes() const
+	{
+		size_t Bytes = sizeof(EnvironmentLight) + mMarginal.GetSizeInBytes() + GetVectorBytes(mRows);
+
+		for (const AliasTable& Row : mRows)
+		{
+			Bytes += Row.GetSizeInBytes();
+		}
+
+		return Bytes;
+	}
+
+} // namespace PathTracer
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <Pch.h>
+#include <Constants.h>
+#include <Texture.h>
+#include <Memory.h>
+
+namespace PathTracer
+{
+	// Walker's alias method with Vose's construction, draws an index in constant time
+	class AliasTable
+	{
+	public:
+		AliasTable() = default;
+
+		AliasTable(const Float* pWeights, size_t Count);
+
+		AliasTable(AliasTable&&) = default;
+		AliasTable& operator=(AliasTable&&) = default;
+
+		~AliasTable() = default;
+
+		// U in [0, 1), Remapped is a fresh uniform from what the pick left over
+		unsigned Sample(Float U, Float& Pmf, Float& Remapped) const;
+
+		Float GetPmf(unsigned Index) const { return mEntries[Index].Pmf; }
+
+		Float GetTotalWeight() const { return mTotalWeight; }
+
+		size_t GetSizeInBytes() const { return GetVectorBytes(mEntries); }
+
+	private:
+		struct Entry
+		{
+			Float Threshold;	// keeps the index below it, takes the alias above
+			uint32_t Alias;
+			Float Pmf;
+		};
+
+		std::vector<Entry> mEntries;
+		Float mTotalWeight = 0;
+	};
+
+	struct EnvironmentSample
+	{
+		Eigen::Vector3f Direction;
+		Eigen::Vector3f Radiance;
+		Float Pdf;	// solid angle measure
+	};
+
+	// Infinitely far lat-long map lighting every ray that leaves the scene, Y up.
+	// Texels are sampled with a piecewise constant distribution over the map
+	// weighted by luminance and sin theta, a marginal alias table picks the row
+	// and the row's own table the column
+	class EnvironmentLight
+	{
+	public:
+		EnvironmentLight(const Texture& Map, Float Scale = 1);
+
+		EnvironmentLight(const EnvironmentLight&) = delete;
+		EnvironmentLight& operator=(const EnvironmentLight&) = delete;
+
+		~EnvironmentLight() = default;
+
+		Eigen::Vector3f Le(const Eigen::Vector3f& Direction) const;
+
+		// False when the map is black
+		bool Sample(const Eigen::Vector2f& U, EnvironmentSample& Result) const;
+
+		// What Sample would have produced for Direction, for MIS against BSDF samples
+		Float Pdf(const Eigen::Vector3f& Direction) const;
+
+		size_t GetSizeInBytes() const;
+
+	private:
+		void ToTexel(const Eigen::Vector3f& Direction, unsigned& X, unsigned& Y) const;
+
+		const Texture& mMap;
+		Float mScale;
+		unsigned mWidth, mHeight;
+		AliasTable mMarginal;
+		std::vector<AliasTable> mRows;
+	};
+
+} // namespace PathTracer
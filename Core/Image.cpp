@@ -2,6 +2,11 @@
 
 namespace PathTracer
 {
+	static int GammaEncode(Float Value)
+	{
+		return static_cast<int>(std::pow(std::clamp(Value, 0.f, 1.f), 1.f / 2.2f) * 255);
+	}
+
 	Image::Image(unsigned Width, unsigned Height)
 	: mImageWidth{Width}, mImageHeight{Height}
 	{
@@ -26,15 +31,13 @@ namespace PathTracer
 
 		Output << "P3\n" << mImageWidth << " " << mImageHeight << "\n255\n";
 
-		float GammaCorrection = 1.f / 2.2f;
-
 		std::cout << "Saving File...\n";
 
 		for (size_t i = 0; i < mImageData.size(); i++)
 		{
-			int Red   = static_cast<int>(std::pow(std::clamp(mImageData[i].RGB[0], 0.f, 1.f), GammaCorrection) * 255);
-			int Green = static_cast<int>(std::pow(std::clamp(mImageData[i].RGB[1], 0.f, 1.f), GammaCorrection) * 255);
-			int Blue  = static_cast<int>(std::pow(std::clamp(mImageData[i].RGB[2], 0.f, 1.f), GammaCorrection) * 255);
+			int Red   = GammaEncode(mImageData[i].RGB[0]);
+			int Green = GammaEncode(mImageData[i].RGB[1]);
+			int Blue  = GammaEncode(mImageData[i].RGB[2]);
 
 			Output << Red << " " << Green << " "<< Blue << "\n";
 		}
@@ -44,4 +47,100 @@ namespace PathTracer
 		std::cout << "Saving Completed!\n";
 	}
 
+	ImageStream::ImageStream(std::string_view FileName, unsigned Width, unsigned Height, unsigned WindowRows)
+	: mFile{std::string(FileName), std::ios::binary}, mWindow(std::max(WindowRows, 1u)), mFilled(mWindow.size(), 0),
+	  mEncoded(3 * size_t(Width)), mWidth{Width}, mHeight{Height}
+	{
+		if (mWidth == 0 || mHeight == 0)
+		{
+			throw std::logic_error("Cannot stream image with 0 dimension\n");
+		}
+
+		if (!mFile.is_open())
+		{
+			throw std::runtime_error("Failed to open file output\n");
+		}
+
+		mFile << "P6\n" << mWidth << " " << mHeight << "\n255\n";
+	}
+
+	void ImageStream::WriteRow(unsigned Row, const Pixel* pPixels)
+	{
+		const unsigned WindowRows = static_cast<unsigned>(mWindow.size());
+
+		std::unique_lock<std::mutex> Lock(mMutex);
+
+		mWindowFreed.wait(Lock, [&]() { return Row < mNextRow + WindowRows || mAborted; });
+
+		if (mAborted)
+		{
+			return;
+		}
+
+		mWindow[Row % WindowRows].assign(pPixels, pPixels + mWidth);
+		mFilled[Row % WindowRows] = 1;
+		mPeakBufferedRows = std::max(mPeakBufferedRows, ++mBufferedRows);
+
+		// whoever completes the oldest row writes out the run that follows it
+		const unsigned FirstRow = mNextRow;
+
+		while (mNextRow < mHeight && mFilled[mNextRow % WindowRows])
+		{
+			const std::vector<Pixel>& Pixels = mWindow[mNextRow % WindowRows];
+
+			for (unsigned Col = 0; Col < mWidth; Col++)
+			{
+				for (int Channel = 0; Channel < 3; Channel++)
+				{
+					mEncoded[3 * Col + Channel] = static_cast<unsigned char>(GammaEncode(Pixels[Col].RGB[Channel]));
+				}
+			}
+
+			mFile.write(reinterpret_cast<const char*>(mEncoded.data()), static_cast<std::streamsize>(mEncoded.size()));
+
+			mFilled[mNextRow % WindowRows] = 0;
+			mBufferedRows--;
+			mNextRow++;
+		}
+
+		const bool Advanced = mNextRow != FirstRow;
+
+		Lock.unlock();
+
+		if (Advanced)
+		{
+			mWindowFreed.notify_all();
+		}
+	}
+
+	void ImageStream::Abort()
+	{
+		{
+			std::lock_guard<std::mutex> Lock(mMutex);
+
+			mAborted = true;
+		}
+
+		mWindowFreed.notify_all();
+	}
+
+	void ImageStream::Finish()
+	{
+		std::lock_guard<std::mutex> Lock(mMutex);
+
+		mFile.flush();
+
+		if (mNextRow != mHeight || !mFile)
+		{
+			throw std::runtime_error("Failed to stream every image row\n");
+		}
+	}
+
+	size_t ImageStream::GetPeakBufferedBytes() const
+	{
+		std::lock_guard<std::mutex> Lock(mMutex);
+
+		return size_t(mPeakBufferedRows) * mWidth * sizeof(Pixel);
+	}
+
 } // namespace PathTracer
\ No newline at end of file
@@ -31,5 +31,42 @@ namespace PathTracer
 		unsigned mImageWidth, mImageHeight;
 	};
 
+	// Binary PPM written row by row while the rows finish in any order. Rows
+	// ahead of the oldest unwritten one wait in a window of WindowRows, a
+	// producer further ahead blocks, so memory depends on the window, not the height
+	class ImageStream
+	{
+	public:
+		ImageStream(std::string_view FileName, unsigned Width, unsigned Height, unsigned WindowRows);
+
+		ImageStream(const ImageStream&) = delete;
+		ImageStream& operator=(const ImageStream&) = delete;
+
+		~ImageStream() = default;
+
+		// pPixels holds Width pixels
+		void WriteRow(unsigned Row, const Pixel* pPixels);
+
+		// Releases every blocked producer, for a render that failed
+		void Abort();
+
+		// Throws unless every row was written
+		void Finish();
+
+		size_t GetPeakBufferedBytes() const;
+
+	private:
+		mutable std::mutex mMutex;
+		std::condition_variable mWindowFreed;
+		std::ofstream mFile;
+		std::vector<std::vector<Pixel>> mWindow;	// slot Row % WindowRows
+		std::vector<char> mFilled;
+		std::vector<unsigned char> mEncoded;
+		unsigned mWidth, mHeight;
+		unsigned mNextRow = 0;
+		unsigned mBufferedRows = 0, mPeakBufferedRows = 0;
+		bool mAborted = false;
+	};
+
 } // namespace PathTracer
 
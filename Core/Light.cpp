@@ -0,0 +1,466 @@
+#include <Light.h>
+#include <Scene.h>
+
+using namespace Eigen;
+
+namespace PathTracer
+{
+	PowerLightSampler::PowerLightSampler(const std::vector<EmissiveTriangle>& Emitters)
+	{
+		mCdf.reserve(Emitters.size());
+
+		for (const auto& Emitter : Emitters)
+		{
+			mTotalPower += Emitter.Power;
+			mCdf.push_back(mTotalPower);
+		}
+	}
+
+	int PowerLightSampler::Select(const Vector3f& Point, const Vector3f& Normal, Float U, Float& Pmf) const
+	{
+		if (mCdf.empty() || mTotalPower <= 0)
+		{
+			return -1;
+		}
+
+		const auto Found = std::upper_bound(mCdf.begin(), mCdf.end(), U * mTotalPower);
+		const unsigned LightIndex = static_cast<unsigned>(std::min<ptrdiff_t>(Found - mCdf.begin(), mCdf.size() - 1));
+
+		Pmf = SelectionPmf(Point, Normal, LightIndex);
+
+		return static_cast<int>(LightIndex);
+	}
+
+	Float PowerLightSampler::SelectionPmf(const Vector3f&, const Vector3f&, unsigned LightIndex) const
+	{
+		const Float Previous = LightIndex == 0 ? 0 : mCdf[LightIndex - 1];
+
+		return (mCdf[LightIndex] - Previous) / mTotalPower;
+	}
+
+	constexpr unsigned kLightBvhBuckets = 12;
+	constexpr unsigned kLightBvhMaxSaohDepth = 32; // deeper nodes split by count so bit trails fit 64 bits
+
+	// cos(max(0, A - B)) from the sines and cosines of both angles
+	static Float CosSubClamped(Float SinA, Float CosA, Float SinB, Float CosB)
+	{
+		return CosA > CosB ? 1 : CosA * CosB + SinA * SinB;
+	}
+
+	static Float SinSubClamped(Float SinA, Float CosA, Float SinB, Float CosB)
+	{
+		return CosA > CosB ? 0 : SinA * CosB - CosA * SinB;
+	}
+
+	static Float SafeSqrt(Float Value)
+	{
+		return std::sqrt(std::max<Float>(0, Value));
+	}
+
+	static Float SafeAcos(Float Value)
+	{
+		return std::acos(std::clamp<Float>(Value, -1, 1));
+	}
+
+	static void UnionCone(const Vector3f& AxisA, Float CosA, const Vector3f& AxisB, Float CosB, Vector3f& Axis, Float& CosTheta)
+	{
+		const Float ThetaA = SafeAcos(CosA);
+		const Float ThetaB = SafeAcos(CosB);
+		const Float ThetaD = SafeAcos(AxisA.dot(AxisB));
+
+		if (std::min(ThetaD + ThetaB, kPi) <= ThetaA)
+		{
+			Axis = AxisA;
+			CosTheta = CosA;
+
+			return;
+		}
+
+		if (std::min(ThetaD + ThetaA, kPi) <= ThetaB)
+		{
+			Axis = AxisB;
+			CosTheta = CosB;
+
+			return;
+		}
+
+		const Float ThetaO = (ThetaA + ThetaD + ThetaB) / 2;
+		const Vector3f RotationAxis = AxisA.cross(AxisB);
+
+		if (ThetaO >= kPi || RotationAxis.squaredNorm() == 0)
+		{
+			Axis = AxisA;
+			CosTheta = -1;
+
+			return;
+		}
+
+		Axis = (AngleAxisf(ThetaO - ThetaA, RotationAxis.normalized()) * AxisA).normalized();
+		CosTheta = std::cos(ThetaO);
+	}
+
+	static LightBounds Union(const LightBounds& A, const LightBounds& B)
+	{
+		if (A.Power == 0)
+		{
+			return B;
+		}
+
+		if (B.Power == 0)
+		{
+			return A;
+		}
+
+		LightBounds Result;
+
+		Result.MinBound = A.MinBound.cwiseMin(B.MinBound);
+		Result.MaxBound = A.MaxBound.cwiseMax(B.MaxBound);
+		Result.CosThetaE = std::min(A.CosThetaE, B.CosThetaE);
+		Result.Power = A.Power + B.Power;
+
+		UnionCone(A.Axis, A.CosThetaO, B.Axis, B.CosThetaO, Result.Axis, Result.CosThetaO);
+
+		return Result;
+	}
+
+	// Orientation measure times area, the cost of a node for the SAOH
+	static Float OrientedCost(const LightBounds& Bounds)
+	{
+		if (Bounds.Power == 0)
+		{
+			return 0;
+		}
+
+		const Float ThetaO = SafeAcos(Bounds.CosThetaO);
+		const Float ThetaE = SafeAcos(Bounds.CosThetaE);
+		const Float ThetaW = std::min(ThetaO + ThetaE, kPi);
+		const Float SinThetaO = SafeSqrt(1 - Bounds.CosThetaO * Bounds.CosThetaO);
+
+		const Float MOmega = k2Pi * (1 - Bounds.CosThetaO)
+			+ kPi / 2 * (2 * ThetaW * SinThetaO - std::cos(ThetaO - 2 * ThetaW) - 2 * ThetaO * SinThetaO + Bounds.CosThetaO);
+
+		const Vector3f Extent = Bounds.MaxBound - Bounds.MinBound;
+		const Float Area = 2 * (Extent.x() * Extent.y() + Extent.x() * Extent.z() + Extent.y() * Extent.z());
+
+		return Bounds.Power * MOmega * Area;
+	}
+
+	LightBvh::LightBvh(const std::vector<EmissiveTriangle>& Emitters)
+	{
+		std::vector<BuildEntry> Entries;
+		Entries.reserve(Emitters.size());
+
+		for (unsigned Index = 0; Index < Emitters.size(); Index++)
+		{
+			LightBounds Bounds = CalcEmitterBounds(Emitters[Index]);
+
+			if (Bounds.Power > 0)
+			{
+				Entries.emplace_back(Index, Bounds);
+			}
+		}
+
+		mBitTrails.assign(Emitters.size(), 0);
+
+		if (!Entries.empty())
+		{
+			mNodes.reserve(2 * Entries.size() - 1);
+
+			BuildNode(Entries, 0, Entries.size(), 0, 0);
+		}
+	}
+
+	LightBounds LightBvh::CalcEmitterBounds(const EmissiveTriangle& Emitter)
+	{
+		const Triangle& aTriangle = *Emitter.pTriangle;
+
+		const Vector3f V0 = aTriangle.GetPosition(0);
+		const Vector3f V1 = aTriangle.GetPosition(1);
+		const Vector3f V2 = aTriangle.GetPosition(2);
+
+		const Vector3f Normal = (V1 - V0).cross(V2 - V0);
+
+		LightBounds Bounds;
+
+		if (Normal.squaredNorm() == 0)
+		{
+			return Bounds;
+		}
+
+		Bounds.MinBound = V0.cwiseMin(V1).cwiseMin(V2);
+		Bounds.MaxBound = V0.cwiseMax(V1).cwiseMax(V2);
+		Bounds.Axis = Normal.normalized();
+		Bounds.CosThetaO = 1;
+		Bounds.CosThetaE = 0;
+		Bounds.Power = Emitter.Power;
+
+		return Bounds;
+	}
+
+	unsigned LightBvh::BuildNode(std::vector<BuildEntry>& Entries, size_t Begin, size_t End, uint64_t BitTrail, unsigned Depth)
+	{
+		const unsigned NodeIndex = static_cast<unsigned>(mNodes.size());
+
+		mNodes.emplace_back();
+
+		if (End - Begin == 1)
+		{
+			mNodes[NodeIndex] = {Entries[Begin].second, Entries[Begin].first, true};
+			mBitTrails[Entries[Begin].first] = BitTrail;
+
+			return NodeIndex;
+		}
+
+		LightBounds NodeBounds;
+		Vector3f CentroidMin = Vector3f::Constant(kInfinity);
+		Vector3f CentroidMax = Vector3f::Constant(-kInfinity);
+
+		for (size_t Index = Begin; Index < End; Index++)
+		{
+			NodeBounds = Union(NodeBounds, Entries[Index].second);
+
+			CentroidMin = CentroidMin.cwiseMin(Entries[Index].second.GetCentroid());
+			CentroidMax = CentroidMax.cwiseMax(Entries[Index].second.GetCentroid());
+		}
+
+		const Vector3f Extent = NodeBounds.MaxBound - NodeBounds.MinBound;
+		const Vector3f CentroidExtent = CentroidMax - CentroidMin;
+
+		Float BestCost = kInfinity;
+		int BestAxis = -1;
+		unsigned BestBucket = 0;
+
+		for (int Axis = 0; Axis < 3 && Depth < kLightBvhMaxSaohDepth; Axis++)
+		{
+			if (CentroidExtent[Axis] <= 0)
+			{
+				continue;
+			}
+
+			auto BucketOf = [&](const LightBounds& Bounds)
+			{
+				const Float Offset = (Bounds.GetCentroid()[Axis] - CentroidMin[Axis]) / CentroidExtent[Axis];
+
+				return std::min(static_cast<unsigned>(Offset * kLightBvhBuckets), kLightBvhBuckets - 1);
+			};
+
+			std::array<LightBounds, kLightBvhBuckets> Buckets;
+
+			for (size_t Index = Begin; Index < End; Index++)
+			{
+				const unsigned Bucket = BucketOf(Entries[Index].second);
+
+				Buckets[Bucket] = Union(Buckets[Bucket], Entries[Index].second);
+			}
+
+			// thin boxes are penalised so splits favour the long axis
+			const Float Regularization = Extent.maxCoeff() / std::max(Extent[Axis], kEpsilon);
+
+			for (unsigned Split = 1; Split < kLightBvhBuckets; Split++)
+			{
+				LightBounds Below, Above;
+
+				for (unsigned Bucket = 0; Bucket < Split; Bucket++)
+				{
+					Below = Union(Below, Buckets[Bucket]);
+				}
+
+				for (unsigned Bucket = Split; Bucket < kLightBvhBuckets; Bucket++)
+				{
+					Above = Union(Above, Buckets[Bucket]);
+				}
+
+				if (Below.Power == 0 || Above.Power == 0)
+				{
+					continue;
+				}
+
+				const Float Cost = Regularization * (OrientedCost(Below) + OrientedCost(Above));
+
+				if (Cost < BestCost)
+				{
+					BestCost = Cost;
+					BestAxis = Axis;
+					BestBucket = Split;
+				}
+			}
+		}
+
+		size_t Middle;
+
+		if (BestAxis >= 0)
+		{
+			const auto Split = std::partition(Entries.begin() + Begin, Entries.begin() + End, [&](const BuildEntry& Entry)
+			{
+				const Float Offset = (Entry.second.GetCentroid()[BestAxis] - CentroidMin[BestAxis]) / CentroidExtent[BestAxis];
+
+				return std::min(static_cast<unsigned>(Offset * kLightBvhBuckets), kLightBvhBuckets - 1) < BestBucket;
+			});
+
+			Middle = Split - Entries.begin();
+		}
+		else
+		{
+			// coincident centroids or too deep, halve by count along the widest axis
+			int Axis = 0;
+			CentroidExtent.maxCoeff(&Axis);
+
+			Middle = (Begin + End) / 2;
+
+			std::nth_element(Entries.begin() + Begin, Entries.begin() + Middle, Entries.begin() + End, [Axis](const BuildEntry& A, const BuildEntry& B)
+			{
+				return A.second.GetCentroid()[Axis] < B.second.GetCentroid()[Axis];
+			});
+		}
+
+		BuildNode(Entries, Begin, Middle, BitTrail, Depth + 1);
+
+		const unsigned RightChild = BuildNode(Entries, Middle, End, BitTrail | (uint64_t(1) << Depth), Depth + 1);
+
+		mNodes[NodeIndex] = {NodeBounds, RightChild, false};
+
+		return NodeIndex;
+	}
+
+	Float LightBvh::Importance(const LightBounds& Bounds, const Vector3f& Point, const Vector3f& Normal)
+	{
+		if (Bounds.Power == 0)
+		{
+			return 0;
+		}
+
+		const Vector3f Centroid = Bounds.GetCentroid();
+		const Float HalfDiagonal = 0.5f * (Bounds.MaxBound - Bounds.MinBound).norm();
+
+		// clamped as in pbrt-v4, a squared half diagonal flattens big nearby nodes too much
+		const Float DistanceSq = std::max((Point - Centroid).squaredNorm(), HalfDiagonal);
+
+		const Vector3f ToPoint = (Point - Centroid).normalized();
+
+		const Float CosThetaW = std::abs(Bounds.Axis.dot(ToPoint));
+		const Float SinThetaW = SafeSqrt(1 - CosThetaW * CosThetaW);
+
+		// half angle of the cone from the point that holds the bounding sphere
+		Float CosThetaB = -1;
+
+		if ((Point - Centroid).squaredNorm() > HalfDiagonal * HalfDiagonal)
+		{
+			CosThetaB = SafeSqrt(1 - HalfDiagonal * HalfDiagonal / (Point - Centroid).squaredNorm());
+		}
+
+		const Float SinThetaB = SafeSqrt(1 - CosThetaB * CosThetaB);
+		const Float SinThetaO = SafeSqrt(1 - Bounds.CosThetaO * Bounds.CosThetaO);
+
+		const Float CosThetaX = CosSubClamped(SinThetaW, CosThetaW, SinThetaO, Bounds.CosThetaO);
+		const Float SinThetaX = SinSubClamped(SinThetaW, CosThetaW, SinThetaO, Bounds.CosThetaO);
+		const Float CosThetaP = CosSubClamped(SinThetaX, CosThetaX, SinThetaB, CosThetaB);
+
+		if (CosThetaP <= Bounds.CosThetaE)
+		{
+			return 0;
+		}
+
+		Float Result = Bounds.Power * CosThetaP / DistanceSq;
+
+		if (Normal.squaredNorm() > 0)
+		{
+			const Float CosThetaI = -ToPoint.dot(Normal);
+			const Float SinThetaI = SafeSqrt(1 - CosThetaI * CosThetaI);
+
+			Result *= std::max<Float>(0, CosSubClamped(SinThetaI, CosThetaI, SinThetaB, CosThetaB));
+		}
+
+		return Result;
+	}
+
+	int LightBvh::Select(const Vector3f& Point, const Vector3f& Normal, Float U, Float& Pmf) const
+	{
+		if (mNodes.empty())
+		{
+			return -1;
+		}
+
+		unsigned NodeIndex = 0;
+		Pmf = 1;
+
+		while (!mNodes[NodeIndex].IsLeaf)
+		{
+			const unsigned Left = NodeIndex + 1;
+			const unsigned Right = mNodes[NodeIndex].Index;
+
+			const Float LeftImportance = Importance(mNodes[Left].Bounds, Point, Normal);
+			const Float RightImportance = Importance(mNodes[Right].Bounds, Point, Normal);
+
+			if (LeftImportance == 0 && RightImportance == 0)
+			{
+				return -1;
+			}
+
+			const Float LeftProbability = LeftImportance / (LeftImportance + RightImportance);
+
+			if (U < LeftProbability)
+			{
+				NodeIndex = Left;
+				U = std::min(U / LeftProbability, 0x1.fffffep-1f);
+				Pmf *= LeftProbability;
+			}
+			else
+			{
+				NodeIndex = Right;
+				U = std::min((U - LeftProbability) / (1 - LeftProbability), 0x1.fffffep-1f);
+				Pmf *= 1 - LeftProbability;
+			}
+		}
+
+		if (NodeIndex == 0 && Importance(mNodes[0].Bounds, Point, Normal) == 0)
+		{
+			return -1;
+		}
+
+		return static_cast<int>(mNodes[NodeIndex].Index);
+	}
+
+	Float LightBvh::SelectionPmf(const Vector3f& Point, const Vector3f& Normal, unsigned LightIndex) const
+	{
+		if (mNodes.empty() || LightIndex >= mBitTrails.size())
+		{
+			return 0;
+		}
+
+		uint64_t BitTrail = mBitTrails[LightIndex];
+		unsigned NodeIndex = 0;
+		Float Pmf = 1;
+
+		while (!mNodes[NodeIndex].IsLeaf)
+		{
+			const unsigned Left = NodeIndex + 1;
+			const unsigned Right = mNodes[NodeIndex].Index;
+
+			const Float LeftImportance = Importance(mNodes[Left].Bounds, Point, Normal);
+			const Float RightImportance = Importance(mNodes[Right].Bounds, Point, Normal);
+
+			if (LeftImportance == 0 && RightImportance == 0)
+			{
+				return 0;
+			}
+
+			const bool GoRight = BitTrail & 1;
+
+			Pmf *= (GoRight ? RightImportance : LeftImportance) / (LeftImportance + RightImportance);
+			NodeIndex = GoRight ? Right : Left;
+			BitTrail >>= 1;
+		}
+
+		return mNodes[NodeIndex].Index == LightIndex ? Pmf : 0;
+	}
+
+	Vector3f SampleTriangle(const Triangle& aTriangle, const Vector2f& Sample)
+	{
+		const Float SqrtU = std::sqrt(Sample.x());
+		const Float B0 = 1 - SqrtU;
+		const Float B1 = Sample.y() * SqrtU;
+
+		return B0 * aTriangle.GetPosition(0) + B1 * aTriangle.GetPosition(1) + (1 - B0 - B1) * aTriangle.GetPosition(2);
+	}
+
+} // namespace PathTracer
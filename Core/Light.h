@@ -0,0 +1,128 @@
+#pragma once
+
+#include <Pch.h>
+#include <Shape.h>
+#include <Constants.h>
+#include <Memory.h>
+
+namespace PathTracer
+{
+	inline Float Luminance(const Eigen::Vector3f& RGB)
+	{
+		return 0.2126f * RGB.x() + 0.7152f * RGB.y() + 0.0722f * RGB.z();
+	}
+
+	enum class LightSamplerType
+	{
+		Power = 1,
+		Bvh = 2,
+	};
+
+	struct EmissiveTriangle
+	{
+		const Triangle* pTriangle;
+		Eigen::Vector3f Emission;
+		Float Power;
+	};
+
+	struct LightSample
+	{
+		Eigen::Vector3f Position;
+		Eigen::Vector3f Normal;
+		Eigen::Vector3f Emission;
+		Float Pdf; // area measure, includes the selection probability
+	};
+
+	class ILightSampler
+	{
+	public:
+		ILightSampler() = default;
+
+		ILightSampler(const ILightSampler&) = delete;
+		ILightSampler& operator=(const ILightSampler&) = delete;
+
+		virtual ~ILightSampler() = default;
+
+		// Picks an emitter for the shading point, returns -1 when there is nothing to pick
+		virtual int Select(const Eigen::Vector3f& Point, const Eigen::Vector3f& Normal, Float U, Float& Pmf) const = 0;
+
+		virtual Float SelectionPmf(const Eigen::Vector3f& Point, const Eigen::Vector3f& Normal, unsigned LightIndex) const = 0;
+
+		virtual size_t GetSizeInBytes() const = 0;
+	};
+
+	// Selects emitters proportionally to their power, independent of the shading point
+	class PowerLightSampler : public ILightSampler
+	{
+	public:
+		PowerLightSampler(const std::vector<EmissiveTriangle>& Emitters);
+
+		int Select(const Eigen::Vector3f& Point, const Eigen::Vector3f& Normal, Float U, Float& Pmf) const override;
+
+		Float SelectionPmf(const Eigen::Vector3f& Point, const Eigen::Vector3f& Normal, unsigned LightIndex) const override;
+
+		size_t GetSizeInBytes() const override { return GetVectorBytes(mCdf); }
+
+		~PowerLightSampler() = default;
+
+	private:
+		std::vector<Float> mCdf;
+		Float mTotalPower = 0;
+	};
+
+	// Spatial bounds, emission direction cone and power of a group of emitters.
+	// Emitters are two-sided, so the cone is tested against both orientations
+	struct LightBounds
+	{
+		Eigen::Vector3f MinBound = Eigen::Vector3f::Constant(kInfinity);
+		Eigen::Vector3f MaxBound = Eigen::Vector3f::Constant(-kInfinity);
+		Eigen::Vector3f Axis = Eigen::Vector3f::UnitZ();
+		Float CosThetaO = 1;	// spread of the normals around Axis
+		Float CosThetaE = 0;	// emission falloff past the normals, diffuse emitters reach 90 degrees
+		Float Power = 0;
+
+		Eigen::Vector3f GetCentroid() const { return 0.5f * (MinBound + MaxBound); }
+	};
+
+	struct LightBvhNode
+	{
+		LightBounds Bounds;
+		unsigned Index;			// second child for inner nodes, emitter for leaves
+		bool IsLeaf;
+	};
+
+	// Light hierarchy after Conty Estevez and Kulla, built with the surface area
+	// orientation heuristic. Selection walks down choosing children by their
+	// estimated contribution to the shading point
+	class LightBvh : public ILightSampler
+	{
+	public:
+		LightBvh(const std::vector<EmissiveTriangle>& Emitters);
+
+		int Select(const Eigen::Vector3f& Point, const Eigen::Vector3f& Normal, Float U, Float& Pmf) const override;
+
+		Float SelectionPmf(const Eigen::Vector3f& Point, const Eigen::Vector3f& Normal, unsigned LightIndex) const override;
+
+		static LightBounds CalcEmitterBounds(const EmissiveTriangle& Emitter);
+
+		static Float Importance(const LightBounds& Bounds, const Eigen::Vector3f& Point, const Eigen::Vector3f& Normal);
+
+		const std::vector<LightBvhNode>& GetNodes() const { return mNodes; }
+
+		size_t GetSizeInBytes() const override { return GetVectorBytes(mNodes) + GetVectorBytes(mBitTrails); }
+
+		~LightBvh() = default;
+
+	private:
+		using BuildEntry = std::pair<unsigned, LightBounds>;
+
+		unsigned BuildNode(std::vector<BuildEntry>& Entries, size_t Begin, size_t End, uint64_t BitTrail, unsigned Depth);
+
+		std::vector<LightBvhNode> mNodes;
+		std::vector<uint64_t> mBitTrails; // per emitter, bit n set means the right child at depth n
+	};
+
+	// Uniform point on a triangle, Barycentrics after Shirley and Chiu
+	Eigen::Vector3f SampleTriangle(const Triangle& aTriangle, const Eigen::Vector2f& Sample);
+
+} // namespace PathTracer
@@ -0,0 +1,560 @@
+#include <Lod.h>
+#include <Scene.h>
+#include <Parallel.h>
+
+using namespace Eigen;
+
+namespace PathTracer
+{
+	// past this many cells per axis the grid key runs out of bits
+	constexpr uint32_t kMaxCellCoordinate = (1u << 21) - 1;
+
+	struct LodLevel
+	{
+		TriangleMesh Mesh;
+		Float CellSize = 0;
+		std::once_flag BuildFlag;
+		std::atomic<bool> IsBuilt = false;
+		std::vector<Triangle*> pTriangles;
+		std::unique_ptr<Bvh> pBvh;
+	};
+
+	// Sums of one grid cell, the quadric is kept as its normal equations
+	struct VertexCluster
+	{
+		Matrix3d A = Matrix3d::Zero();
+		Vector3d B = Vector3d::Zero();
+		Vector3d PositionSum = Vector3d::Zero();
+		Vector3f NormalSum = Vector3f::Zero();
+		Vector2f TexCoordSum = Vector2f::Zero();
+		Vector3f CellMin;
+		unsigned NumVertices = 0;
+		unsigned NewIndex = ~0u;
+	};
+
+	// Where the ray enters the bounds, 0 when it starts inside
+	static Float CalcEntryDistance(const Aabb& Bounds, const Ray& aRay)
+	{
+		const Vector3f Near = (Bounds.Bounds[0] - aRay.Origin).cwiseProduct(aRay.InvDirection);
+		const Vector3f Far = (Bounds.Bounds[1] - aRay.Origin).cwiseProduct(aRay.InvDirection);
+
+		const Float Entry = Near.cwiseMin(Far).maxCoeff();
+
+		return std::isfinite(Entry) ? std::max(Entry, 0.f) : 0;
+	}
+
+	// The point of least quadric error, solved around the cluster mean with the
+	// eigen directions that are too flat to say anything dropped (Lindstrom 2000)
+	static Vector3f PlaceClusterVertex(const VertexCluster& Cluster, Float CellSize)
+	{
+		const Vector3d Mean = Cluster.PositionSum / Cluster.NumVertices;
+
+		SelfAdjointEigenSolver<Matrix3d> Solver(Cluster.A);
+
+		const Vector3d Residual = -Cluster.B - Cluster.A * Mean;
+		const double Threshold = 1e-3 * Solver.eigenvalues().cwiseAbs().maxCoeff();
+
+		Vector3d Position = Mean;
+
+		for (int Axis = 0; Axis < 3; Axis++)
+		{
+			const double Eigenvalue = Solver.eigenvalues()[Axis];
+
+			if (Eigenvalue > Threshold && Eigenvalue > 0)
+			{
+				const Vector3d Direction = Solver.eigenvectors().col(Axis);
+
+				Position += Direction * (Direction.dot(Residual) / Eigenvalue);
+			}
+		}
+
+		// a vertex outside its cell would stretch the surface past the level's error
+		const Vector3f CellMax = Cluster.CellMin + Vector3f::Constant(CellSize);
+
+		return Position.cast<float>().cwiseMax(Cluster.CellMin).cwiseMin(CellMax);
+	}
+
+	// LodMesh
+	LodMesh::LodMesh(TriangleMesh FullMesh, const LodOptions& Options, bool CompressVertices)
+	: mOptions{Options}
+	{
+		if (FullMesh.GetTriangles().empty())
+		{
+			throw std::logic_error("Level of detail mesh needs at least one triangle\n");
+		}
+
+		mLevels.push_back(std::make_unique<LodLevel>());
+		mLevels[0]->Mesh = std::move(FullMesh);
+
+		const TriangleMesh& Source = mLevels[0]->Mesh;
+		const std::vector<Triangle>& Triangles = Source.GetTriangles();
+
+		Float EdgeLengthSum = 0;
+
+		for (const auto& aTriangle : Triangles)
+		{
+			for (unsigned Corner = 0; Corner < 3; Corner++)
+			{
+				mBounds.GrowBy(aTriangle.GetPosition(Corner));
+
+				EdgeLengthSum += (aTriangle.GetPosition((Corner + 1) % 3) - aTriangle.GetPosition(Corner)).norm();
+			}
+		}
+
+		const Float MaxExtent = mBounds.GetExtent().maxCoeff();
+		const unsigned NumVertices = static_cast<unsigned>(Source.IsCompressed() ? Source.mCompressedVertices.size() : Source.mVertices.size());
+
+		// cells twice the mean edge merge about four triangles into one
+		Float CellSize = 2 * EdgeLengthSum / (3 * Triangles.size());
+
+		while (mLevels.size() <= mOptions.MaxLevels && CellSize > 0 && CellSize < MaxExtent)
+		{
+			std::unordered_map<uint64_t, unsigned> CellClusters;
+			std::vector<VertexCluster> Clusters;
+			std::vector<unsigned> VertexClusters(NumVertices);
+
+			for (unsigned Index = 0; Index < NumVertices; Index++)
+			{
+				const Vector3f Position = Source.GetPosition(Index);
+				const Vector3f Cell = ((Position - mBounds.Bounds[0]) / CellSize).array().floor();
+
+				uint64_t Key = 0;
+
+				for (int Axis = 0; Axis < 3; Axis++)
+				{
+					Key |= uint64_t(std::clamp(Cell[Axis], 0.f, Float(kMaxCellCoordinate))) << (21 * Axis);
+				}
+
+				const auto [Found, Inserted] = CellClusters.emplace(Key, static_cast<unsigned>(Clusters.size()));
+
+				if (Inserted)
+				{
+					Clusters.emplace_back().CellMin = mBounds.Bounds[0] + Cell.cwiseMax(0) * CellSize;
+				}
+
+				VertexCluster& Cluster = Clusters[Found->second];
+
+				Cluster.PositionSum += Position.cast<double>();
+				Cluster.NormalSum += Source.GetNormal(Index).normalized();
+				Cluster.TexCoordSum += Source.GetTexCoord(Index);
+				Cluster.NumVertices++;
+
+				VertexClusters[Index] = Found->second;
+			}
+
+			// every face plane goes to the clusters of its corners, weighted by area
+			for (const auto& aTriangle : Triangles)
+			{
+				const Vector3f V0 = aTriangle.GetPosition(0);
+				const Vector3f Cross = (aTriangle.GetPosition(1) - V0).cross(aTriangle.GetPosition(2) - V0);
+				const Float DoubleArea = Cross.norm();
+
+				if (DoubleArea <= 0)
+				{
+					continue;
+				}
+
+				const Vector3d Normal = (Cross / DoubleArea).cast<double>();
+				const double Distance = -Normal.dot(V0.cast<double>());
+				const double Weight = 0.5 * DoubleArea;
+
+				for (unsigned Corner = 0; Corner < 3; Corner++)
+				{
+					VertexCluster& Cluster = Clusters[VertexClusters[aTriangle.Indices[Corner]]];
+
+					Cluster.A += Weight * Normal * Normal.transpose();
+					Cluster.B += Weight * Distance * Normal;
+				}
+			}
+
+			// faces whose corners share a cluster vanish, so do faces repeated in another order
+			std::vector<std::array<unsigned, 6>> Faces;
+			Faces.reserve(Triangles.size() / 2);
+
+			for (const auto& aTriangle : Triangles)
+			{
+				const unsigned C0 = VertexClusters[aTriangle.Indices[0]];
+				const unsigned C1 = VertexClusters[aTriangle.Indices[1]];
+				const unsigned C2 = VertexClusters[aTriangle.Indices[2]];
+
+				if (C0 == C1 || C1 == C2 || C2 == C0)
+				{
+					continue;
+				}
+
+				std::array<unsigned, 3> Sorted = { C0, C1, C2 };
+				std::sort(Sorted.begin(), Sorted.end());
+
+				Faces.push_back({ Sorted[0], Sorted[1], Sorted[2], C0, C1, C2 });
+			}
+
+			std::sort(Faces.begin(), Faces.end());
+
+			Faces.erase(std::unique(Faces.begin(), Faces.end(), [](const auto& A, const auto& B)
+			{
+				return A[0] == B[0] && A[1] == B[1] && A[2] == B[2];
+			}), Faces.end());
+
+			const size_t PreviousTriangles = mLevels.back()->Mesh.GetTriangles().size();
+
+			if (Faces.empty() || Faces.size() > mOptions.MinReduction * PreviousTriangles)
+			{
+				break;
+			}
+
+			std::vector<Vertex> Vertices;
+			std::vector<Vector2f> TexCoords;
+			std::vector<unsigned> Indices;
+			Indices.reserve(3 * Faces.size());
+
+			for (const auto& Face : Faces)
+			{
+				for (unsigned Corner = 3; Corner < 6; Corner++)
+				{
+					VertexCluster& Cluster = Clusters[Face[Corner]];
+
+					if (Cluster.NewIndex == ~0u)
+					{
+						Cluster.NewIndex = static_cast<unsigned>(Vertices.size());
+
+						Vertices.push_back({ PlaceClusterVertex(Cluster, CellSize), Vector3f::Zero() });
+						TexCoords.push_back(Cluster.TexCoordSum / static_cast<Float>(Cluster.NumVertices));
+					}
+
+					Indices.push_back(Cluster.NewIndex);
+				}
+			}
+
+			auto NewLevel = std::make_unique<LodLevel>();
+			NewLevel->CellSize = CellSize;
+			NewLevel->Mesh.mVertices = std::move(Vertices);
+			NewLevel->Mesh.mIndices = std::move(Indices);
+			NewLevel->Mesh.mMaterialIndex = Source.GetMaterialIndex();
+
+			// normals of both sides of a collapsed sheet cancel, the new faces decide those
+			NewLevel->Mesh.GenerateNormals();
+
+			for (const auto& Cluster : Clusters)
+			{
+				if (Cluster.NewIndex != ~0u && Cluster.NormalSum.norm() > 0.5f * Cluster.NumVertices)
+				{
+					NewLevel->Mesh.mVertices[Cluster.NewIndex].Normal = Cluster.NormalSum.normalized();
+				}
+			}
+
+			// seams of the source UV layout get averaged across, distant texels are filtered wide anyway
+			if (Source.HasTexCoords())
+			{
+				NewLevel->Mesh.mTexCoords = std::move(TexCoords);
+			}
+
+			NewLevel->Mesh.BuildTriangles();
+
+			if (CompressVertices)
+			{
+				NewLevel->Mesh.Compress();
+			}
+
+			mLevels.push_back(std::move(NewLevel));
+
+			CellSize *= 2;
+		}
+	}
+
+	LodMesh::~LodMesh() = default;
+
+	const TriangleMesh& LodMesh::GetLevel(unsigned Level) const
+	{
+		return mLevels[Level]->Mesh;
+	}
+
+	Float LodMesh::GetCellSize(unsigned Level) const
+	{
+		return mLevels[Level]->CellSize;
+	}
+
+	size_t LodMesh::GetMeshBytes() const
+	{
+		size_t Bytes = sizeof(LodMesh) + GetVectorBytes(mLevels);
+
+		for (const auto& pLevel : mLevels)
+		{
+			Bytes += sizeof(LodLevel) + pLevel->Mesh.GetSizeInBytes();
+		}
+
+		return Bytes;
+	}
+
+	size_t LodMesh::GetBvhBytes() const
+	{
+		size_t Bytes = 0;
+
+		for (const auto& pLevel : mLevels)
+		{
+			if (pLevel->IsBuilt)
+			{
+				Bytes += GetVectorBytes(pLevel->pTriangles) + pLevel->pBvh->GetSizeInBytes();
+			}
+		}
+
+		return Bytes;
+	}
+
+	const Bvh& LodMesh::AcquireBvh(unsigned Level) const
+	{
+		LodLevel& aLevel = *mLevels[Level];
+
+		std::call_once(aLevel.BuildFlag, [&]()
+		{
+			for (auto& aTriangle : aLevel.Mesh.mTriangles)
+			{
+				aLevel.pTriangles.push_back(&aTriangle);
+			}
+
+			aLevel.pBvh = std::make_unique<Bvh>(aLevel.pTriangles);
+			aLevel.pBvh->ReleaseBuildData();
+
+			aLevel.IsBuilt = true;
+		});
+
+		return *aLevel.pBvh;
+	}
+
+	unsigned LodMesh::SelectLevel(const Ray& aRay) const
+	{
+		const RayDetail& Detail = aRay.Detail;
+
+		// leaving the surface it was hit on, another level could sit above or below the origin
+		for (unsigned Level = 0; Level < mLevels.size(); Level++)
+		{
+			if (Detail.pOriginMesh == &mLevels[Level]->Mesh)
+			{
+				return Level;
+			}
+		}
+
+		const Float Width = Detail.ConeWidth + Detail.ConeSpread * CalcEntryDistance(mBounds, aRay);
+
+		if (mLevels.size() == 1 || Width <= 0)
+		{
+			return 0;
+		}
+
+		// level k >= 1 clusters on cells of GetCellSize(1) * 2^(k - 1)
+		const Float Continuous = 1 + std::log2(Width * mOptions.FootprintScale / mLevels[1]->CellSize);
+		const Float Picked = std::floor(Continuous + Detail.Sample);
+
+		return static_cast<unsigned>(std::clamp(Picked, 0.f, static_cast<Float>(mLevels.size() - 1)));
+	}
+
+	bool LodMesh::Intersect(const Ray& aRay, Intersection& HitResult) const
+	{
+		return AcquireBvh(SelectLevel(aRay)).Intersect(aRay, HitResult);
+	}
+
+	bool LodMesh::Occluded(const Ray& aRay) const
+	{
+		return AcquireBvh(SelectLevel(aRay)).Occluded(aRay);
+	}
+
+	// LodGroup
+	LodGroup::LodGroup(std::vector<TriangleMesh> Meshes, const LodOptions& Options, bool CompressVertices)
+	{
+		if (Meshes.empty())
+		{
+			throw std::logic_error("Level of detail group needs at least one mesh\n");
+		}
+
+		mMeshes.resize(Meshes.size());
+
+		ParallelFor(Meshes.size(), [&](size_t MeshIndex)
+		{
+			mMeshes[MeshIndex] = std::make_unique<LodMesh>(std::move(Meshes[MeshIndex]), Options, CompressVertices);
+		});
+
+		BuildTree();
+	}
+
+	void LodGroup::ReportMemory(MemoryReport& Report) const
+	{
+		size_t MeshBytes = GetVectorBytes(mMeshes) + GetVectorBytes(mNodes) + GetVectorBytes(mMeshOrder);
+		size_t BvhBytes = 0;
+
+		for (const auto& pMesh : mMeshes)
+		{
+			MeshBytes += pMesh->GetMeshBytes();
+			BvhBytes += pMesh->GetBvhBytes();
+		}
+
+		Report.Add("Level of detail meshes", MeshBytes);
+		Report.Add("Level of detail BVHs", BvhBytes);
+	}
+
+	void LodGroup::BuildTree()
+	{
+		const unsigned NumMeshes = static_cast<unsigned>(mMeshes.size());
+
+		std::vector<Vector3f> Centroids(NumMeshes);
+
+		for (unsigned Mesh = 0; Mesh < NumMeshes; Mesh++)
+		{
+			const Aabb& Bounds = mMeshes[Mesh]->GetBounds();
+
+			Centroids[Mesh] = 0.5f * (Bounds.Bounds[0] + Bounds.Bounds[1]);
+		}
+
+		mMeshOrder.resize(NumMeshes);
+		std::iota(mMeshOrder.begin(), mMeshOrder.end(), 0);
+
+		mNodes.reserve(2 * NumMeshes - 1);
+		mNodes.emplace_back();
+
+		struct BuildTask
+		{
+			unsigned Node, Begin, End;
+		};
+
+		std::vector<BuildTask> Tasks = { { 0, 0, NumMeshes } };
+
+		while (!Tasks.empty())
+		{
+			const BuildTask Task = Tasks.back();
+			Tasks.pop_back();
+
+			Aabb Bounds, CentroidBounds;
+
+			for (unsigned Index = Task.Begin; Index < Task.End; Index++)
+			{
+				Bounds.GrowBy(mMeshes[mMeshOrder[Index]]->GetBounds());
+				CentroidBounds.GrowBy(Centroids[mMeshOrder[Index]]);
+			}
+
+			mNodes[Task.Node].BoundingBox = std::move(Bounds);
+
+			if (Task.End - Task.Begin == 1)
+			{
+				mNodes[Task.Node].LeftChild = Task.Begin;
+				mNodes[Task.Node].NumPrimitives = 1;
+
+				continue;
+			}
+
+			const Vector3f Extent = CentroidBounds.GetExtent();
+
+			unsigned Axis = 0;
+
+			if (Extent.y() > Extent[Axis])
+			{
+				Axis = 1;
+			}
+
+			if (Extent.z() > Extent[Axis])
+			{
+				Axis = 2;
+			}
+
+			const unsigned Middle = (Task.Begin + Task.End) / 2;
+
+			std::nth_element(mMeshOrder.begin() + Task.Begin, mMeshOrder.begin() + Middle, mMeshOrder.begin() + Task.End,
+				[&](unsigned A, unsigned B) { return Centroids[A][Axis] < Centroids[B][Axis]; });
+
+			const unsigned LeftChild = static_cast<unsigned>(mNodes.size());
+
+			mNodes.emplace_back();
+			mNodes.emplace_back();
+
+			mNodes[Task.Node].LeftChild = LeftChild;
+			mNodes[Task.Node].SplitAxis = Axis;
+
+			Tasks.push_back({ LeftChild, Task.Begin, Middle });
+			Tasks.push_back({ LeftChild + 1, Middle, Task.End });
+		}
+	}
+
+	bool LodGroup::Intersect(const Ray& aRay, Intersection& HitResult) const
+	{
+		bool HitSomething = false;
+
+		unsigned CurrentNode = 0;
+		unsigned ToVisitOffset = 0;
+		unsigned NodesToVisit[64];
+
+		while (true)
+		{
+			const BvhNode& Node = mNodes[CurrentNode];
+
+			if (Node.BoundingBox.Intersect(aRay))
+			{
+				if (Node.NumPrimitives > 0)
+				{
+					HitSomething |= mMeshes[mMeshOrder[Node.LeftChild]]->Intersect(aRay, HitResult);
+
+					if (ToVisitOffset == 0)
+					{
+						break;
+					}
+
+					CurrentNode = NodesToVisit[--ToVisitOffset];
+				}
+				else
+				{
+					if (aRay.IsDirectionNeg[Node.SplitAxis])
+					{
+						NodesToVisit[ToVisitOffset++] = Node.LeftChild;
+						CurrentNode = Node.LeftChild + 1;
+					}
+					else
+					{
+						NodesToVisit[ToVisitOffset++] = Node.LeftChild + 1;
+						CurrentNode = Node.LeftChild;
+					}
+				}
+			}
+			else
+			{
+				if (ToVisitOffset == 0)
+				{
+					break;
+				}
+
+				CurrentNode = NodesToVisit[--ToVisitOffset];
+			}
+		}
+
+		return HitSomething;
+	}
+
+	bool LodGroup::Occluded(const Ray& aRay) const
+	{
+		unsigned NodesToVisit[64];
+		unsigned ToVisitOffset = 0;
+
+		NodesToVisit[ToVisitOffset++] = 0;
+
+		while (ToVisitOffset > 0)
+		{
+			const BvhNode& Node = mNodes[NodesToVisit[--ToVisitOffset]];
+
+			if (!Node.BoundingBox.Intersect(aRay))
+			{
+				continue;
+			}
+
+			if (Node.NumPrimitives == 0)
+			{
+				NodesToVisit[ToVisitOffset++] = Node.LeftChild;
+				NodesToVisit[ToVisitOffset++] = Node.LeftChild + 1;
+
+				continue;
+			}
+
+			if (mMeshes[mMeshOrder[Node.LeftChild]]->Occluded(aRay))
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+} // namespace PathTracer
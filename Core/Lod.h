@@ -0,0 +1,96 @@
+#pragma once
+
+#include <Pch.h>
+#include <Ray.h>
+#include <Shape.h>
+#include <Acceleration.h>
+#include <Memory.h>
+
+namespace PathTracer
+{
+	class TriangleMesh;
+
+	struct LodOptions
+	{
+		unsigned MaxLevels = 0;			// simplified levels below the full mesh, 0 keeps every mesh as it is
+		size_t MinTriangles = 20000;	// smaller meshes are cheap enough at full detail
+		Float MinReduction = 0.5f;		// a level keeping more than this fraction of the triangles before it ends the chain
+		Float FootprintScale = 1;		// cluster cells allowed per ray cone width, larger picks coarser levels
+	};
+
+	// One simplified version of a mesh with its lazily built BVH
+	struct LodLevel;
+
+	// A mesh with a chain of coarser versions made by vertex clustering (Rossignac
+	// and Borrel 1993) with quadric placed cluster vertices (Lindstrom 2000). Every
+	// level clusters on cells twice as wide as the one before, so its error is about
+	// its cell size. A level's BVH is built the first time a ray picks it, distant
+	// meshes never build the full resolution one
+	class LodMesh
+	{
+	public:
+		LodMesh(TriangleMesh FullMesh, const LodOptions& Options, bool CompressVertices);
+
+		LodMesh(const LodMesh&) = delete;
+		LodMesh& operator=(const LodMesh&) = delete;
+
+		~LodMesh();
+
+		// Picks from the cone width where the ray enters the bounds, dithered by the
+		// ray's sample so neighbouring levels blend instead of popping
+		unsigned SelectLevel(const Ray& aRay) const;
+
+		bool Intersect(const Ray& aRay, Intersection& HitResult) const;
+
+		bool Occluded(const Ray& aRay) const;
+
+		const Aabb& GetBounds() const { return mBounds; }
+
+		unsigned GetNumLevels() const { return static_cast<unsigned>(mLevels.size()); }
+
+		const TriangleMesh& GetLevel(unsigned Level) const;
+
+		// Cell width of the level, 0 for the full mesh
+		Float GetCellSize(unsigned Level) const;
+
+		size_t GetMeshBytes() const;
+
+		// Only what has been built so far
+		size_t GetBvhBytes() const;
+
+	private:
+		const Bvh& AcquireBvh(unsigned Level) const;
+
+		std::vector<std::unique_ptr<LodLevel>> mLevels;
+		Aabb mBounds;
+		LodOptions mOptions;
+	};
+
+	// Every simplified mesh of a scene under one small tree of their bounds
+	class LodGroup
+	{
+	public:
+		LodGroup(std::vector<TriangleMesh> Meshes, const LodOptions& Options, bool CompressVertices);
+
+		LodGroup(const LodGroup&) = delete;
+		LodGroup& operator=(const LodGroup&) = delete;
+
+		~LodGroup() = default;
+
+		bool Intersect(const Ray& aRay, Intersection& HitResult) const;
+
+		bool Occluded(const Ray& aRay) const;
+
+		const std::vector<std::unique_ptr<LodMesh>>& GetMeshes() const { return mMeshes; }
+
+		void ReportMemory(MemoryReport& Report) const;
+
+	private:
+		void BuildTree();
+
+		std::vector<std::unique_ptr<LodMesh>> mMeshes;
+		std::vector<BvhNode> mNodes;
+		std::vector<unsigned> mMeshOrder;
+	};
+
+} // namespace PathTracer
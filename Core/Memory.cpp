@@ -0,0 +1,85 @@
+#include <Memory.h>
+
+#if defined(__linux__)
+#include <sys/resource.h>
+#endif
+
+namespace PathTracer
+{
+	void MemoryReport::Add(std::string_view Name, size_t Bytes)
+	{
+		Entries.emplace_back(std::string(Name), Bytes);
+	}
+
+	size_t MemoryReport::GetTotalBytes() const
+	{
+		size_t Total = 0;
+
+		for (const auto& Entry : Entries)
+		{
+			Total += Entry.second;
+		}
+
+		return Total;
+	}
+
+	void MemoryReport::Print(std::ostream& Stream) const
+	{
+		auto PrintLine = [&](std::string_view Name, size_t Bytes)
+		{
+			Stream << "  " << Name << std::string(Name.size() < 24 ? 24 - Name.size() : 1, ' ')
+				   << std::fixed << std::setprecision(2) << Bytes / (1024.0 * 1024.0) << " MB\n";
+		};
+
+		const std::ios_base::fmtflags Flags = Stream.flags();
+		const std::streamsize Precision = Stream.precision();
+
+		Stream << "Memory usage\n";
+
+		for (const auto& Entry : Entries)
+		{
+			PrintLine(Entry.first, Entry.second);
+		}
+
+		PrintLine("Total", GetTotalBytes());
+
+		Stream.flags(Flags);
+		Stream.precision(Precision);
+	}
+
+	size_t GetPeakResidentBytes()
+	{
+	#if defined(__linux__)
+		// VmHWM follows clear_refs resets, the rusage maximum does not
+		std::ifstream Status("/proc/self/status");
+		std::string Line;
+
+		while (std::getline(Status, Line))
+		{
+			if (Line.rfind("VmHWM:", 0) == 0)
+			{
+				return std::stoull(Line.substr(6)) * 1024;
+			}
+		}
+
+		rusage Usage;
+
+		if (getrusage(RUSAGE_SELF, &Usage) == 0)
+		{
+			return static_cast<size_t>(Usage.ru_maxrss) * 1024;
+		}
+	#endif
+
+		return 0;
+	}
+
+	void ResetPeakResidentBytes()
+	{
+	#if defined(__linux__)
+		std::ofstream ClearRefs("/proc/self/clear_refs");
+
+		ClearRefs << "5";
+	#endif
+	}
+
+} // namespace PathTracer
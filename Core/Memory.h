@@ -0,0 +1,32 @@
+#pragma once
+
+#include <Pch.h>
+
+namespace PathTracer
+{
+	// Bytes held per subsystem, filled in by whoever owns the data
+	struct MemoryReport
+	{
+		void Add(std::string_view Name, size_t Bytes);
+
+		size_t GetTotalBytes() const;
+
+		void Print(std::ostream& Stream) const;
+
+		std::vector<std::pair<std::string, size_t>> Entries;
+	};
+
+	// Capacity, not size, is what a vector really holds on to
+	template<typename T>
+	size_t GetVectorBytes(const std::vector<T>& Vector)
+	{
+		return Vector.capacity() * sizeof(T);
+	}
+
+	// Peak resident set of the process, 0 where the platform does not tell
+	size_t GetPeakResidentBytes();
+
+	// Starts a new peak from the current resident set, where the platform allows it
+	void ResetPeakResidentBytes();
+
+} // namespace PathTracer
@@ -0,0 +1,242 @@
+#include <Numa.h>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace PathTracer
+{
+	static std::unique_ptr<NumaTopology> gTopology;
+	static std::once_flag gTopologyOnce;
+	static std::atomic<bool> gThreadPinning = false;
+
+	thread_local unsigned tCurrentNode = 0;
+	thread_local bool tIsPinned = false;
+
+#if defined(__linux__)
+	// affinity the thread had before its first pin, restored by UnpinCurrentThread
+	thread_local cpu_set_t tOriginalCpus;
+#endif
+
+	std::vector<unsigned> ParseCpuList(std::string_view List)
+	{
+		std::vector<unsigned> Cpus;
+
+		size_t Position = 0;
+
+		while (Position < List.size())
+		{
+			size_t End = List.find(',', Position);
+
+			if (End == std::string_view::npos)
+			{
+				End = List.size();
+			}
+
+			const std::string Range(List.substr(Position, End - Position));
+
+			Position = End + 1;
+
+			if (Range.find_first_not_of(" \t\r\n") == std::string::npos)
+			{
+				continue;
+			}
+
+			const size_t Dash = Range.find('-');
+
+			try
+			{
+				const unsigned First = static_cast<unsigned>(std::stoul(Range.substr(0, Dash)));
+				const unsigned Last = Dash == std::string::npos ? First : static_cast<unsigned>(std::stoul(Range.substr(Dash + 1)));
+
+				for (unsigned Cpu = First; Cpu <= Last; Cpu++)
+				{
+					Cpus.push_back(Cpu);
+				}
+			}
+			catch (const std::exception&)
+			{
+				throw std::runtime_error("Malformed CPU list: " + std::string(List) + "\n");
+			}
+		}
+
+		return Cpus;
+	}
+
+	NumaTopology NumaTopology::Read(const std::filesystem::path& SysRoot)
+	{
+		NumaTopology Topology;
+
+		std::error_code Error;
+
+		for (unsigned Node = 0; ; Node++)
+		{
+			const std::filesystem::path CpuListFile = SysRoot / ("node" + std::to_string(Node)) / "cpulist";
+
+			if (!std::filesystem::exists(CpuListFile, Error))
+			{
+				break;
+			}
+
+			std::ifstream File(CpuListFile);
+			std::string List;
+
+			std::getline(File, List);
+
+			// memory-only nodes have no CPUs to pin to
+			std::vector<unsigned> Cpus = ParseCpuList(List);
+
+			if (!Cpus.empty())
+			{
+				Topology.NodeCpus.push_back(std::move(Cpus));
+			}
+		}
+
+		return Topology;
+	}
+
+	NumaTopology NumaTopology::SingleNode()
+	{
+		NumaTopology Topology;
+
+		Topology.NodeCpus.emplace_back(std::max(1u, std::thread::hardware_concurrency()));
+
+		std::iota(Topology.NodeCpus[0].begin(), Topology.NodeCpus[0].end(), 0);
+
+		return Topology;
+	}
+
+	const NumaTopology& GetNumaTopology()
+	{
+		std::call_once(gTopologyOnce, []()
+		{
+			if (gTopology)
+			{
+				return;
+			}
+
+			const char* pOverride = std::getenv("PATHTRACER_NUMA_SYSFS");
+
+			NumaTopology Topology = NumaTopology::Read(pOverride ? pOverride : "/sys/devices/system/node");
+
+			gTopology = std::make_unique<NumaTopology>(Topology.GetNumNodes() > 0 ? std::move(Topology) : NumaTopology::SingleNode());
+		});
+
+		return *gTopology;
+	}
+
+	void SetNumaTopology(NumaTopology Topology)
+	{
+		if (Topology.GetNumNodes() == 0)
+		{
+			throw std::invalid_argument("A NUMA topology needs at least one node with CPUs\n");
+		}
+
+		gTopology = std::make_unique<NumaTopology>(std::move(Topology));
+	}
+
+	void SetThreadPinning(bool Enable)
+	{
+		gThreadPinning = Enable;
+	}
+
+	bool IsThreadPinningEnabled()
+	{
+		return gThreadPinning;
+	}
+
+	ThreadPinningScope::ThreadPinningScope(bool Enable)
+		: mWasEnabled(gThreadPinning.exchange(Enable))
+	{}
+
+	ThreadPinningScope::~ThreadPinningScope()
+	{
+		gThreadPinning = mWasEnabled;
+	}
+
+	static void PinCurrentThread(unsigned Node, unsigned Cpu)
+	{
+		tCurrentNode = Node;
+
+#if defined(__linux__)
+		if (Cpu >= CPU_SETSIZE)
+		{
+			return;
+		}
+
+		if (!tIsPinned)
+		{
+			if (pthread_getaffinity_np(pthread_self(), sizeof(tOriginalCpus), &tOriginalCpus) != 0)
+			{
+				return;
+			}
+
+			tIsPinned = true;
+		}
+
+		cpu_set_t CpuSet;
+		CPU_ZERO(&CpuSet);
+		CPU_SET(Cpu, &CpuSet);
+
+		// a CPU that is offline or only exists in a fake topology leaves the thread where it is
+		pthread_setaffinity_np(pthread_self(), sizeof(CpuSet), &CpuSet);
+#else
+		(void)Cpu;
+#endif
+	}
+
+	void PinWorkerThread(unsigned WorkerIndex)
+	{
+		const NumaTopology& Topology = GetNumaTopology();
+
+		const unsigned Node = WorkerIndex % Topology.GetNumNodes();
+		const std::vector<unsigned>& Cpus = Topology.NodeCpus[Node];
+
+		PinCurrentThread(Node, Cpus[(WorkerIndex / Topology.GetNumNodes()) % Cpus.size()]);
+	}
+
+	void PinThreadToNode(const NumaTopology& Topology, unsigned Node)
+	{
+		Node %= Topology.GetNumNodes();
+
+		PinCurrentThread(Node, Topology.NodeCpus[Node][0]);
+	}
+
+	void UnpinCurrentThread()
+	{
+		tCurrentNode = 0;
+
+		if (!tIsPinned)
+		{
+			return;
+		}
+
+		tIsPinned = false;
+
+#if defined(__linux__)
+		pthread_setaffinity_np(pthread_self(), sizeof(tOriginalCpus), &tOriginalCpus);
+#endif
+	}
+
+	unsigned GetNumNumaCopies(NumaPlacement Placement, const NumaTopology& Topology)
+	{
+		switch (Placement)
+		{
+		case NumaPlacement::Interleave:
+			return 1;
+
+		case NumaPlacement::Replicate:
+			return std::max(1u, Topology.GetNumNodes());
+
+		default:
+			return 0;
+		}
+	}
+
+	unsigned GetCurrentNumaNode()
+	{
+		return tCurrentNode;
+	}
+
+} // namespace PathTracer
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <Pch.h>
+
+namespace PathTracer
+{
+	// CPUs of every NUMA node as listed under /sys/devices/system/node
+	struct NumaTopology
+	{
+		// Reads <SysRoot>/node<N>/cpulist, a directory laid out the same way fakes any topology
+		static NumaTopology Read(const std::filesystem::path& SysRoot);
+
+		static NumaTopology SingleNode();
+
+		unsigned GetNumNodes() const { return static_cast<unsigned>(NodeCpus.size()); }
+
+		std::vector<std::vector<unsigned>> NodeCpus;
+	};
+
+	// "0-3,8,10-11" style lists of the kernel
+	std::vector<unsigned> ParseCpuList(std::string_view List);
+
+	// Read once from /sys, or from PATHTRACER_NUMA_SYSFS when set. Falls back to one node
+	const NumaTopology& GetNumaTopology();
+
+	// Replaces the detected topology, call before any worker starts
+	void SetNumaTopology(NumaTopology Topology);
+
+	// Worker threads of ParallelFor pin themselves while this is on
+	void SetThreadPinning(bool Enable);
+
+	bool IsThreadPinningEnabled();
+
+	// Sets thread pinning for its lifetime and puts back the previous setting, also when
+	// the scope is left by an exception
+	class ThreadPinningScope
+	{
+	public:
+		explicit ThreadPinningScope(bool Enable);
+
+		ThreadPinningScope(const ThreadPinningScope&) = delete;
+		ThreadPinningScope& operator=(const ThreadPinningScope&) = delete;
+
+		~ThreadPinningScope();
+
+	private:
+		bool mWasEnabled;
+	};
+
+	// Pins the calling thread to a CPU picked round robin over the nodes, so any number
+	// of workers spreads evenly. The node is remembered even when the CPU does not exist,
+	// which keeps fake topologies usable on small machines
+	void PinWorkerThread(unsigned WorkerIndex);
+
+	void PinThreadToNode(const NumaTopology& Topology, unsigned Node);
+
+	// Gives the calling thread back the affinity it had before it was first pinned, for
+	// pool threads that outlive the render that pinned them
+	void UnpinCurrentThread();
+
+	// Node the calling thread was pinned to, 0 for threads that never were
+	unsigned GetCurrentNumaNode();
+
+	enum class NumaPlacement
+	{
+		None = 1,
+		Interleave = 2,		// one copy whose pages alternate between the nodes
+		Replicate = 3,		// one copy per node, threads read their own
+	};
+
+	// Copies a NumaArray makes besides its source vector
+	unsigned GetNumNumaCopies(NumaPlacement Placement, const NumaTopology& Topology);
+
+	// Read-only copy of an array placed across the NUMA nodes. Pages go to the node of
+	// the thread that touches them first, so every part is copied by a thread pinned there.
+	// Elements are copied bitwise, the node types delete their copy constructors
+	template<typename T>
+	class NumaArray
+	{
+		static_assert(std::is_trivially_destructible_v<T> && std::is_standard_layout_v<T>);
+
+	public:
+		NumaArray() = default;
+
+		NumaArray(const std::vector<T>& Source, NumaPlacement Placement, const NumaTopology& Topology);
+
+		NumaArray(const NumaArray&) = delete;
+		NumaArray& operator=(const NumaArray&) = delete;
+
+		NumaArray(NumaArray&& Other) noexcept
+		: mCopies{std::exchange(Other.mCopies, {})}, mSize{std::exchange(Other.mSize, 0)}
+		{
+		}
+
+		// the copies held so far are freed, not overwritten
+		NumaArray& operator=(NumaArray&& Other) noexcept
+		{
+			if (this != &Other)
+			{
+				Clear();
+
+				mCopies = std::exchange(Other.mCopies, {});
+				mSize = std::exchange(Other.mSize, 0);
+			}
+
+			return *this;
+		}
+
+		~NumaArray() { Clear(); }
+
+		void Clear();
+
+		bool IsEmpty() const { return mCopies.empty(); }
+
+		// The copy closest to the calling thread
+		const T* GetData() const
+		{
+			return mCopies.size() == 1 ? mCopies[0] : mCopies[GetCurrentNumaNode() % mCopies.size()];
+		}
+
+		size_t GetSizeInBytes() const { return mCopies.size() * mSize * sizeof(T); }
+
+	private:
+		static T* Allocate(size_t Size);
+
+		std::vector<T*> mCopies;
+		size_t mSize = 0;
+	};
+
+	template<typename T>
+	NumaArray<T>::NumaArray(const std::vector<T>& Source, NumaPlacement Placement, const NumaTopology& Topology)
+	: mSize{Source.size()}
+	{
+		if (Placement == NumaPlacement::None || Source.empty())
+		{
+			return;
+		}
+
+		const unsigned NumNodes = std::max(1u, Topology.GetNumNodes());
+
+		std::vector<std::thread> Threads;
+
+		if (Placement == NumaPlacement::Replicate)
+		{
+			mCopies.assign(NumNodes, nullptr);
+
+			for (unsigned Node = 0; Node < NumNodes; Node++)
+			{
+				Threads.emplace_back([&, Node]()
+				{
+					PinThreadToNode(Topology, Node);
+
+					T* pCopy = Allocate(Source.size());
+
+					std::memcpy(static_cast<void*>(pCopy), Source.data(), Source.size() * sizeof(T));
+
+					mCopies[Node] = pCopy;
+				});
+			}
+		}
+		else
+		{
+			T* pCopy = Allocate(Source.size());
+
+			mCopies.push_back(pCopy);
+
+			// chunks of whole pages where the element size allows it
+			const size_t ChunkSize = std::max<size_t>(1, (size_t(64) << 10) / sizeof(T));
+
+			for (unsigned Node = 0; Node < NumNodes; Node++)
+			{
+				Threads.emplace_back([&, Node, pCopy]()
+				{
+					PinThreadToNode(Topology, Node);
+
+					for (size_t Begin = Node * ChunkSize; Begin < Source.size(); Begin += NumNodes * ChunkSize)
+					{
+						const size_t End = std::min(Begin + ChunkSize, Source.size());
+
+						std::memcpy(static_cast<void*>(pCopy + Begin), Source.data() + Begin, (End - Begin) * sizeof(T));
+					}
+				});
+			}
+		}
+
+		for (auto& Thread : Threads)
+		{
+			Thread.join();
+		}
+	}
+
+	template<typename T>
+	void NumaArray<T>::Clear()
+	{
+		for (T* pCopy : mCopies)
+		{
+			std::free(pCopy);
+		}
+
+		mCopies.clear();
+	}
+
+	template<typename T>
+	T* NumaArray<T>::Allocate(size_t Size)
+	{
+		// malloc leaves the pages untouched, unlike new T[]
+		void* pMemory = std::malloc(Size * sizeof(T));
+
+		if (pMemory == nullptr)
+		{
+			throw std::bad_alloc();
+		}
+
+		return static_cast<T*>(pMemory);
+	}
+
+} // namespace PathTracer
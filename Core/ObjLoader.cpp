@@ -0,0 +1,704 @@
+#include <ObjLoader.h>
+#include <Parallel.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace Eigen;
+
+namespace PathTracer
+{
+	constexpr size_t kObjChunkBytes = size_t(4) << 20;
+	constexpr uint32_t kObjNoIndex = ~0u;
+	constexpr int kObjInheritMaterial = -1;	// whatever the previous chunk ended with
+	constexpr int kObjDefaultMaterial = -2;	// no usemtl yet, or a name the MTL does not define
+
+	MappedFile::MappedFile(const std::string& FileName)
+	{
+	#if defined(_WIN32)
+		mFileHandle = CreateFileA(FileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+		if (mFileHandle == INVALID_HANDLE_VALUE)
+		{
+			throw std::runtime_error("Failed to open " + FileName + "\n");
+		}
+
+		LARGE_INTEGER FileSize;
+		GetFileSizeEx(mFileHandle, &FileSize);
+		mSize = static_cast<size_t>(FileSize.QuadPart);
+
+		if (mSize > 0)
+		{
+			mMappingHandle = CreateFileMappingA(mFileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			pData = mMappingHandle ? static_cast<const char*>(MapViewOfFile(mMappingHandle, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+
+			if (pData == nullptr)
+			{
+				throw std::runtime_error("Failed to map " + FileName + "\n");
+			}
+		}
+	#else
+		const int Descriptor = open(FileName.c_str(), O_RDONLY);
+
+		if (Descriptor < 0)
+		{
+			throw std::runtime_error("Failed to open " + FileName + "\n");
+		}
+
+		struct stat Status;
+
+		if (fstat(Descriptor, &Status) == 0)
+		{
+			mSize = static_cast<size_t>(Status.st_size);
+		}
+
+		if (mSize > 0)
+		{
+			void* pMapping = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, Descriptor, 0);
+
+			if (pMapping == MAP_FAILED)
+			{
+				close(Descriptor);
+
+				throw std::runtime_error("Failed to map " + FileName + "\n");
+			}
+
+			// chunks are read in parallel, start paging in all of them
+			madvise(pMapping, mSize, MADV_WILLNEED);
+
+			pData = static_cast<const char*>(pMapping);
+		}
+
+		// the mapping keeps its own reference to the file
+		close(Descriptor);
+	#endif
+	}
+
+	MappedFile::~MappedFile()
+	{
+	#if defined(_WIN32)
+		if (pData)
+		{
+			UnmapViewOfFile(pData);
+		}
+
+		if (mMappingHandle)
+		{
+			CloseHandle(mMappingHandle);
+		}
+
+		CloseHandle(mFileHandle);
+	#else
+		if (pData)
+		{
+			munmap(const_cast<char*>(pData), mSize);
+		}
+	#endif
+	}
+
+	struct ObjCorner
+	{
+		uint32_t Position;
+		uint32_t TexCoord;
+		uint32_t Normal;
+	};
+
+	// Faces from FirstTriangle on belong to Group and Material, up to the next run
+	struct ObjRun
+	{
+		size_t FirstTriangle;
+		uint32_t Group;
+		int Material;
+	};
+
+	struct ObjChunk
+	{
+		const char* pBegin;
+		const char* pEnd;
+
+		// counted by the first pass, turned into offsets before the second
+		size_t NumPositions = 0, NumTexCoords = 0, NumNormals = 0, NumGroups = 0;
+		size_t FirstPosition = 0, FirstTexCoord = 0, FirstNormal = 0, FirstGroup = 0;
+		std::vector<std::string> MaterialLibraries;
+
+		std::vector<ObjCorner> Corners;		// three per triangle
+		std::vector<ObjRun> Runs;
+	};
+
+	static bool IsSpace(char Character)
+	{
+		return Character == ' ' || Character == '\t' || Character == '\r';
+	}
+
+	static const char* SkipSpaces(const char* pCursor, const char* pEnd)
+	{
+		while (pCursor < pEnd && IsSpace(*pCursor))
+		{
+			pCursor++;
+		}
+
+		return pCursor;
+	}
+
+	static const char* FindLineEnd(const char* pCursor, const char* pEnd)
+	{
+		const void* pFound = std::memchr(pCursor, '\n', pEnd - pCursor);
+
+		return pFound ? static_cast<const char*>(pFound) : pEnd;
+	}
+
+	// The keyword must end at a space or the line end, "vt" is not a "v"
+	static bool StartsWithKeyword(const char* pLine, const char* pEnd, std::string_view Keyword)
+	{
+		const size_t Length = Keyword.size();
+
+		return size_t(pEnd - pLine) >= Length && std::memcmp(pLine, Keyword.data(), Length) == 0 && (pLine + Length == pEnd || IsSpace(pLine[Length]));
+	}
+
+	static std::string_view TrimmedRest(const char* pCursor, const char* pEnd)
+	{
+		pCursor = SkipSpaces(pCursor, pEnd);
+
+		while (pEnd > pCursor && IsSpace(pEnd[-1]))
+		{
+			pEnd--;
+		}
+
+		return std::string_view(pCursor, pEnd - pCursor);
+	}
+
+	// from_chars is locale independent and exact, no strtod round trip
+	static const char* ParseFloat(const char* pCursor, const char* pEnd, float& Value)
+	{
+		pCursor = SkipSpaces(pCursor, pEnd);
+
+		if (pCursor < pEnd && *pCursor == '+')
+		{
+			pCursor++;
+		}
+
+		const auto [pNext, Error] = std::from_chars(pCursor, pEnd, Value);
+
+		if (Error != std::errc())
+		{
+			throw std::runtime_error("Malformed number in OBJ file\n");
+		}
+
+		return pNext;
+	}
+
+	static bool TryParseFloat(const char*& pCursor, const char* pEnd, float& Value)
+	{
+		pCursor = SkipSpaces(pCursor, pEnd);
+
+		if (pCursor == pEnd)
+		{
+			return false;
+		}
+
+		pCursor = ParseFloat(pCursor, pEnd, Value);
+
+		return true;
+	}
+
+	// OBJ indices count from 1, negative ones back from the last element so far
+	static uint32_t ResolveIndex(int64_t Index, size_t NumSoFar, size_t NumTotal)
+	{
+		const int64_t Resolved = Index > 0 ? Index - 1 : static_cast<int64_t>(NumSoFar) + Index;
+
+		if (Index == 0 || Resolved < 0 || Resolved >= static_cast<int64_t>(NumTotal))
+		{
+			throw std::runtime_error("OBJ face index out of range\n");
+		}
+
+		return static_cast<uint32_t>(Resolved);
+	}
+
+	static void CountChunk(ObjChunk& Chunk)
+	{
+		for (const char* pLine = Chunk.pBegin; pLine < Chunk.pEnd; )
+		{
+			const char* pLineEnd = FindLineEnd(pLine, Chunk.pEnd);
+			const char* pCursor = SkipSpaces(pLine, pLineEnd);
+
+			if (StartsWithKeyword(pCursor, pLineEnd, "v"))
+			{
+				Chunk.NumPositions++;
+			}
+			else if (StartsWithKeyword(pCursor, pLineEnd, "vt"))
+			{
+				Chunk.NumTexCoords++;
+			}
+			else if (StartsWithKeyword(pCursor, pLineEnd, "vn"))
+			{
+				Chunk.NumNormals++;
+			}
+			else if (StartsWithKeyword(pCursor, pLineEnd, "o") || StartsWithKeyword(pCursor, pLineEnd, "g"))
+			{
+				Chunk.NumGroups++;
+			}
+			else if (StartsWithKeyword(pCursor, pLineEnd, "mtllib"))
+			{
+				Chunk.MaterialLibraries.emplace_back(TrimmedRest(pCursor + 6, pLineEnd));
+			}
+
+			pLine = pLineEnd + 1;
+		}
+	}
+
+	struct ObjAttributes
+	{
+		std::vector<Vector3f> Positions;
+		std::vector<Vector2f> TexCoords;
+		std::vector<Vector3f> Normals;
+	};
+
+	static void ParseChunk(ObjChunk& Chunk, ObjAttributes& Attributes, const std::unordered_map<std::string, int>& MaterialIndices)
+	{
+		size_t NumPositions = Chunk.FirstPosition;
+		size_t NumTexCoords = Chunk.FirstTexCoord;
+		size_t NumNormals = Chunk.FirstNormal;
+
+		ObjRun Current{0, static_cast<uint32_t>(Chunk.FirstGroup), kObjInheritMaterial};
+		Chunk.Runs.push_back(Current);
+
+		std::vector<ObjCorner> Polygon;
+
+		auto StartRun = [&]()
+		{
+			Current.FirstTriangle = Chunk.Corners.size() / 3;
+
+			// a run that never got a face is simply replaced
+			if (Chunk.Runs.back().FirstTriangle == Current.FirstTriangle)
+			{
+				Chunk.Runs.back() = Current;
+			}
+			else
+			{
+				Chunk.Runs.push_back(Current);
+			}
+		};
+
+		for (const char* pLine = Chunk.pBegin; pLine < Chunk.pEnd; )
+		{
+			const char* pLineEnd = FindLineEnd(pLine, Chunk.pEnd);
+			const char* pCursor = SkipSpaces(pLine, pLineEnd);
+
+			if (StartsWithKeyword(pCursor, pLineEnd, "v"))
+			{
+				Vector3f& Position = Attributes.Positions[NumPositions++];
+
+				pCursor = ParseFloat(pCursor + 1, pLineEnd, Position.x());
+				pCursor = ParseFloat(pCursor, pLineEnd, Position.y());
+				ParseFloat(pCursor, pLineEnd, Position.z());
+			}
+			else if (StartsWithKeyword(pCursor, pLineEnd, "vt"))
+			{
+				Vector2f& TexCoord = Attributes.TexCoords[NumTexCoords++];
+
+				pCursor = ParseFloat(pCursor + 2, pLineEnd, TexCoord.x());
+
+				if (!TryParseFloat(pCursor, pLineEnd, TexCoord.y()))
+				{
+					TexCoord.y() = 0;
+				}
+			}
+			else if (StartsWithKeyword(pCursor, pLineEnd, "vn"))
+			{
+				Vector3f& Normal = Attributes.Normals[NumNormals++];
+
+				pCursor = ParseFloat(pCursor + 2, pLineEnd, Normal.x());
+				pCursor = ParseFloat(pCursor, pLineEnd, Normal.y());
+				ParseFloat(pCursor, pLineEnd, Normal.z());
+			}
+			else if (StartsWithKeyword(pCursor, pLineEnd, "f"))
+			{
+				Polygon.clear();
+
+				for (pCursor = SkipSpaces(pCursor + 1, pLineEnd); pCursor < pLineEnd; pCursor = SkipSpaces(pCursor, pLineEnd))
+				{
+					ObjCorner Corner{kObjNoIndex, kObjNoIndex, kObjNoIndex};
+					uint32_t* pSlots[3] = { &Corner.Position, &Corner.TexCoord, &Corner.Normal };
+					const size_t NumSoFar[3] = { NumPositions, NumTexCoords, NumNormals };
+					const size_t NumTotal[3] = { Attributes.Positions.size(), Attributes.TexCoords.size(), Attributes.Normals.size() };
+
+					// v, v/t, v//n or v/t/n
+					for (int Slot = 0; Slot < 3 && pCursor < pLineEnd && !IsSpace(*pCursor); Slot++)
+					{
+						if (*pCursor != '/')
+						{
+							int64_t Index = 0;
+							const auto [pNext, Error] = std::from_chars(pCursor, pLineEnd, Index);
+
+							if (Error != std::errc())
+							{
+								throw std::runtime_error("Malformed face in OBJ file\n");
+							}
+
+							*pSlots[Slot] = ResolveIndex(Index, NumSoFar[Slot], NumTotal[Slot]);
+							pCursor = pNext;
+						}
+
+						if (pCursor < pLineEnd && *pCursor == '/')
+						{
+							pCursor++;
+						}
+					}
+
+					if (Corner.Position == kObjNoIndex)
+					{
+						throw std::runtime_error("OBJ face corner without a position\n");
+					}
+
+					Polygon.push_back(Corner);
+				}
+
+				// convex polygons fan out from their first corner
+				for (size_t Corner = 2; Corner < Polygon.size(); Corner++)
+				{
+					Chunk.Corners.insert(Chunk.Corners.end(), { Polygon[0], Polygon[Corner - 1], Polygon[Corner] });
+				}
+			}
+			else if (StartsWithKeyword(pCursor, pLineEnd, "o") || StartsWithKeyword(pCursor, pLineEnd, "g"))
+			{
+				Current.Group++;
+				StartRun();
+			}
+			else if (StartsWithKeyword(pCursor, pLineEnd, "usemtl"))
+			{
+				const auto Found = MaterialIndices.find(std::string(TrimmedRest(pCursor + 6, pLineEnd)));
+
+				Current.Material = Found != MaterialIndices.end() ? Found->second : kObjDefaultMaterial;
+				StartRun();
+			}
+
+			pLine = pLineEnd + 1;
+		}
+	}
+
+	// Map options come first, the file name is the last word
+	static std::string MapFileName(std::string_view Rest)
+	{
+		const size_t LastSpace = Rest.find_last_of(" \t");
+
+		return std::string(LastSpace == std::string_view::npos ? Rest : Rest.substr(LastSpace + 1));
+	}
+
+	// Only what Scene::ConvertMaterial and the texture loading read from Assimp
+	static void LoadMaterialLibrary(const std::filesystem::path& FileName, ObjScene& Result, std::unordered_map<std::string, int>& MaterialIndices)
+	{
+		std::ifstream Input(FileName);
+
+		if (!Input.is_open())
+		{
+			std::cout << "Skipping material library " << FileName.string() << "\n";
+
+			return;
+		}
+
+		auto ParseColour = [](const char* pCursor, const char* pEnd)
+		{
+			Vector3f Colour;
+
+			pCursor = ParseFloat(pCursor, pEnd, Colour.x());
+			pCursor = ParseFloat(pCursor, pEnd, Colour.y());
+			ParseFloat(pCursor, pEnd, Colour.z());
+
+			return Colour;
+		};
+
+		std::string Line;
+		int Current = -1;
+
+		while (std::getline(Input, Line))
+		{
+			const char* pEnd = Line.data() + Line.size();
+			const char* pCursor = SkipSpaces(Line.data(), pEnd);
+
+			if (StartsWithKeyword(pCursor, pEnd, "newmtl"))
+			{
+				Current = static_cast<int>(Result.Materials.size());
+
+				Result.Materials.emplace_back();
+				Result.DiffuseMaps.emplace_back();
+				Result.DisplacementMaps.emplace_back();
+
+				MaterialIndices.emplace(std::string(TrimmedRest(pCursor + 6, pEnd)), Current);
+			}
+			else if (Current < 0)
+			{
+				continue;
+			}
+			else if (StartsWithKeyword(pCursor, pEnd, "Kd"))
+			{
+				Result.Materials[Current].Diffuse = ParseColour(pCursor + 2, pEnd);
+			}
+			else if (StartsWithKeyword(pCursor, pEnd, "Ke"))
+			{
+				Result.Materials[Current].Emission = ParseColour(pCursor + 2, pEnd);
+			}
+			else if (StartsWithKeyword(pCursor, pEnd, "map_Kd"))
+			{
+				Result.DiffuseMaps[Current] = MapFileName(TrimmedRest(pCursor + 6, pEnd));
+			}
+			else if (StartsWithKeyword(pCursor, pEnd, "disp"))
+			{
+				Result.DisplacementMaps[Current] = MapFileName(TrimmedRest(pCursor + 4, pEnd));
+			}
+			else if ((StartsWithKeyword(pCursor, pEnd, "bump") || StartsWithKeyword(pCursor, pEnd, "map_bump")) && Result.DisplacementMaps[Current].empty())
+			{
+				const size_t KeywordLength = *pCursor == 'b' ? 4 : 8;
+
+				Result.DisplacementMaps[Current] = MapFileName(TrimmedRest(pCursor + KeywordLength, pEnd));
+			}
+		}
+	}
+
+	static ObjMesh BuildMesh(const std::vector<ObjChunk>& Chunks, const std::vector<std::pair<size_t, std::pair<size_t, size_t>>>& Ranges, const ObjAttributes& Attributes)
+	{
+		ObjMesh Mesh;
+		Mesh.HasNormals = true;
+
+		uint32_t MinPosition = kObjNoIndex, MaxPosition = 0;
+		bool HasTexCoords = false;
+
+		for (const auto& [ChunkIndex, Range] : Ranges)
+		{
+			for (size_t Corner = 3 * Range.first; Corner < 3 * Range.second; Corner++)
+			{
+				const ObjCorner& aCorner = Chunks[ChunkIndex].Corners[Corner];
+
+				MinPosition = std::min(MinPosition, aCorner.Position);
+				MaxPosition = std::max(MaxPosition, aCorner.Position);
+				HasTexCoords |= aCorner.TexCoord != kObjNoIndex;
+				Mesh.HasNormals &= aCorner.Normal != kObjNoIndex;
+			}
+		}
+
+		if (MinPosition > MaxPosition)
+		{
+			return Mesh;
+		}
+
+		// vertices sharing a position are chained from it, the chains stay as short as the seams there
+		std::vector<uint32_t> Heads(MaxPosition - MinPosition + 1, kObjNoIndex);
+		std::vector<uint32_t> Next;
+		std::vector<ObjCorner> Keys;
+
+		for (const auto& [ChunkIndex, Range] : Ranges)
+		{
+			for (size_t Corner = 3 * Range.first; Corner < 3 * Range.second; Corner++)
+			{
+				ObjCorner aCorner = Chunks[ChunkIndex].Corners[Corner];
+
+				if (!Mesh.HasNormals)
+				{
+					aCorner.Normal = kObjNoIndex;
+				}
+
+				uint32_t& Head = Heads[aCorner.Position - MinPosition];
+				uint32_t VertexIndex = Head;
+
+				while (VertexIndex != kObjNoIndex && (Keys[VertexIndex].TexCoord != aCorner.TexCoord || Keys[VertexIndex].Normal != aCorner.Normal))
+				{
+					VertexIndex = Next[VertexIndex];
+				}
+
+				if (VertexIndex == kObjNoIndex)
+				{
+					VertexIndex = static_cast<uint32_t>(Keys.size());
+
+					Keys.push_back(aCorner);
+					Next.push_back(Head);
+					Head = VertexIndex;
+				}
+
+				Mesh.Indices.push_back(VertexIndex);
+			}
+		}
+
+		Mesh.Vertices.resize(Keys.size());
+
+		if (HasTexCoords)
+		{
+			Mesh.TexCoords.resize(Keys.size(), Vector2f::Zero());
+		}
+
+		for (size_t VertexIndex = 0; VertexIndex < Keys.size(); VertexIndex++)
+		{
+			const ObjCorner& Key = Keys[VertexIndex];
+
+			Mesh.Vertices[VertexIndex].Position = Attributes.Positions[Key.Position];
+			Mesh.Vertices[VertexIndex].Normal = Mesh.HasNormals ? Attributes.Normals[Key.Normal] : Vector3f::Zero();
+
+			if (HasTexCoords && Key.TexCoord != kObjNoIndex)
+			{
+				Mesh.TexCoords[VertexIndex] = Attributes.TexCoords[Key.TexCoord];
+			}
+		}
+
+		return Mesh;
+	}
+
+	std::vector<std::string> GetObjReferences(std::string_view Text, bool IsMaterialLibrary)
+	{
+		std::vector<std::string> References;
+
+		const char* pEnd = Text.data() + Text.size();
+
+		for (const char* pLine = Text.data(); pLine < pEnd;)
+		{
+			const char* pLineEnd = FindLineEnd(pLine, pEnd);
+			const char* pCursor = SkipSpaces(pLine, pLineEnd);
+
+			if (!IsMaterialLibrary && StartsWithKeyword(pCursor, pLineEnd, "mtllib"))
+			{
+				References.emplace_back(TrimmedRest(pCursor + 6, pLineEnd));
+			}
+			else if (IsMaterialLibrary)
+			{
+				for (std::string_view Keyword : { "map_Kd", "disp", "bump", "map_bump" })
+				{
+					if (StartsWithKeyword(pCursor, pLineEnd, Keyword))
+					{
+						References.push_back(MapFileName(TrimmedRest(pCursor + Keyword.size(), pLineEnd)));
+					}
+				}
+			}
+
+			pLine = pLineEnd + 1;
+		}
+
+		return References;
+	}
+
+	ObjScene LoadObj(std::string_view FileName)
+	{
+		const MappedFile File{std::string(FileName)};
+
+		const char* pData = File.GetData();
+		const char* pEnd = pData + File.GetSize();
+
+		// chunks start right after a line break, so no line is cut in two
+		const size_t NumChunks = std::max<size_t>(1, File.GetSize() / kObjChunkBytes);
+
+		std::vector<ObjChunk> Chunks(NumChunks);
+
+		for (size_t ChunkIndex = 0; ChunkIndex < NumChunks; ChunkIndex++)
+		{
+			const char* pBegin = ChunkIndex == 0 ? pData : Chunks[ChunkIndex - 1].pEnd;
+			const char* pSplit = ChunkIndex + 1 == NumChunks ? pEnd : std::max(pBegin, pData + File.GetSize() / NumChunks * (ChunkIndex + 1));
+
+			Chunks[ChunkIndex].pBegin = pBegin;
+			Chunks[ChunkIndex].pEnd = pSplit == pEnd ? pEnd : std::min(pEnd, FindLineEnd(pSplit, pEnd) + 1);
+		}
+
+		ParallelFor(NumChunks, [&](size_t ChunkIndex) { CountChunk(Chunks[ChunkIndex]); });
+
+		size_t NumPositions = 0, NumTexCoords = 0, NumNormals = 0, NumGroups = 0;
+
+		for (ObjChunk& Chunk : Chunks)
+		{
+			Chunk.FirstPosition = NumPositions;
+			Chunk.FirstTexCoord = NumTexCoords;
+			Chunk.FirstNormal = NumNormals;
+			Chunk.FirstGroup = NumGroups;
+
+			NumPositions += Chunk.NumPositions;
+			NumTexCoords += Chunk.NumTexCoords;
+			NumNormals += Chunk.NumNormals;
+			NumGroups += Chunk.NumGroups;
+		}
+
+		if (NumPositions >= kObjNoIndex || NumTexCoords >= kObjNoIndex || NumNormals >= kObjNoIndex)
+		{
+			throw std::runtime_error("OBJ file has too many vertices for 32 bit indices\n");
+		}
+
+		ObjScene Result;
+		std::unordered_map<std::string, int> MaterialIndices;
+
+		const std::filesystem::path Directory = std::filesystem::path(FileName).parent_path();
+
+		for (const ObjChunk& Chunk : Chunks)
+		{
+			for (const std::string& Library : Chunk.MaterialLibraries)
+			{
+				LoadMaterialLibrary(Directory / Library, Result, MaterialIndices);
+			}
+		}
+
+		ObjAttributes Attributes;
+		Attributes.Positions.resize(NumPositions);
+		Attributes.TexCoords.resize(NumTexCoords);
+		Attributes.Normals.resize(NumNormals);
+
+		ParallelFor(NumChunks, [&](size_t ChunkIndex) { ParseChunk(Chunks[ChunkIndex], Attributes, MaterialIndices); });
+
+		// runs pick up the material the file order leaves them with, then group into meshes
+		std::map<std::pair<uint32_t, int>, size_t> MeshIndices;
+		std::vector<std::vector<std::pair<size_t, std::pair<size_t, size_t>>>> MeshRanges;
+		std::vector<int> MeshMaterials;
+
+		int CurrentMaterial = kObjDefaultMaterial;
+
+		for (size_t ChunkIndex = 0; ChunkIndex < NumChunks; ChunkIndex++)
+		{
+			const ObjChunk& Chunk = Chunks[ChunkIndex];
+
+			for (size_t RunIndex = 0; RunIndex < Chunk.Runs.size(); RunIndex++)
+			{
+				const ObjRun& Run = Chunk.Runs[RunIndex];
+
+				if (Run.Material != kObjInheritMaterial)
+				{
+					CurrentMaterial = Run.Material;
+				}
+
+				const size_t LastTriangle = RunIndex + 1 < Chunk.Runs.size() ? Chunk.Runs[RunIndex + 1].FirstTriangle : Chunk.Corners.size() / 3;
+
+				if (LastTriangle == Run.FirstTriangle)
+				{
+					continue;
+				}
+
+				const auto [Found, Inserted] = MeshIndices.try_emplace({Run.Group, CurrentMaterial}, MeshRanges.size());
+
+				if (Inserted)
+				{
+					MeshRanges.emplace_back();
+					MeshMaterials.push_back(CurrentMaterial);
+				}
+
+				MeshRanges[Found->second].push_back({ChunkIndex, {Run.FirstTriangle, LastTriangle}});
+			}
+		}
+
+		if (std::find(MeshMaterials.begin(), MeshMaterials.end(), kObjDefaultMaterial) != MeshMaterials.end())
+		{
+			Result.Materials.emplace_back();
+			Result.DiffuseMaps.emplace_back();
+			Result.DisplacementMaps.emplace_back();
+		}
+
+		Result.Meshes.resize(MeshRanges.size());
+
+		ParallelFor(MeshRanges.size(), [&](size_t MeshIndex)
+		{
+			Result.Meshes[MeshIndex] = BuildMesh(Chunks, MeshRanges[MeshIndex], Attributes);
+
+			const int MaterialIndex = MeshMaterials[MeshIndex];
+
+			Result.Meshes[MeshIndex].MaterialIndex = MaterialIndex == kObjDefaultMaterial ? static_cast<unsigned>(Result.Materials.size() - 1) : MaterialIndex;
+		});
+
+		return Result;
+	}
+
+} // namespace PathTracer
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <Pch.h>
+#include <Scene.h>
+
+namespace PathTracer
+{
+	// Read-only view of a whole file, mapped into memory instead of copied
+	class MappedFile
+	{
+	public:
+		MappedFile(const std::string& FileName);
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		~MappedFile();
+
+		const char* GetData() const { return pData; }
+
+		size_t GetSize() const { return mSize; }
+
+	private:
+		const char* pData = nullptr;
+		size_t mSize = 0;
+
+	#if defined(_WIN32)
+		void* mFileHandle = nullptr;
+		void* mMappingHandle = nullptr;
+	#endif
+	};
+
+	// Vertices are shared by the faces that use the same position, texcoord and
+	// normal, as Assimp's JoinIdenticalVertices does
+	struct ObjMesh
+	{
+		std::vector<Vertex> Vertices;
+		std::vector<unsigned> Indices;
+		std::vector<Eigen::Vector2f> TexCoords;		// empty when no face has any
+		bool HasNormals = false;					// every corner had one, otherwise they are generated
+		unsigned MaterialIndex = 0;
+	};
+
+	struct ObjScene
+	{
+		std::vector<ObjMesh> Meshes;				// one per group and material
+		std::vector<Material> Materials;
+		std::vector<std::string> DiffuseMaps;		// per material as the MTL names them, empty for none
+		std::vector<std::string> DisplacementMaps;
+	};
+
+	// Fast path for Wavefront OBJ. The mapped file is split into chunks at line
+	// boundaries, a first parallel pass counts the elements of each chunk and a
+	// second one parses them straight into the shared attribute arrays at their
+	// prefix offsets, which also resolves negative indices without a merge step.
+	// Polygons are fanned into triangles, points and lines are skipped
+	ObjScene LoadObj(std::string_view FileName);
+
+	// Files named by the text of an OBJ, its material libraries, or of an MTL, its
+	// texture maps. Both are relative to the OBJ's directory as LoadObj reads them
+	std::vector<std::string> GetObjReferences(std::string_view Text, bool IsMaterialLibrary);
+
+} // namespace PathTracer
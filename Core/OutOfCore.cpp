@@ -0,0 +1,1038 @@
+#include <OutOfCore.h>
+
+using namespace Eigen;
+
+namespace PathTracer
+{
+	constexpr char kOutOfCoreMagic[4] = { 'P', 'T', 'O', 'C' };
+	constexpr uint32_t kOutOfCoreVersion = 3;
+	constexpr uint64_t kPageAlignment = 4096;
+
+	struct OutOfCoreHeader
+	{
+		char Magic[4];
+		uint32_t Version;
+		uint32_t NumTopNodes;
+		uint32_t NumTreelets;
+		uint64_t DirectoryOffset;
+		uint64_t ResidentOffset;
+		uint64_t ResidentSize;
+	};
+
+	struct TreeletHeader
+	{
+		uint32_t NumNodes;
+		uint32_t NumTriangles;
+	};
+
+	struct NodeRecord
+	{
+		float Bounds[6];
+		uint32_t LeftChild;
+		uint32_t NumPrimitives;
+		uint32_t SplitAxis;
+	};
+
+	struct VertexRecord
+	{
+		float Position[3];
+		float Normal[3];
+		float TexCoord[2];
+	};
+
+	struct TriangleRecord
+	{
+		VertexRecord Corners[3];
+		uint32_t MaterialIndex;
+		uint32_t HasTexCoords;
+	};
+
+	// The map names follow, then the next material
+	struct MaterialRecord
+	{
+		float Diffuse[3];
+		float Emission[3];
+		uint32_t DiffuseMapLength;
+		uint32_t DisplacementMapLength;
+	};
+
+	// The vertices follow, then the indices
+	struct ResidentMeshRecord
+	{
+		uint32_t MaterialIndex;
+		uint32_t NumVertices;
+		uint32_t NumIndices;
+		uint32_t HasTexCoords;
+	};
+
+	// Keeps the treelet of the last closest hit alive, the intersection points into its meshes
+	static thread_local std::shared_ptr<const Treelet> tHitTreelet;
+
+	// Treelets a ray reaches, and the ones left to load, reused across the calls of a thread
+	static thread_local std::vector<TreeletCrossing> tTreelets;
+	static thread_local std::vector<TreeletCrossing> tDeferred;
+
+	template<typename T>
+	static void Append(std::vector<char>& Buffer, const T& Value)
+	{
+		const char* pBytes = reinterpret_cast<const char*>(&Value);
+
+		Buffer.insert(Buffer.end(), pBytes, pBytes + sizeof(T));
+	}
+
+	template<typename T>
+	static T Consume(const std::vector<char>& Buffer, size_t& Cursor)
+	{
+		if (Cursor + sizeof(T) > Buffer.size())
+		{
+			throw std::runtime_error("Truncated out of core page\n");
+		}
+
+		T Value;
+		std::memcpy(&Value, Buffer.data() + Cursor, sizeof(T));
+		Cursor += sizeof(T);
+
+		return Value;
+	}
+
+	static std::string ConsumeString(const std::vector<char>& Buffer, size_t& Cursor, uint32_t Length)
+	{
+		if (Cursor + Length > Buffer.size())
+		{
+			throw std::runtime_error("Truncated out of core page\n");
+		}
+
+		std::string Value(Buffer.data() + Cursor, Length);
+		Cursor += Length;
+
+		return Value;
+	}
+
+	static OutOfCoreHeader ReadHeader(std::ifstream& Input)
+	{
+		OutOfCoreHeader Header;
+		Input.read(reinterpret_cast<char*>(&Header), sizeof(Header));
+
+		if (!Input || std::memcmp(Header.Magic, kOutOfCoreMagic, sizeof(Header.Magic)) != 0 || Header.Version != kOutOfCoreVersion)
+		{
+			throw std::runtime_error("Not an out of core scene file\n");
+		}
+
+		return Header;
+	}
+
+	static NodeRecord ToRecord(const BvhNode& Node)
+	{
+		NodeRecord Record;
+
+		for (int Axis = 0; Axis < 3; Axis++)
+		{
+			Record.Bounds[Axis] = Node.BoundingBox.Bounds[0][Axis];
+			Record.Bounds[Axis + 3] = Node.BoundingBox.Bounds[1][Axis];
+		}
+
+		Record.LeftChild = Node.LeftChild;
+		Record.NumPrimitives = Node.NumPrimitives;
+		Record.SplitAxis = Node.SplitAxis;
+
+		return Record;
+	}
+
+	static void FromRecord(const NodeRecord& Record, BvhNode& Node)
+	{
+		Node.BoundingBox = Aabb(Vector3f(Record.Bounds[0], Record.Bounds[1], Record.Bounds[2]),
+								Vector3f(Record.Bounds[3], Record.Bounds[4], Record.Bounds[5]));
+		Node.LeftChild = Record.LeftChild;
+		Node.NumPrimitives = Record.NumPrimitives;
+		Node.SplitAxis = Record.SplitAxis;
+	}
+
+	// Treelet
+	size_t Treelet::GetSizeInBytes() const
+	{
+		size_t Bytes = sizeof(Treelet) + GetVectorBytes(mNodes) + GetVectorBytes(mMeshes) + GetVectorBytes(mTriangles);
+
+		for (const TriangleMesh& Mesh : mMeshes)
+		{
+			Bytes += Mesh.GetSizeInBytes();
+		}
+
+		return Bytes;
+	}
+
+	bool Treelet::Intersect(const Ray& aRay, Intersection& HitResult) const
+	{
+		unsigned CurrentNode = 0;
+		unsigned ToVisitOffset = 0;
+		unsigned NodesToVisit[64];
+
+		bool HitSomething = false;
+
+		while (true)
+		{
+			const BvhNode& Node = mNodes[CurrentNode];
+
+			if (Node.BoundingBox.Intersect(aRay))
+			{
+				if (Node.NumPrimitives > 0)
+				{
+					for (unsigned Index = 0; Index < Node.NumPrimitives; Index++)
+					{
+						if (mTriangles[Index + Node.LeftChild]->Intersect(aRay, HitResult))
+						{
+							HitSomething = true;
+						}
+					}
+
+					if (ToVisitOffset == 0)
+					{
+						break;
+					}
+
+					CurrentNode = NodesToVisit[--ToVisitOffset];
+				}
+				else
+				{
+					if (aRay.IsDirectionNeg[Node.SplitAxis])
+					{
+						NodesToVisit[ToVisitOffset++] = Node.LeftChild;
+						CurrentNode = Node.LeftChild + 1;
+					}
+					else
+					{
+						NodesToVisit[ToVisitOffset++] = Node.LeftChild + 1;
+						CurrentNode = Node.LeftChild;
+					}
+				}
+			}
+			else
+			{
+				if (ToVisitOffset == 0)
+				{
+					break;
+				}
+
+				CurrentNode = NodesToVisit[--ToVisitOffset];
+			}
+		}
+
+		return HitSomething;
+	}
+
+	// TreeletCache
+	TreeletCache::TreeletCache(std::string_view FileName, std::vector<TreeletPage> Pages, size_t Budget)
+	: mFileName{FileName}, mPages{std::move(Pages)}, mBudget{Budget}
+	{
+		if (!std::ifstream(mFileName, std::ios::binary).is_open())
+		{
+			throw std::runtime_error("Failed to open out of core scene file\n");
+		}
+	}
+
+	bool TreeletCache::IsResident(unsigned TreeletIndex) const
+	{
+		std::lock_guard<std::mutex> Lock(mMutex);
+
+		return mEntries.find(TreeletIndex) != mEntries.end();
+	}
+
+	size_t TreeletCache::GetNumLoads() const
+	{
+		std::lock_guard<std::mutex> Lock(mMutex);
+
+		return mNumLoads;
+	}
+
+	std::shared_ptr<const Treelet> TreeletCache::TryAcquire(unsigned TreeletIndex)
+	{
+		std::lock_guard<std::mutex> Lock(mMutex);
+
+		auto Found = mEntries.find(TreeletIndex);
+
+		if (Found == mEntries.end())
+		{
+			return nullptr;
+		}
+
+		mLru.splice(mLru.begin(), mLru, Found->second.LruPosition);
+
+		return Found->second.Data;
+	}
+
+	std::shared_ptr<const Treelet> TreeletCache::Acquire(unsigned TreeletIndex)
+	{
+		{
+			std::lock_guard<std::mutex> Lock(mMutex);
+
+			auto Found = mEntries.find(TreeletIndex);
+
+			if (Found != mEntries.end())
+			{
+				mLru.splice(mLru.begin(), mLru, Found->second.LruPosition);
+
+				return Found->second.Data;
+			}
+		}
+
+		std::shared_ptr<const Treelet> Loaded = Load(TreeletIndex);
+
+		std::lock_guard<std::mutex> Lock(mMutex);
+
+		auto Found = mEntries.find(TreeletIndex);
+
+		if (Found != mEntries.end())
+		{
+			mLru.splice(mLru.begin(), mLru, Found->second.LruPosition);
+
+			return Found->second.Data;
+		}
+
+		mNumLoads++;
+
+		// the caller gets it either way, the cache only keeps it when the budget allows
+		if (!Evict())
+		{
+			return Loaded;
+		}
+
+		mLru.push_front(TreeletIndex);
+		mEntries.emplace(TreeletIndex, Entry{Loaded, mLru.begin()});
+
+		return Loaded;
+	}
+
+	bool TreeletCache::Evict()
+	{
+		auto Victim = mLru.end();
+
+		// only treelets no caller holds free anything when dropped
+		while (*mLiveBytes > mBudget && Victim != mLru.begin())
+		{
+			--Victim;
+
+			auto Found = mEntries.find(*Victim);
+
+			if (Found->second.Data.use_count() > 1)
+			{
+				continue;
+			}
+
+			mEntries.erase(Found);
+			Victim = mLru.erase(Victim);
+		}
+
+		return *mLiveBytes <= mBudget;
+	}
+
+	std::shared_ptr<const Treelet> TreeletCache::Load(unsigned TreeletIndex) const
+	{
+		const TreeletPage& Page = mPages[TreeletIndex];
+
+		std::vector<char> Buffer(Page.Size);
+
+		// a stream per load, so the reads of different threads do not wait on each other
+		std::ifstream File(mFileName, std::ios::binary);
+
+		File.seekg(static_cast<std::streamoff>(Page.Offset));
+		File.read(Buffer.data(), static_cast<std::streamsize>(Page.Size));
+
+		if (!File)
+		{
+			throw std::runtime_error("Failed to read out of core page\n");
+		}
+
+		size_t Cursor = 0;
+
+		const TreeletHeader Header = Consume<TreeletHeader>(Buffer, Cursor);
+
+		auto NewTreelet = std::make_unique<Treelet>();
+
+		NewTreelet->mNodes.resize(Header.NumNodes);
+
+		for (uint32_t Index = 0; Index < Header.NumNodes; Index++)
+		{
+			FromRecord(Consume<NodeRecord>(Buffer, Cursor), NewTreelet->mNodes[Index]);
+		}
+
+		// one mesh per material, triangles keep their leaf order through mTriangles
+		struct MeshData
+		{
+			std::vector<Vertex> Vertices;
+			std::vector<Vector2f> TexCoords;
+		};
+
+		std::map<std::pair<uint32_t, uint32_t>, unsigned> MeshIndices;
+		std::vector<MeshData> Meshes;
+		std::vector<std::pair<unsigned, unsigned>> Placements(Header.NumTriangles);
+
+		for (uint32_t Index = 0; Index < Header.NumTriangles; Index++)
+		{
+			const TriangleRecord Record = Consume<TriangleRecord>(Buffer, Cursor);
+
+			const auto [Found, Inserted] = MeshIndices.emplace(std::make_pair(Record.MaterialIndex, Record.HasTexCoords), static_cast<unsigned>(Meshes.size()));
+
+			if (Inserted)
+			{
+				Meshes.emplace_back();
+			}
+
+			MeshData& Mesh = Meshes[Found->second];
+
+			Placements[Index] = { Found->second, static_cast<unsigned>(Mesh.Vertices.size() / 3) };
+
+			for (const VertexRecord& Corner : Record.Corners)
+			{
+				Vertex NewVertex;
+				NewVertex.Position = Vector3f(Corner.Position[0], Corner.Position[1], Corner.Position[2]);
+				NewVertex.Normal = Vector3f(Corner.Normal[0], Corner.Normal[1], Corner.Normal[2]);
+
+				Mesh.Vertices.push_back(std::move(NewVertex));
+
+				if (Record.HasTexCoords)
+				{
+					Mesh.TexCoords.emplace_back(Corner.TexCoord[0], Corner.TexCoord[1]);
+				}
+			}
+		}
+
+		NewTreelet->mMeshes.resize(Meshes.size());
+
+		for (const auto& [Key, MeshIndex] : MeshIndices)
+		{
+			std::vector<unsigned> Indices(Meshes[MeshIndex].Vertices.size());
+			std::iota(Indices.begin(), Indices.end(), 0);
+
+			TriangleMesh& Mesh = NewTreelet->mMeshes[MeshIndex];
+
+			Mesh = TriangleMesh(std::move(Meshes[MeshIndex].Vertices), std::move(Indices));
+			Mesh.mTexCoords = std::move(Meshes[MeshIndex].TexCoords);
+			Mesh.SetMaterialIndex(Key.first);
+		}
+
+		NewTreelet->mTriangles.reserve(Header.NumTriangles);
+
+		for (const auto& [MeshIndex, TriangleIndex] : Placements)
+		{
+			NewTreelet->mTriangles.push_back(&NewTreelet->mMeshes[MeshIndex].GetTriangles()[TriangleIndex]);
+		}
+
+		// counted from here until the last holder lets go, cached or not
+		const size_t Bytes = NewTreelet->GetSizeInBytes();
+
+		*mLiveBytes += Bytes;
+
+		return std::shared_ptr<const Treelet>(NewTreelet.release(), [pLiveBytes = mLiveBytes, Bytes](const Treelet* pTreelet)
+		{
+			*pLiveBytes -= Bytes;
+
+			delete pTreelet;
+		});
+	}
+
+	// OutOfCoreScene
+	struct TreeletWriter
+	{
+		TreeletWriter(const Bvh& SourceBvh, std::ofstream& Output, unsigned TreeletPrimitives)
+		: Nodes{SourceBvh.GetNodes()}, Indices{SourceBvh.GetTriangleIndices()}, Triangles{SourceBvh.GetTriangles()}, Output{Output},
+		  SubtreePrimitives(Nodes.size()), TopNodes(1), TreeletPrimitives{std::max(TreeletPrimitives, 1u)}
+		{
+		}
+
+		const std::vector<BvhNode>& Nodes;
+		const std::vector<unsigned>& Indices;
+		const std::vector<Triangle*>& Triangles;
+		std::ofstream& Output;
+		std::vector<unsigned> SubtreePrimitives;
+		std::vector<BvhNode> TopNodes;
+		std::vector<TreeletPage> Pages;
+		unsigned TreeletPrimitives;
+		uint32_t NumMaterials = 0;	// one past the highest material index written
+
+		unsigned CountPrimitives(unsigned NodeIndex)
+		{
+			const BvhNode& Node = Nodes[NodeIndex];
+
+			if (Node.NumPrimitives > 0)
+			{
+				return SubtreePrimitives[NodeIndex] = Node.NumPrimitives;
+			}
+
+			return SubtreePrimitives[NodeIndex] = CountPrimitives(Node.LeftChild) + CountPrimitives(Node.LeftChild + 1);
+		}
+
+		void CopySubtree(unsigned NodeIndex, unsigned LocalIndex, std::vector<BvhNode>& LocalNodes, std::vector<unsigned>& LocalTriangles)
+		{
+			const BvhNode& Node = Nodes[NodeIndex];
+
+			LocalNodes[LocalIndex].BoundingBox = Aabb(Node.BoundingBox.Bounds[0], Node.BoundingBox.Bounds[1]);
+
+			if (Node.NumPrimitives > 0)
+			{
+				LocalNodes[LocalIndex].LeftChild = static_cast<unsigned>(LocalTriangles.size());
+				LocalNodes[LocalIndex].NumPrimitives = Node.NumPrimitives;
+
+				for (unsigned Index = 0; Index < Node.NumPrimitives; Index++)
+				{
+					LocalTriangles.push_back(Indices[Node.LeftChild + Index]);
+				}
+
+				return;
+			}
+
+			const unsigned LeftChildIndex = static_cast<unsigned>(LocalNodes.size());
+
+			LocalNodes.emplace_back();
+			LocalNodes.emplace_back();
+
+			LocalNodes[LocalIndex].LeftChild = LeftChildIndex;
+			LocalNodes[LocalIndex].SplitAxis = Node.SplitAxis;
+
+			CopySubtree(Node.LeftChild, LeftChildIndex, LocalNodes, LocalTriangles);
+			CopySubtree(Node.LeftChild + 1, LeftChildIndex + 1, LocalNodes, LocalTriangles);
+		}
+
+		unsigned WriteTreelet(unsigned NodeIndex)
+		{
+			std::vector<BvhNode> LocalNodes(1);
+			std::vector<unsigned> LocalTriangles;
+
+			CopySubtree(NodeIndex, 0, LocalNodes, LocalTriangles);
+
+			std::vector<char> Buffer;
+
+			Append(Buffer, TreeletHeader{ static_cast<uint32_t>(LocalNodes.size()), static_cast<uint32_t>(LocalTriangles.size()) });
+
+			for (const BvhNode& Node : LocalNodes)
+			{
+				Append(Buffer, ToRecord(Node));
+			}
+
+			for (unsigned TriangleIndex : LocalTriangles)
+			{
+				const Triangle& aTriangle = *Triangles[TriangleIndex];
+
+				TriangleRecord Record;
+				Record.MaterialIndex = aTriangle.pMesh->GetMaterialIndex();
+				Record.HasTexCoords = aTriangle.pMesh->HasTexCoords();
+
+				NumMaterials = std::max(NumMaterials, Record.MaterialIndex + 1);
+
+				for (unsigned Corner = 0; Corner < 3; Corner++)
+				{
+					const Vector3f Position = aTriangle.GetPosition(Corner);
+					const Vector3f Normal = aTriangle.GetNormal(Corner);
+					const Vector2f TexCoord = aTriangle.GetTexCoord(Corner);
+
+					Record.Corners[Corner] = { { Position.x(), Position.y(), Position.z() }, { Normal.x(), Normal.y(), Normal.z() }, { TexCoord.x(), TexCoord.y() } };
+				}
+
+				Append(Buffer, Record);
+			}
+
+			const uint64_t Offset = static_cast<uint64_t>(Output.tellp());
+
+			Output.write(Buffer.data(), static_cast<std::streamsize>(Buffer.size()));
+
+			// pad so each page starts on an aligned boundary
+			const uint64_t Padding = (kPageAlignment - Buffer.size() % kPageAlignment) % kPageAlignment;
+
+			for (uint64_t Index = 0; Index < Padding; Index++)
+			{
+				Output.put(0);
+			}
+
+			Pages.push_back(TreeletPage{ Offset, Buffer.size() });
+
+			return static_cast<unsigned>(Pages.size() - 1);
+		}
+
+		// Top-level leaves hold a single treelet index in LeftChild
+		void BuildTopLevel(unsigned NodeIndex, unsigned TopIndex)
+		{
+			const BvhNode& Node = Nodes[NodeIndex];
+
+			TopNodes[TopIndex].BoundingBox = Aabb(Node.BoundingBox.Bounds[0], Node.BoundingBox.Bounds[1]);
+
+			if (Node.NumPrimitives > 0 || SubtreePrimitives[NodeIndex] <= TreeletPrimitives)
+			{
+				TopNodes[TopIndex].LeftChild = WriteTreelet(NodeIndex);
+				TopNodes[TopIndex].NumPrimitives = 1;
+
+				return;
+			}
+
+			const unsigned LeftChildIndex = static_cast<unsigned>(TopNodes.size());
+
+			TopNodes.emplace_back();
+			TopNodes.emplace_back();
+
+			TopNodes[TopIndex].LeftChild = LeftChildIndex;
+			TopNodes[TopIndex].SplitAxis = Node.SplitAxis;
+
+			BuildTopLevel(Node.LeftChild, LeftChildIndex);
+			BuildTopLevel(Node.LeftChild + 1, LeftChildIndex + 1);
+		}
+	};
+
+	void OutOfCoreScene::Bake(const Scene& aScene, std::string_view FileName, unsigned TreeletPrimitives)
+	{
+		Bake(aScene.GetBvh(), FileName, TreeletPrimitives);
+	}
+
+	void OutOfCoreScene::Bake(const Bvh& SourceBvh, std::string_view FileName, unsigned TreeletPrimitives, const ObjScene& Residents)
+	{
+		std::ofstream Output(FileName.data(), std::ios::binary | std::ios::trunc);
+
+		if (!Output.is_open())
+		{
+			throw std::runtime_error("Failed to open out of core scene file for writing\n");
+		}
+
+		TreeletWriter Writer(SourceBvh, Output, TreeletPrimitives);
+
+		// header is rewritten once the directory offset is known
+		OutOfCoreHeader Header{};
+		std::memcpy(Header.Magic, kOutOfCoreMagic, sizeof(Header.Magic));
+		Header.Version = kOutOfCoreVersion;
+
+		Output.write(reinterpret_cast<const char*>(&Header), sizeof(Header));
+		Output.seekp(static_cast<std::streamoff>(kPageAlignment));
+
+		Writer.CountPrimitives(0);
+		Writer.BuildTopLevel(0, 0);
+
+		Header.NumTopNodes = static_cast<uint32_t>(Writer.TopNodes.size());
+		Header.NumTreelets = static_cast<uint32_t>(Writer.Pages.size());
+		Header.DirectoryOffset = static_cast<uint64_t>(Output.tellp());
+
+		std::vector<char> Directory;
+
+		for (const BvhNode& Node : Writer.TopNodes)
+		{
+			Append(Directory, ToRecord(Node));
+		}
+
+		for (const TreeletPage& Page : Writer.Pages)
+		{
+			Append(Directory, Page);
+		}
+
+		Output.write(Directory.data(), static_cast<std::streamsize>(Directory.size()));
+
+		// every material index a treelet uses gets a material, the default one when the residents have none
+		std::vector<char> Resident;
+
+		const uint32_t NumMaterials = std::max(static_cast<uint32_t>(Residents.Materials.size()), Writer.NumMaterials);
+
+		Append(Resident, NumMaterials);
+
+		for (uint32_t MaterialIndex = 0; MaterialIndex < NumMaterials; MaterialIndex++)
+		{
+			const bool IsResident = MaterialIndex < Residents.Materials.size();
+			const Material aMaterial = IsResident ? Residents.Materials[MaterialIndex] : Material{};
+			const std::string DiffuseMap = IsResident ? Residents.DiffuseMaps[MaterialIndex] : std::string();
+			const std::string DisplacementMap = IsResident ? Residents.DisplacementMaps[MaterialIndex] : std::string();
+
+			MaterialRecord Record = { { aMaterial.Diffuse.x(), aMaterial.Diffuse.y(), aMaterial.Diffuse.z() },
+									  { aMaterial.Emission.x(), aMaterial.Emission.y(), aMaterial.Emission.z() },
+									  static_cast<uint32_t>(DiffuseMap.size()), static_cast<uint32_t>(DisplacementMap.size()) };
+
+			Append(Resident, Record);
+
+			Resident.insert(Resident.end(), DiffuseMap.begin(), DiffuseMap.end());
+			Resident.insert(Resident.end(), DisplacementMap.begin(), DisplacementMap.end());
+		}
+
+		Append(Resident, static_cast<uint32_t>(Residents.Meshes.size()));
+
+		for (const ObjMesh& Mesh : Residents.Meshes)
+		{
+			Append(Resident, ResidentMeshRecord{ Mesh.MaterialIndex, static_cast<uint32_t>(Mesh.Vertices.size()), static_cast<uint32_t>(Mesh.Indices.size()), !Mesh.TexCoords.empty() });
+
+			for (size_t Index = 0; Index < Mesh.Vertices.size(); Index++)
+			{
+				const Vertex& aVertex = Mesh.Vertices[Index];
+				const Vector2f TexCoord = Mesh.TexCoords.empty() ? Vector2f::Zero() : Mesh.TexCoords[Index];
+
+				Append(Resident, VertexRecord{ { aVertex.Position.x(), aVertex.Position.y(), aVertex.Position.z() },
+											   { aVertex.Normal.x(), aVertex.Normal.y(), aVertex.Normal.z() }, { TexCoord.x(), TexCoord.y() } });
+			}
+
+			for (unsigned Index : Mesh.Indices)
+			{
+				Append(Resident, static_cast<uint32_t>(Index));
+			}
+		}
+
+		Header.ResidentOffset = static_cast<uint64_t>(Output.tellp());
+		Header.ResidentSize = Resident.size();
+
+		Output.write(Resident.data(), static_cast<std::streamsize>(Resident.size()));
+
+		Output.seekp(0);
+		Output.write(reinterpret_cast<const char*>(&Header), sizeof(Header));
+
+		if (!Output)
+		{
+			throw std::runtime_error("Failed to write out of core scene file\n");
+		}
+	}
+
+	bool OutOfCoreScene::IsBakedFile(std::string_view FileName)
+	{
+		std::ifstream Input(std::string(FileName), std::ios::binary);
+
+		char Magic[sizeof(kOutOfCoreMagic)];
+		Input.read(Magic, sizeof(Magic));
+
+		return Input && std::memcmp(Magic, kOutOfCoreMagic, sizeof(Magic)) == 0;
+	}
+
+	ObjScene OutOfCoreScene::ReadResidents(std::string_view FileName)
+	{
+		std::ifstream Input(std::string(FileName), std::ios::binary);
+
+		if (!Input.is_open())
+		{
+			throw std::runtime_error("Failed to open out of core scene file\n");
+		}
+
+		const OutOfCoreHeader Header = ReadHeader(Input);
+
+		std::vector<char> Buffer(Header.ResidentSize);
+
+		Input.seekg(static_cast<std::streamoff>(Header.ResidentOffset));
+		Input.read(Buffer.data(), static_cast<std::streamsize>(Buffer.size()));
+
+		if (!Input)
+		{
+			throw std::runtime_error("Failed to read out of core resident meshes\n");
+		}
+
+		ObjScene Result;
+		size_t Cursor = 0;
+
+		const uint32_t NumMaterials = Consume<uint32_t>(Buffer, Cursor);
+
+		for (uint32_t MaterialIndex = 0; MaterialIndex < NumMaterials; MaterialIndex++)
+		{
+			const MaterialRecord Record = Consume<MaterialRecord>(Buffer, Cursor);
+
+			Material& aMaterial = Result.Materials.emplace_back();
+			aMaterial.Diffuse = Vector3f(Record.Diffuse[0], Record.Diffuse[1], Record.Diffuse[2]);
+			aMaterial.Emission = Vector3f(Record.Emission[0], Record.Emission[1], Record.Emission[2]);
+
+			Result.DiffuseMaps.push_back(ConsumeString(Buffer, Cursor, Record.DiffuseMapLength));
+			Result.DisplacementMaps.push_back(ConsumeString(Buffer, Cursor, Record.DisplacementMapLength));
+		}
+
+		const uint32_t NumMeshes = Consume<uint32_t>(Buffer, Cursor);
+
+		for (uint32_t MeshIndex = 0; MeshIndex < NumMeshes; MeshIndex++)
+		{
+			const ResidentMeshRecord Record = Consume<ResidentMeshRecord>(Buffer, Cursor);
+
+			ObjMesh& Mesh = Result.Meshes.emplace_back();
+			Mesh.MaterialIndex = Record.MaterialIndex;
+			Mesh.HasNormals = true;
+
+			Mesh.Vertices.resize(Record.NumVertices);
+
+			for (Vertex& aVertex : Mesh.Vertices)
+			{
+				const VertexRecord Corner = Consume<VertexRecord>(Buffer, Cursor);
+
+				aVertex.Position = Vector3f(Corner.Position[0], Corner.Position[1], Corner.Position[2]);
+				aVertex.Normal = Vector3f(Corner.Normal[0], Corner.Normal[1], Corner.Normal[2]);
+
+				if (Record.HasTexCoords)
+				{
+					Mesh.TexCoords.emplace_back(Corner.TexCoord[0], Corner.TexCoord[1]);
+				}
+			}
+
+			Mesh.Indices.resize(Record.NumIndices);
+
+			for (unsigned& Index : Mesh.Indices)
+			{
+				Index = Consume<uint32_t>(Buffer, Cursor);
+			}
+		}
+
+		return Result;
+	}
+
+	OutOfCoreScene::OutOfCoreScene(std::string_view FileName, const OutOfCoreOptions& Options)
+	{
+		std::ifstream Input(FileName.data(), std::ios::binary);
+
+		if (!Input.is_open())
+		{
+			throw std::runtime_error("Failed to open out of core scene file\n");
+		}
+
+		const OutOfCoreHeader Header = ReadHeader(Input);
+
+		const size_t TopLevelBytes = Header.NumTopNodes * sizeof(BvhNode) + Header.NumTreelets * sizeof(TreeletPage);
+
+		if (TopLevelBytes >= Options.MemoryBudget)
+		{
+			throw std::runtime_error("Out of core top-level tree exceeds the memory budget\n");
+		}
+
+		std::vector<char> Directory(Header.NumTopNodes * sizeof(NodeRecord) + Header.NumTreelets * sizeof(TreeletPage));
+
+		Input.seekg(static_cast<std::streamoff>(Header.DirectoryOffset));
+		Input.read(Directory.data(), static_cast<std::streamsize>(Directory.size()));
+
+		if (!Input)
+		{
+			throw std::runtime_error("Failed to read out of core directory\n");
+		}
+
+		size_t Cursor = 0;
+
+		mTopNodes.resize(Header.NumTopNodes);
+
+		for (auto& Node : mTopNodes)
+		{
+			FromRecord(Consume<NodeRecord>(Directory, Cursor), Node);
+		}
+
+		std::vector<TreeletPage> Pages(Header.NumTreelets);
+
+		for (auto& Page : Pages)
+		{
+			Page = Consume<TreeletPage>(Directory, Cursor);
+		}
+
+		mCache = std::make_unique<TreeletCache>(FileName, std::move(Pages), Options.MemoryBudget - TopLevelBytes);
+	}
+
+	size_t OutOfCoreScene::GetResidentBytes() const
+	{
+		return mTopNodes.capacity() * sizeof(BvhNode) + mCache->GetResidentBytes();
+	}
+
+	void OutOfCoreScene::CollectTreelets(const Ray& aRay, std::vector<TreeletCrossing>& Treelets) const
+	{
+		unsigned CurrentNode = 0;
+		unsigned ToVisitOffset = 0;
+		unsigned NodesToVisit[64];
+
+		while (true)
+		{
+			const BvhNode& Node = mTopNodes[CurrentNode];
+
+			Float tEntry;
+
+			if (Node.BoundingBox.Intersect(aRay, tEntry))
+			{
+				if (Node.NumPrimitives > 0)
+				{
+					Treelets.push_back({ Node.LeftChild, tEntry });
+
+					if (ToVisitOffset == 0)
+					{
+						break;
+					}
+
+					CurrentNode = NodesToVisit[--ToVisitOffset];
+				}
+				else
+				{
+					if (aRay.IsDirectionNeg[Node.SplitAxis])
+					{
+						NodesToVisit[ToVisitOffset++] = Node.LeftChild;
+						CurrentNode = Node.LeftChild + 1;
+					}
+					else
+					{
+						NodesToVisit[ToVisitOffset++] = Node.LeftChild + 1;
+						CurrentNode = Node.LeftChild;
+					}
+				}
+			}
+			else
+			{
+				if (ToVisitOffset == 0)
+				{
+					break;
+				}
+
+				CurrentNode = NodesToVisit[--ToVisitOffset];
+			}
+		}
+
+		std::sort(Treelets.begin(), Treelets.end(), [](const TreeletCrossing& A, const TreeletCrossing& B) { return A.tEntry < B.tEntry; });
+	}
+
+	bool OutOfCoreScene::Intersect(const Ray& aRay, Intersection& HitResult) const
+	{
+		tTreelets.clear();
+		tDeferred.clear();
+
+		CollectTreelets(aRay, tTreelets);
+
+		std::shared_ptr<const Treelet> pHitTreelet;
+
+		// the cached treelets shorten the ray before anything is read
+		for (const TreeletCrossing& Crossing : tTreelets)
+		{
+			if (Crossing.tEntry >= aRay.tMax)
+			{
+				break;
+			}
+
+			std::shared_ptr<const Treelet> pTreelet = mCache->TryAcquire(Crossing.Index);
+
+			if (!pTreelet)
+			{
+				tDeferred.push_back(Crossing);
+			}
+			else if (pTreelet->Intersect(aRay, HitResult))
+			{
+				pHitTreelet = std::move(pTreelet);
+			}
+		}
+
+		for (const TreeletCrossing& Crossing : tDeferred)
+		{
+			if (Crossing.tEntry >= aRay.tMax)
+			{
+				break;
+			}
+
+			std::shared_ptr<const Treelet> pTreelet = mCache->Acquire(Crossing.Index);
+
+			if (pTreelet->Intersect(aRay, HitResult))
+			{
+				pHitTreelet = std::move(pTreelet);
+			}
+		}
+
+		if (!pHitTreelet)
+		{
+			return false;
+		}
+
+		tHitTreelet = std::move(pHitTreelet);
+
+		return true;
+	}
+
+	// Any hit will do, so only an unoccluded ray reads every treelet it crosses
+	bool OutOfCoreScene::Occluded(const Ray& aRay) const
+	{
+		tTreelets.clear();
+		tDeferred.clear();
+
+		CollectTreelets(aRay, tTreelets);
+
+		Intersection HitResult;
+
+		for (const TreeletCrossing& Crossing : tTreelets)
+		{
+			std::shared_ptr<const Treelet> pTreelet = mCache->TryAcquire(Crossing.Index);
+
+			if (!pTreelet)
+			{
+				tDeferred.push_back(Crossing);
+			}
+			else if (pTreelet->Intersect(aRay, HitResult))
+			{
+				return true;
+			}
+		}
+
+		for (const TreeletCrossing& Crossing : tDeferred)
+		{
+			if (mCache->Acquire(Crossing.Index)->Intersect(aRay, HitResult))
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void OutOfCoreScene::IntersectBatch(const std::vector<Ray>& Rays, std::vector<PagedHit>& Hits) const
+	{
+		Hits.assign(Rays.size(), PagedHit{});
+
+		// queued rays keep where they enter, the ones a closer hit has passed by then are dropped
+		std::unordered_map<unsigned, std::vector<std::pair<unsigned, Float>>> Queues;
+		std::vector<TreeletCrossing> Treelets;
+
+		for (size_t RayIndex = 0; RayIndex < Rays.size(); RayIndex++)
+		{
+			Treelets.clear();
+
+			CollectTreelets(Rays[RayIndex], Treelets);
+
+			for (const TreeletCrossing& Crossing : Treelets)
+			{
+				if (Crossing.tEntry >= Rays[RayIndex].tMax)
+				{
+					break;
+				}
+
+				std::shared_ptr<const Treelet> pTreelet = mCache->TryAcquire(Crossing.Index);
+
+				if (!pTreelet)
+				{
+					Queues[Crossing.Index].emplace_back(static_cast<unsigned>(RayIndex), Crossing.tEntry);
+				}
+				else if (pTreelet->Intersect(Rays[RayIndex], Hits[RayIndex].Result))
+				{
+					Hits[RayIndex].pTreelet = std::move(pTreelet);
+				}
+			}
+		}
+
+		// load in file order so the reads stream through the file
+		std::vector<unsigned> LoadOrder;
+		LoadOrder.reserve(Queues.size());
+
+		for (const auto& Queue : Queues)
+		{
+			LoadOrder.push_back(Queue.first);
+		}
+
+		std::sort(LoadOrder.begin(), LoadOrder.end(), [this](unsigned A, unsigned B)
+		{
+			return mCache->GetPageOffset(A) < mCache->GetPageOffset(B);
+		});
+
+		for (unsigned TreeletIndex : LoadOrder)
+		{
+			std::vector<std::pair<unsigned, Float>>& Queue = Queues[TreeletIndex];
+
+			std::erase_if(Queue, [&](const std::pair<unsigned, Float>& Queued) { return Queued.second >= Rays[Queued.first].tMax; });
+
+			if (Queue.empty())
+			{
+				continue;
+			}
+
+			std::shared_ptr<const Treelet> pTreelet = mCache->Acquire(TreeletIndex);
+
+			for (const auto& [RayIndex, tEntry] : Queue)
+			{
+				if (pTreelet->Intersect(Rays[RayIndex], Hits[RayIndex].Result))
+				{
+					Hits[RayIndex].pTreelet = pTreelet;
+				}
+			}
+		}
+
+		for (size_t RayIndex = 0; RayIndex < Rays.size(); RayIndex++)
+		{
+			if (Hits[RayIndex].pTreelet)
+			{
+				Hits[RayIndex].t = Rays[RayIndex].tMax;
+			}
+		}
+	}
+
+} // namespace PathTracer
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <Pch.h>
+#include <Ray.h>
+#include <Shape.h>
+#include <Scene.h>
+#include <Acceleration.h>
+#include <ObjLoader.h>
+
+namespace PathTracer
+{
+	// A self contained BVH subtree with its own copy of the triangles, one mesh
+	// per material. Leaves index into mTriangles
+	struct Treelet
+	{
+		Treelet() = default;
+
+		Treelet(const Treelet&) = delete;
+		Treelet& operator=(const Treelet&) = delete;
+
+		Treelet(Treelet&&) = default;
+		Treelet& operator=(Treelet&&) = default;
+
+		~Treelet() = default;
+
+		bool Intersect(const Ray& aRay, Intersection& HitResult) const;
+
+		size_t GetSizeInBytes() const;
+
+		std::vector<BvhNode> mNodes;
+		std::vector<TriangleMesh> mMeshes;
+		std::vector<const Triangle*> mTriangles;
+	};
+
+	struct TreeletPage
+	{
+		uint64_t Offset;
+		uint64_t Size;
+	};
+
+	// A treelet a ray reaches, tEntry is where it enters the treelet's box
+	struct TreeletCrossing
+	{
+		unsigned Index;
+		Float tEntry;
+	};
+
+	// Bounded LRU cache of treelets read from the paged scene file. Pages are read
+	// outside the lock, a racing load of the same treelet is dropped. Treelets a
+	// caller still holds count against the budget until they are released
+	class TreeletCache
+	{
+	public:
+		TreeletCache(std::string_view FileName, std::vector<TreeletPage> Pages, size_t Budget);
+
+		TreeletCache(const TreeletCache&) = delete;
+		TreeletCache& operator=(const TreeletCache&) = delete;
+
+		~TreeletCache() = default;
+
+		// When the held treelets leave no room the treelet comes back uncached
+		std::shared_ptr<const Treelet> Acquire(unsigned TreeletIndex);
+
+		// Null unless the treelet is cached, never reads the file
+		std::shared_ptr<const Treelet> TryAcquire(unsigned TreeletIndex);
+
+		bool IsResident(unsigned TreeletIndex) const;
+
+		uint64_t GetPageOffset(unsigned TreeletIndex) const { return mPages[TreeletIndex].Offset; }
+
+		// Every treelet alive, cached or not
+		size_t GetResidentBytes() const { return *mLiveBytes; }
+
+		size_t GetNumLoads() const;
+
+	private:
+		std::shared_ptr<const Treelet> Load(unsigned TreeletIndex) const;
+
+		// False when only treelets held elsewhere are left to evict
+		bool Evict();
+
+		struct Entry
+		{
+			std::shared_ptr<const Treelet> Data;
+			std::list<unsigned>::iterator LruPosition;
+		};
+
+		mutable std::mutex mMutex;
+		std::string mFileName;
+		std::vector<TreeletPage> mPages;
+		std::unordered_map<unsigned, Entry> mEntries;
+		std::list<unsigned> mLru;
+		size_t mBudget;
+		size_t mNumLoads = 0;
+
+		// shared with the treelets, which may outlive the cache in a thread's last hit
+		std::shared_ptr<std::atomic<size_t>> mLiveBytes = std::make_shared<std::atomic<size_t>>(0);
+	};
+
+	// Scene whose geometry lives in a paged file on disk. Only the top levels of
+	// the BVH stay in memory, each top-level leaf references one treelet.
+	class OutOfCoreScene
+	{
+	public:
+		OutOfCoreScene(std::string_view FileName, const OutOfCoreOptions& Options = {});
+
+		OutOfCoreScene(const OutOfCoreScene&) = delete;
+		OutOfCoreScene& operator=(const OutOfCoreScene&) = delete;
+
+		~OutOfCoreScene() = default;
+
+		// Writes the triangles and BVH of an in-memory scene as a paged file
+		static void Bake(const Scene& aScene, std::string_view FileName, unsigned TreeletPrimitives = OutOfCoreOptions{}.TreeletPrimitives);
+
+		// Same for any BVH, the triangles keep their material and texture coordinates. The
+		// residents are what stays in memory, stored too so the file opens without its source
+		static void Bake(const Bvh& SourceBvh, std::string_view FileName, unsigned TreeletPrimitives = OutOfCoreOptions{}.TreeletPrimitives,
+						 const ObjScene& Residents = {});
+
+		static bool IsBakedFile(std::string_view FileName);
+
+		// Materials with their map paths and the resident meshes, one material for each index the treelets use
+		static ObjScene ReadResidents(std::string_view FileName);
+
+		// Loads missing treelets synchronously, the cached ones are tested first and
+		// a treelet entered past the closest hit so far is never read. A hit stays
+		// valid until the calling thread's next Intersect, which keeps its treelet alive until then
+		bool Intersect(const Ray& aRay, Intersection& HitResult) const;
+
+		bool Occluded(const Ray& aRay) const;
+
+		// Rays reaching non resident treelets are queued per treelet and
+		// processed once the treelet is loaded, so every treelet is read at most once per batch
+		void IntersectBatch(const std::vector<Ray>& Rays, std::vector<PagedHit>& Hits) const;
+
+		size_t GetResidentBytes() const;
+
+		size_t GetNumTreeletLoads() const { return mCache->GetNumLoads(); }
+
+	private:
+		// Sorted near to far
+		void CollectTreelets(const Ray& aRay, std::vector<TreeletCrossing>& Treelets) const;
+
+		std::vector<BvhNode> mTopNodes;
+		std::unique_ptr<TreeletCache> mCache;
+	};
+
+} // namespace PathTracer
@@ -0,0 +1,352 @@
+#pragma once
+
+#include <Pch.h>
+#include <Numa.h>
+
+namespace PathTracer
+{
+	inline std::atomic<unsigned>& GetWorkerThreadLimit()
+	{
+		static std::atomic<unsigned> Limit = 0;
+
+		return Limit;
+	}
+
+	// Caps the parallel loops started afterwards, 0 goes back to every hardware thread
+	inline void SetNumWorkerThreads(unsigned NumThreads)
+	{
+		GetWorkerThreadLimit() = NumThreads;
+	}
+
+	inline unsigned GetNumWorkerThreads()
+	{
+		const unsigned Limit = GetWorkerThreadLimit();
+
+		return Limit > 0 ? Limit : std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	// Threads kept alive across parallel loops. They start on first use and grow
+	// to the most helpers any loop asked for, loops from several threads share
+	// one queue. A loop run on a pool thread stays on that thread, the outer
+	// loop already keeps the others busy
+	class WorkerPool
+	{
+	public:
+		static WorkerPool& Get()
+		{
+			static WorkerPool Pool;
+
+			return Pool;
+		}
+
+		WorkerPool(const WorkerPool&) = delete;
+		WorkerPool& operator=(const WorkerPool&) = delete;
+
+		~WorkerPool()
+		{
+			{
+				std::lock_guard<std::mutex> Lock(mMutex);
+				mStopping = true;
+			}
+
+			mWorkAvailable.notify_all();
+
+			for (auto& Thread : mThreads)
+			{
+				Thread.join();
+			}
+		}
+
+		static bool IsWorkerThread() { return tIsWorker; }
+
+		// Runs Helper(Index) for every index in [0, NumHelpers) on pool threads while
+		// the calling thread runs Caller. Helpers still queued once Caller returns are
+		// dropped, so neither may wait for the other and Helper must not throw
+		template<typename CallerType>
+		void Run(unsigned NumHelpers, const std::function<void(unsigned)>& Helper, CallerType&& Caller)
+		{
+			Batch Work(Helper, NumHelpers);
+
+			{
+				std::lock_guard<std::mutex> Lock(mMutex);
+
+				while (mThreads.size() < NumHelpers)
+				{
+					mThreads.emplace_back(&WorkerPool::RunWorker, this);
+				}
+
+				for (unsigned Index = 0; Index < NumHelpers; Index++)
+				{
+					mQueue.push_back({&Work, Index});
+				}
+			}
+
+			mWorkAvailable.notify_all();
+
+			std::exception_ptr CallerError;
+
+			try
+			{
+				Caller();
+			}
+			catch (...)
+			{
+				CallerError = std::current_exception();
+			}
+
+			{
+				std::lock_guard<std::mutex> Lock(mMutex);
+
+				const size_t NumDropped = std::erase_if(mQueue, [&](const Task& Queued) { return Queued.pWork == &Work; });
+
+				std::lock_guard<std::mutex> WorkLock(Work.Mutex);
+				Work.Remaining -= static_cast<unsigned>(NumDropped);
+			}
+
+			{
+				std::unique_lock<std::mutex> WorkLock(Work.Mutex);
+				Work.Done.wait(WorkLock, [&]() { return Work.Remaining == 0; });
+			}
+
+			if (CallerError)
+			{
+				std::rethrow_exception(CallerError);
+			}
+		}
+
+	private:
+		struct Batch
+		{
+			Batch(const std::function<void(unsigned)>& Helper, unsigned NumHelpers)
+			: pHelper{&Helper}, Remaining{NumHelpers}
+			{
+			}
+
+			const std::function<void(unsigned)>* pHelper;
+			unsigned Remaining;
+			std::mutex Mutex;
+			std::condition_variable Done;
+		};
+
+		struct Task
+		{
+			Batch* pWork;
+			unsigned Index;
+		};
+
+		WorkerPool() = default;
+
+		void RunWorker()
+		{
+			tIsWorker = true;
+
+			while (true)
+			{
+				Task Next;
+
+				{
+					std::unique_lock<std::mutex> Lock(mMutex);
+
+					mWorkAvailable.wait(Lock, [&]() { return mStopping || !mQueue.empty(); });
+
+					if (mQueue.empty())
+					{
+						return;
+					}
+
+					Next = mQueue.front();
+					mQueue.pop_front();
+				}
+
+				(*Next.pWork->pHelper)(Next.Index);
+
+				// the caller may free the batch as soon as the lock is let go
+				std::lock_guard<std::mutex> WorkLock(Next.pWork->Mutex);
+
+				if (--Next.pWork->Remaining == 0)
+				{
+					Next.pWork->Done.notify_all();
+				}
+			}
+		}
+
+		static inline thread_local bool tIsWorker = false;
+
+		std::mutex mMutex;
+		std::condition_variable mWorkAvailable;
+		std::deque<Task> mQueue;
+		std::vector<std::thread> mThreads;
+		bool mStopping = false;
+	};
+
+	// Runs Function(Index) for every index in [0, Count) across the worker threads
+	template<typename FunctionType>
+	void ParallelFor(size_t Count, FunctionType&& Function)
+	{
+		const unsigned NumThreads = static_cast<unsigned>(std::min<size_t>(GetNumWorkerThreads(), Count));
+
+		if (NumThreads <= 1 || WorkerPool::IsWorkerThread())
+		{
+			for (size_t Index = 0; Index < Count; Index++)
+			{
+				Function(Index);
+			}
+
+			return;
+		}
+
+		std::atomic<size_t> NextIndex = 0;
+		std::exception_ptr FirstError;
+		std::mutex ErrorMutex;
+
+		auto Worker = [&]()
+		{
+			try
+			{
+				for (size_t Index = NextIndex++; Index < Count; Index = NextIndex++)
+				{
+					Function(Index);
+				}
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> Lock(ErrorMutex);
+
+				if (!FirstError)
+				{
+					FirstError = std::current_exception();
+				}
+
+				NextIndex = Count;
+			}
+		};
+
+		// the calling thread keeps its affinity, it is worker 0 only for the duration
+		WorkerPool::Get().Run(NumThreads - 1, [&](unsigned Helper)
+		{
+			if (IsThreadPinningEnabled())
+			{
+				PinWorkerThread(Helper + 1);
+			}
+			else
+			{
+				UnpinCurrentThread();
+			}
+
+			Worker();
+		}, Worker);
+
+		if (FirstError)
+		{
+			std::rethrow_exception(FirstError);
+		}
+	}
+
+	// Runs Work(Index) on worker threads while the calling thread runs
+	// Consume(Index) in index order as soon as each item is finished
+	template<typename WorkType, typename ConsumeType>
+	void ParallelForOrdered(size_t Count, WorkType&& Work, ConsumeType&& Consume)
+	{
+		const unsigned NumThreads = static_cast<unsigned>(std::min<size_t>(GetNumWorkerThreads(), Count));
+
+		if (NumThreads <= 1 || WorkerPool::IsWorkerThread())
+		{
+			for (size_t Index = 0; Index < Count; Index++)
+			{
+				Work(Index);
+				Consume(Index);
+			}
+
+			return;
+		}
+
+		std::atomic<size_t> NextIndex = 0;
+		std::exception_ptr FirstError;
+		std::vector<char> Finished(Count, 0);
+		std::mutex FinishedMutex;
+		std::condition_variable FinishedSignal;
+
+		auto Worker = [&]()
+		{
+			for (size_t Index = NextIndex++; Index < Count; Index = NextIndex++)
+			{
+				try
+				{
+					Work(Index);
+				}
+				catch (...)
+				{
+					std::lock_guard<std::mutex> Lock(FinishedMutex);
+
+					if (!FirstError)
+					{
+						FirstError = std::current_exception();
+					}
+				}
+
+				{
+					std::lock_guard<std::mutex> Lock(FinishedMutex);
+					Finished[Index] = 1;
+				}
+
+				FinishedSignal.notify_one();
+			}
+		};
+
+		std::exception_ptr ConsumeError;
+
+		auto ConsumeInOrder = [&]()
+		{
+			try
+			{
+				for (size_t Index = 0; Index < Count; Index++)
+				{
+					std::unique_lock<std::mutex> Lock(FinishedMutex);
+
+					FinishedSignal.wait(Lock, [&]() { return Finished[Index] != 0; });
+
+					if (FirstError)
+					{
+						break;
+					}
+
+					Lock.unlock();
+
+					Consume(Index);
+				}
+			}
+			catch (...)
+			{
+				ConsumeError = std::current_exception();
+			}
+
+			// stop handing out work once anything failed
+			NextIndex = Count;
+		};
+
+		WorkerPool::Get().Run(NumThreads, [&](unsigned Helper)
+		{
+			if (IsThreadPinningEnabled())
+			{
+				PinWorkerThread(Helper);
+			}
+			else
+			{
+				UnpinCurrentThread();
+			}
+
+			Worker();
+		}, ConsumeInOrder);
+
+		if (ConsumeError)
+		{
+			std::rethrow_exception(ConsumeError);
+		}
+
+		if (FirstError)
+		{
+			std::rethrow_exception(FirstError);
+		}
+	}
+
+} // namespace PathTracer
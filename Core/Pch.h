@@ -7,6 +7,7 @@
 
 #include <Eigen/Core>
 #include <Eigen/Geometry>
+#include <Eigen/Eigenvalues>
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -18,7 +19,11 @@
 #include <array>
 #include <string>
 #include <string_view>
+#include <chrono>
+#include <filesystem>
 #include <fstream>
+#include <iomanip>
+#include <sstream>
 #include <algorithm>
 #include <functional>
 #include <random>
@@ -26,5 +31,25 @@
 #include <numeric>
 #include <numbers>
 #include <stdexcept>
+#include <cstdint>
+#include <bit>
+#include <cstring>
+#include <charconv>
+#include <list>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PATHTRACER_SSE
+#include <immintrin.h>
+#endif
 
 using Float = float;
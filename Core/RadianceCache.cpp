@@ -0,0 +1,138 @@
+#include <RadianceCache.h>
+
+using namespace Eigen;
+
+namespace PathTracer
+{
+	constexpr unsigned kMaxProbes = 16;
+
+	static uint64_t MixBits(uint64_t Value)
+	{
+		Value ^= Value >> 33;
+		Value *= 0xff51afd7ed558ccdull;
+		Value ^= Value >> 33;
+		Value *= 0xc4ceb9fe1a85ec53ull;
+		Value ^= Value >> 33;
+
+		return Value;
+	}
+
+	RadianceCache::RadianceCache(const RadianceCacheOptions& Options)
+	: mOptions{Options}
+	{
+		const size_t NumEntries = std::bit_ceil(std::max<size_t>(Options.NumEntries, kMaxProbes));
+
+		mEntries = std::make_unique<Entry[]>(NumEntries);
+		mMask = NumEntries - 1;
+	}
+
+	uint64_t RadianceCache::GetKey(const Vector3f& Point, const Vector3f& Normal, Float CameraDistance) const
+	{
+		// power of two cell sizes so neighbouring pixels share a level
+		const int Level = static_cast<int>(std::floor(std::log2(std::max(mOptions.CellScale * CameraDistance, 1e-6f))));
+		const Float InvCellSize = std::ldexp(1.f, -Level);
+
+		int Axis;
+		Normal.cwiseAbs().maxCoeff(&Axis);
+
+		const uint64_t Side = 2 * Axis + (Normal[Axis] < 0);
+
+		uint64_t Key = MixBits(uint64_t(Level + 128) << 3 | Side);
+
+		for (int Dimension = 0; Dimension < 3; Dimension++)
+		{
+			const int64_t Cell = static_cast<int64_t>(std::floor(Point[Dimension] * InvCellSize));
+
+			Key = MixBits(Key ^ static_cast<uint64_t>(Cell));
+		}
+
+		// zero marks an empty entry
+		return Key | 1;
+	}
+
+	const RadianceCache::Entry* RadianceCache::Find(uint64_t Key) const
+	{
+		for (unsigned Probe = 0; Probe < kMaxProbes; Probe++)
+		{
+			const Entry& aEntry = mEntries[(Key + Probe) & mMask];
+			const uint64_t EntryKey = aEntry.Key.load(std::memory_order_acquire);
+
+			if (EntryKey == Key)
+			{
+				return &aEntry;
+			}
+
+			if (EntryKey == 0)
+			{
+				return nullptr;
+			}
+		}
+
+		return nullptr;
+	}
+
+	bool RadianceCache::Lookup(uint64_t Key, Vector3f& Radiance) const
+	{
+		const Entry* pEntry = Find(Key);
+
+		if (pEntry == nullptr)
+		{
+			return false;
+		}
+
+		// the sums may already hold a sample the count does not, negligible once MinSamples is reached
+		const uint32_t NumSamples = pEntry->NumSamples.load(std::memory_order_acquire);
+
+		if (NumSamples < std::max(1u, mOptions.MinSamples))
+		{
+			return false;
+		}
+
+		const Float InvSamples = 1.f / NumSamples;
+
+		Radiance = InvSamples * Vector3f(pEntry->Sum[0].load(std::memory_order_relaxed),
+										 pEntry->Sum[1].load(std::memory_order_relaxed),
+										 pEntry->Sum[2].load(std::memory_order_relaxed));
+
+		return true;
+	}
+
+	void RadianceCache::Update(uint64_t Key, const Vector3f& Radiance)
+	{
+		if (!Radiance.allFinite())
+		{
+			return;
+		}
+
+		for (unsigned Probe = 0; Probe < kMaxProbes; Probe++)
+		{
+			Entry& aEntry = mEntries[(Key + Probe) & mMask];
+
+			uint64_t EntryKey = aEntry.Key.load(std::memory_order_acquire);
+
+			if (EntryKey == 0 && aEntry.Key.compare_exchange_strong(EntryKey, Key, std::memory_order_acq_rel))
+			{
+				mNumCells.fetch_add(1, std::memory_order_relaxed);
+
+				EntryKey = Key;
+			}
+
+			if (EntryKey != Key)
+			{
+				continue;
+			}
+
+			for (int Channel = 0; Channel < 3; Channel++)
+			{
+				aEntry.Sum[Channel].fetch_add(Radiance[Channel], std::memory_order_relaxed);
+			}
+
+			aEntry.NumSamples.fetch_add(1, std::memory_order_release);
+
+			return;
+		}
+
+		mNumDropped.fetch_add(1, std::memory_order_relaxed);
+	}
+
+} // namespace PathTracer
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <Pch.h>
+
+namespace PathTracer
+{
+	struct RadianceCacheOptions
+	{
+		bool Enable = false;
+		Float CellScale = 0.05f;		// cell edge relative to the camera distance, larger cells average more paths but blur the lighting
+		unsigned MinSamples = 16;		// paths a cell must have seen before it may end other paths
+		unsigned StartDepth = 1;		// first vertex that may end in the cache, 1 keeps the direct lighting of visible surfaces exact
+		size_t NumEntries = size_t(1) << 20;
+	};
+
+	// World space cache of the radiance reflected off Lambertian surfaces. Cells are
+	// keyed by quantized position, dominant normal axis and a level of detail that
+	// grows with the camera distance, and live in an open addressing hash table that
+	// render threads insert into and update without locks
+	class RadianceCache
+	{
+	public:
+		RadianceCache(const RadianceCacheOptions& Options = {});
+
+		RadianceCache(const RadianceCache&) = delete;
+		RadianceCache& operator=(const RadianceCache&) = delete;
+
+		~RadianceCache() = default;
+
+		uint64_t GetKey(const Eigen::Vector3f& Point, const Eigen::Vector3f& Normal, Float CameraDistance) const;
+
+		// Mean reflected radiance of the cell, false until the cell has enough samples
+		bool Lookup(uint64_t Key, Eigen::Vector3f& Radiance) const;
+
+		void Update(uint64_t Key, const Eigen::Vector3f& Radiance);
+
+		const RadianceCacheOptions& GetOptions() const { return mOptions; }
+
+		size_t GetNumCells() const { return mNumCells; }
+
+		// Updates lost because every probed entry belonged to another cell
+		size_t GetNumDropped() const { return mNumDropped; }
+
+	private:
+		struct Entry
+		{
+			std::atomic<uint64_t> Key = 0;
+			std::atomic<uint32_t> NumSamples = 0;
+			std::atomic<float> Sum[3] = {0.f, 0.f, 0.f};
+		};
+
+		const Entry* Find(uint64_t Key) const;
+
+		RadianceCacheOptions mOptions;
+		std::unique_ptr<Entry[]> mEntries;
+		size_t mMask;
+		std::atomic<size_t> mNumCells = 0;
+		std::atomic<size_t> mNumDropped = 0;
+	};
+
+} // namespace PathTracer
@@ -5,12 +5,27 @@
 
 namespace PathTracer
 {
+    struct Triangle;
+    class TriangleMesh;
+
     struct Intersection
     {
         Eigen::Vector3f HitPoint;
         Eigen::Vector3f Normal;
+        Eigen::Vector3f GeometricNormal;
+        const Triangle* pTriangle = nullptr;
+        Float U = 0, V = 0; // barycentrics of the second and third corner
     };
     
+	// What level of detail selection reads, a ray left at the defaults sees every mesh in full
+	struct RayDetail
+	{
+		Float ConeWidth = 0;	// ray cone width at the origin
+		Float ConeSpread = 0;	// width added per unit of distance
+		Float Sample = 0;		// uniform, shared by the stochastic level pick of every mesh along the ray
+		const TriangleMesh* pOriginMesh = nullptr;	// the ray leaves this mesh and sees it at the same level
+	};
+
 	struct Ray
 	{
         Ray(const Eigen::Vector3f& Origin, const Eigen::Vector3f& Direction, Float tMax = kInfinity)
@@ -25,6 +40,15 @@ namespace PathTracer
             IsDirectionNeg[2] = Direction.z() < 0;
         }
 
+        // For callers that already computed the reciprocal, e.g. the batched camera rays
+        Ray(const Eigen::Vector3f& Origin, const Eigen::Vector3f& Direction, const Eigen::Vector3f& InvDirection, Float tMax = kInfinity)
+        : Origin{Origin}, Direction{Direction}, InvDirection{InvDirection}, tMax{tMax}
+        {
+            IsDirectionNeg[0] = Direction.x() < 0;
+            IsDirectionNeg[1] = Direction.y() < 0;
+            IsDirectionNeg[2] = Direction.z() < 0;
+        }
+
         Eigen::Vector3f operator()(Float tPoint) const noexcept
         {
             return Origin + tPoint * Direction;
@@ -45,6 +69,7 @@ namespace PathTracer
 		Eigen::Vector3f InvDirection;
 		unsigned IsDirectionNeg[3];
 		mutable Float tMax;
+		RayDetail Detail;
 	};
 
 } // namespace PathTracer
\ No newline at end of file
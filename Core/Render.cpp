@@ -0,0 +1,759 @@
+#include <Render.h>
+#include <Parallel.h>
+
+using namespace Eigen;
+
+namespace PathTracer
+{
+	// Cone spread after a diffuse bounce, the lobe blurs texture detail anyway
+	constexpr Float kDiffuseConeSpread = 0.1f;
+
+	// Vertices of one path that report back to the radiance cache
+	constexpr unsigned kMaxCacheVertices = 16;
+
+	// Rays traced by the calling thread, the render kernel sums them per row
+	static thread_local uint64_t tNumRays = 0;
+
+	struct CacheVertex
+	{
+		uint64_t Key;
+		Vector3f Throughput;
+		Vector3f Radiance;	// what the path had gathered before the vertex reflected anything
+	};
+
+	static Float PowerHeuristic(Float Pdf, Float OtherPdf)
+	{
+		const Float PdfSq = Pdf * Pdf;
+		const Float Sum = PdfSq + OtherPdf * OtherPdf;
+
+		return Sum > 0 ? PdfSq / Sum : 0;
+	}
+
+	// Hemisphere samples are Y-up, Normal becomes the Y axis (Duff et al. 2017 basis)
+	static Vector3f LocalToWorld(const Vector3f& Local, const Vector3f& Normal)
+	{
+		const Float Sign = std::copysign(1.f, Normal.z());
+		const Float A = -1 / (Sign + Normal.z());
+		const Float B = Normal.x() * Normal.y() * A;
+
+		const Vector3f Tangent(1 + Sign * Normal.x() * Normal.x() * A, Sign * B, -Sign * Normal.x());
+		const Vector3f Bitangent(B, Sign + Normal.y() * Normal.y() * A, -Normal.y());
+
+		return (Local.x() * Tangent + Local.y() * Normal + Local.z() * Bitangent).normalized();
+	}
+
+	PathIntegrator::PathIntegrator(const Scene& aScene, const RenderOptions& Options, Float PixelSpreadAngle, RadianceCache* pCache)
+	: mScene{aScene}, mOptions{Options}, mPixelSpreadAngle{PixelSpreadAngle}, pRadianceCache{pCache}
+	{
+	}
+
+	template<typename SamplerType>
+	Vector3f PathIntegrator::Li(Ray aRay, SamplerType& Sampler, PathFeatures* pFeatures, const VisibilitySample* pFirstHit, const PagedHit* pPagedHit) const
+	{
+		Vector3f Radiance = Vector3f::Zero();
+		Vector3f Throughput = Vector3f::Ones();
+
+		// the previous vertex is all MIS needs when a BSDF sample lands on an emitter
+		Vector3f PrevPoint = aRay.Origin;
+		Vector3f PrevNormal = Vector3f::Zero();
+		Float PrevBsdfPdf = 0;
+
+		// ray cone for picking texture mip levels, and mesh levels of detail
+		Float ConeWidth = 0;
+		Float ConeSpread = mPixelSpreadAngle;
+
+		// drawn only for scenes that have the levels to pick, the others keep their sample streams
+		const Float LodSample = mScene.GetLevelsOfDetail() ? Sampler.SampleUnitSquare().x() : 0;
+
+		aRay.Detail = { ConeWidth, ConeSpread, LodSample, nullptr };
+
+		const Vector3f CameraPoint = aRay.Origin;
+
+		std::array<CacheVertex, kMaxCacheVertices> CacheVertices;
+		unsigned NumCacheVertices = 0;
+
+		for (unsigned Depth = 0; ; Depth++)
+		{
+			Intersection Hit;
+
+			tNumRays++;
+
+			const bool HitSomething = Depth == 0 && (pFirstHit || pPagedHit) ? mScene.Intersect(aRay, pFirstHit, pPagedHit, Hit) : mScene.Intersect(aRay, Hit);
+
+			if (!HitSomething)
+			{
+				const EnvironmentLight* pEnvironment = mScene.GetEnvironment();
+
+				if (!pEnvironment)
+				{
+					Radiance += Throughput.cwiseProduct(mOptions.Background);
+				}
+				else
+				{
+					const Float Weight = Depth == 0 ? 1 : PowerHeuristic(PrevBsdfPdf, pEnvironment->Pdf(aRay.Direction));
+
+					Radiance += Weight * Throughput.cwiseProduct(pEnvironment->Le(aRay.Direction));
+				}
+
+				break;
+			}
+
+			if (Hit.pTriangle == nullptr)
+			{
+				break;
+			}
+
+			const Material& aMaterial = mScene.GetMaterial(*Hit.pTriangle);
+			const Vector3f Outgoing = -aRay.Direction;
+
+			ConeWidth += ConeSpread * (Hit.HitPoint - aRay.Origin).norm();
+
+			const Vector3f Albedo = mScene.GetAlbedo(Hit, ConeWidth);
+
+			// both normals face the side the path arrived from
+			Vector3f GeometricNormal = Hit.GeometricNormal;
+
+			if (GeometricNormal.dot(Outgoing) < 0)
+			{
+				GeometricNormal = -GeometricNormal;
+			}
+
+			Vector3f Normal = Hit.Normal.normalized();
+
+			if (Normal.dot(GeometricNormal) < 0)
+			{
+				Normal = -Normal;
+			}
+
+			if (Depth == 0 && pFeatures)
+			{
+				pFeatures->Normal = Normal;
+				pFeatures->Albedo = Albedo;
+				pFeatures->Position = Hit.HitPoint;
+				pFeatures->Depth = (Hit.HitPoint - aRay.Origin).norm();
+				pFeatures->Hit = true;
+			}
+
+			if (aMaterial.IsEmissive())
+			{
+				if (Depth == 0)
+				{
+					Radiance += Throughput.cwiseProduct(aMaterial.Emission);
+				}
+				else
+				{
+					const Float DistanceSq = (Hit.HitPoint - PrevPoint).squaredNorm();
+					const Float CosLight = GeometricNormal.dot(Outgoing);
+					const Float LightPdf = CosLight > 0 ? mScene.LightPdf(PrevPoint, PrevNormal, *Hit.pTriangle) * DistanceSq / CosLight : 0;
+
+					Radiance += PowerHeuristic(PrevBsdfPdf, LightPdf) * Throughput.cwiseProduct(aMaterial.Emission);
+				}
+			}
+
+			// the last vertex only collects emission, both strategies then cover the same path lengths
+			if (Depth == mOptions.MaxDepth)
+			{
+				break;
+			}
+
+			if (pRadianceCache && Depth >= pRadianceCache->GetOptions().StartDepth)
+			{
+				const uint64_t Key = pRadianceCache->GetKey(Hit.HitPoint, Normal, (Hit.HitPoint - CameraPoint).norm());
+
+				Vector3f Cached;
+
+				if (pRadianceCache->Lookup(Key, Cached))
+				{
+					Radiance += Throughput.cwiseProduct(Cached);
+
+					break;
+				}
+
+				if (NumCacheVertices < kMaxCacheVertices)
+				{
+					CacheVertices[NumCacheVertices++] = {Key, Throughput, Radiance};
+				}
+			}
+
+			// rays leaving the hit see its mesh at the level it was hit at
+			const RayDetail Detail = { ConeWidth, ConeSpread, LodSample, Hit.pTriangle->pMesh };
+
+			Radiance += Throughput.cwiseProduct(SampleDirectLight(Hit.HitPoint, Normal, Albedo, Detail, Sampler));
+
+			if (mScene.GetEnvironment())
+			{
+				Radiance += Throughput.cwiseProduct(SampleEnvironment(Hit.HitPoint, Normal, Albedo, Detail, Sampler));
+			}
+
+			const Vector3f Local = Sampler.SampleHemisphere(SamplingStrategy::CosineWeighted, 1);
+			const Vector3f Incoming = LocalToWorld(Local, Normal);
+
+			if (Local.y() <= 0 || Incoming.dot(GeometricNormal) <= 0)
+			{
+				break;
+			}
+
+			// Lambertian f * cos / pdf reduces to the albedo
+			Throughput = Throughput.cwiseProduct(Albedo);
+
+			ConeSpread = std::max(ConeSpread, kDiffuseConeSpread);
+
+			PrevPoint = Hit.HitPoint;
+			PrevNormal = Normal;
+			PrevBsdfPdf = Local.y() / kPi;
+
+			if (Depth + 1 >= mOptions.RussianRouletteDepth)
+			{
+				const Float Termination = std::max(0.05f, 1 - Throughput.maxCoeff());
+
+				if (Sampler.SampleUnitSquare().x() < Termination)
+				{
+					break;
+				}
+
+				Throughput /= 1 - Termination;
+			}
+
+			aRay = Ray(Hit.HitPoint, Incoming);
+			aRay.Detail = Detail;
+			aRay.Detail.ConeSpread = ConeSpread;
+		}
+
+		// everything gathered past a vertex, divided by the throughput up to it, is what it reflects
+		for (unsigned Vertex = 0; Vertex < NumCacheVertices; Vertex++)
+		{
+			const CacheVertex& aVertex = CacheVertices[Vertex];
+
+			const Vector3f Reflected = (Radiance - aVertex.Radiance).cwiseQuotient(aVertex.Throughput.cwiseMax(1e-6f));
+
+			pRadianceCache->Update(aVertex.Key, Reflected.cwiseMax(0));
+		}
+
+		return Radiance;
+	}
+
+	template<typename SamplerType>
+	Vector3f PathIntegrator::SampleDirectLight(const Vector3f& Point, const Vector3f& Normal, const Vector3f& Albedo, const RayDetail& Detail, SamplerType& Sampler) const
+	{
+		LightSample Sample;
+
+		const Float LightSelect = Sampler.SampleUnitSquare().x();
+
+		if (!mScene.SampleLight(Point, Normal, LightSelect, Sampler.SampleUnitSquare(), Sample))
+		{
+			return Vector3f::Zero();
+		}
+
+		const Vector3f ToLight = Sample.Position - Point;
+		const Float DistanceSq = ToLight.squaredNorm();
+		const Float Distance = std::sqrt(DistanceSq);
+		const Vector3f Direction = ToLight / Distance;
+
+		const Float CosSurface = Normal.dot(Direction);
+		const Float CosLight = std::abs(Sample.Normal.dot(Direction));
+
+		if (CosSurface <= 0 || CosLight <= 0 || Distance <= 2 * kEpsilon)
+		{
+			return Vector3f::Zero();
+		}
+
+		Ray ShadowRay(Point, Direction, Distance - kEpsilon);
+		ShadowRay.Detail = Detail;
+
+		tNumRays++;
+
+		if (mScene.Occluded(ShadowRay))
+		{
+			return Vector3f::Zero();
+		}
+
+		const Float LightPdf = Sample.Pdf * DistanceSq / CosLight;
+		const Float BsdfPdf = CosSurface / kPi;
+
+		const Float Weight = PowerHeuristic(LightPdf, BsdfPdf) * CosSurface / (kPi * LightPdf);
+
+		return Weight * Albedo.cwiseProduct(Sample.Emission);
+	}
+
+	// The environment gets its own sample next to the emitter one, no selection probability to balance
+	template<typename SamplerType>
+	Vector3f PathIntegrator::SampleEnvironment(const Vector3f& Point, const Vector3f& Normal, const Vector3f& Albedo, const RayDetail& Detail, SamplerType& Sampler) const
+	{
+		EnvironmentSample Sample;
+
+		if (!mScene.GetEnvironment()->Sample(Sampler.SampleUnitSquare(), Sample))
+		{
+			return Vector3f::Zero();
+		}
+
+		const Float CosSurface = Normal.dot(Sample.Direction);
+
+		if (CosSurface <= 0)
+		{
+			return Vector3f::Zero();
+		}
+
+		Ray ShadowRay(Point, Sample.Direction);
+		ShadowRay.Detail = Detail;
+
+		tNumRays++;
+
+		if (mScene.Occluded(ShadowRay))
+		{
+			return Vector3f::Zero();
+		}
+
+		const Float BsdfPdf = CosSurface / kPi;
+		const Float Weight = PowerHeuristic(Sample.Pdf, BsdfPdf) * CosSurface / (kPi * Sample.Pdf);
+
+		return Weight * Albedo.cwiseProduct(Sample.Radiance);
+	}
+
+	template Vector3f PathIntegrator::Li(Ray, ISampler&, PathFeatures*, const VisibilitySample*, const PagedHit*) const;
+	template Vector3f PathIntegrator::Li(Ray, RandomSampler&, PathFeatures*, const VisibilitySample*, const PagedHit*) const;
+	template Vector3f PathIntegrator::Li(Ray, CMJSampler&, PathFeatures*, const VisibilitySample*, const PagedHit*) const;
+	template Vector3f PathIntegrator::Li(Ray, HammersleySampler&, PathFeatures*, const VisibilitySample*, const PagedHit*) const;
+
+	// What the rows of one render share
+	struct RenderJob
+	{
+		RenderJob(Camera& aCamera, const Scene& aScene, const RenderOptions& aOptions, ReprojectionCache* aHistory, FeatureBuffers& aFeatures,
+			ImageStream* aStream, CheckpointWriter* aCheckpoint, const VisibilityBuffer* aVisibility, uint32_t aSeed)
+		: RenderCamera{aCamera}, RenderScene{aScene}, Options{aOptions}, pHistory{aHistory}, Features{aFeatures},
+		  pStream{aStream}, pCheckpoint{aCheckpoint}, pVisibility{aVisibility}, Seed{aSeed}
+		{
+		}
+
+		Camera& RenderCamera;
+		const Scene& RenderScene;
+		const RenderOptions& Options;
+		ReprojectionCache* pHistory;
+		FeatureBuffers& Features;
+		ImageStream* pStream;
+		CheckpointWriter* pCheckpoint;
+		const VisibilityBuffer* pVisibility;
+		uint32_t Seed;
+		std::atomic<unsigned> RowsDone = 0;
+		std::atomic<size_t> PixelsReused = 0;
+		std::atomic<uint64_t> NumRays = 0;
+		std::mutex ProgressMutex;
+	};
+
+	// Rows draw their streams from the render seed alone, so a row rendered again after a resume matches
+	static uint32_t GetRowSeed(uint32_t Seed, size_t Row)
+	{
+		std::seed_seq Sequence{ Seed, static_cast<uint32_t>(Row) };
+
+		uint32_t RowSeed;
+		Sequence.generate(&RowSeed, &RowSeed + 1);
+
+		return RowSeed;
+	}
+
+	template<typename SamplerType>
+	static SamplerType MakePathSampler(unsigned SamplesPerPixel, uint32_t Seed)
+	{
+		if constexpr (std::is_same_v<SamplerType, RandomSampler>)
+		{
+			return RandomSampler(Seed);
+		}
+		else
+		{
+			return SamplerType(SamplesPerPixel, kDefaultSampleSets, Seed);
+		}
+	}
+
+	// pBand holds the row when its camera rays are rasterized
+	template<typename SamplerType, typename IntegratorType>
+	static void RenderRow(RenderJob& Job, const IntegratorType& Integrator, size_t Row, const VisibilityBand* pBand = nullptr)
+	{
+		Camera& aCamera = Job.RenderCamera;
+		const RenderOptions& Options = Job.Options;
+		ReprojectionCache* pHistory = Job.pHistory;
+
+		const Vector2i CamResolution = aCamera.GetImageResolution();
+		const bool NeedFeatures = Options.Denoise || pHistory;
+
+		SamplerType PathSampler = MakePathSampler<SamplerType>(Options.SamplesPerPixel, GetRowSeed(Job.Seed, Row));
+		CameraRayBatch Batch;
+
+		const uint64_t RaysBefore = tNumRays;
+
+		const int Width = CamResolution.x();
+		const CameraTile Tile{static_cast<int>(Row), 0, 1, Width};
+
+		std::vector<Vector3f> PixelColors(Width, Vector3f::Zero());
+		std::vector<PathFeatures> Sums(Width);
+		std::vector<PathFeatures> FirstHits(Width);
+		std::vector<unsigned> NumHits(Width, 0);
+		std::vector<Float> LuminanceSq(Width, 0);
+
+		// pixels that found their history only take a few fresh samples
+		std::vector<HistoryPixel> Histories(Width);
+		std::vector<unsigned> NumSamples(Width, Options.SamplesPerPixel);
+
+		std::vector<Pixel> StreamedRow(Job.pStream ? Width : 0);
+
+		std::vector<VisibilitySample> Visibility;
+
+		// the camera rays of a row reach the paged meshes together, so each treelet is read once for them
+		const bool TracePaged = Job.RenderScene.HasPagedMeshes();
+
+		std::vector<Ray> PagedRays(TracePaged ? Width : 0);
+		std::vector<PagedHit> PagedHits;
+
+		for (auto& Sum : Sums)
+		{
+			Sum.Albedo.setZero();
+		}
+
+		for (unsigned N = 0; N < Options.SamplesPerPixel; N++)
+		{
+			aCamera.GenerateRays(Tile, N, Options.SamplesPerPixel, Job.Seed, Batch);
+
+			if (pBand)
+			{
+				Job.pVisibility->Rasterize(*pBand, static_cast<int>(Row), Batch, Visibility);
+			}
+
+			if (TracePaged)
+			{
+				for (int Col = 0; Col < Width; Col++)
+				{
+					PagedRays[Col] = Batch.GetRay(Col);
+				}
+
+				Job.RenderScene.IntersectPaged(PagedRays, PagedHits);
+			}
+
+			for (int Col = 0; Col < Width; Col++)
+			{
+				if (N >= NumSamples[Col])
+				{
+					continue;
+				}
+
+				PathFeatures SampleFeatures;
+
+				const Vector3f Radiance = Integrator.Li(Batch.GetRay(Col), PathSampler, NeedFeatures ? &SampleFeatures : nullptr,
+														pBand ? &Visibility[Col] : nullptr, TracePaged ? &PagedHits[Col] : nullptr);
+
+				PixelColors[Col] += Radiance;
+				LuminanceSq[Col] += Luminance(Radiance) * Luminance(Radiance);
+
+				if (NeedFeatures)
+				{
+					Sums[Col].Normal += SampleFeatures.Normal;
+					Sums[Col].Albedo += SampleFeatures.Albedo;
+					Sums[Col].Depth += SampleFeatures.Depth;
+					NumHits[Col] += SampleFeatures.Hit;
+				}
+
+				if (N == 0 && pHistory)
+				{
+					FirstHits[Col] = SampleFeatures;
+
+					if (SampleFeatures.Hit && pHistory->Lookup(SampleFeatures.Position, SampleFeatures.Normal, SampleFeatures.Depth, Histories[Col]))
+					{
+						NumSamples[Col] = std::clamp(pHistory->GetOptions().ReusedSamples, 1u, Options.SamplesPerPixel);
+						Job.PixelsReused++;
+					}
+				}
+			}
+		}
+
+		for (int Col = 0; Col < Width; Col++)
+		{
+			const size_t Pixel = Row * Width + Col;
+			const Float InvSamples = 1.f / NumSamples[Col];
+
+			// the history counts as prior samples of the same pixel
+			const unsigned MaxHistory = pHistory ? pHistory->GetOptions().MaxHistorySamples : 0;
+			const unsigned NumPrior = std::min(Histories[Col].NumSamples, MaxHistory);
+			const Float InvTotal = 1.f / (NumPrior + NumSamples[Col]);
+
+			const Vector3f PixelColor = (Histories[Col].Radiance * NumPrior + PixelColors[Col]) * InvTotal;
+			const Float MeanLuminanceSq = (Histories[Col].LuminanceSq * NumPrior + LuminanceSq[Col]) * InvTotal;
+
+			if (aCamera.HasImage())
+			{
+				aCamera.SetPixelColour(static_cast<int>(Row), Col, PixelColor);
+			}
+
+			if (Job.pStream)
+			{
+				StreamedRow[Col] = { PixelColor.x(), PixelColor.y(), PixelColor.z() };
+			}
+
+			if (Options.Denoise)
+			{
+				const Float Mean = Luminance(PixelColor);
+				const PathFeatures& Sum = Sums[Col];
+
+				Job.Features.Normals[Pixel] = Sum.Normal.squaredNorm() > 0 ? Vector3f(Sum.Normal.normalized()) : Vector3f::Zero();
+				Job.Features.Albedo[Pixel] = Sum.Albedo * InvSamples;
+				Job.Features.Depth[Pixel] = NumHits[Col] > 0 ? Sum.Depth / NumHits[Col] : 0;
+				Job.Features.Variance[Pixel] = std::max<Float>(0, MeanLuminanceSq - Mean * Mean) * InvTotal;
+			}
+
+			if (pHistory && FirstHits[Col].Hit)
+			{
+				HistoryPixel History;
+				History.Radiance = PixelColor;
+				History.Position = FirstHits[Col].Position;
+				History.Normal = FirstHits[Col].Normal;
+				History.LuminanceSq = MeanLuminanceSq;
+				History.NumSamples = std::min(NumPrior + NumSamples[Col], MaxHistory);
+
+				pHistory->Store(Pixel, History);
+			}
+		}
+
+		if (Job.pCheckpoint)
+		{
+			Job.pCheckpoint->PublishRow(static_cast<unsigned>(Row), NumSamples.data());
+		}
+
+		if (Job.pStream)
+		{
+			Job.pStream->WriteRow(static_cast<unsigned>(Row), StreamedRow.data());
+		}
+
+		Job.NumRays += tNumRays - RaysBefore;
+
+		const unsigned Done = ++Job.RowsDone;
+
+		if (!Options.ShowProgress)
+		{
+			return;
+		}
+
+		std::lock_guard<std::mutex> Lock(Job.ProgressMutex);
+
+		std::cout << "\r( Rendering " << Done * 100 / CamResolution.y() << " % Completed )" << std::flush;
+	}
+
+	// Render kernel, instantiated per sampler and integrator so nothing in the
+	// sample loop goes through a virtual call. Render picks the instance once
+	template<typename SamplerType, typename IntegratorType>
+	static void RenderRows(RenderJob& Job, const IntegratorType& Integrator)
+	{
+		auto RenderRowOnce = [&](size_t Row, const VisibilityBand* pBand)
+		{
+			if (Job.pCheckpoint && Job.pCheckpoint->IsRowDone(static_cast<unsigned>(Row)))
+			{
+				return;
+			}
+
+			try
+			{
+				RenderRow<SamplerType>(Job, Integrator, Row, pBand);
+			}
+			catch (...)
+			{
+				// rows waiting on this one would never be let through
+				if (Job.pStream)
+				{
+					Job.pStream->Abort();
+				}
+
+				throw;
+			}
+		};
+
+		if (!Job.pVisibility)
+		{
+			ParallelFor(Job.RenderCamera.GetImageResolution().y(), [&](size_t Row) { RenderRowOnce(Row, nullptr); });
+
+			return;
+		}
+
+		// a band is projected once for its rows
+		ParallelFor(Job.pVisibility->GetNumBands(), [&](size_t BandIndex)
+		{
+			VisibilityBand Band;
+			Job.pVisibility->PrepareBand(static_cast<unsigned>(BandIndex), Band);
+
+			for (int Row = Band.BeginRow; Row < Band.EndRow; Row++)
+			{
+				RenderRowOnce(Row, &Band);
+			}
+		});
+	}
+
+	RenderStats Render(Camera& aCamera, const Scene& aScene, const RenderOptions& Options, ReprojectionCache* pHistory)
+	{
+		if (Options.StreamOutput && (Options.Denoise || pHistory || Options.OutputName.empty()))
+		{
+			throw std::logic_error("Streamed output needs an output name and works without denoising or history\n");
+		}
+
+		// resumed rows keep no denoiser features or history, and would never reach a stream
+		if (!Options.Checkpoint.FileName.empty() && (Options.Denoise || pHistory || Options.StreamOutput || !aCamera.HasImage()))
+		{
+			throw std::logic_error("Checkpoints need the camera image and work without denoising, history or streaming\n");
+		}
+
+		if (Options.RasterizeFirstHits && aCamera.GetLensRadius() > 0)
+		{
+			throw std::logic_error("Rasterized first hits need a pinhole camera, lens rays do not share an origin\n");
+		}
+
+		// the CMJ pattern is an n by n grid, any other count would leave samples of every set unset
+		if (Options.PathSampler == PathSamplerType::Cmj)
+		{
+			const unsigned n = static_cast<unsigned>(std::sqrt(static_cast<double>(Options.SamplesPerPixel)));
+
+			if (n * n != Options.SamplesPerPixel)
+			{
+				throw std::logic_error("CMJ path sampling needs a square number of samples per pixel, got " + std::to_string(Options.SamplesPerPixel) + "\n");
+			}
+		}
+
+		// reprojection goes through the pinhole, see CameraProjection
+		if (pHistory && aCamera.GetLensRadius() > 0)
+		{
+			throw std::logic_error("Reprojected history needs a pinhole camera\n");
+		}
+
+		const auto StartTime = std::chrono::steady_clock::now();
+
+		const Vector2i CamResolution = aCamera.GetImageResolution();
+
+		std::unique_ptr<RadianceCache> pCache;
+
+		if (Options.RadianceCaching.Enable)
+		{
+			pCache = std::make_unique<RadianceCache>(Options.RadianceCaching);
+		}
+
+		const PathIntegrator Integrator(aScene, Options, aCamera.GetPixelSpreadAngle(), pCache.get());
+
+		FeatureBuffers Features;
+
+		if (Options.Denoise)
+		{
+			Features = FeatureBuffers(CamResolution.x(), CamResolution.y());
+		}
+
+		if (pHistory)
+		{
+			pHistory->BeginFrame(aCamera);
+		}
+
+		const ThreadPinningScope Pinning(Options.PinThreads);
+
+		if (Options.ShowProgress)
+		{
+			std::cout << "\nStarting Rendering\n";
+		}
+
+		std::unique_ptr<ImageStream> pStream;
+
+		if (Options.StreamOutput)
+		{
+			// two rows of slack per worker keep them from waiting on each other
+			pStream = std::make_unique<ImageStream>(Options.OutputName + ".ppm", CamResolution.x(), CamResolution.y(), 2 * GetNumWorkerThreads());
+		}
+
+		uint32_t Seed = Options.Seed != 0 ? Options.Seed : std::random_device()();
+
+		std::unique_ptr<CheckpointWriter> pCheckpoint;
+
+		if (!Options.Checkpoint.FileName.empty())
+		{
+			RenderCheckpoint Checkpoint;
+
+			if (Options.Checkpoint.Resume && ReadCheckpoint(Options.Checkpoint.FileName, Checkpoint))
+			{
+				if (Checkpoint.Width != unsigned(CamResolution.x()) || Checkpoint.Height != unsigned(CamResolution.y()) ||
+					Checkpoint.SamplesPerPixel != Options.SamplesPerPixel || Checkpoint.PathSampler != uint32_t(Options.PathSampler))
+				{
+					throw std::runtime_error("Checkpoint " + Options.Checkpoint.FileName + " was taken of a different render\n");
+				}
+			}
+			else
+			{
+				Checkpoint.Width = CamResolution.x();
+				Checkpoint.Height = CamResolution.y();
+				Checkpoint.SamplesPerPixel = Options.SamplesPerPixel;
+				Checkpoint.PathSampler = uint32_t(Options.PathSampler);
+				Checkpoint.Seed = Seed;
+			}
+
+			Seed = Checkpoint.Seed;
+			pCheckpoint = std::make_unique<CheckpointWriter>(aCamera.GetImage(), std::move(Checkpoint), Options.Checkpoint);
+		}
+
+		std::unique_ptr<VisibilityBuffer> pVisibility;
+
+		if (Options.RasterizeFirstHits)
+		{
+			pVisibility = std::make_unique<VisibilityBuffer>(aCamera, aScene);
+		}
+
+		RenderJob Job(aCamera, aScene, Options, pHistory, Features, pStream.get(), pCheckpoint.get(), pVisibility.get(), Seed);
+
+		if (pCheckpoint)
+		{
+			Job.RowsDone = pCheckpoint->GetNumRowsDone();
+		}
+
+		switch (Options.PathSampler)
+		{
+		case PathSamplerType::Cmj:
+			RenderRows<CMJSampler>(Job, Integrator);
+			break;
+
+		case PathSamplerType::Hammersley:
+			RenderRows<HammersleySampler>(Job, Integrator);
+			break;
+
+		default:
+			RenderRows<RandomSampler>(Job, Integrator);
+			break;
+		}
+
+		if (Options.ShowProgress)
+		{
+			std::cout << "\n";
+		}
+
+		if (pCheckpoint)
+		{
+			pCheckpoint->Finish();
+		}
+
+		if (pHistory)
+		{
+			pHistory->EndFrame();
+		}
+
+		if (pHistory && Options.ShowProgress)
+		{
+			std::cout << "Reused history for " << Job.PixelsReused * 100 / (size_t(CamResolution.x()) * CamResolution.y()) << " % of pixels\n";
+		}
+
+		if (Options.Denoise)
+		{
+			Denoise(aCamera.GetImage(), Features, Options.DenoiseOptions);
+		}
+
+		if (pStream)
+		{
+			pStream->Finish();
+		}
+
+		RenderStats Stats;
+		Stats.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+		Stats.NumRays = Job.NumRays;
+
+		if (!Options.OutputName.empty() && !pStream)
+		{
+			aCamera.WriteImageToPPM(Options.OutputName);
+		}
+
+		return Stats;
+	}
+
+} // namespace PathTracer
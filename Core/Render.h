@@ -0,0 +1,93 @@
+#pragma once
+
+#include <Pch.h>
+#include <Scene.h>
+#include <Camera.h>
+#include <Sampler.h>
+#include <Denoiser.h>
+#include <Reprojection.h>
+#include <RadianceCache.h>
+#include <Checkpoint.h>
+#include <VisibilityBuffer.h>
+
+namespace PathTracer
+{
+	// What the paths draw their random numbers from, Render instantiates its kernel for each
+	enum class PathSamplerType
+	{
+		Random = 1,
+		Cmj = 2,			// SamplesPerPixel must be a square, Render throws otherwise
+		Hammersley = 3,
+	};
+
+	struct RenderOptions
+	{
+		unsigned SamplesPerPixel = 16;
+		unsigned MaxDepth = 8;
+		unsigned RussianRouletteDepth = 3;
+		Eigen::Vector3f Background = Eigen::Vector3f::Zero();	// unused when the scene has an environment map
+		bool Denoise = false;
+		DenoiserOptions DenoiseOptions;
+		RadianceCacheOptions RadianceCaching;
+		PathSamplerType PathSampler = PathSamplerType::Random;
+		bool PinThreads = false;	// workers pinned round robin over the NUMA nodes, see SetThreadPinning
+		bool ShowProgress = true;
+		std::string OutputName = "Image";	// PPM written after the render, empty for none
+		bool StreamOutput = false;	// rows go to OutputName as they finish, the camera may then skip its image
+		uint32_t Seed = 0;			// every row's sampler is seeded from it, 0 draws a new one per render
+		CheckpointOptions Checkpoint;	// a resumed render keeps the seed of its checkpoint
+		bool RasterizeFirstHits = false;	// camera rays start from a VisibilityBuffer instead of the BVH, pinhole cameras only
+	};
+
+	struct RenderStats
+	{
+		double Seconds = 0;
+		uint64_t NumRays = 0;	// camera, bounce and shadow rays
+	};
+
+	// What the camera ray saw first, feeds the denoiser
+	struct PathFeatures
+	{
+		Eigen::Vector3f Normal = Eigen::Vector3f::Zero();
+		Eigen::Vector3f Albedo = Eigen::Vector3f::Ones();
+		Eigen::Vector3f Position = Eigen::Vector3f::Zero();
+		Float Depth = 0;
+		bool Hit = false;
+	};
+
+	// Unidirectional path tracer over Lambertian surfaces, emitter sampling and
+	// BSDF sampling are combined with the power heuristic
+	class PathIntegrator
+	{
+	public:
+		// Paths end in pCache once it has learned the radiance at a vertex, and feed it otherwise
+		PathIntegrator(const Scene& aScene, const RenderOptions& Options, Float PixelSpreadAngle = 0, RadianceCache* pCache = nullptr);
+
+		PathIntegrator(const PathIntegrator&) = delete;
+		PathIntegrator& operator=(const PathIntegrator&) = delete;
+
+		~PathIntegrator() = default;
+
+		// Instantiated for ISampler and every final sampler, the latter resolve their calls at compile time.
+		// pFirstHit is what a VisibilityBuffer found for a camera ray, pPagedHit what Scene::IntersectPaged did
+		template<typename SamplerType>
+		Eigen::Vector3f Li(Ray aRay, SamplerType& Sampler, PathFeatures* pFeatures = nullptr, const VisibilitySample* pFirstHit = nullptr,
+						   const PagedHit* pPagedHit = nullptr) const;
+
+	private:
+		template<typename SamplerType>
+		Eigen::Vector3f SampleDirectLight(const Eigen::Vector3f& Point, const Eigen::Vector3f& Normal, const Eigen::Vector3f& Albedo, const RayDetail& Detail, SamplerType& Sampler) const;
+
+		template<typename SamplerType>
+		Eigen::Vector3f SampleEnvironment(const Eigen::Vector3f& Point, const Eigen::Vector3f& Normal, const Eigen::Vector3f& Albedo, const RayDetail& Detail, SamplerType& Sampler) const;
+
+		const Scene& mScene;
+		RenderOptions mOptions;
+		Float mPixelSpreadAngle;
+		RadianceCache* pRadianceCache;
+	};
+
+	// With a history the previous render seeds this one, see ReprojectionCache
+	RenderStats Render(Camera& aCamera, const Scene& aScene, const RenderOptions& Options = {}, ReprojectionCache* pHistory = nullptr);
+
+} // namespace PathTracer
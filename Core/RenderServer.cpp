@@ -0,0 +1,279 @@
+#include <RenderServer.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define PATHTRACER_UNIX_SOCKETS
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace Eigen;
+
+namespace PathTracer
+{
+	constexpr size_t kMaxRequestBytes = 64 << 10;
+
+	static std::string_view Trim(std::string_view Text)
+	{
+		const size_t First = Text.find_first_not_of(" \t\r");
+
+		if (First == std::string_view::npos)
+		{
+			return {};
+		}
+
+		return Text.substr(First, Text.find_last_not_of(" \t\r") - First + 1);
+	}
+
+	template<typename FunctionType>
+	static void ForEachLine(std::string_view Text, FunctionType&& Function)
+	{
+		while (!Text.empty())
+		{
+			const size_t LineEnd = std::min(Text.find('\n'), Text.size());
+			const std::string_view Line = Trim(Text.substr(0, LineEnd));
+
+			if (!Line.empty() && !Function(Line))
+			{
+				return;
+			}
+
+			Text.remove_prefix(std::min(LineEnd + 1, Text.size()));
+		}
+	}
+
+	// A request ends at its "render" or "quit" line, or when the client stops sending
+	static bool HasCommand(std::string_view Text, std::string_view Command)
+	{
+		bool Found = false;
+
+		ForEachLine(Text, [&](std::string_view Line)
+		{
+			Found = Line == Command;
+
+			return !Found;
+		});
+
+		return Found;
+	}
+
+	template<typename VectorType>
+	static VectorType ParseValues(std::string_view Key, std::string_view Values)
+	{
+		std::istringstream Stream{std::string(Values)};
+		VectorType Result;
+
+		for (int Index = 0; Index < Result.size(); Index++)
+		{
+			Stream >> Result[Index];
+		}
+
+		if (!Stream)
+		{
+			throw std::runtime_error("Expected " + std::to_string(Result.size()) + " numbers for " + std::string(Key) + "\n");
+		}
+
+		return Result;
+	}
+
+	RenderRequest ParseRenderRequest(std::string_view Text)
+	{
+		RenderRequest Request;
+		Request.Camera.Up = Vector3f(0, 1, 0);
+		Request.Camera.FOVDegrees = 45;
+		Request.Options.ShowProgress = false;
+
+		bool HasFrom = false, HasAt = false, HasResolution = false;
+
+		ForEachLine(Text, [&](std::string_view Line)
+		{
+			const size_t KeyEnd = std::min(Line.find_first_of(" \t"), Line.size());
+			const std::string_view Key = Line.substr(0, KeyEnd);
+			const std::string_view Values = Trim(Line.substr(KeyEnd));
+
+			if (Key == "scene")
+			{
+				Request.ScenePath = Values;
+			}
+			else if (Key == "from")
+			{
+				Request.Camera.LookFrom = ParseValues<Vector3f>(Key, Values);
+				HasFrom = true;
+			}
+			else if (Key == "at")
+			{
+				Request.Camera.LookAt = ParseValues<Vector3f>(Key, Values);
+				HasAt = true;
+			}
+			else if (Key == "up")
+			{
+				Request.Camera.Up = ParseValues<Vector3f>(Key, Values);
+			}
+			else if (Key == "resolution")
+			{
+				Request.Camera.Resolution = ParseValues<Vector2i>(Key, Values);
+				HasResolution = Request.Camera.Resolution.minCoeff() > 0;
+			}
+			else if (Key == "fov")
+			{
+				Request.Camera.FOVDegrees = ParseValues<Matrix<Float, 1, 1>>(Key, Values)[0];
+			}
+			else if (Key == "lens")
+			{
+				Request.Camera.LensRadius = ParseValues<Matrix<Float, 1, 1>>(Key, Values)[0];
+			}
+			else if (Key == "focus")
+			{
+				Request.Camera.FocusDistance = ParseValues<Matrix<Float, 1, 1>>(Key, Values)[0];
+			}
+			else if (Key == "samples")
+			{
+				Request.Options.SamplesPerPixel = std::max(1, ParseValues<Matrix<int, 1, 1>>(Key, Values)[0]);
+			}
+			else if (Key == "depth")
+			{
+				Request.Options.MaxDepth = std::max(0, ParseValues<Matrix<int, 1, 1>>(Key, Values)[0]);
+			}
+			else if (Key == "output")
+			{
+				Request.Options.OutputName = Values;
+			}
+			else if (Key == "render")
+			{
+				return false;
+			}
+			else
+			{
+				throw std::runtime_error("Unknown request key " + std::string(Key) + "\n");
+			}
+
+			return true;
+		});
+
+		if (Request.ScenePath.empty() || !HasFrom || !HasAt || !HasResolution)
+		{
+			throw std::runtime_error("A render request needs scene, from, at and resolution\n");
+		}
+
+		return Request;
+	}
+
+	RenderServer::RenderServer(const RenderServerOptions& Options)
+	: mOptions{Options}, mCache{Options.SceneCacheBudget, Options.BuildOptions}
+	{
+	}
+
+	RenderServer::~RenderServer()
+	{
+	#if defined(PATHTRACER_UNIX_SOCKETS)
+		if (mSocket >= 0)
+		{
+			close(mSocket);
+			unlink(mOptions.SocketPath.c_str());
+		}
+	#endif
+	}
+
+	std::string RenderServer::HandleRequest(std::string_view Text)
+	{
+		try
+		{
+			const RenderRequest Request = ParseRenderRequest(Text);
+
+			bool WasCached = false;
+			const std::shared_ptr<const Scene> pScene = mCache.Acquire(Request.ScenePath, WasCached);
+
+			Camera aCamera(Request.Camera);
+
+			const RenderStats Stats = Render(aCamera, *pScene, Request.Options);
+
+			std::ostringstream Reply;
+			Reply << "ok seconds " << Stats.Seconds << " rays " << Stats.NumRays << " cached " << WasCached << "\n";
+
+			return Reply.str();
+		}
+		catch (const std::exception& Error)
+		{
+			// replies are single lines
+			std::string Message = Error.what();
+			std::replace(Message.begin(), Message.end(), '\n', ' ');
+
+			return "error " + std::string(Trim(Message)) + "\n";
+		}
+	}
+
+	void RenderServer::Run()
+	{
+	#if defined(PATHTRACER_UNIX_SOCKETS)
+		sockaddr_un Address{};
+		Address.sun_family = AF_UNIX;
+
+		if (mOptions.SocketPath.size() >= sizeof(Address.sun_path))
+		{
+			throw std::runtime_error("Socket path " + mOptions.SocketPath + " is too long\n");
+		}
+
+		std::memcpy(Address.sun_path, mOptions.SocketPath.c_str(), mOptions.SocketPath.size() + 1);
+
+		// a socket file left behind by an earlier server would fail the bind
+		unlink(mOptions.SocketPath.c_str());
+
+		mSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+		if (mSocket < 0 || bind(mSocket, reinterpret_cast<const sockaddr*>(&Address), sizeof(Address)) != 0 || listen(mSocket, 16) != 0)
+		{
+			throw std::runtime_error("Failed to listen on " + mOptions.SocketPath + "\n");
+		}
+
+		std::cout << "Render server listening on " << mOptions.SocketPath << "\n";
+
+		for (bool Running = true; Running; )
+		{
+			const int Connection = accept(mSocket, nullptr, nullptr);
+
+			if (Connection < 0)
+			{
+				continue;
+			}
+
+			std::string Text;
+			char Buffer[4096];
+
+			while (!HasCommand(Text, "render") && !HasCommand(Text, "quit") && Text.size() < kMaxRequestBytes)
+			{
+				const ssize_t Received = recv(Connection, Buffer, sizeof(Buffer), 0);
+
+				if (Received <= 0)
+				{
+					break;
+				}
+
+				Text.append(Buffer, static_cast<size_t>(Received));
+			}
+
+			std::string Reply;
+
+			if (HasCommand(Text, "quit"))
+			{
+				Reply = "ok\n";
+				Running = false;
+			}
+			else
+			{
+				Reply = HandleRequest(Text);
+			}
+
+		#if defined(MSG_NOSIGNAL)
+			send(Connection, Reply.data(), Reply.size(), MSG_NOSIGNAL);
+		#else
+			send(Connection, Reply.data(), Reply.size(), 0);
+		#endif
+
+			close(Connection);
+		}
+	#else
+		throw std::runtime_error("The render server needs Unix domain sockets\n");
+	#endif
+	}
+
+} // namespace PathTracer
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <Pch.h>
+#include <Camera.h>
+#include <Render.h>
+#include <SceneCache.h>
+
+namespace PathTracer
+{
+	struct RenderServerOptions
+	{
+		std::string SocketPath = "/tmp/PathTracer.sock";
+		size_t SceneCacheBudget = size_t(4) << 30;
+		SceneOptions BuildOptions;
+	};
+
+	struct RenderRequest
+	{
+		std::string ScenePath;
+		CamOptions Camera;
+		RenderOptions Options;
+	};
+
+	// Text form of a job, one "key values" line per setting and a closing "render":
+	//   scene Models/Cube.obj
+	//   from 3 2 5
+	//   at 0 2 -1
+	//   resolution 500 500
+	//   render
+	// up (0 1 0), fov (45), lens, focus, samples, depth and output (Image) are optional
+	RenderRequest ParseRenderRequest(std::string_view Text);
+
+	// Long running renderer on a Unix domain socket. Every connection carries one
+	// job and gets one line back, "ok seconds S rays N cached 0|1" or "error
+	// message". Jobs run one after another, each on the shared worker pool, and
+	// share the loaded scenes through a SceneCache. A "quit" line stops the server
+	class RenderServer
+	{
+	public:
+		RenderServer(const RenderServerOptions& Options);
+
+		RenderServer(const RenderServer&) = delete;
+		RenderServer& operator=(const RenderServer&) = delete;
+
+		~RenderServer();
+
+		void Run();
+
+		// The reply line for a request, without the socket
+		std::string HandleRequest(std::string_view Text);
+
+		const SceneCache& GetSceneCache() const { return mCache; }
+
+	private:
+		RenderServerOptions mOptions;
+		SceneCache mCache;
+		int mSocket = -1;
+	};
+
+} // namespace PathTracer
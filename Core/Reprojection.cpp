@@ -0,0 +1,72 @@
+#include <Reprojection.h>
+
+using namespace Eigen;
+
+namespace PathTracer
+{
+	ReprojectionCache::ReprojectionCache(const ReprojectionOptions& Options)
+	: mOptions{Options}
+	{
+	}
+
+	bool ReprojectionCache::Lookup(const Vector3f& Position, const Vector3f& Normal, Float Distance, HistoryPixel& History) const
+	{
+		if (mPixels.empty())
+		{
+			return false;
+		}
+
+		Vector2f Pixel;
+
+		if (!mProjection.Project(Position, Pixel))
+		{
+			return false;
+		}
+
+		const size_t Index = size_t(Pixel.y()) * mProjection.Resolution.x() + size_t(Pixel.x());
+		const HistoryPixel& Previous = mPixels[Index];
+
+		if (Previous.NumSamples == 0 || Previous.Normal.dot(Normal) < mOptions.NormalTolerance)
+		{
+			return false;
+		}
+
+		// sliding along the surface is fine, a different surface in front or behind is not
+		if (std::abs(Normal.dot(Previous.Position - Position)) > mOptions.PlaneTolerance * Distance)
+		{
+			return false;
+		}
+
+		History = Previous;
+
+		return true;
+	}
+
+	void ReprojectionCache::BeginFrame(const Camera& aCamera)
+	{
+		mNextProjection = aCamera.GetProjection();
+
+		mNextPixels.assign(size_t(mNextProjection.Resolution.x()) * mNextProjection.Resolution.y(), HistoryPixel{});
+	}
+
+	void ReprojectionCache::Store(size_t Pixel, const HistoryPixel& History)
+	{
+		mNextPixels[Pixel] = History;
+	}
+
+	void ReprojectionCache::EndFrame()
+	{
+		std::swap(mPixels, mNextPixels);
+
+		mProjection = mNextProjection;
+
+		mNextPixels.clear();
+	}
+
+	void ReprojectionCache::Clear()
+	{
+		mPixels.clear();
+		mNextPixels.clear();
+	}
+
+} // namespace PathTracer
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <Pch.h>
+#include <Camera.h>
+
+namespace PathTracer
+{
+	struct ReprojectionOptions
+	{
+		unsigned MaxHistorySamples = 256;	// caps the weight of old samples so footprint changes wash out
+		unsigned ReusedSamples = 2;			// fresh samples for a pixel that found its history
+		Float PlaneTolerance = 0.01f;		// distance to the tangent plane, relative to the hit distance
+		Float NormalTolerance = 0.9f;		// minimum cosine between the normals
+	};
+
+	// Accumulated result of one pixel
+	struct HistoryPixel
+	{
+		Eigen::Vector3f Radiance = Eigen::Vector3f::Zero();		// mean over the samples
+		Eigen::Vector3f Position = Eigen::Vector3f::Zero();
+		Eigen::Vector3f Normal = Eigen::Vector3f::Zero();		// zero where nothing was hit
+		Float LuminanceSq = 0;									// mean of the squared luminance
+		unsigned NumSamples = 0;
+	};
+
+	// Keeps the last render so a re-render after a small camera move starts from the
+	// samples that are still valid. Surfaces are Lambertian, so the radiance of a point
+	// found again through backward reprojection carries over unchanged
+	class ReprojectionCache
+	{
+	public:
+		ReprojectionCache(const ReprojectionOptions& Options = {});
+
+		ReprojectionCache(const ReprojectionCache&) = delete;
+		ReprojectionCache& operator=(const ReprojectionCache&) = delete;
+
+		ReprojectionCache(ReprojectionCache&&) = default;
+		ReprojectionCache& operator=(ReprojectionCache&&) = default;
+
+		~ReprojectionCache() = default;
+
+		// History of the surface point seen in the new view, false where it was occluded or off screen
+		bool Lookup(const Eigen::Vector3f& Position, const Eigen::Vector3f& Normal, Float Distance, HistoryPixel& History) const;
+
+		// Pixels stored between BeginFrame and EndFrame become the history of the next render
+		void BeginFrame(const Camera& aCamera);
+
+		void Store(size_t Pixel, const HistoryPixel& History);
+
+		void EndFrame();
+
+		void Clear();
+
+		const ReprojectionOptions& GetOptions() const { return mOptions; }
+
+	private:
+		ReprojectionOptions mOptions;
+		CameraProjection mProjection, mNextProjection;
+		std::vector<HistoryPixel> mPixels, mNextPixels;
+	};
+
+} // namespace PathTracer
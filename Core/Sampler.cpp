@@ -6,8 +6,8 @@ using namespace Eigen;
 
 namespace PathTracer
 {
-    ISampler::ISampler(unsigned NumSamples, unsigned NumSets) 
-    : mRng{std::random_device()()}, mDistrib{0.f, 1.f},
+    ISampler::ISampler(unsigned NumSamples, unsigned NumSets, uint32_t Seed) 
+    : mRng{Seed}, mDistrib{0.f, 1.f},
         nCountSquare{0}, nSamples{NumSamples}, nSets{NumSets}
     {
         GetRandomFloat01 = std::bind(mDistrib, mRng);
@@ -39,12 +39,23 @@ namespace PathTracer
         return Eigen::Vector3f{SinTheta * std::cosf(Phi), CosTheta, SinTheta * std::sinf(Phi)};
     }
 
-    // Random
-    Vector2f RandomSampler::SampleUnitSquare()
+    // DensityPower is the cosine exponent, 1 gives the usual cosine weighted distribution
+    Eigen::Vector3f ISampler::MapSquareToHemisphere(const Eigen::Vector2f& Sample, SamplingStrategy Strategy, Float DensityPower)
     {
-        return Vector2f{GetRandomFloat01(), GetRandomFloat01()};
+        switch (Strategy)
+        {
+        case SamplingStrategy::Uniform:
+            return InternalSampleHemisphere(Sample.x(), k2Pi * Sample.y());
+
+        case SamplingStrategy::CosineWeighted:
+            return InternalSampleHemisphere(std::powf(Sample.x(), 1 / (DensityPower + 1)), k2Pi * Sample.y());
+
+        default:
+            throw std::invalid_argument("Unsupported strategy");
+        }
     }
 
+    // Random
     Vector2f RandomSampler::SampleUnitDisk()
     {
         Float Radius = std::sqrtf(GetRandomFloat01());
@@ -55,36 +66,12 @@ namespace PathTracer
 
     Vector3f RandomSampler::SampleHemisphere(SamplingStrategy Strategy, Float DensityPower)
     {
-        switch (Strategy)
-        {
-        case SamplingStrategy::Uniform:
-            {
-                Float CosTheta = GetRandomFloat01();
-                Float Phi = k2Pi * GetRandomFloat01();
-
-                return InternalSampleHemisphere(CosTheta, Phi);
-            }
-            break;
-
-        case SamplingStrategy::CosineWeighted:
-            {
-                Float CosTheta = std::powf(GetRandomFloat01(), 1 / (DensityPower + 1));
-                Float Phi = k2Pi * GetRandomFloat01();
-
-                return InternalSampleHemisphere(CosTheta, Phi);
-            }
-            break;
-
-        default:
-            throw std::invalid_argument("Unsupported strategy");
-
-            break;
-        }
+        return MapSquareToHemisphere(SampleUnitSquare(), Strategy, DensityPower);
     }
 
     // MultiJitteredSampler
-    CMJSampler::CMJSampler(unsigned NumSamples, unsigned NumSets) 
-    : ISampler(NumSamples, NumSets)
+    CMJSampler::CMJSampler(unsigned NumSamples, unsigned NumSets, uint32_t Seed) 
+    : ISampler(NumSamples, NumSets, Seed)
     {
         GenerateSamples();
     }
@@ -95,6 +82,8 @@ namespace PathTracer
 
         Float InvN = 1.f / n;
 
+        mSamples.resize(nSets * nSamples);
+
 		for (unsigned p = 0; p < nSets; p++)
 		{
             unsigned SampleSet = p * nSamples;
@@ -157,17 +146,17 @@ namespace PathTracer
 
     Vector2f CMJSampler::SampleUnitDisk()
     {
-        return Vector2f{};
+        return MapSquareToDisk(SampleUnitSquare());
     }
 
     Vector3f CMJSampler::SampleHemisphere(SamplingStrategy Strategy, Float DensityPower)
     {
-        return Vector3f{};
+        return MapSquareToHemisphere(SampleUnitSquare(), Strategy, DensityPower);
     }
 
     // HammersleySampler
-    HammersleySampler::HammersleySampler(unsigned NumSamples, unsigned NumSets) 
-    : ISampler(NumSamples, NumSets)
+    HammersleySampler::HammersleySampler(unsigned NumSamples, unsigned NumSets, uint32_t Seed) 
+    : ISampler(NumSamples, NumSets, Seed)
     {
         GenerateSamples();
     }
@@ -176,11 +165,26 @@ namespace PathTracer
 	{
 		Float OneDivSamples = 1.f / nSamples;
 
+		// 24 bits fill the float mantissa, so no scrambled value rounds up to 1
+		constexpr Float k1Div2Pow24 = 1.f / (1 << 24);
+
+		// every set gets its own shift of x and random digit scramble of y, the same
+		// points in each set would bias the estimate instead of only stratifying it
 		for (unsigned s = 0; s < nSets; s++)
 		{
+			const Float Shift = GetRandomFloat01();
+			const uint32_t Scramble = mRng();
+
 			for (unsigned i = 0; i < nSamples; i++)
 			{
-				mSamples.push_back(Vector2f((i + 0.5f) * OneDivSamples, Reverse64bit(i) * k1Div2PowNeg64));
+				Float X = (i + 0.5f) * OneDivSamples + Shift;
+
+				if (X >= 1)
+				{
+					X -= 1;
+				}
+
+				mSamples.push_back(Vector2f(X, ((Reverse32bit(i) ^ Scramble) >> 8) * k1Div2Pow24));
 			}
 		}
 	}
@@ -197,12 +201,38 @@ namespace PathTracer
 
     Vector2f HammersleySampler::SampleUnitDisk()
     {
-        return Vector2f{};
+        return MapSquareToDisk(SampleUnitSquare());
     }
 
     Vector3f HammersleySampler::SampleHemisphere(SamplingStrategy Strategy, Float DensityPower)
     {
-        return Vector3f{};
+        return MapSquareToHemisphere(SampleUnitSquare(), Strategy, DensityPower);
+    }
+
+    Vector2f MapSquareToDisk(const Vector2f& Sample)
+    {
+        const Float X = 2 * Sample.x() - 1;
+        const Float Y = 2 * Sample.y() - 1;
+
+        if (X == 0 && Y == 0)
+        {
+            return Vector2f::Zero();
+        }
+
+        Float Radius, Theta;
+
+        if (std::abs(X) > std::abs(Y))
+        {
+            Radius = X;
+            Theta = (kPi / 4) * (Y / X);
+        }
+        else
+        {
+            Radius = Y;
+            Theta = kPi / 2 - (kPi / 4) * (X / Y);
+        }
+
+        return Vector2f{Radius * std::cos(Theta), Radius * std::sin(Theta)};
     }
 
 	uint32_t Reverse32bit(uint32_t Number)
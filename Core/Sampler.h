@@ -5,6 +5,8 @@
 
 namespace PathTracer
 {
+	constexpr unsigned kDefaultSampleSets = 97;
+
 	enum class SamplingStrategy
 	{
 		Uniform = 1,
@@ -14,7 +16,8 @@ namespace PathTracer
     class ISampler
     {
     public:
-        ISampler(unsigned NumSamples = 0, unsigned NumSets = 0);
+        // A fixed seed repeats the same sample sets and streams
+        ISampler(unsigned NumSamples = 0, unsigned NumSets = 0, uint32_t Seed = std::random_device()());
 
 		ISampler(const ISampler&) = delete;
 		ISampler& operator=(const ISampler&) = delete;
@@ -30,6 +33,8 @@ namespace PathTracer
     protected:
         Eigen::Vector3f InternalSampleHemisphere(Float CosTheta, Float Phi);
 
+        Eigen::Vector3f MapSquareToHemisphere(const Eigen::Vector2f& Sample, SamplingStrategy Strategy, Float DensityPower);
+
         std::function<Float()> GetRandomFloat01;
         std::mt19937 mRng;
         std::uniform_real_distribution<Float> mDistrib;
@@ -39,22 +44,30 @@ namespace PathTracer
 		unsigned nCountSquare, mJumpSquare, nSamples, nSets;
     };
     
-    class RandomSampler : public ISampler
+    // The samplers are final so render kernels instantiated on them call straight
+    // through, SampleUnitSquare of the random sampler inlines into the path loop
+    class RandomSampler final : public ISampler
     {
     public:
         RandomSampler() = default;
+
+        explicit RandomSampler(uint32_t Seed) : ISampler(0, 0, Seed) {}
         
-        Eigen::Vector2f SampleUnitSquare() override;
+        Eigen::Vector2f SampleUnitSquare() override
+        {
+            return Eigen::Vector2f{mDistrib(mRng), mDistrib(mRng)};
+        }
+
         Eigen::Vector2f SampleUnitDisk() override;
         Eigen::Vector3f SampleHemisphere(SamplingStrategy Strategy, Float DensityPower = 0) override;
 
         ~RandomSampler() = default;
     };
     
-    class CMJSampler : public ISampler
+    class CMJSampler final : public ISampler
     {
     public:
-        CMJSampler(unsigned NumSamples, unsigned NumSets = 97);
+        CMJSampler(unsigned NumSamples, unsigned NumSets = kDefaultSampleSets, uint32_t Seed = std::random_device()());
         
         Eigen::Vector2f SampleUnitSquare() override;
         Eigen::Vector2f SampleUnitDisk() override;
@@ -65,10 +78,10 @@ namespace PathTracer
         void GenerateSamples();
     };
 
-	class HammersleySampler : public ISampler
+	class HammersleySampler final : public ISampler
 	{
 	public:
-		HammersleySampler(unsigned NumSamples, unsigned NumSets = 97);
+		HammersleySampler(unsigned NumSamples, unsigned NumSets = kDefaultSampleSets, uint32_t Seed = std::random_device()());
 
         Eigen::Vector2f SampleUnitSquare() override;
         Eigen::Vector2f SampleUnitDisk() override;
@@ -80,6 +93,9 @@ namespace PathTracer
 		void GenerateSamples();
 	};
 
+    // Concentric map (Shirley and Chiu), keeps the strata of the square sample intact
+    Eigen::Vector2f MapSquareToDisk(const Eigen::Vector2f& Sample);
+
     uint32_t Reverse32bit(uint32_t Number);
 	uint64_t Reverse64bit(uint64_t Number);
     
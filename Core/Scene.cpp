@@ -1,6 +1,10 @@
 #pragma once
 
 #include <Scene.h>
+#include <Parallel.h>
+#include <ObjLoader.h>
+#include <VisibilityBuffer.h>
+#include <OutOfCore.h>
 
 #define ASSIMP_PREPROCESS_FLAGS (aiProcess_Triangulate | aiProcess_JoinIdenticalVertices)
 
@@ -8,16 +12,165 @@ using namespace Eigen;
 
 namespace PathTracer
 {
+	uint32_t EncodeOctahedral(const Vector3f& Normal)
+	{
+		const Float InvLength = 1 / (std::abs(Normal.x()) + std::abs(Normal.y()) + std::abs(Normal.z()));
+
+		Float X = Normal.x() * InvLength;
+		Float Y = Normal.y() * InvLength;
+
+		if (Normal.z() < 0)
+		{
+			const Float FoldedX = (1 - std::abs(Y)) * (X >= 0 ? 1 : -1);
+			const Float FoldedY = (1 - std::abs(X)) * (Y >= 0 ? 1 : -1);
+
+			X = FoldedX;
+			Y = FoldedY;
+		}
+
+		const int16_t QuantizedX = static_cast<int16_t>(std::lround(std::clamp(X, -1.f, 1.f) * 32767));
+		const int16_t QuantizedY = static_cast<int16_t>(std::lround(std::clamp(Y, -1.f, 1.f) * 32767));
+
+		return uint32_t(uint16_t(QuantizedX)) | (uint32_t(uint16_t(QuantizedY)) << 16);
+	}
+
+	static Float CalcTriangleArea(const Triangle& aTriangle)
+	{
+		const Vector3f V0 = aTriangle.GetPosition(0);
+
+		return 0.5f * (aTriangle.GetPosition(1) - V0).cross(aTriangle.GetPosition(2) - V0).norm();
+	}
+
+	TriangleMesh::TriangleMesh(std::vector<Vertex> Vertices, std::vector<unsigned> Indices)
+	: mVertices{std::move(Vertices)}, mIndices{std::move(Indices)}
+	{
+		BuildTriangles();
+	}
+
+	TriangleMesh::TriangleMesh(TriangleMesh&& Other) noexcept
+	{
+		*this = std::move(Other);
+	}
+
+	TriangleMesh& TriangleMesh::operator=(TriangleMesh&& Other) noexcept
+	{
+		mVertices = std::move(Other.mVertices);
+		mIndices = std::move(Other.mIndices);
+		mTriangles = std::move(Other.mTriangles);
+		mCompressedVertices = std::move(Other.mCompressedVertices);
+		mTexCoords = std::move(Other.mTexCoords);
+		mQuantizationOrigin = Other.mQuantizationOrigin;
+		mQuantizationStep = Other.mQuantizationStep;
+		mMaterialIndex = Other.mMaterialIndex;
+
+		for (auto& aTriangle : mTriangles)
+		{
+			aTriangle.pMesh = this;
+		}
+
+		return *this;
+	}
+
 	void TriangleMesh::BuildTriangles()
 	{
 		mTriangles.reserve(mIndices.size() / 3);
 
 		for (size_t Index = 0; Index < mIndices.size(); Index += 3)
 		{
-			mTriangles.emplace_back(this, mVertices[mIndices[Index]], mVertices[mIndices[Index + 1]], mVertices[mIndices[Index + 2]]);
+			Triangle& aTriangle = mTriangles.emplace_back(this, mIndices[Index], mIndices[Index + 1], mIndices[Index + 2]);
+
+			aTriangle.Area = CalcTriangleArea(aTriangle);
+		}
+	}
+
+	void TriangleMesh::GenerateNormals()
+	{
+		for (auto& aVertex : mVertices)
+		{
+			aVertex.Normal.setZero();
+		}
+
+		// area weighted, the cross product length is twice the face area
+		for (size_t Index = 0; Index + 2 < mIndices.size(); Index += 3)
+		{
+			Vertex& V0 = mVertices[mIndices[Index]];
+			Vertex& V1 = mVertices[mIndices[Index + 1]];
+			Vertex& V2 = mVertices[mIndices[Index + 2]];
+
+			const Vector3f FaceNormal = (V1.Position - V0.Position).cross(V2.Position - V0.Position);
+
+			V0.Normal += FaceNormal;
+			V1.Normal += FaceNormal;
+			V2.Normal += FaceNormal;
+		}
+
+		for (auto& aVertex : mVertices)
+		{
+			const Float Length = aVertex.Normal.norm();
+
+			aVertex.Normal = Length > 0 ? Vector3f(aVertex.Normal / Length) : Vector3f(0, 0, 1);
+		}
+	}
+
+	void TriangleMesh::Compress()
+	{
+		if (mVertices.empty())
+		{
+			return;
+		}
+
+		Vector3f MinBound(kInfinity, kInfinity, kInfinity);
+		Vector3f MaxBound = -MinBound;
+
+		for (const auto& aVertex : mVertices)
+		{
+			MinBound = MinBound.cwiseMin(aVertex.Position);
+			MaxBound = MaxBound.cwiseMax(aVertex.Position);
+		}
+
+		const Vector3f Extent = MaxBound - MinBound;
+
+		mQuantizationOrigin = MinBound;
+		mQuantizationStep = Extent / static_cast<Float>(kPositionQuantizationMax);
+
+		mCompressedVertices.reserve(mVertices.size());
+
+		for (const auto& aVertex : mVertices)
+		{
+			uint64_t Bits = 0;
+
+			for (int Axis = 0; Axis < 3; Axis++)
+			{
+				const Float Normalized = Extent[Axis] > 0 ? (aVertex.Position[Axis] - MinBound[Axis]) / Extent[Axis] : 0;
+				const uint64_t Quantized = static_cast<uint64_t>(std::lround(std::clamp(Normalized, 0.f, 1.f) * kPositionQuantizationMax));
+
+				Bits |= Quantized << (21 * Axis);
+			}
+
+			CompressedVertex Packed;
+			Packed.Position[0] = static_cast<uint32_t>(Bits);
+			Packed.Position[1] = static_cast<uint32_t>(Bits >> 32);
+			Packed.Normal = EncodeOctahedral(aVertex.Normal);
+
+			mCompressedVertices.push_back(Packed);
+		}
+
+		mVertices = std::vector<Vertex>();
+
+		// match the quantized positions the intersector sees
+		for (auto& aTriangle : mTriangles)
+		{
+			aTriangle.Area = CalcTriangleArea(aTriangle);
 		}
 	}
 
+	size_t TriangleMesh::GetSizeInBytes() const
+	{
+		return sizeof(TriangleMesh) + mVertices.capacity() * sizeof(Vertex) + mIndices.capacity() * sizeof(unsigned)
+			+ mTriangles.capacity() * sizeof(Triangle) + mCompressedVertices.capacity() * sizeof(CompressedVertex)
+			+ mTexCoords.capacity() * sizeof(Vector2f);
+	}
+
     bool TriangleMesh::Intersect(const Ray& aRay, Intersection& HitResult) const
     {
         bool Result = false;
@@ -33,91 +186,840 @@ namespace PathTracer
         return Result;
     }
 
-	Scene::Scene(std::string_view FileName)
+	Scene::Scene(std::string_view FileName, const SceneOptions& Options)
+	: mOptions{Options}
 	{
 		using namespace std::string_literals;
 
+		mTextureCache = std::make_unique<TextureCache>(Options.TextureMemoryBudget);
+
+		const std::filesystem::path Directory = std::filesystem::path(FileName).parent_path();
+
+		std::string Extension = std::filesystem::path(FileName).extension().string();
+		std::transform(Extension.begin(), Extension.end(), Extension.begin(), [](unsigned char Character) { return static_cast<char>(std::tolower(Character)); });
+
+		// OBJ takes the fast path, other formats and whatever it cannot read go through Assimp. A baked
+		// out of core file stores its resident meshes the same way and needs no source
+		std::unique_ptr<ObjScene> pObj;
+
+		const bool IsBaked = OutOfCoreScene::IsBakedFile(FileName);
+
+		if (IsBaked)
+		{
+			pObj = std::make_unique<ObjScene>(OutOfCoreScene::ReadResidents(FileName));
+		}
+		else if (Extension == ".obj")
+		{
+			try
+			{
+				pObj = std::make_unique<ObjScene>(LoadObj(FileName));
+			}
+			catch (const std::exception& Error)
+			{
+				std::cout << "OBJ fast path failed, falling back to Assimp: " << Error.what();
+			}
+		}
+
 		Assimp::Importer Importer;
+		std::vector<const aiMesh*> SourceMeshes;
 
-		const aiScene* pScene = Importer.ReadFile(FileName.data(), ASSIMP_PREPROCESS_FLAGS);
+		if (pObj)
+		{
+			for (size_t MaterialIndex = 0; MaterialIndex < pObj->Materials.size(); MaterialIndex++)
+			{
+				Material NewMaterial = pObj->Materials[MaterialIndex];
+
+				if (!pObj->DiffuseMaps[MaterialIndex].empty())
+				{
+					NewMaterial.DiffuseTexture = LoadTexture(Directory / pObj->DiffuseMaps[MaterialIndex]);
+				}
 
-		if (pScene == nullptr)
+				if (!pObj->DisplacementMaps[MaterialIndex].empty())
+				{
+					NewMaterial.DisplacementTexture = LoadTexture(Directory / pObj->DisplacementMaps[MaterialIndex]);
+				}
+
+				mMaterials.push_back(NewMaterial);
+			}
+
+			mMeshes.resize(pObj->Meshes.size());
+		}
+		else
 		{
-			throw std::runtime_error("Assimp Error \n"s + Importer.GetErrorString());
+			const aiScene* pScene = Importer.ReadFile(FileName.data(), ASSIMP_PREPROCESS_FLAGS);
+
+			if (pScene == nullptr)
+			{
+				throw std::runtime_error("Assimp Error \n"s + Importer.GetErrorString());
+			}
+
+			for (size_t MaterialIndex = 0; MaterialIndex < pScene->mNumMaterials; MaterialIndex++)
+			{
+				const aiMaterial& SourceMaterial = *pScene->mMaterials[MaterialIndex];
+
+				Material NewMaterial = ConvertMaterial(SourceMaterial);
+
+				aiString TexturePath;
+
+				if (SourceMaterial.GetTexture(aiTextureType_DIFFUSE, 0, &TexturePath) == AI_SUCCESS)
+				{
+					NewMaterial.DiffuseTexture = LoadTexture(Directory / TexturePath.C_Str());
+				}
+
+				// OBJ bump maps arrive as height maps
+				if (SourceMaterial.GetTexture(aiTextureType_DISPLACEMENT, 0, &TexturePath) == AI_SUCCESS
+					|| SourceMaterial.GetTexture(aiTextureType_HEIGHT, 0, &TexturePath) == AI_SUCCESS)
+				{
+					NewMaterial.DisplacementTexture = LoadTexture(Directory / TexturePath.C_Str());
+				}
+
+				mMaterials.push_back(NewMaterial);
+			}
+
+			CollectMeshes(pScene, pScene->mRootNode, SourceMeshes);
+
+			mMeshes.resize(SourceMeshes.size());
 		}
 
-		mMeshes.reserve(pScene->mNumMeshes);
+		if (mMaterials.empty())
+		{
+			mMaterials.emplace_back();
+		}
 
-		ProcessNode(pScene, pScene->mRootNode);
+		std::vector<std::vector<Vector3f>> MeshCentroids(mMeshes.size());
+		std::vector<Vector3f> Centroids;
+		std::vector<size_t> TessellatedIndices, SimplifiedIndices, PagedIndices;
 
-		BuildBvh();
+		// meshes convert on the workers while this thread gathers the finished
+		// ones in order, so the BVH input is ready as soon as the last mesh is
+		ParallelForOrdered(mMeshes.size(),
+			[&](size_t MeshIndex)
+			{
+				TriangleMesh& Mesh = mMeshes[MeshIndex];
+
+				if (pObj)
+				{
+					ConvertMesh(pObj->Meshes[MeshIndex], Mesh);
+				}
+				else
+				{
+					ConvertMesh(*SourceMeshes[MeshIndex], Mesh);
+				}
+
+				if (Mesh.mMaterialIndex >= mMaterials.size())
+				{
+					Mesh.mMaterialIndex = 0;
+				}
+
+				if (Options.CompressVertices)
+				{
+					Mesh.Compress();
+				}
+
+				MeshCentroids[MeshIndex].reserve(Mesh.mTriangles.size());
+
+				for (const auto& aTriangle : Mesh.mTriangles)
+				{
+					MeshCentroids[MeshIndex].push_back(Bvh::CalcCentroid(aTriangle));
+				}
+			},
+			[&](size_t MeshIndex)
+			{
+				if (IsTessellated(mMeshes[MeshIndex]))
+				{
+					TessellatedIndices.push_back(MeshIndex);
+				}
+				else if (IsSimplified(mMeshes[MeshIndex]))
+				{
+					SimplifiedIndices.push_back(MeshIndex);
+				}
+				else if (!IsBaked && IsPaged(mMeshes[MeshIndex]))
+				{
+					PagedIndices.push_back(MeshIndex);
+				}
+				else
+				{
+					for (auto& aTriangle : mMeshes[MeshIndex].mTriangles)
+					{
+						pTriangles.push_back(&aTriangle);
+					}
+
+					Centroids.insert(Centroids.end(), MeshCentroids[MeshIndex].begin(), MeshCentroids[MeshIndex].end());
+				}
+
+				MeshCentroids[MeshIndex] = std::vector<Vector3f>();
+			});
+
+		if (IsBaked)
+		{
+			mOutOfCore = std::make_unique<OutOfCoreScene>(FileName, Options.OutOfCore);
+		}
+
+		// first, the resident meshes are baked along and the others take theirs away
+		PageMeshes(PagedIndices);
+
+		TessellateMeshes(TessellatedIndices);
+
+		SimplifyMeshes(SimplifiedIndices);
+
+		BuildBvh(std::move(Centroids));
+
+		BuildLightSampler();
 	}
 
-	void Scene::ProcessNode(const aiScene* pScene, const aiNode* pNode)
+	Scene::Scene(std::vector<TriangleMesh> Meshes, std::vector<Material> Materials, const SceneOptions& Options)
+	: mOptions{Options}, mMeshes{std::move(Meshes)}, mMaterials{std::move(Materials)}
 	{
-		if (pNode)
+		mTextureCache = std::make_unique<TextureCache>(Options.TextureMemoryBudget);
+
+		if (mMaterials.empty())
+		{
+			mMaterials.emplace_back();
+		}
+
+		std::vector<size_t> TessellatedIndices, SimplifiedIndices, PagedIndices;
+
+		for (size_t MeshIndex = 0; MeshIndex < mMeshes.size(); MeshIndex++)
 		{
-			for (size_t MeshIndex = 0; MeshIndex < pNode->mNumMeshes; MeshIndex++)
+			TriangleMesh& Mesh = mMeshes[MeshIndex];
+
+			if (Mesh.mMaterialIndex >= mMaterials.size())
 			{
-				const aiMesh& mMesh = *pScene->mMeshes[pNode->mMeshes[MeshIndex]];
+				Mesh.mMaterialIndex = 0;
+			}
 
-				TriangleMesh NewMesh;
-				
-				NewMesh.mVertices.reserve(mMesh.mNumVertices);
+			if (Options.CompressVertices)
+			{
+				Mesh.Compress();
+			}
 
-				for (size_t VertexIndex = 0; VertexIndex < mMesh.mNumVertices; VertexIndex++)
-				{
-					Vertex NewVertex;
+			if (IsTessellated(Mesh))
+			{
+				TessellatedIndices.push_back(MeshIndex);
+			}
+			else if (IsSimplified(Mesh))
+			{
+				SimplifiedIndices.push_back(MeshIndex);
+			}
+			else if (IsPaged(Mesh))
+			{
+				PagedIndices.push_back(MeshIndex);
+			}
+		}
+
+		PageMeshes(PagedIndices);
+
+		TessellateMeshes(TessellatedIndices);
+
+		SimplifyMeshes(SimplifiedIndices);
+
+		BuildBvh();
+
+		BuildLightSampler();
+	}
+
+	Scene::~Scene() = default;
+
+	void Scene::TessellateMeshes(const std::vector<size_t>& MeshIndices)
+	{
+		if (MeshIndices.empty())
+		{
+			return;
+		}
+
+		mTessellationCache = std::make_unique<TessellationCache>(mOptions.Tessellation.CacheBudget);
+
+		// the tessellated meshes copy what they need, the coarse triangles go
+		for (size_t MeshIndex : MeshIndices)
+		{
+			TriangleMesh& Mesh = mMeshes[MeshIndex];
+
+			const int Displacement = mMaterials[Mesh.mMaterialIndex].DisplacementTexture;
+			const Texture* pDisplacement = Displacement >= 0 ? mTextures[Displacement].get() : nullptr;
+
+			mTessellatedMeshes.push_back(std::make_unique<TessellatedMesh>(Mesh, static_cast<unsigned>(MeshIndex), mOptions.Tessellation, pDisplacement, *mTessellationCache));
+
+			Mesh = TriangleMesh();
+		}
+	}
+
+	bool Scene::IsTessellated(const TriangleMesh& Mesh) const
+	{
+		const TessellationOptions& Options = mOptions.Tessellation;
+		const Material& aMaterial = mMaterials[Mesh.mMaterialIndex];
+
+		if (Options.EdgeSegments == 0 || Mesh.mTriangles.empty() || aMaterial.IsEmissive())
+		{
+			return false;
+		}
 
-					NewVertex.Position.x() = mMesh.mVertices[VertexIndex].x;
-					NewVertex.Position.y() = mMesh.mVertices[VertexIndex].y;
-					NewVertex.Position.z() = mMesh.mVertices[VertexIndex].z;
+		return !Options.DisplacedOnly || aMaterial.DisplacementTexture >= 0;
+	}
+
+	void Scene::SimplifyMeshes(const std::vector<size_t>& MeshIndices)
+	{
+		if (MeshIndices.empty())
+		{
+			return;
+		}
+
+		// the full meshes become level 0 of their chains and leave the scene BVH
+		std::vector<TriangleMesh> Meshes;
+		Meshes.reserve(MeshIndices.size());
 
-					NewVertex.Normal.x() = mMesh.mNormals[VertexIndex].x;
-					NewVertex.Normal.y() = mMesh.mNormals[VertexIndex].y;
-					NewVertex.Normal.z() = mMesh.mNormals[VertexIndex].z;
+		for (size_t MeshIndex : MeshIndices)
+		{
+			Meshes.push_back(std::move(mMeshes[MeshIndex]));
 
-					NewMesh.mVertices.push_back(std::move(NewVertex));
+			mMeshes[MeshIndex] = TriangleMesh();
+		}
+
+		mLodGroup = std::make_unique<LodGroup>(std::move(Meshes), mOptions.LevelOfDetail, mOptions.CompressVertices);
+	}
+
+	bool Scene::IsSimplified(const TriangleMesh& Mesh) const
+	{
+		const LodOptions& Options = mOptions.LevelOfDetail;
+
+		if (Options.MaxLevels == 0 || Mesh.mTriangles.size() < std::max<size_t>(Options.MinTriangles, 1))
+		{
+			return false;
+		}
+
+		return !mMaterials[Mesh.mMaterialIndex].IsEmissive();
+	}
+
+	void Scene::PageMeshes(const std::vector<size_t>& MeshIndices)
+	{
+		if (MeshIndices.empty())
+		{
+			return;
+		}
+
+		const OutOfCoreOptions& Options = mOptions.OutOfCore;
+
+		// the paged meshes get a BVH of their own to bake, then only the file keeps them. The
+		// rest of the scene goes along so the file opens on its own later
+		{
+			std::vector<Triangle*> PagedTriangles;
+			std::vector<char> IsPagedMesh(mMeshes.size(), 0);
+
+			for (size_t MeshIndex : MeshIndices)
+			{
+				for (auto& aTriangle : mMeshes[MeshIndex].mTriangles)
+				{
+					PagedTriangles.push_back(&aTriangle);
 				}
 
-				NewMesh.mIndices.reserve(mMesh.mNumFaces * 3);
+				IsPagedMesh[MeshIndex] = 1;
+			}
+
+			ObjScene Residents;
+
+			std::vector<std::string> TexturePaths(mTextures.size());
 
-				for (size_t FaceIndex = 0; FaceIndex < mMesh.mNumFaces; FaceIndex++)
+			for (const auto& [Key, TextureIndex] : mTextureIndices)
+			{
+				if (TextureIndex >= 0)
 				{
-					assert (mMesh.mFaces[FaceIndex].mNumIndices == 3);
+					TexturePaths[TextureIndex] = std::filesystem::absolute(Key).string();
+				}
+			}
+
+			for (const Material& aMaterial : mMaterials)
+			{
+				Material& Stored = Residents.Materials.emplace_back(aMaterial);
+				Stored.DiffuseTexture = Stored.DisplacementTexture = -1;
+
+				Residents.DiffuseMaps.push_back(aMaterial.DiffuseTexture >= 0 ? TexturePaths[aMaterial.DiffuseTexture] : std::string());
+				Residents.DisplacementMaps.push_back(aMaterial.DisplacementTexture >= 0 ? TexturePaths[aMaterial.DisplacementTexture] : std::string());
+			}
 
-					NewMesh.mIndices.push_back(mMesh.mFaces[FaceIndex].mIndices[0]);
-					NewMesh.mIndices.push_back(mMesh.mFaces[FaceIndex].mIndices[1]);
-					NewMesh.mIndices.push_back(mMesh.mFaces[FaceIndex].mIndices[2]);
+			for (size_t MeshIndex = 0; MeshIndex < mMeshes.size(); MeshIndex++)
+			{
+				const TriangleMesh& Mesh = mMeshes[MeshIndex];
+
+				if (IsPagedMesh[MeshIndex] || Mesh.mTriangles.empty())
+				{
+					continue;
 				}
 
-				NewMesh.BuildTriangles();
+				ObjMesh& Stored = Residents.Meshes.emplace_back();
+				Stored.Indices = Mesh.mIndices;
+				Stored.TexCoords = Mesh.mTexCoords;
+				Stored.HasNormals = true;
+				Stored.MaterialIndex = Mesh.mMaterialIndex;
+
+				const size_t NumVertices = Mesh.IsCompressed() ? Mesh.mCompressedVertices.size() : Mesh.mVertices.size();
 
-				mMeshes.push_back(std::move(NewMesh));
+				for (unsigned Index = 0; Index < NumVertices; Index++)
+				{
+					Stored.Vertices.push_back({ Mesh.GetPosition(Index), Mesh.GetNormal(Index) });
+				}
 			}
+
+			const Bvh PagedBvh(PagedTriangles, mOptions.BuildOptions);
+
+			OutOfCoreScene::Bake(PagedBvh, Options.FileName, Options.TreeletPrimitives, Residents);
+		}
+
+		for (size_t MeshIndex : MeshIndices)
+		{
+			mMeshes[MeshIndex] = TriangleMesh();
+		}
+
+		mOutOfCore = std::make_unique<OutOfCoreScene>(Options.FileName, Options);
+	}
+
+	bool Scene::IsPaged(const TriangleMesh& Mesh) const
+	{
+		if (mOptions.OutOfCore.FileName.empty() || Mesh.mTriangles.empty())
+		{
+			return false;
+		}
+
+		return !mMaterials[Mesh.mMaterialIndex].IsEmissive();
+	}
+
+	bool Scene::IntersectOutOfCore(const Ray& aRay, Intersection& HitResult) const
+	{
+		return mOutOfCore->Intersect(aRay, HitResult);
+	}
+
+	bool Scene::OccludedOutOfCore(const Ray& aRay) const
+	{
+		return mOutOfCore->Occluded(aRay);
+	}
+
+	void Scene::CollectMeshes(const aiScene* pScene, const aiNode* pNode, std::vector<const aiMesh*>& Meshes)
+	{
+		if (pNode == nullptr)
+		{
+			return;
+		}
+
+		for (size_t MeshIndex = 0; MeshIndex < pNode->mNumMeshes; MeshIndex++)
+		{
+			Meshes.push_back(pScene->mMeshes[pNode->mMeshes[MeshIndex]]);
 		}
 
 		for (size_t ChildIndex = 0; ChildIndex < pNode->mNumChildren; ChildIndex++)
 		{
-			ProcessNode(pScene, pNode->mChildren[ChildIndex]);
+			CollectMeshes(pScene, pNode->mChildren[ChildIndex], Meshes);
+		}
+	}
+
+	void Scene::ConvertMesh(const aiMesh& Source, TriangleMesh& Mesh)
+	{
+		static_assert(sizeof(aiVector3D) == 3 * sizeof(float));
+
+		Mesh.mVertices.resize(Source.mNumVertices);
+
+		for (size_t VertexIndex = 0; VertexIndex < Source.mNumVertices; VertexIndex++)
+		{
+			std::memcpy(Mesh.mVertices[VertexIndex].Position.data(), &Source.mVertices[VertexIndex], sizeof(aiVector3D));
+		}
+
+		if (Source.HasNormals())
+		{
+			for (size_t VertexIndex = 0; VertexIndex < Source.mNumVertices; VertexIndex++)
+			{
+				std::memcpy(Mesh.mVertices[VertexIndex].Normal.data(), &Source.mNormals[VertexIndex], sizeof(aiVector3D));
+			}
+		}
+
+		Mesh.mIndices.resize(Source.mNumFaces * 3);
+
+		unsigned* pIndices = Mesh.mIndices.data();
+
+		for (size_t FaceIndex = 0; FaceIndex < Source.mNumFaces; FaceIndex++)
+		{
+			assert (Source.mFaces[FaceIndex].mNumIndices == 3);
+
+			std::memcpy(pIndices + FaceIndex * 3, Source.mFaces[FaceIndex].mIndices, 3 * sizeof(unsigned));
+		}
+
+		if (!Source.HasNormals())
+		{
+			Mesh.GenerateNormals();
+		}
+
+		if (Source.HasTextureCoords(0))
+		{
+			Mesh.mTexCoords.resize(Source.mNumVertices);
+
+			for (size_t VertexIndex = 0; VertexIndex < Source.mNumVertices; VertexIndex++)
+			{
+				Mesh.mTexCoords[VertexIndex] = Vector2f(Source.mTextureCoords[0][VertexIndex].x, Source.mTextureCoords[0][VertexIndex].y);
+			}
+		}
+
+		Mesh.mMaterialIndex = Source.mMaterialIndex;
+
+		Mesh.BuildTriangles();
+	}
+
+	void Scene::ConvertMesh(ObjMesh& Source, TriangleMesh& Mesh)
+	{
+		Mesh.mVertices = std::move(Source.Vertices);
+		Mesh.mIndices = std::move(Source.Indices);
+		Mesh.mTexCoords = std::move(Source.TexCoords);
+		Mesh.mMaterialIndex = Source.MaterialIndex;
+
+		if (!Source.HasNormals)
+		{
+			Mesh.GenerateNormals();
 		}
+
+		Mesh.BuildTriangles();
 	}
 
-    void Scene::BuildBvh()
+	Material Scene::ConvertMaterial(const aiMaterial& Source)
+	{
+		Material Result;
+
+		aiColor3D Colour;
+
+		if (Source.Get(AI_MATKEY_COLOR_DIFFUSE, Colour) == AI_SUCCESS)
+		{
+			Result.Diffuse = Vector3f(Colour.r, Colour.g, Colour.b);
+		}
+
+		if (Source.Get(AI_MATKEY_COLOR_EMISSIVE, Colour) == AI_SUCCESS)
+		{
+			Result.Emission = Vector3f(Colour.r, Colour.g, Colour.b);
+		}
+
+		return Result;
+	}
+
+    void Scene::BuildBvh(std::vector<Vector3f> Centroids)
     {
-        for (int i = 0; i < mMeshes.size(); i++)
+        if (pTriangles.empty())
         {
-            int MeshTriangleCount = static_cast<int>(mMeshes[i].mTriangles.size());
-
-            for (int j = 0; j < MeshTriangleCount; j++)
+            for (auto& Mesh : mMeshes)
             {
-                pTriangles.push_back(&mMeshes[i].mTriangles[j]);
+                for (auto& aTriangle : Mesh.mTriangles)
+                {
+                    pTriangles.push_back(&aTriangle);
+                }
             }
         }
         
         pTriangles.shrink_to_fit();
 
-        mBvh = std::make_unique<Bvh>(pTriangles);
+        // everything may have gone to tessellated meshes
+        if (pTriangles.empty())
+        {
+            return;
+        }
+
+        if (mOptions.MemoryBudget == 0)
+        {
+            mBvh = std::make_unique<Bvh>(pTriangles, mOptions.BuildOptions, std::move(Centroids));
+            mBvh->PlaceForNuma(mOptions.BvhPlacement);
+
+            return;
+        }
+
+        // what is already loaded stays, only the BVH can give way
+        const size_t Resident = GetMemoryReport().GetTotalBytes();
+        const size_t NumTriangles = pTriangles.size();
+
+        BvhOptions BuildOptions = mOptions.BuildOptions;
+        NumaPlacement Placement = mOptions.BvhPlacement;
+
+        // the NUMA copies sit next to the nodes and indices they were made from
+        auto Fits = [&](bool WithCentroids)
+        {
+            return Resident + Bvh::EstimateSizeInBytes(NumTriangles, BuildOptions, WithCentroids, Placement) <= mOptions.MemoryBudget;
+        };
+
+        if (!Fits(true) && BuildOptions.Builder == BvhBuilder::SpatialSplit)
+        {
+            std::cout << "Memory budget: falling back from spatial splits to the midpoint builder\n";
+
+            BuildOptions.Builder = BvhBuilder::MidPoint;
+        }
+
+        if (!Fits(false) && Placement != NumaPlacement::None)
+        {
+            std::cout << "Memory budget: dropping the NUMA placement of the BVH\n";
+
+            Placement = NumaPlacement::None;
+        }
+
+        if (!Fits(false))
+        {
+            throw std::runtime_error("BVH for " + std::to_string(NumTriangles) + " triangles would exceed the memory budget of "
+                                      + std::to_string(mOptions.MemoryBudget) + " bytes\n");
+        }
+
+        mBvh = std::make_unique<Bvh>(pTriangles, BuildOptions, std::move(Centroids));
+
+        if (!Fits(true) || Resident + mBvh->GetSizeInBytes() + mBvh->GetPlacementSizeInBytes(Placement) > mOptions.MemoryBudget)
+        {
+            std::cout << "Memory budget: releasing the BVH build data\n";
+
+            mBvh->ReleaseBuildData();
+        }
+
+        mBvh->PlaceForNuma(Placement);
     }
 
+	MemoryReport Scene::GetMemoryReport() const
+	{
+		MemoryReport Report;
+
+		size_t MeshBytes = 0, TriangleBytes = GetVectorBytes(pTriangles);
+
+		for (const auto& Mesh : mMeshes)
+		{
+			MeshBytes += Mesh.GetSizeInBytes() - GetVectorBytes(Mesh.mTriangles);
+			TriangleBytes += GetVectorBytes(Mesh.mTriangles);
+		}
+
+		Report.Add("Meshes", MeshBytes + GetVectorBytes(mMeshes) - mMeshes.size() * sizeof(TriangleMesh));
+		Report.Add("Triangles", TriangleBytes);
+
+		if (mBvh)
+		{
+			mBvh->ReportMemory(Report);
+		}
+
+		if (mCompressedBvh)
+		{
+			Report.Add("Compressed BVH", mCompressedBvh->GetSizeInBytes());
+		}
+
+		Report.Add("Materials", GetVectorBytes(mMaterials));
+
+		if (mTextureCache)
+		{
+			Report.Add("Texture tiles", mTextureCache->GetResidentBytes());
+		}
+
+		// hash nodes are roughly a key, a value and a next pointer each
+		Report.Add("Emitters", GetVectorBytes(mEmitters) + mEmitterIndices.size() * (sizeof(const Triangle*) + sizeof(unsigned) + sizeof(void*)));
+
+		if (mLightSampler)
+		{
+			Report.Add("Light sampler", mLightSampler->GetSizeInBytes());
+		}
+
+		if (mEnvironment)
+		{
+			Report.Add("Environment light", mEnvironment->GetSizeInBytes());
+		}
+
+		if (mTessellationCache)
+		{
+			size_t ControlBytes = GetVectorBytes(mTessellatedMeshes);
+
+			for (const auto& Mesh : mTessellatedMeshes)
+			{
+				ControlBytes += Mesh->GetSizeInBytes();
+			}
+
+			Report.Add("Tessellation meshes", ControlBytes);
+			Report.Add("Tessellated patches", mTessellationCache->GetResidentBytes());
+		}
+
+		if (mLodGroup)
+		{
+			mLodGroup->ReportMemory(Report);
+		}
+
+		if (mOutOfCore)
+		{
+			Report.Add("Out of core treelets", mOutOfCore->GetResidentBytes());
+		}
+
+		return Report;
+	}
+
+    void Scene::CompressBvh()
+    {
+        if (!mBvh)
+        {
+            return;
+        }
+
+        mCompressedBvh = std::make_unique<CompressedBvh>(*mBvh);
+
+        mBvh.reset();
+    }
+
+	bool Scene::Intersect(const Ray& aRay, const VisibilitySample* pFirstHit, const PagedHit* pPagedHit, Intersection& HitResult) const
+	{
+		bool HitSomething = false;
+
+		if (pFirstHit && !pFirstHit->NeedsTrace())
+		{
+			// left as traversal would leave it, the separate meshes only take closer hits
+			if (pFirstHit->Triangle != VisibilitySample::kNoHit)
+			{
+				aRay.tMax = pFirstHit->t;
+				pTriangles[pFirstHit->Triangle]->FillIntersection(aRay, pFirstHit->U, pFirstHit->V, HitResult);
+
+				HitSomething = true;
+			}
+		}
+		else if (mCompressedBvh)
+		{
+			HitSomething = mCompressedBvh->Intersect(aRay, HitResult);
+		}
+		else if (mBvh)
+		{
+			HitSomething = mBvh->Intersect(aRay, HitResult);
+		}
+
+		return IntersectSeparateMeshes(aRay, HitResult, pPagedHit) || HitSomething;
+	}
+
+	void Scene::IntersectPaged(const std::vector<Ray>& Rays, std::vector<PagedHit>& Hits) const
+	{
+		mOutOfCore->IntersectBatch(Rays, Hits);
+	}
+
+	int Scene::LoadTexture(const std::filesystem::path& FileName)
+	{
+		const std::string Key = FileName.lexically_normal().string();
+
+		const auto Found = mTextureIndices.find(Key);
+
+		if (Found != mTextureIndices.end())
+		{
+			return Found->second;
+		}
+
+		int TextureIndex = -1;
+
+		try
+		{
+			mTextures.push_back(std::make_unique<Texture>(Key, *mTextureCache));
+
+			TextureIndex = static_cast<int>(mTextures.size()) - 1;
+		}
+		catch (const std::exception& Error)
+		{
+			// an unreadable map falls back to the plain diffuse colour
+			std::cout << "Skipping texture: " << Error.what();
+		}
+
+		mTextureIndices.emplace(Key, TextureIndex);
+
+		return TextureIndex;
+	}
+
+	Vector3f Scene::GetAlbedo(const Intersection& Hit, Float Footprint) const
+	{
+		const Material& aMaterial = GetMaterial(*Hit.pTriangle);
+
+		if (aMaterial.DiffuseTexture < 0 || !Hit.pTriangle->pMesh->HasTexCoords())
+		{
+			return aMaterial.Diffuse;
+		}
+
+		const Triangle& aTriangle = *Hit.pTriangle;
+
+		const Vector2f UV0 = aTriangle.GetTexCoord(0);
+		const Vector2f UV1 = aTriangle.GetTexCoord(1);
+		const Vector2f UV2 = aTriangle.GetTexCoord(2);
+
+		const Vector2f UV = (1 - Hit.U - Hit.V) * UV0 + Hit.U * UV1 + Hit.V * UV2;
+
+		// world footprint to UV footprint through the ratio of the triangle areas
+		const Vector2f Edge1 = UV1 - UV0;
+		const Vector2f Edge2 = UV2 - UV0;
+		const Float UVArea = 0.5f * std::abs(Edge1.x() * Edge2.y() - Edge1.y() * Edge2.x());
+		const Float UVFootprint = aTriangle.Area > 0 ? Footprint * std::sqrt(UVArea / aTriangle.Area) : 0;
+
+		return aMaterial.Diffuse.cwiseProduct(mTextures[aMaterial.DiffuseTexture]->Sample(UV, UVFootprint));
+	}
+
+	void Scene::BuildLightSampler()
+	{
+		mEmitters.clear();
+		mEmitterIndices.clear();
+
+		for (const auto& Mesh : mMeshes)
+		{
+			const Material& aMaterial = mMaterials[Mesh.mMaterialIndex];
+
+			if (!aMaterial.IsEmissive())
+			{
+				continue;
+			}
+
+			for (const auto& aTriangle : Mesh.mTriangles)
+			{
+				if (aTriangle.Area <= 0)
+				{
+					continue;
+				}
+
+				mEmitterIndices.emplace(&aTriangle, static_cast<unsigned>(mEmitters.size()));
+				mEmitters.push_back({&aTriangle, aMaterial.Emission, aTriangle.Area * Luminance(aMaterial.Emission)});
+			}
+		}
+
+		if (mOptions.LightSampling == LightSamplerType::Bvh)
+		{
+			mLightSampler = std::make_unique<LightBvh>(mEmitters);
+		}
+		else
+		{
+			mLightSampler = std::make_unique<PowerLightSampler>(mEmitters);
+		}
+
+		mEnvironment.reset();
+
+		if (!mOptions.EnvironmentMap.empty())
+		{
+			const int MapIndex = LoadTexture(mOptions.EnvironmentMap);
+
+			if (MapIndex >= 0)
+			{
+				mEnvironment = std::make_unique<EnvironmentLight>(*mTextures[MapIndex], mOptions.EnvironmentScale);
+			}
+		}
+	}
+
+	bool Scene::SampleLight(const Vector3f& Point, const Vector3f& Normal, Float LightSelect, const Vector2f& Sample, LightSample& Result) const
+	{
+		Float SelectPmf = 0;
+
+		const int LightIndex = mLightSampler ? mLightSampler->Select(Point, Normal, LightSelect, SelectPmf) : -1;
+
+		if (LightIndex < 0 || SelectPmf <= 0)
+		{
+			return false;
+		}
+
+		const EmissiveTriangle& Emitter = mEmitters[LightIndex];
+		const Triangle& aTriangle = *Emitter.pTriangle;
+
+		const Vector3f V0 = aTriangle.GetPosition(0);
+
+		Result.Position = SampleTriangle(aTriangle, Sample);
+		Result.Normal = (aTriangle.GetPosition(1) - V0).cross(aTriangle.GetPosition(2) - V0).normalized();
+		Result.Emission = Emitter.Emission;
+		Result.Pdf = SelectPmf / aTriangle.Area;
+
+		return true;
+	}
+
+	Float Scene::LightPdf(const Vector3f& Point, const Vector3f& Normal, const Triangle& Emitter) const
+	{
+		const auto Found = mEmitterIndices.find(&Emitter);
+
+		if (Found == mEmitterIndices.end())
+		{
+			return 0;
+		}
+
+		return mLightSampler->SelectionPmf(Point, Normal, Found->second) / Emitter.Area;
+	}
+
 } // namespace PathTracer
\ No newline at end of file
@@ -4,6 +4,12 @@
 #include <Ray.h>
 #include <Shape.h>
 #include <Acceleration.h>
+#include <CompressedBvh.h>
+#include <Light.h>
+#include <Texture.h>
+#include <Tessellation.h>
+#include <EnvironmentLight.h>
+#include <Lod.h>
 
 namespace PathTracer
 {
@@ -13,28 +19,285 @@ namespace PathTracer
 		Eigen::Vector3f Normal;
 	};
 
+	// Position quantized to 21 bits per axis over the mesh bounds, normal octahedron encoded
+	struct CompressedVertex
+	{
+		uint32_t Position[2];
+		uint32_t Normal;
+	};
+
+	// Lambertian, parameters come from the Kd and Ke entries of the source materials
+	struct Material
+	{
+		Eigen::Vector3f Diffuse = Eigen::Vector3f(0.8f, 0.8f, 0.8f);
+		Eigen::Vector3f Emission = Eigen::Vector3f::Zero();
+		int DiffuseTexture = -1; // map_Kd, scales Diffuse
+		int DisplacementTexture = -1; // disp or bump, heights of tessellated meshes
+
+		bool IsEmissive() const { return (Emission.array() > 0).any(); }
+	};
+
+	struct ObjMesh;
+	struct VisibilitySample;
+	struct Treelet;
+	class OutOfCoreScene;
+
+	// Closest hit of a camera ray among the paged meshes, found for a batch of rays by Scene::IntersectPaged
+	struct PagedHit
+	{
+		Intersection Result;
+		Float t = kInfinity;
+		std::shared_ptr<const Treelet> pTreelet;	// null for a miss, keeps the triangle of Result alive
+	};
+
+	constexpr uint32_t kPositionQuantizationMax = (1u << 21) - 1;
+
+	uint32_t EncodeOctahedral(const Eigen::Vector3f& Normal);
+
+	inline Eigen::Vector3f DecodeOctahedral(uint32_t Encoded)
+	{
+		Float X = static_cast<int16_t>(Encoded & 0xffff) * (1.f / 32767);
+		Float Y = static_cast<int16_t>(Encoded >> 16) * (1.f / 32767);
+		Float Z = 1 - std::abs(X) - std::abs(Y);
+
+		if (Z < 0)
+		{
+			const Float FoldedX = (1 - std::abs(Y)) * (X >= 0 ? 1 : -1);
+			const Float FoldedY = (1 - std::abs(X)) * (Y >= 0 ? 1 : -1);
+
+			X = FoldedX;
+			Y = FoldedY;
+		}
+
+		return Eigen::Vector3f(X, Y, Z).normalized();
+	}
+
     class TriangleMesh
 	{
 	friend class Scene;
+	friend class TessellatedMesh;
+	friend class LodMesh;
+	friend class TreeletCache;
 
 	public:
 		TriangleMesh() = default;
 
+		TriangleMesh(std::vector<Vertex> Vertices, std::vector<unsigned> Indices);
+
 		TriangleMesh(const TriangleMesh&) = delete;
 		TriangleMesh& operator=(const TriangleMesh&) = delete;
 
-		TriangleMesh(TriangleMesh&&) = default;
-		TriangleMesh& operator=(TriangleMesh&&) = default;
+		// triangles point back at their mesh, so moves rebind them
+		TriangleMesh(TriangleMesh&& Other) noexcept;
+		TriangleMesh& operator=(TriangleMesh&& Other) noexcept;
 
 		~TriangleMesh() = default;
 
+		Eigen::Vector3f GetPosition(unsigned Index) const
+		{
+			if (mCompressedVertices.empty())
+			{
+				return mVertices[Index].Position;
+			}
+
+			const CompressedVertex& Packed = mCompressedVertices[Index];
+			const uint64_t Bits = (uint64_t(Packed.Position[1]) << 32) | Packed.Position[0];
+
+			const Eigen::Vector3f Quantized(static_cast<Float>(Bits & kPositionQuantizationMax),
+											static_cast<Float>((Bits >> 21) & kPositionQuantizationMax),
+											static_cast<Float>((Bits >> 42) & kPositionQuantizationMax));
+
+			return mQuantizationOrigin + Quantized.cwiseProduct(mQuantizationStep);
+		}
+
+		Eigen::Vector3f GetNormal(unsigned Index) const
+		{
+			if (mCompressedVertices.empty())
+			{
+				return mVertices[Index].Normal;
+			}
+
+			return DecodeOctahedral(mCompressedVertices[Index].Normal);
+		}
+
+		Eigen::Vector2f GetTexCoord(unsigned Index) const
+		{
+			return mTexCoords.empty() ? Eigen::Vector2f::Zero() : mTexCoords[Index];
+		}
+
+		bool HasTexCoords() const { return !mTexCoords.empty(); }
+
+		const std::vector<Triangle>& GetTriangles() const { return mTriangles; }
+
+		bool IsCompressed() const { return !mCompressedVertices.empty(); }
+
+		unsigned GetMaterialIndex() const { return mMaterialIndex; }
+
+		void SetMaterialIndex(unsigned Index) { mMaterialIndex = Index; }
+
+		size_t GetSizeInBytes() const;
+
 		bool Intersect(const Ray& aRay, Intersection& Result) const;
 
 		void BuildTriangles();
+
+		// Smooth area weighted normals for meshes imported without any
+		void GenerateNormals();
+
+		// Must run before the BVH is built, bounds come from the decoded positions
+		void Compress();
 	private:        
 		std::vector<Vertex> mVertices;
         std::vector<unsigned> mIndices;
 		std::vector<Triangle> mTriangles;
+		std::vector<CompressedVertex> mCompressedVertices;
+		std::vector<Eigen::Vector2f> mTexCoords;
+		Eigen::Vector3f mQuantizationOrigin;
+		Eigen::Vector3f mQuantizationStep;
+		unsigned mMaterialIndex = 0;
+	};
+
+	inline Eigen::Vector3f Triangle::GetPosition(unsigned Corner) const
+	{
+		return pMesh->GetPosition(Indices[Corner]);
+	}
+
+	inline Eigen::Vector3f Triangle::GetNormal(unsigned Corner) const
+	{
+		return pMesh->GetNormal(Indices[Corner]);
+	}
+
+	inline Eigen::Vector2f Triangle::GetTexCoord(unsigned Corner) const
+	{
+		return pMesh->GetTexCoord(Indices[Corner]);
+	}
+
+	// Paths need hits from both sides, shadow rays would leak through back faces otherwise
+	// #define BACKFACECULLING
+
+	// Inline so the traversal kernels can fold the test into their leaf loops
+	inline bool Triangle::IntersectBarycentric(const Ray& aRay, Float& U, Float& V) const
+	{
+		const Eigen::Vector3f V0 = GetPosition(0);
+		const Eigen::Vector3f V0ToV1 = GetPosition(1) - V0;
+		const Eigen::Vector3f V0ToV2 = GetPosition(2) - V0;
+
+		const Eigen::Vector3f V0ToRayOrigin = aRay.Origin - V0;
+		const Float MDeterminant = aRay.Direction.cross(V0ToV2).dot(V0ToV1);
+		const Float InvMDeterminant = 1 / MDeterminant;
+
+	#ifdef BACKFACECULLING
+
+		const float tHit = V0ToV2.cross(V0ToRayOrigin).dot(V0ToV1) * InvMDeterminant;
+
+		if (tHit < kEpsilon || aRay.tMax < tHit)
+		{
+			return false;
+		}
+		
+		U = aRay.Direction.cross(V0ToV2).dot(V0ToRayOrigin);
+
+		if (U < 0.0 || U > MDeterminant)
+		{
+			return false;
+		}
+		
+		V = aRay.Direction.cross(V0ToRayOrigin).dot(V0ToV1);
+
+		if (V < 0.0 || V + U > MDeterminant)
+		{
+			return false;
+		}
+		
+		U *= InvMDeterminant;
+		V *= InvMDeterminant;
+
+	#else
+
+		if (MDeterminant == 0)
+		{
+			return false;
+		}
+
+		const Float tHit = V0ToV2.cross(V0ToRayOrigin).dot(V0ToV1) * InvMDeterminant;
+
+		if (tHit < kEpsilon || aRay.tMax < tHit)
+		{
+			return false;
+		}
+
+		U = aRay.Direction.cross(V0ToV2).dot(V0ToRayOrigin) * InvMDeterminant;
+
+		if (U < 0 || U > 1)
+		{
+			return false;
+		}
+
+		V = aRay.Direction.cross(V0ToRayOrigin).dot(V0ToV1) * InvMDeterminant;
+
+		if (V < 0 || U + V > 1)
+		{
+			return false;
+		}
+
+	#endif
+
+		aRay.tMax = tHit;
+
+		return true;
+	}
+
+	inline void Triangle::FillIntersection(const Ray& aRay, Float U, Float V, Intersection& HitResult) const
+	{
+		const Eigen::Vector3f V0 = GetPosition(0);
+		const Float W = 1 - U - V;
+
+		HitResult.HitPoint = aRay(aRay.tMax);
+		HitResult.Normal = W * GetNormal(0) + U * GetNormal(1) + V * GetNormal(2);
+		HitResult.GeometricNormal = (GetPosition(1) - V0).cross(GetPosition(2) - V0).normalized();
+		HitResult.pTriangle = this;
+		HitResult.U = U;
+		HitResult.V = V;
+	}
+
+	inline bool Triangle::Intersect(const Ray& aRay, Intersection& HitResult) const
+	{
+		Float U, V;
+
+		if (!IntersectBarycentric(aRay, U, V))
+		{
+			return false;
+		}
+
+		FillIntersection(aRay, U, V, HitResult);
+
+		return true;
+	}
+
+	// A scene loaded from the baked file itself reads neither the source nor FileName,
+	// only the budget applies
+	struct OutOfCoreOptions
+	{
+		std::string FileName;	// the non emissive meshes are baked to this paged file and leave memory, empty keeps them resident
+
+		// Upper bound for the resident top-level tree plus all cached treelets
+		size_t MemoryBudget = size_t(512) << 20;
+		unsigned TreeletPrimitives = 4096;
+	};
+
+	struct SceneOptions
+	{
+		bool CompressVertices = false;
+		BvhOptions BuildOptions;
+		LightSamplerType LightSampling = LightSamplerType::Bvh;
+		size_t TextureMemoryBudget = size_t(256) << 20;
+		size_t MemoryBudget = 0;	// 0 for no limit, a BVH build that would exceed it is downgraded or refused
+		NumaPlacement BvhPlacement = NumaPlacement::None;
+		TessellationOptions Tessellation;
+		LodOptions LevelOfDetail;
+		OutOfCoreOptions OutOfCore;
+		std::string EnvironmentMap;		// lat-long PFM or PPM lighting the rays that leave the scene
+		Float EnvironmentScale = 1;
 	};
     
 	class Scene
@@ -42,23 +305,203 @@ namespace PathTracer
 	public:
 		bool Intersect(const Ray& aRay, Intersection& HitResult) const
 		{
-			return mBvh->Intersect(aRay, HitResult);
+			bool HitSomething = false;
+
+			if (mCompressedBvh)
+			{
+				HitSomething = mCompressedBvh->Intersect(aRay, HitResult);
+			}
+			else if (mBvh)
+			{
+				HitSomething = mBvh->Intersect(aRay, HitResult);
+			}
+
+			return IntersectSeparateMeshes(aRay, HitResult) || HitSomething;
+		}
+
+		// For a camera ray whose BVH hit a VisibilityBuffer already found, or whose
+		// paged hit IntersectPaged did, either may be null
+		bool Intersect(const Ray& aRay, const VisibilitySample* pFirstHit, const PagedHit* pPagedHit, Intersection& HitResult) const;
+
+		// Rays are traced against the paged meshes only, their treelet reads batched
+		void IntersectPaged(const std::vector<Ray>& Rays, std::vector<PagedHit>& Hits) const;
+
+		bool HasPagedMeshes() const { return mOutOfCore != nullptr; }
+
+		bool Occluded(const Ray& aRay) const
+		{
+			if (mCompressedBvh ? mCompressedBvh->Occluded(aRay) : mBvh && mBvh->Occluded(aRay))
+			{
+				return true;
+			}
+
+			for (const auto& Mesh : mTessellatedMeshes)
+			{
+				if (Mesh->Occluded(aRay))
+				{
+					return true;
+				}
+			}
+
+			if (mLodGroup && mLodGroup->Occluded(aRay))
+			{
+				return true;
+			}
+
+			return mOutOfCore && OccludedOutOfCore(aRay);
 		}
 
 		Scene() = default;
 
-		Scene(std::string_view FileName);
+		Scene(std::string_view FileName, const SceneOptions& Options = {});
+
+		// For geometry made in code, meshes with an out of range material get the first one
+		Scene(std::vector<TriangleMesh> Meshes, std::vector<Material> Materials, const SceneOptions& Options = {});
+
+		~Scene();
+
+		static void CollectMeshes(const aiScene* pScene, const aiNode* pNode, std::vector<const aiMesh*>& Meshes);
+
+		static void ConvertMesh(const aiMesh& Source, TriangleMesh& Mesh);
 
-		~Scene() = default;
+		// Moves the buffers of the OBJ fast path over
+		static void ConvertMesh(ObjMesh& Source, TriangleMesh& Mesh);
 
-		void ProcessNode(const aiScene* pScene, const aiNode* pNode);
+		static Material ConvertMaterial(const aiMaterial& Source);
 
-		void BuildBvh();
+		// Centroids may be passed in when they were computed during import
+		void BuildBvh(std::vector<Eigen::Vector3f> Centroids = {});
+
+		// Nothing to do when every triangle went to the separate meshes
+		BvhOptimizeReport OptimizeBvh(const BvhOptimizeOptions& Options = {})
+		{
+			if (mCompressedBvh)
+			{
+				throw std::logic_error("The BVH is optimized before CompressBvh, which releases the binary one\n");
+			}
+
+			return mBvh ? mBvh->Optimize(Options) : BvhOptimizeReport{};
+		}
+
+		// Replaces the binary BVH with the quantized 8-wide one
+		void CompressBvh();
+
+		const Bvh& GetBvh() const
+		{
+			if (!mBvh)
+			{
+				throw std::logic_error("Binary BVH was released by CompressBvh\n");
+			}
+
+			return *mBvh;
+		}
+
+		const Material& GetMaterial(const Triangle& aTriangle) const
+		{
+			return mMaterials[aTriangle.pMesh->GetMaterialIndex()];
+		}
+
+		// Diffuse colour with the texture applied, Footprint is the ray cone width at the hit
+		Eigen::Vector3f GetAlbedo(const Intersection& Hit, Float Footprint) const;
+
+		const TextureCache& GetTextureCache() const { return *mTextureCache; }
+
+		const std::vector<EmissiveTriangle>& GetEmitters() const { return mEmitters; }
+
+		// Picks an emitter for the shading point and a uniform point on it, false without emitters
+		bool SampleLight(const Eigen::Vector3f& Point, const Eigen::Vector3f& Normal, Float LightSelect, const Eigen::Vector2f& Sample, LightSample& Result) const;
+
+		// Area density SampleLight would have produced for this point on the emitter
+		Float LightPdf(const Eigen::Vector3f& Point, const Eigen::Vector3f& Normal, const Triangle& Emitter) const;
+
+		// Also loads the environment map, whose light is sampled on its own
+		void BuildLightSampler();
+
+		// Null without an environment map
+		const EnvironmentLight* GetEnvironment() const { return mEnvironment.get(); }
+
+		MemoryReport GetMemoryReport() const;
+
+		const std::vector<std::unique_ptr<TessellatedMesh>>& GetTessellatedMeshes() const { return mTessellatedMeshes; }
+
+		// Null when no mesh was simplified, rays then need no RayDetail
+		const LodGroup* GetLevelsOfDetail() const { return mLodGroup.get(); }
+
+		// What the BVH holds, every triangle outside the tessellated, simplified and paged meshes
+		const std::vector<Triangle*>& GetBvhTriangles() const { return pTriangles; }
 	private:
+		// The tessellated, simplified and paged meshes, which sit outside the BVH. A paged
+		// hit found ahead is taken as the traversal of the paged meshes would take it
+		bool IntersectSeparateMeshes(const Ray& aRay, Intersection& HitResult, const PagedHit* pPagedHit = nullptr) const
+		{
+			bool HitSomething = false;
+
+			for (const auto& Mesh : mTessellatedMeshes)
+			{
+				HitSomething |= Mesh->Intersect(aRay, HitResult);
+			}
+
+			if (mLodGroup)
+			{
+				HitSomething |= mLodGroup->Intersect(aRay, HitResult);
+			}
+
+			if (pPagedHit)
+			{
+				if (pPagedHit->pTreelet && pPagedHit->t <= aRay.tMax)
+				{
+					aRay.tMax = pPagedHit->t;
+					HitResult = pPagedHit->Result;
+					HitSomething = true;
+				}
+			}
+			else if (mOutOfCore)
+			{
+				HitSomething |= IntersectOutOfCore(aRay, HitResult);
+			}
+
+			return HitSomething;
+		}
+
+		bool IntersectOutOfCore(const Ray& aRay, Intersection& HitResult) const;
+
+		bool OccludedOutOfCore(const Ray& aRay) const;
+
+		// Non emissive meshes the tessellation options pick, emitters stay plain triangles for light sampling
+		bool IsTessellated(const TriangleMesh& Mesh) const;
+
+		void TessellateMeshes(const std::vector<size_t>& MeshIndices);
+
+		// Large non emissive meshes the level of detail options pick, emitters stay whole like above
+		bool IsSimplified(const TriangleMesh& Mesh) const;
+
+		void SimplifyMeshes(const std::vector<size_t>& MeshIndices);
+
+		// Non emissive meshes left over when the out of core options name a file
+		bool IsPaged(const TriangleMesh& Mesh) const;
+
+		void PageMeshes(const std::vector<size_t>& MeshIndices);
+
+		// Returns the texture index, or -1 when the file cannot be used
+		int LoadTexture(const std::filesystem::path& FileName);
 
+		SceneOptions mOptions;
         std::vector<TriangleMesh> mMeshes;
 		std::vector<Triangle*> pTriangles;
 		std::unique_ptr<Bvh> mBvh;
+		std::unique_ptr<CompressedBvh> mCompressedBvh;
+		std::vector<Material> mMaterials;
+		std::unique_ptr<TextureCache> mTextureCache; // declared first so it outlives the textures
+		std::vector<std::unique_ptr<Texture>> mTextures;
+		std::unordered_map<std::string, int> mTextureIndices;
+		std::vector<EmissiveTriangle> mEmitters;
+		std::unordered_map<const Triangle*, unsigned> mEmitterIndices;
+		std::unique_ptr<ILightSampler> mLightSampler;
+		std::unique_ptr<EnvironmentLight> mEnvironment;
+		std::unique_ptr<TessellationCache> mTessellationCache;
+		std::vector<std::unique_ptr<TessellatedMesh>> mTessellatedMeshes;
+		std::unique_ptr<LodGroup> mLodGroup;
+		std::unique_ptr<OutOfCoreScene> mOutOfCore;
 	};
 
 } // namespace PathTracer
\ No newline at end of file
@@ -0,0 +1,230 @@
+#include <SceneCache.h>
+#include <ObjLoader.h>
+
+namespace PathTracer
+{
+	constexpr uint64_t kFnvOffsetBasis = 0xcbf29ce484222325ull;
+	constexpr uint64_t kFnvPrime = 0x100000001b3ull;
+
+	// Stands in for a referenced file that does not exist, creating it changes the key
+	constexpr uint64_t kMissingFileHash = 0x9e3779b97f4a7c15ull;
+
+	SceneCache::SceneCache(size_t Budget, const SceneOptions& Options)
+	: mOptions{Options}, mBudget{Budget}
+	{
+	}
+
+	// FNV-1a over 64 bit words, the file is mapped rather than read
+	uint64_t SceneCache::GetContentHash(const std::filesystem::path& FileName, std::vector<std::string>& References)
+	{
+		const std::filesystem::file_time_type ModifiedTime = std::filesystem::last_write_time(FileName);
+		const uintmax_t Size = std::filesystem::file_size(FileName);
+
+		{
+			std::lock_guard<std::mutex> Lock(mMutex);
+
+			const auto Found = mStamps.find(FileName.string());
+
+			if (Found != mStamps.end() && Found->second.ModifiedTime == ModifiedTime && Found->second.Size == Size)
+			{
+				References = Found->second.References;
+
+				return Found->second.Hash;
+			}
+		}
+
+		const MappedFile File(FileName.string());
+		const char* pData = File.GetData();
+
+		uint64_t Hash = kFnvOffsetBasis ^ File.GetSize();
+		size_t Offset = 0;
+
+		for (; Offset + sizeof(uint64_t) <= File.GetSize(); Offset += sizeof(uint64_t))
+		{
+			uint64_t Word;
+			std::memcpy(&Word, pData + Offset, sizeof(Word));
+
+			Hash = (Hash ^ Word) * kFnvPrime;
+		}
+
+		for (; Offset < File.GetSize(); Offset++)
+		{
+			Hash = (Hash ^ static_cast<unsigned char>(pData[Offset])) * kFnvPrime;
+		}
+
+		std::string Extension = FileName.extension().string();
+		std::transform(Extension.begin(), Extension.end(), Extension.begin(), [](unsigned char Character) { return static_cast<char>(std::tolower(Character)); });
+
+		References.clear();
+
+		if (Extension == ".obj" || Extension == ".mtl")
+		{
+			References = GetObjReferences(std::string_view(pData, File.GetSize()), Extension == ".mtl");
+		}
+
+		std::lock_guard<std::mutex> Lock(mMutex);
+
+		mStamps[FileName.string()] = FileStamp{ModifiedTime, Size, Hash, References};
+
+		return Hash;
+	}
+
+	// The maps of every material library resolve against the scene's directory, as
+	// Scene does. A library that changes what it names is hashed again on its own
+	uint64_t SceneCache::GetSceneKey(const std::string& FileName)
+	{
+		std::vector<std::string> Libraries, Maps, Unused;
+
+		uint64_t Key = GetContentHash(FileName, Libraries);
+
+		auto AddFile = [&](const std::filesystem::path& Dependency, std::vector<std::string>& References)
+		{
+			std::error_code Error;
+
+			References.clear();
+
+			const uint64_t Hash = std::filesystem::is_regular_file(Dependency, Error) ? GetContentHash(Dependency, References) : kMissingFileHash;
+
+			Key = (Key ^ Hash) * kFnvPrime;
+		};
+
+		const std::filesystem::path Directory = std::filesystem::path(FileName).parent_path();
+
+		for (const std::string& Library : Libraries)
+		{
+			AddFile(Directory / Library, Maps);
+
+			for (const std::string& Map : Maps)
+			{
+				AddFile(Directory / Map, Unused);
+			}
+		}
+
+		if (!mOptions.EnvironmentMap.empty())
+		{
+			AddFile(mOptions.EnvironmentMap, Unused);
+		}
+
+		return Key;
+	}
+
+	std::shared_ptr<const Scene> SceneCache::Acquire(const std::string& FileName, bool& WasCached)
+	{
+		const uint64_t Key = GetSceneKey(FileName);
+
+		{
+			std::lock_guard<std::mutex> Lock(mMutex);
+
+			const auto Found = mEntries.find(Key);
+
+			if (Found != mEntries.end())
+			{
+				mLru.splice(mLru.begin(), mLru, Found->second.LruPosition);
+				WasCached = true;
+
+				return Found->second.Data;
+			}
+		}
+
+		WasCached = false;
+
+		auto Loaded = LoadScene(FileName, Key);
+		const size_t Bytes = Loaded->GetMemoryReport().GetTotalBytes();
+
+		std::lock_guard<std::mutex> Lock(mMutex);
+
+		mNumLoads++;
+
+		const auto Found = mEntries.find(Key);
+
+		if (Found != mEntries.end())
+		{
+			mLru.splice(mLru.begin(), mLru, Found->second.LruPosition);
+
+			return Found->second.Data;
+		}
+
+		// too big to keep, this render still gets it
+		if (Bytes > mBudget)
+		{
+			return Loaded;
+		}
+
+		Evict(Bytes);
+
+		mLru.push_front(Key);
+		mEntries.emplace(Key, Entry{Loaded, Bytes, mLru.begin()});
+		mResidentBytes += Bytes;
+
+		return Loaded;
+	}
+
+	std::shared_ptr<const Scene> SceneCache::LoadScene(const std::string& FileName, uint64_t Key)
+	{
+		if (mOptions.OutOfCore.FileName.empty())
+		{
+			return std::make_shared<const Scene>(FileName, mOptions);
+		}
+
+		// a shared paged file would be truncated by the next bake while cached scenes still
+		// read it, so every load bakes to its own, racing loads of one key included
+		SceneOptions Options = mOptions;
+
+		{
+			std::lock_guard<std::mutex> Lock(mMutex);
+
+			Options.OutOfCore.FileName += "." + std::to_string(Key) + "." + std::to_string(mNumBakes++);
+		}
+
+		const std::string BakedFile = Options.OutOfCore.FileName;
+
+		auto RemoveBakedFile = [BakedFile]()
+		{
+			std::error_code Error;
+			std::filesystem::remove(BakedFile, Error);
+		};
+
+		try
+		{
+			return std::shared_ptr<const Scene>(new Scene(FileName, Options), [RemoveBakedFile](const Scene* pScene)
+			{
+				delete pScene;
+
+				RemoveBakedFile();
+			});
+		}
+		catch (...)
+		{
+			RemoveBakedFile();
+
+			throw;
+		}
+	}
+
+	void SceneCache::Evict(size_t BytesNeeded)
+	{
+		while (!mLru.empty() && mResidentBytes + BytesNeeded > mBudget)
+		{
+			auto Victim = mEntries.find(mLru.back());
+
+			mResidentBytes -= Victim->second.Bytes;
+			mEntries.erase(Victim);
+			mLru.pop_back();
+		}
+	}
+
+	size_t SceneCache::GetResidentBytes() const
+	{
+		std::lock_guard<std::mutex> Lock(mMutex);
+
+		return mResidentBytes;
+	}
+
+	size_t SceneCache::GetNumLoads() const
+	{
+		std::lock_guard<std::mutex> Lock(mMutex);
+
+		return mNumLoads;
+	}
+
+} // namespace PathTracer
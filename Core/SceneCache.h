@@ -0,0 +1,69 @@
+#pragma once
+
+#include <Pch.h>
+#include <Scene.h>
+
+namespace PathTracer
+{
+	// Loaded scenes with their built BVH, shared by every render that asks for the
+	// same file. Entries are keyed by a hash of the file content along with the
+	// MTL files and textures an OBJ names and the environment map, so a copied or
+	// touched but unchanged file still hits. Each path remembers its modification
+	// time and size, and is only hashed again once either changes. Scenes are
+	// loaded outside the lock, a racing load of the same content is dropped
+	class SceneCache
+	{
+	public:
+		SceneCache(size_t Budget, const SceneOptions& Options = {});
+
+		SceneCache(const SceneCache&) = delete;
+		SceneCache& operator=(const SceneCache&) = delete;
+
+		~SceneCache() = default;
+
+		// Evicted scenes live on until their last render lets go of them
+		std::shared_ptr<const Scene> Acquire(const std::string& FileName, bool& WasCached);
+
+		size_t GetResidentBytes() const;
+
+		size_t GetNumLoads() const;
+
+	private:
+		// References are the files an OBJ or MTL names, empty for any other file
+		uint64_t GetContentHash(const std::filesystem::path& FileName, std::vector<std::string>& References);
+
+		uint64_t GetSceneKey(const std::string& FileName);
+
+		// With out-of-core options the scene pages into a file of its own named after
+		// the key, which is deleted along with the last reference to the scene
+		std::shared_ptr<const Scene> LoadScene(const std::string& FileName, uint64_t Key);
+
+		void Evict(size_t BytesNeeded);
+
+		struct Entry
+		{
+			std::shared_ptr<const Scene> Data;
+			size_t Bytes;
+			std::list<uint64_t>::iterator LruPosition;
+		};
+
+		struct FileStamp
+		{
+			std::filesystem::file_time_type ModifiedTime;
+			uintmax_t Size;
+			uint64_t Hash;
+			std::vector<std::string> References;
+		};
+
+		mutable std::mutex mMutex;
+		std::unordered_map<uint64_t, Entry> mEntries;
+		std::unordered_map<std::string, FileStamp> mStamps;
+		std::list<uint64_t> mLru;
+		SceneOptions mOptions;
+		size_t mBudget;
+		size_t mResidentBytes = 0;
+		size_t mNumLoads = 0;
+		size_t mNumBakes = 0;
+	};
+
+} // namespace PathTracer
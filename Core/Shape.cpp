@@ -3,58 +3,8 @@
 
 using namespace Eigen;
 
-#define BACKFACECULLING
-
 namespace PathTracer
 {
-	// Triangle
-	bool Triangle::Intersect(const Ray& aRay, Intersection& HitResult) const
-	{
-		const Vector3f V0ToV1 = V1.Position - V0.Position;
-		const Vector3f V0ToV2 = V2.Position - V0.Position;
-
-		const Vector3f V0ToRayOrigin = aRay.Origin - V0.Position;
-		const Float MDeterminant = aRay.Direction.cross(V0ToV2).dot(V0ToV1);
-		const Float InvMDeterminant = 1 / MDeterminant;
-
-	#ifdef BACKFACECULLING
-
-		const float tHit = V0ToV2.cross(V0ToRayOrigin).dot(V0ToV1) * InvMDeterminant;
-
-		if (tHit < kEpsilon || aRay.tMax < tHit)
-		{
-			return false;
-		}
-		
-		Float U = aRay.Direction.cross(V0ToV2).dot(V0ToRayOrigin);
-
-		if (U < 0.0 || U > MDeterminant)
-		{
-			return false;
-		}
-		
-		float V = aRay.Direction.cross(V0ToRayOrigin).dot(V0ToV1);
-
-		if (V < 0.0 || V + U > MDeterminant)
-		{
-			return false;
-		}
-		
-		U *= InvMDeterminant;
-		V *= InvMDeterminant;
-
-		float W = 1 - U - V;
-
-		HitResult.HitPoint = aRay(tHit);
-		HitResult.Normal = W * V0.Normal + U * V1.Normal + V * V2.Normal;
-		aRay.tMax = tHit;
-		
-		return true;
-
-	#endif
-
-	}
-
 	// Sphere
 	bool Sphere::Intersect(const Ray& aRay, Intersection& HitResult) const
 	{
@@ -89,6 +39,8 @@ namespace PathTracer
 
 		HitResult.HitPoint = aRay(tHit);
 		HitResult.Normal = (HitResult.HitPoint - mCenter).normalized();
+		HitResult.GeometricNormal = HitResult.Normal;
+		HitResult.pTriangle = nullptr;
 		aRay.tMax = tHit;
 		
 		return true;				
@@ -96,6 +48,13 @@ namespace PathTracer
 
 	// Box
 	bool Aabb::Intersect(const Ray& aRay) const
+	{
+		Float tEntry;
+
+		return Intersect(aRay, tEntry);
+	}
+
+	bool Aabb::Intersect(const Ray& aRay, Float& tEntry) const
 	{
 		Float TMin, TMax, TyMin, TyMax, TzMin, TzMax;
 
@@ -138,6 +97,8 @@ namespace PathTracer
 			TMax = TzMax;
 		}
 
+		tEntry = TMin;
+
 		return ((TMin < aRay.tMax) && (TMax > kEpsilon));
 	}
 
@@ -19,13 +19,13 @@ namespace PathTracer
     };
 
 	// Triangle
-	struct Triangle : public IShape
+	struct Triangle final : public IShape
 	{
 	public:
 		Triangle() = default;
 
-        Triangle(const TriangleMesh* pMesh, const Vertex& V0, const Vertex& V1, const Vertex& V2)
-		: pMesh{pMesh}, V0{V0}, V1{V1}, V2{V2} {}
+        Triangle(const TriangleMesh* pMesh, unsigned I0, unsigned I1, unsigned I2)
+		: pMesh{pMesh}, Indices{I0, I1, I2} {}
 
 		Triangle(const Triangle&) = delete;
 		Triangle& operator=(const Triangle&) = delete;
@@ -35,14 +35,36 @@ namespace PathTracer
 
 		bool Intersect(const Ray& aRay, Intersection& HitResult) const override;
 
+		// Hit test alone, narrows aRay.tMax and returns the barycentrics of a hit
+		bool IntersectBarycentric(const Ray& aRay, Float& U, Float& V) const;
+
+		// Shading data of a hit found by IntersectBarycentric, taken at aRay.tMax
+		void FillIntersection(const Ray& aRay, Float U, Float V, Intersection& HitResult) const;
+
 		Float GetArea() const noexcept override { return Area; };
+
+		// Vertices are fetched through the mesh, which may store them compressed
+		Eigen::Vector3f GetPosition(unsigned Corner) const;
+		Eigen::Vector3f GetNormal(unsigned Corner) const;
+		Eigen::Vector2f GetTexCoord(unsigned Corner) const;
 	public:
-        const Vertex& V0;
-		const Vertex& V1;
-		const Vertex& V2;
 		const TriangleMesh* pMesh;
+		unsigned Indices[3];
 		Float Area;
 	};
+
+	// Primitive kernels, chosen at compile time by the BVH traversals. Closest hit
+	// narrows the ray and fills the intersection once traversal is done, any hit
+	// returns at the first triangle in range
+	struct ClosestHitKernel
+	{
+		static constexpr bool kStopAtFirstHit = false;
+	};
+
+	struct AnyHitKernel
+	{
+		static constexpr bool kStopAtFirstHit = true;
+	};
 	
 	// Sphere
 	struct Sphere : public IShape
@@ -97,6 +119,17 @@ namespace PathTracer
 			return Extent.x() * Extent.y() + Extent.x() * Extent.z() + Extent.y() * Extent.z();
 		}
 
+		void GrowBy(const Aabb& Other)
+		{
+			Bounds[0] = Bounds[0].cwiseMin(Other.Bounds[0]);
+			Bounds[1] = Bounds[1].cwiseMax(Other.Bounds[1]);
+		}
+
+		bool IsEmpty() const noexcept
+		{
+			return (Bounds[0].array() > Bounds[1].array()).any();
+		}
+
 		void GrowBy(const Eigen::Vector3f& Position)
 		{
 			Bounds[0].x() = std::min(Bounds[0].x(), Position.x());
@@ -118,6 +151,9 @@ namespace PathTracer
 
 		bool Intersect(const Ray& Ray) const;
 
+		// tEntry is where the ray enters the box, negative when it starts inside
+		bool Intersect(const Ray& aRay, Float& tEntry) const;
+
 		Eigen::Vector3f Bounds[2];
 	};
 
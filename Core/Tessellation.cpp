@@ -0,0 +1,580 @@
+#include <Tessellation.h>
+#include <Scene.h>
+
+using namespace Eigen;
+
+namespace PathTracer
+{
+	// one patch per leaf, so a patch is only built once a ray enters its own bounds
+	constexpr unsigned kMaxPatchesPerLeaf = 1;
+
+	struct TessellatedPatch
+	{
+		TriangleMesh Mesh;
+		std::vector<Triangle*> pTriangles;
+		std::unique_ptr<Bvh> pBvh;
+
+		size_t GetSizeInBytes() const
+		{
+			return sizeof(TessellatedPatch) + Mesh.GetSizeInBytes() + GetVectorBytes(pTriangles) + pBvh->GetSizeInBytes();
+		}
+	};
+
+	// Keeps the patch of the last closest hit alive, the intersection points into its mesh
+	static thread_local std::shared_ptr<const TessellatedPatch> tHitPatch;
+
+	// PN control points b300, b030, b003, b210, b120, b021, b012, b102, b201, b111
+	static void CalcControlPoints(const Vector3f P[3], const Vector3f N[3], Vector3f Points[10])
+	{
+		auto EdgePoint = [](const Vector3f& From, const Vector3f& To, const Vector3f& Normal) -> Vector3f
+		{
+			return (2 * From + To - (To - From).dot(Normal) * Normal) / 3;
+		};
+
+		Points[0] = P[0];
+		Points[1] = P[1];
+		Points[2] = P[2];
+		Points[3] = EdgePoint(P[0], P[1], N[0]);
+		Points[4] = EdgePoint(P[1], P[0], N[1]);
+		Points[5] = EdgePoint(P[1], P[2], N[1]);
+		Points[6] = EdgePoint(P[2], P[1], N[2]);
+		Points[7] = EdgePoint(P[2], P[0], N[2]);
+		Points[8] = EdgePoint(P[0], P[2], N[0]);
+
+		const Vector3f EdgeMean = (Points[3] + Points[4] + Points[5] + Points[6] + Points[7] + Points[8]) / 6;
+		const Vector3f Center = (P[0] + P[1] + P[2]) / 3;
+
+		Points[9] = EdgeMean + (EdgeMean - Center) / 2;
+	}
+
+	static bool PositionLess(const Vector3f& A, const Vector3f& B)
+	{
+		return std::lexicographical_compare(A.data(), A.data() + 3, B.data(), B.data() + 3);
+	}
+
+	// TessellationCache
+	TessellationCache::TessellationCache(size_t Budget)
+	: mBudget{Budget}
+	{
+	}
+
+	std::shared_ptr<const TessellatedPatch> TessellationCache::Find(uint64_t Key)
+	{
+		std::lock_guard<std::mutex> Lock(mMutex);
+
+		auto Found = mEntries.find(Key);
+
+		if (Found == mEntries.end())
+		{
+			return nullptr;
+		}
+
+		mLru.splice(mLru.begin(), mLru, Found->second.LruPosition);
+
+		return Found->second.Data;
+	}
+
+	std::shared_ptr<const TessellatedPatch> TessellationCache::Insert(uint64_t Key, std::shared_ptr<const TessellatedPatch> Patch)
+	{
+		std::lock_guard<std::mutex> Lock(mMutex);
+
+		auto Found = mEntries.find(Key);
+
+		if (Found != mEntries.end())
+		{
+			mLru.splice(mLru.begin(), mLru, Found->second.LruPosition);
+
+			return Found->second.Data;
+		}
+
+		const size_t Bytes = Patch->GetSizeInBytes();
+
+		mNumBuilds++;
+
+		// too big to keep, this lookup still gets it
+		if (Bytes > mBudget)
+		{
+			return Patch;
+		}
+
+		Evict(Bytes);
+
+		mLru.push_front(Key);
+		mEntries.emplace(Key, Entry{Patch, mLru.begin()});
+		mResidentBytes += Bytes;
+
+		return Patch;
+	}
+
+	void TessellationCache::Evict(size_t BytesNeeded)
+	{
+		// patches still held by a caller stay alive until released
+		while (!mLru.empty() && mResidentBytes + BytesNeeded > mBudget)
+		{
+			auto Victim = mEntries.find(mLru.back());
+
+			mResidentBytes -= Victim->second.Data->GetSizeInBytes();
+			mEntries.erase(Victim);
+			mLru.pop_back();
+		}
+	}
+
+	size_t TessellationCache::GetResidentBytes() const
+	{
+		std::lock_guard<std::mutex> Lock(mMutex);
+
+		return mResidentBytes;
+	}
+
+	size_t TessellationCache::GetNumBuilds() const
+	{
+		std::lock_guard<std::mutex> Lock(mMutex);
+
+		return mNumBuilds;
+	}
+
+	// TessellatedMesh
+	TessellatedMesh::TessellatedMesh(const TriangleMesh& ControlMesh, unsigned MeshId, const TessellationOptions& Options, const Texture* pDisplacement, TessellationCache& Cache)
+	: mMeshId{MeshId}, mMaterialIndex{ControlMesh.GetMaterialIndex()}, mHasTexCoords{ControlMesh.HasTexCoords()},
+	  mOptions{Options}, pDisplacementMap{pDisplacement}, pCache{&Cache}
+	{
+		if (ControlMesh.GetTriangles().empty())
+		{
+			throw std::logic_error("Tessellated mesh needs at least one control triangle\n");
+		}
+
+		mOptions.EdgeSegments = std::max(mOptions.EdgeSegments, 1u);
+
+		std::unordered_map<unsigned, unsigned> Remap;
+
+		Float UVEdgeLength = 0;
+
+		for (const auto& aTriangle : ControlMesh.GetTriangles())
+		{
+			for (unsigned Corner = 0; Corner < 3; Corner++)
+			{
+				const unsigned Index = aTriangle.Indices[Corner];
+				const auto [Found, Inserted] = Remap.emplace(Index, static_cast<unsigned>(mVertices.size()));
+
+				if (Inserted)
+				{
+					mVertices.push_back({ ControlMesh.GetPosition(Index), ControlMesh.GetNormal(Index).normalized(), ControlMesh.GetTexCoord(Index) });
+				}
+
+				mIndices.push_back(Found->second);
+			}
+
+			UVEdgeLength += (aTriangle.GetTexCoord(1) - aTriangle.GetTexCoord(0)).norm();
+		}
+
+		// one filter width for the whole mesh, so neighbouring patches displace shared edges alike
+		mDisplacementFootprint = UVEdgeLength / (GetNumPatches() * mOptions.EdgeSegments);
+
+		BuildPatchTree();
+	}
+
+	size_t TessellatedMesh::GetSizeInBytes() const
+	{
+		return sizeof(TessellatedMesh) + GetVectorBytes(mVertices) + GetVectorBytes(mIndices) + GetVectorBytes(mPatchNodes) + GetVectorBytes(mPatchOrder);
+	}
+
+	TessellatedMesh::ControlVertex TessellatedMesh::Evaluate(const ControlVertex* pCorners[3], Float U, Float V) const
+	{
+		const Vector3f P[3] = { pCorners[0]->Position, pCorners[1]->Position, pCorners[2]->Position };
+		const Vector3f N[3] = { pCorners[0]->Normal, pCorners[1]->Normal, pCorners[2]->Normal };
+
+		Vector3f B[10];
+
+		CalcControlPoints(P, N, B);
+
+		const Float W = 1 - U - V;
+
+		ControlVertex Result;
+
+		Result.Position = B[0] * (W * W * W) + B[1] * (U * U * U) + B[2] * (V * V * V)
+						+ 3 * (B[3] * (W * W * U) + B[4] * (W * U * U) + B[8] * (W * W * V))
+						+ 3 * (B[5] * (U * U * V) + B[7] * (W * V * V) + B[6] * (U * V * V))
+						+ B[9] * (6 * W * U * V);
+
+		Result.Normal = (W * N[0] + U * N[1] + V * N[2]).normalized();
+		Result.TexCoord = W * pCorners[0]->TexCoord + U * pCorners[1]->TexCoord + V * pCorners[2]->TexCoord;
+
+		if (pDisplacementMap)
+		{
+			const Float Height = std::clamp(Luminance(pDisplacementMap->Sample(Result.TexCoord, mDisplacementFootprint)), 0.f, 1.f);
+
+			Result.Position += mOptions.DisplacementScale * Height * Result.Normal;
+		}
+
+		return Result;
+	}
+
+	std::shared_ptr<const TessellatedPatch> TessellatedMesh::Tessellate(unsigned PatchIndex) const
+	{
+		const unsigned Segments = mOptions.EdgeSegments;
+		const Float InvSegments = 1.f / Segments;
+
+		const ControlVertex* pCorners[3];
+
+		for (unsigned Corner = 0; Corner < 3; Corner++)
+		{
+			pCorners[Corner] = &mVertices[mIndices[PatchIndex * 3 + Corner]];
+		}
+
+		// Points on an edge are evaluated from its lower corner with the other
+		// endpoint second, so both patches sharing it produce the same bits
+		auto EvaluateEdge = [&](unsigned From, unsigned To, unsigned Steps)
+		{
+			const ControlVertex* pEdge[3] = { pCorners[From], pCorners[To], pCorners[3 - From - To] };
+
+			if (PositionLess(pEdge[1]->Position, pEdge[0]->Position))
+			{
+				std::swap(pEdge[0], pEdge[1]);
+				Steps = Segments - Steps;
+			}
+
+			return Evaluate(pEdge, Steps * InvSegments, 0);
+		};
+
+		auto EvaluateGrid = [&](unsigned I, unsigned J)
+		{
+			if (J == 0)
+			{
+				return EvaluateEdge(0, 1, I);
+			}
+
+			if (I == 0)
+			{
+				return EvaluateEdge(0, 2, J);
+			}
+
+			if (I + J == Segments)
+			{
+				return EvaluateEdge(1, 2, J);
+			}
+
+			return Evaluate(pCorners, I * InvSegments, J * InvSegments);
+		};
+
+		// rows of constant J, each one vertex shorter than the last
+		std::vector<unsigned> RowStart(Segments + 2, 0);
+
+		for (unsigned J = 0; J <= Segments; J++)
+		{
+			RowStart[J + 1] = RowStart[J] + Segments + 1 - J;
+		}
+
+		std::vector<Vertex> Vertices(RowStart[Segments + 1]);
+		std::vector<Vector2f> TexCoords(Vertices.size());
+
+		for (unsigned J = 0; J <= Segments; J++)
+		{
+			for (unsigned I = 0; I + J <= Segments; I++)
+			{
+				const ControlVertex Point = EvaluateGrid(I, J);
+
+				Vertices[RowStart[J] + I] = { Point.Position, Point.Normal };
+				TexCoords[RowStart[J] + I] = Point.TexCoord;
+			}
+		}
+
+		// displaced surfaces shade with the normal of the displaced surface, a small step away
+		if (pDisplacementMap && mOptions.DisplacementScale != 0)
+		{
+			const Float Step = 0.25f * InvSegments;
+
+			for (unsigned J = 0; J <= Segments; J++)
+			{
+				for (unsigned I = 0; I + J <= Segments; I++)
+				{
+					const Float U = I * InvSegments, V = J * InvSegments;
+
+					Vertex& Point = Vertices[RowStart[J] + I];
+
+					const Vector3f Center = Evaluate(pCorners, U, V).Position;
+					const Vector3f AlongU = Evaluate(pCorners, U + Step, V).Position - Center;
+					const Vector3f AlongV = Evaluate(pCorners, U, V + Step).Position - Center;
+
+					const Vector3f Normal = AlongU.cross(AlongV);
+
+					if (Normal.squaredNorm() > 0)
+					{
+						Point.Normal = Normal.dot(Point.Normal) < 0 ? Vector3f(-Normal.normalized()) : Vector3f(Normal.normalized());
+					}
+				}
+			}
+		}
+
+		std::vector<unsigned> Indices;
+		Indices.reserve(3 * Segments * Segments);
+
+		for (unsigned J = 0; J < Segments; J++)
+		{
+			for (unsigned I = 0; I + J < Segments; I++)
+			{
+				const unsigned Corner = RowStart[J] + I;
+				const unsigned Above = RowStart[J + 1] + I;
+
+				Indices.insert(Indices.end(), { Corner, Corner + 1, Above });
+
+				if (I + J + 1 < Segments)
+				{
+					Indices.insert(Indices.end(), { Corner + 1, Above + 1, Above });
+				}
+			}
+		}
+
+		auto Patch = std::make_shared<TessellatedPatch>();
+
+		Patch->Mesh = TriangleMesh(std::move(Vertices), std::move(Indices));
+		Patch->Mesh.mMaterialIndex = mMaterialIndex;
+
+		if (mHasTexCoords)
+		{
+			Patch->Mesh.mTexCoords = std::move(TexCoords);
+		}
+
+		for (auto& aTriangle : Patch->Mesh.mTriangles)
+		{
+			Patch->pTriangles.push_back(&aTriangle);
+		}
+
+		Patch->pBvh = std::make_unique<Bvh>(Patch->pTriangles);
+		Patch->pBvh->ReleaseBuildData();
+
+		return Patch;
+	}
+
+	std::shared_ptr<const TessellatedPatch> TessellatedMesh::AcquirePatch(unsigned PatchIndex) const
+	{
+		const uint64_t Key = (uint64_t(mMeshId) << 32) | PatchIndex;
+
+		if (auto Patch = pCache->Find(Key))
+		{
+			return Patch;
+		}
+
+		return pCache->Insert(Key, Tessellate(PatchIndex));
+	}
+
+	Aabb TessellatedMesh::CalcPatchBounds(unsigned PatchIndex) const
+	{
+		Vector3f P[3], N[3];
+
+		for (unsigned Corner = 0; Corner < 3; Corner++)
+		{
+			P[Corner] = mVertices[mIndices[PatchIndex * 3 + Corner]].Position;
+			N[Corner] = mVertices[mIndices[PatchIndex * 3 + Corner]].Normal;
+		}
+
+		// the cubic patch stays inside the hull of its control net
+		Vector3f B[10];
+
+		CalcControlPoints(P, N, B);
+
+		Aabb Bounds;
+
+		for (const auto& Point : B)
+		{
+			Bounds.GrowBy(Point);
+		}
+
+		Float Padding = 1e-4f * Bounds.GetExtent().maxCoeff() + 1e-6f;
+
+		if (pDisplacementMap)
+		{
+			Padding += std::abs(mOptions.DisplacementScale);
+		}
+
+		Bounds.Bounds[0].array() -= Padding;
+		Bounds.Bounds[1].array() += Padding;
+
+		return Bounds;
+	}
+
+	void TessellatedMesh::BuildPatchTree()
+	{
+		const unsigned NumPatches = GetNumPatches();
+
+		std::vector<Aabb> PatchBounds(NumPatches);
+		std::vector<Vector3f> Centroids(NumPatches);
+
+		for (unsigned Patch = 0; Patch < NumPatches; Patch++)
+		{
+			PatchBounds[Patch] = CalcPatchBounds(Patch);
+			Centroids[Patch] = 0.5f * (PatchBounds[Patch].Bounds[0] + PatchBounds[Patch].Bounds[1]);
+		}
+
+		mPatchOrder.resize(NumPatches);
+		std::iota(mPatchOrder.begin(), mPatchOrder.end(), 0);
+
+		mPatchNodes.reserve(2 * NumPatches - 1);
+		mPatchNodes.emplace_back();
+
+		struct BuildTask
+		{
+			unsigned Node, Begin, End;
+		};
+
+		std::vector<BuildTask> Tasks = { { 0, 0, NumPatches } };
+
+		while (!Tasks.empty())
+		{
+			const BuildTask Task = Tasks.back();
+			Tasks.pop_back();
+
+			Aabb Bounds, CentroidBounds;
+
+			for (unsigned Index = Task.Begin; Index < Task.End; Index++)
+			{
+				Bounds.GrowBy(PatchBounds[mPatchOrder[Index]]);
+				CentroidBounds.GrowBy(Centroids[mPatchOrder[Index]]);
+			}
+
+			mPatchNodes[Task.Node].BoundingBox = std::move(Bounds);
+
+			if (Task.End - Task.Begin <= kMaxPatchesPerLeaf)
+			{
+				mPatchNodes[Task.Node].LeftChild = Task.Begin;
+				mPatchNodes[Task.Node].NumPrimitives = Task.End - Task.Begin;
+
+				continue;
+			}
+
+			const Vector3f Extent = CentroidBounds.GetExtent();
+
+			unsigned Axis = 0;
+
+			if (Extent.y() > Extent[Axis])
+			{
+				Axis = 1;
+			}
+
+			if (Extent.z() > Extent[Axis])
+			{
+				Axis = 2;
+			}
+
+			const unsigned Middle = (Task.Begin + Task.End) / 2;
+
+			std::nth_element(mPatchOrder.begin() + Task.Begin, mPatchOrder.begin() + Middle, mPatchOrder.begin() + Task.End,
+				[&](unsigned A, unsigned B) { return Centroids[A][Axis] < Centroids[B][Axis]; });
+
+			const unsigned LeftChild = static_cast<unsigned>(mPatchNodes.size());
+
+			mPatchNodes.emplace_back();
+			mPatchNodes.emplace_back();
+
+			mPatchNodes[Task.Node].LeftChild = LeftChild;
+			mPatchNodes[Task.Node].SplitAxis = Axis;
+
+			Tasks.push_back({ LeftChild, Task.Begin, Middle });
+			Tasks.push_back({ LeftChild + 1, Middle, Task.End });
+		}
+	}
+
+	bool TessellatedMesh::Intersect(const Ray& aRay, Intersection& HitResult) const
+	{
+		std::shared_ptr<const TessellatedPatch> pHitPatch;
+
+		unsigned CurrentNode = 0;
+		unsigned ToVisitOffset = 0;
+		unsigned NodesToVisit[64];
+
+		while (true)
+		{
+			const BvhNode& Node = mPatchNodes[CurrentNode];
+
+			if (Node.BoundingBox.Intersect(aRay))
+			{
+				if (Node.NumPrimitives > 0)
+				{
+					for (unsigned Index = 0; Index < Node.NumPrimitives; Index++)
+					{
+						auto Patch = AcquirePatch(mPatchOrder[Node.LeftChild + Index]);
+
+						if (Patch->pBvh->Intersect(aRay, HitResult))
+						{
+							pHitPatch = std::move(Patch);
+						}
+					}
+
+					if (ToVisitOffset == 0)
+					{
+						break;
+					}
+
+					CurrentNode = NodesToVisit[--ToVisitOffset];
+				}
+				else
+				{
+					if (aRay.IsDirectionNeg[Node.SplitAxis])
+					{
+						NodesToVisit[ToVisitOffset++] = Node.LeftChild;
+						CurrentNode = Node.LeftChild + 1;
+					}
+					else
+					{
+						NodesToVisit[ToVisitOffset++] = Node.LeftChild + 1;
+						CurrentNode = Node.LeftChild;
+					}
+				}
+			}
+			else
+			{
+				if (ToVisitOffset == 0)
+				{
+					break;
+				}
+
+				CurrentNode = NodesToVisit[--ToVisitOffset];
+			}
+		}
+
+		if (!pHitPatch)
+		{
+			return false;
+		}
+
+		tHitPatch = std::move(pHitPatch);
+
+		return true;
+	}
+
+	bool TessellatedMesh::Occluded(const Ray& aRay) const
+	{
+		unsigned NodesToVisit[64];
+		unsigned ToVisitOffset = 0;
+
+		NodesToVisit[ToVisitOffset++] = 0;
+
+		while (ToVisitOffset > 0)
+		{
+			const BvhNode& Node = mPatchNodes[NodesToVisit[--ToVisitOffset]];
+
+			if (!Node.BoundingBox.Intersect(aRay))
+			{
+				continue;
+			}
+
+			if (Node.NumPrimitives == 0)
+			{
+				NodesToVisit[ToVisitOffset++] = Node.LeftChild;
+				NodesToVisit[ToVisitOffset++] = Node.LeftChild + 1;
+
+				continue;
+			}
+
+			for (unsigned Index = 0; Index < Node.NumPrimitives; Index++)
+			{
+				if (AcquirePatch(mPatchOrder[Node.LeftChild + Index])->pBvh->Occluded(aRay))
+				{
+					return true;
+				}
+			}
+		}
+
+		return false;
+	}
+
+} // namespace PathTracer
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <Pch.h>
+#include <Ray.h>
+#include <Shape.h>
+#include <Acceleration.h>
+#include <Texture.h>
+
+namespace PathTracer
+{
+	class TriangleMesh;
+
+	struct TessellationOptions
+	{
+		unsigned EdgeSegments = 0;			// per patch edge, 0 keeps every mesh as plain triangles
+		bool DisplacedOnly = true;			// only meshes whose material has a displacement map, the rest stay flat
+		Float DisplacementScale = 0.01f;	// world units at height 1, heights are the clamped map luminance
+		size_t CacheBudget = size_t(128) << 20;
+	};
+
+	// Micro triangles of one coarse triangle with their own small BVH
+	struct TessellatedPatch;
+
+	// Bounded LRU cache of tessellated patches shared by every tessellated mesh of a
+	// scene. Patches are built outside the lock, a racing build of the same patch is dropped
+	class TessellationCache
+	{
+	public:
+		TessellationCache(size_t Budget);
+
+		TessellationCache(const TessellationCache&) = delete;
+		TessellationCache& operator=(const TessellationCache&) = delete;
+
+		~TessellationCache() = default;
+
+		std::shared_ptr<const TessellatedPatch> Find(uint64_t Key);
+
+		// Returns the entry that ended up in the cache, which may be another thread's.
+		// A patch larger than the whole budget is returned without being cached
+		std::shared_ptr<const TessellatedPatch> Insert(uint64_t Key, std::shared_ptr<const TessellatedPatch> Patch);
+
+		size_t GetResidentBytes() const;
+
+		size_t GetNumBuilds() const;
+
+	private:
+		void Evict(size_t BytesNeeded);
+
+		struct Entry
+		{
+			std::shared_ptr<const TessellatedPatch> Data;
+			std::list<uint64_t>::iterator LruPosition;
+		};
+
+		mutable std::mutex mMutex;
+		std::unordered_map<uint64_t, Entry> mEntries;
+		std::list<uint64_t> mLru;
+		size_t mBudget;
+		size_t mResidentBytes = 0;
+		size_t mNumBuilds = 0;
+	};
+
+	// Keeps only the coarse control mesh. Every control triangle is a curved PN
+	// patch (Vlachos et al. 2001), optionally displaced along its normal, and is
+	// tessellated the first time a ray enters its conservative bounds
+	class TessellatedMesh
+	{
+	public:
+		TessellatedMesh(const TriangleMesh& ControlMesh, unsigned MeshId, const TessellationOptions& Options, const Texture* pDisplacement, TessellationCache& Cache);
+
+		TessellatedMesh(const TessellatedMesh&) = delete;
+		TessellatedMesh& operator=(const TessellatedMesh&) = delete;
+
+		~TessellatedMesh() = default;
+
+		// A hit stays valid until the calling thread's next Intersect on any tessellated mesh
+		bool Intersect(const Ray& aRay, Intersection& HitResult) const;
+
+		bool Occluded(const Ray& aRay) const;
+
+		const Aabb& GetBounds() const { return mPatchNodes[0].BoundingBox; }
+
+		unsigned GetNumPatches() const { return static_cast<unsigned>(mIndices.size() / 3); }
+
+		// Control mesh and patch tree, the cached patches are reported by the cache
+		size_t GetSizeInBytes() const;
+
+	private:
+		struct ControlVertex
+		{
+			Eigen::Vector3f Position;
+			Eigen::Vector3f Normal;
+			Eigen::Vector2f TexCoord;
+		};
+
+		std::shared_ptr<const TessellatedPatch> AcquirePatch(unsigned PatchIndex) const;
+
+		std::shared_ptr<const TessellatedPatch> Tessellate(unsigned PatchIndex) const;
+
+		// Corners are given in the order the PN control points are derived from
+		ControlVertex Evaluate(const ControlVertex* pCorners[3], Float U, Float V) const;
+
+		Aabb CalcPatchBounds(unsigned PatchIndex) const;
+
+		void BuildPatchTree();
+
+		std::vector<ControlVertex> mVertices;
+		std::vector<unsigned> mIndices;
+		std::vector<BvhNode> mPatchNodes;
+		std::vector<unsigned> mPatchOrder;
+		unsigned mMeshId;
+		unsigned mMaterialIndex;
+		bool mHasTexCoords;
+		TessellationOptions mOptions;
+		Float mDisplacementFootprint = 0;
+		const Texture* pDisplacementMap;
+		TessellationCache* pCache;
+	};
+
+} // namespace PathTracer
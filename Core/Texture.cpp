@@ -0,0 +1,615 @@
+#include <Texture.h>
+
+using namespace Eigen;
+
+namespace PathTracer
+{
+	// Epoch based reclamation shared by all caches. A reader announces the
+	// epoch it entered in, a tile retired in epoch E is freed once no reader
+	// announced an epoch at or below E
+	struct TextureReaderRecord
+	{
+		std::atomic<uint64_t> Epoch = 0; // 0 while outside any guard
+		std::atomic<bool> InUse = false;
+		TextureReaderRecord* pNext = nullptr;
+		unsigned Nesting = 0;
+	};
+
+	static std::atomic<TextureReaderRecord*> gReaderRecords = nullptr;
+	static std::atomic<uint64_t> gTextureEpoch = 1;
+
+	// Records are never freed, threads that exit hand theirs to the next one
+	static TextureReaderRecord* AcquireReaderRecord()
+	{
+		for (TextureReaderRecord* pRecord = gReaderRecords.load(); pRecord != nullptr; pRecord = pRecord->pNext)
+		{
+			bool Expected = false;
+
+			if (!pRecord->InUse.load(std::memory_order_relaxed) && pRecord->InUse.compare_exchange_strong(Expected, true))
+			{
+				return pRecord;
+			}
+		}
+
+		TextureReaderRecord* pRecord = new TextureReaderRecord;
+		pRecord->InUse = true;
+		pRecord->pNext = gReaderRecords.load();
+
+		while (!gReaderRecords.compare_exchange_weak(pRecord->pNext, pRecord))
+		{
+		}
+
+		return pRecord;
+	}
+
+	struct TextureThreadReader
+	{
+		TextureThreadReader()
+		: pRecord{AcquireReaderRecord()} {}
+
+		~TextureThreadReader()
+		{
+			pRecord->Epoch = 0;
+			pRecord->InUse = false;
+		}
+
+		TextureReaderRecord* pRecord;
+	};
+
+	static TextureReaderRecord& GetThreadReaderRecord()
+	{
+		thread_local TextureThreadReader Reader;
+
+		return *Reader.pRecord;
+	}
+
+	static uint64_t OldestActiveEpoch()
+	{
+		uint64_t Oldest = std::numeric_limits<uint64_t>::max();
+
+		for (TextureReaderRecord* pRecord = gReaderRecords.load(); pRecord != nullptr; pRecord = pRecord->pNext)
+		{
+			const uint64_t Epoch = pRecord->Epoch.load();
+
+			if (Epoch != 0)
+			{
+				Oldest = std::min(Oldest, Epoch);
+			}
+		}
+
+		return Oldest;
+	}
+
+	TextureCache::ReadGuard::ReadGuard()
+	{
+		TextureReaderRecord& Record = GetThreadReaderRecord();
+
+		if (Record.Nesting++ == 0)
+		{
+			Record.Epoch.store(gTextureEpoch.load());
+		}
+	}
+
+	TextureCache::ReadGuard::~ReadGuard()
+	{
+		TextureReaderRecord& Record = GetThreadReaderRecord();
+
+		if (--Record.Nesting == 0)
+		{
+			Record.Epoch.store(0, std::memory_order_release);
+		}
+	}
+
+	TextureCache::TextureCache(size_t Budget)
+	: mBudget{Budget}
+	{
+	}
+
+	TextureCache::~TextureCache()
+	{
+		for (TextureTileSlot* pSlot : mResident)
+		{
+			delete pSlot->pTile.exchange(nullptr);
+		}
+
+		for (const auto& Retired : mRetired)
+		{
+			delete Retired.second;
+		}
+	}
+
+	void TextureCache::Insert(TextureTileSlot& Slot, std::unique_ptr<TextureTile> Tile)
+	{
+		mNumDecodes++;
+
+		std::lock_guard<std::mutex> Lock(mMutex);
+
+		if (Slot.pTile.load() != nullptr)
+		{
+			return;
+		}
+
+		const TextureTile* pTile = Tile.release();
+
+		Slot.pTile.store(pTile);
+		Slot.Referenced.store(true, std::memory_order_relaxed);
+		Slot.Credit = Slot.Cost;
+
+		mResident.push_back(&Slot);
+		mResidentBytes += sizeof(TextureTile);
+
+		EvictLocked(&Slot);
+		ReclaimLocked();
+	}
+
+	void TextureCache::EvictLocked(const TextureTileSlot* pKeep)
+	{
+		while (mResidentBytes > mBudget && mResident.size() > 1)
+		{
+			if (mClockHand >= mResident.size())
+			{
+				mClockHand = 0;
+			}
+
+			TextureTileSlot* pSlot = mResident[mClockHand];
+
+			// second chance for anything read since the hand last passed
+			if (pSlot == pKeep || pSlot->Referenced.exchange(false, std::memory_order_relaxed))
+			{
+				pSlot->Credit = pSlot->Cost;
+				mClockHand++;
+
+				continue;
+			}
+
+			if (pSlot->Credit > 0)
+			{
+				pSlot->Credit--;
+				mClockHand++;
+
+				continue;
+			}
+
+			const TextureTile* pTile = pSlot->pTile.load(std::memory_order_relaxed);
+
+			pSlot->pTile.store(nullptr);
+
+			mRetired.emplace_back(gTextureEpoch.fetch_add(1), pTile);
+
+			mResident[mClockHand] = mResident.back();
+			mResident.pop_back();
+			mResidentBytes -= sizeof(TextureTile);
+		}
+	}
+
+	void TextureCache::ReclaimLocked()
+	{
+		if (mRetired.empty())
+		{
+			return;
+		}
+
+		const uint64_t Oldest = OldestActiveEpoch();
+
+		auto Kept = std::remove_if(mRetired.begin(), mRetired.end(), [Oldest](const auto& Retired)
+		{
+			if (Retired.first < Oldest)
+			{
+				delete Retired.second;
+
+				return true;
+			}
+
+			return false;
+		});
+
+		mRetired.erase(Kept, mRetired.end());
+	}
+
+	void TextureCache::Release(TextureTileSlot* pSlots, size_t NumSlots)
+	{
+		std::lock_guard<std::mutex> Lock(mMutex);
+
+		auto Kept = std::remove_if(mResident.begin(), mResident.end(), [&](TextureTileSlot* pSlot)
+		{
+			if (pSlot >= pSlots && pSlot < pSlots + NumSlots)
+			{
+				delete pSlot->pTile.exchange(nullptr);
+
+				return true;
+			}
+
+			return false;
+		});
+
+		mResidentBytes -= (mResident.end() - Kept) * sizeof(TextureTile);
+		mResident.erase(Kept, mResident.end());
+
+		ReclaimLocked();
+	}
+
+	size_t TextureCache::GetResidentBytes() const
+	{
+		std::lock_guard<std::mutex> Lock(mMutex);
+
+		return mResidentBytes;
+	}
+
+	static Float SrgbToLinear(Float Value)
+	{
+		return Value <= 0.04045f ? Value / 12.92f : std::pow((Value + 0.055f) / 1.055f, 2.4f);
+	}
+
+	static std::string ReadHeaderToken(std::ifstream& File)
+	{
+		std::string Token;
+
+		while (File >> Token && Token[0] == '#')
+		{
+			File.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+		}
+
+		return Token;
+	}
+
+	Texture::Texture(std::string_view FileName, TextureCache& Cache)
+	: pCache{&Cache}, mFileName{FileName}
+	{
+		mFile.open(mFileName, std::ios::binary);
+
+		if (!mFile.is_open())
+		{
+			throw std::runtime_error("Failed to open texture " + mFileName + "\n");
+		}
+
+		ReadHeader();
+
+		unsigned Width = mLevels[0].Width;
+		unsigned Height = mLevels[0].Height;
+
+		while (Width > 1 || Height > 1)
+		{
+			Width = (Width + 1) / 2;
+			Height = (Height + 1) / 2;
+
+			mLevels.push_back({Width, Height, 0, 0, 0});
+		}
+
+		for (auto& Level : mLevels)
+		{
+			Level.TilesX = (Level.Width + kTextureTileSize - 1) / kTextureTileSize;
+			Level.TilesY = (Level.Height + kTextureTileSize - 1) / kTextureTileSize;
+			Level.FirstSlot = mNumSlots;
+
+			mNumSlots += size_t(Level.TilesX) * Level.TilesY;
+		}
+
+		mSlots = std::make_unique<TextureTileSlot[]>(mNumSlots);
+
+		for (unsigned Level = 1; Level < mLevels.size(); Level++)
+		{
+			for (size_t Slot = mLevels[Level].FirstSlot; Slot < mNumSlots; Slot++)
+			{
+				mSlots[Slot].Cost = Level;
+			}
+		}
+
+		if (mFormat == FileFormat::Ppm && mMaxValue <= 255)
+		{
+			mSrgbTable.resize(mMaxValue + 1);
+
+			for (unsigned Value = 0; Value <= mMaxValue; Value++)
+			{
+				mSrgbTable[Value] = SrgbToLinear(static_cast<Float>(Value) / mMaxValue);
+			}
+		}
+	}
+
+	Texture::~Texture()
+	{
+		pCache->Release(mSlots.get(), mNumSlots);
+	}
+
+	void Texture::ReadHeader()
+	{
+		const std::string Magic = ReadHeaderToken(mFile);
+
+		if (Magic != "P6" && Magic != "PF")
+		{
+			throw std::runtime_error("Unsupported texture format in " + mFileName + ", expected binary PPM or PFM\n");
+		}
+
+		mFormat = Magic == "P6" ? FileFormat::Ppm : FileFormat::Pfm;
+
+		const unsigned Width = std::stoul(ReadHeaderToken(mFile));
+		const unsigned Height = std::stoul(ReadHeaderToken(mFile));
+
+		if (mFormat == FileFormat::Ppm)
+		{
+			mMaxValue = std::stoul(ReadHeaderToken(mFile));
+
+			if (mMaxValue == 0 || mMaxValue > 65535)
+			{
+				throw std::runtime_error("Invalid PPM maximum value in " + mFileName + "\n");
+			}
+		}
+		else
+		{
+			// a negative scale marks little endian data
+			mLittleEndian = std::stof(ReadHeaderToken(mFile)) < 0;
+		}
+
+		// exactly one whitespace separates the header from the samples
+		mFile.get();
+
+		if (!mFile || Width == 0 || Height == 0)
+		{
+			throw std::runtime_error("Invalid texture header in " + mFileName + "\n");
+		}
+
+		mDataOffset = mFile.tellg();
+
+		mLevels.push_back({Width, Height, 0, 0, 0});
+	}
+
+	void Texture::ReadBaseTile(unsigned TileX, unsigned TileY, TextureTile& Tile) const
+	{
+		const MipLevel& Base = mLevels[0];
+
+		const unsigned BeginX = TileX * kTextureTileSize;
+		const unsigned BeginY = TileY * kTextureTileSize;
+		const unsigned Columns = std::min(kTextureTileSize, Base.Width - BeginX);
+		const unsigned Rows = std::min(kTextureTileSize, Base.Height - BeginY);
+
+		const unsigned SampleBytes = mFormat == FileFormat::Pfm ? 4 : (mMaxValue > 255 ? 2 : 1);
+		const size_t PixelBytes = size_t(SampleBytes) * 3;
+
+		std::vector<unsigned char> Buffer(PixelBytes * Columns);
+
+		for (unsigned Row = 0; Row < Rows; Row++)
+		{
+			// PFM rows run bottom to top
+			const unsigned FileRow = mFormat == FileFormat::Pfm ? Base.Height - 1 - (BeginY + Row) : BeginY + Row;
+
+			{
+				std::lock_guard<std::mutex> Lock(mFileMutex);
+
+				mFile.seekg(mDataOffset + static_cast<std::streamoff>((size_t(FileRow) * Base.Width + BeginX) * PixelBytes));
+				mFile.read(reinterpret_cast<char*>(Buffer.data()), static_cast<std::streamsize>(Buffer.size()));
+
+				if (!mFile)
+				{
+					mFile.clear();
+
+					throw std::runtime_error("Failed to read texture data from " + mFileName + "\n");
+				}
+			}
+
+			float* pTexels = Tile.Texels + size_t(Row) * kTextureTileSize * 3;
+
+			for (size_t Sample = 0; Sample < size_t(Columns) * 3; Sample++)
+			{
+				const unsigned char* pSample = Buffer.data() + Sample * SampleBytes;
+
+				if (mFormat == FileFormat::Pfm)
+				{
+					uint32_t Bits = 0;
+
+					for (unsigned Byte = 0; Byte < 4; Byte++)
+					{
+						Bits |= uint32_t(pSample[Byte]) << (mLittleEndian ? 8 * Byte : 8 * (3 - Byte));
+					}
+
+					pTexels[Sample] = std::bit_cast<float>(Bits);
+				}
+				else
+				{
+					if (SampleBytes == 1)
+					{
+						pTexels[Sample] = mSrgbTable[std::min<unsigned>(pSample[0], mMaxValue)];
+
+						continue;
+					}
+
+					const unsigned Value = (unsigned(pSample[0]) << 8) | pSample[1];
+
+					pTexels[Sample] = SrgbToLinear(static_cast<Float>(Value) / mMaxValue);
+				}
+			}
+		}
+	}
+
+	std::unique_ptr<TextureTile> Texture::DecodeTile(unsigned Level, unsigned TileX, unsigned TileY) const
+	{
+		auto Tile = std::make_unique<TextureTile>();
+
+		std::fill(std::begin(Tile->Texels), std::end(Tile->Texels), 0.f);
+
+		if (Level == 0)
+		{
+			ReadBaseTile(TileX, TileY, *Tile);
+
+			return Tile;
+		}
+
+		// box filter of the 2x2 finer tiles below, which come through the cache as well
+		const MipLevel& Current = mLevels[Level];
+		const MipLevel& Finer = mLevels[Level - 1];
+
+		std::vector<float> Source(size_t(4) * kTextureTileSize * kTextureTileSize * 3, 0.f);
+
+		auto SourceTexel = [&](unsigned X, unsigned Y)
+		{
+			return Source.data() + (size_t(Y) * 2 * kTextureTileSize + X) * 3;
+		};
+
+		TextureTile Child;
+
+		for (unsigned ChildY = 0; ChildY < 2; ChildY++)
+		{
+			for (unsigned ChildX = 0; ChildX < 2; ChildX++)
+			{
+				if (2 * TileX + ChildX >= Finer.TilesX || 2 * TileY + ChildY >= Finer.TilesY)
+				{
+					continue;
+				}
+
+				CopyTile(Level - 1, 2 * TileX + ChildX, 2 * TileY + ChildY, Child);
+
+				for (unsigned Row = 0; Row < kTextureTileSize; Row++)
+				{
+					std::memcpy(SourceTexel(ChildX * kTextureTileSize, ChildY * kTextureTileSize + Row),
+								Child.Texels + size_t(Row) * kTextureTileSize * 3, kTextureTileSize * 3 * sizeof(float));
+				}
+			}
+		}
+
+		const unsigned BeginX = TileX * kTextureTileSize;
+		const unsigned BeginY = TileY * kTextureTileSize;
+		const unsigned Columns = std::min(kTextureTileSize, Current.Width - BeginX);
+		const unsigned Rows = std::min(kTextureTileSize, Current.Height - BeginY);
+
+		// odd sizes repeat the last finer row or column
+		const unsigned LastX = Finer.Width - 1 - 2 * BeginX;
+		const unsigned LastY = Finer.Height - 1 - 2 * BeginY;
+
+		for (unsigned Row = 0; Row < Rows; Row++)
+		{
+			for (unsigned Col = 0; Col < Columns; Col++)
+			{
+				const unsigned X = 2 * Col;
+				const unsigned Y = 2 * Row;
+				const unsigned NextX = std::min(X + 1, LastX);
+				const unsigned NextY = std::min(Y + 1, LastY);
+
+				float* pTexel = Tile->Texels + (size_t(Row) * kTextureTileSize + Col) * 3;
+
+				for (unsigned Channel = 0; Channel < 3; Channel++)
+				{
+					pTexel[Channel] = 0.25f * (SourceTexel(X, Y)[Channel] + SourceTexel(NextX, Y)[Channel]
+											 + SourceTexel(X, NextY)[Channel] + SourceTexel(NextX, NextY)[Channel]);
+				}
+			}
+		}
+
+		return Tile;
+	}
+
+	TextureTileSlot& Texture::GetSlot(unsigned Level, unsigned TileX, unsigned TileY) const
+	{
+		const MipLevel& aLevel = mLevels[Level];
+
+		return mSlots[aLevel.FirstSlot + size_t(TileY) * aLevel.TilesX + TileX];
+	}
+
+	void Texture::CopyTile(unsigned Level, unsigned TileX, unsigned TileY, TextureTile& Tile) const
+	{
+		TextureTileSlot& Slot = GetSlot(Level, TileX, TileY);
+
+		{
+			TextureCache::ReadGuard Guard;
+
+			if (const TextureTile* pTile = Slot.pTile.load())
+			{
+				Tile = *pTile;
+
+				return;
+			}
+		}
+
+		// no guard while decoding, finer levels may be decoded and evicted underneath
+		std::unique_ptr<TextureTile> Decoded = DecodeTile(Level, TileX, TileY);
+
+		Tile = *Decoded;
+
+		pCache->Insert(Slot, std::move(Decoded));
+	}
+
+	Vector3f Texture::FetchTexel(unsigned Level, int X, int Y) const
+	{
+		const MipLevel& aLevel = mLevels[Level];
+
+		X %= static_cast<int>(aLevel.Width);
+		Y %= static_cast<int>(aLevel.Height);
+
+		X += X < 0 ? aLevel.Width : 0;
+		Y += Y < 0 ? aLevel.Height : 0;
+
+		const unsigned TileX = X / kTextureTileSize;
+		const unsigned TileY = Y / kTextureTileSize;
+		const size_t Offset = (size_t(Y % kTextureTileSize) * kTextureTileSize + X % kTextureTileSize) * 3;
+
+		TextureTileSlot& Slot = GetSlot(Level, TileX, TileY);
+
+		{
+			TextureCache::ReadGuard Guard;
+
+			if (const TextureTile* pTile = Slot.pTile.load())
+			{
+				// only write when needed so hot tiles do not bounce between cores
+				if (!Slot.Referenced.load(std::memory_order_relaxed))
+				{
+					Slot.Referenced.store(true, std::memory_order_relaxed);
+				}
+
+				return Vector3f(pTile->Texels[Offset], pTile->Texels[Offset + 1], pTile->Texels[Offset + 2]);
+			}
+		}
+
+		std::unique_ptr<TextureTile> Decoded = DecodeTile(Level, TileX, TileY);
+
+		const Vector3f Result(Decoded->Texels[Offset], Decoded->Texels[Offset + 1], Decoded->Texels[Offset + 2]);
+
+		pCache->Insert(Slot, std::move(Decoded));
+
+		return Result;
+	}
+
+	Vector3f Texture::Texel(unsigned Level, int X, int Y) const
+	{
+		return FetchTexel(std::min(Level, GetNumLevels() - 1), X, Y);
+	}
+
+	Vector3f Texture::Bilinear(unsigned Level, const Vector2f& UV) const
+	{
+		const MipLevel& aLevel = mLevels[Level];
+
+		// V runs up the image, rows run down
+		const Float X = UV.x() * aLevel.Width - 0.5f;
+		const Float Y = (1 - UV.y()) * aLevel.Height - 0.5f;
+
+		const Float FloorX = std::floor(X);
+		const Float FloorY = std::floor(Y);
+
+		const Float FracX = X - FloorX;
+		const Float FracY = Y - FloorY;
+
+		const int X0 = static_cast<int>(FloorX);
+		const int Y0 = static_cast<int>(FloorY);
+
+		return (1 - FracX) * (1 - FracY) * FetchTexel(Level, X0, Y0) + FracX * (1 - FracY) * FetchTexel(Level, X0 + 1, Y0)
+			 + (1 - FracX) * FracY * FetchTexel(Level, X0, Y0 + 1) + FracX * FracY * FetchTexel(Level, X0 + 1, Y0 + 1);
+	}
+
+	Vector3f Texture::Sample(const Vector2f& UV, Float Width) const
+	{
+		const unsigned NumLevels = GetNumLevels();
+		const Float Level = std::log2(std::max(Width * std::max(GetWidth(), GetHeight()), 1e-8f));
+
+		if (Level <= 0)
+		{
+			return Bilinear(0, UV);
+		}
+
+		if (Level >= NumLevels - 1)
+		{
+			return Bilinear(NumLevels - 1, UV);
+		}
+
+		const unsigned Lower = static_cast<unsigned>(Level);
+		const Float Fraction = Level - Lower;
+
+		return (1 - Fraction) * Bilinear(Lower, UV) + Fraction * Bilinear(Lower + 1, UV);
+	}
+
+} // namespace PathTracer
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <Pch.h>
+#include <Constants.h>
+
+namespace PathTracer
+{
+	constexpr unsigned kTextureTileSize = 32;
+
+	// Linear RGB texels of one tile, row major
+	struct TextureTile
+	{
+		float Texels[kTextureTileSize * kTextureTileSize * 3];
+	};
+
+	// Where a texture publishes its decoded tile, readers only ever load the pointer
+	struct TextureTileSlot
+	{
+		std::atomic<const TextureTile*> pTile = nullptr;
+		std::atomic<bool> Referenced = false;
+		unsigned Cost = 0;		// extra sweeps survived, coarse mip tiles are rebuilt from many finer ones
+		unsigned Credit = 0;	// guarded by the cache mutex
+	};
+
+	// Memory budgeted tile cache shared by every texture of a scene. Hits are
+	// lock-free: tiles are published through atomic slot pointers, eviction
+	// approximates LRU with a clock sweep over reference bits weighted by the
+	// rebuild cost, and evicted tiles are freed only once every reader that
+	// could still see them has left
+	class TextureCache
+	{
+	public:
+		TextureCache(size_t Budget);
+
+		TextureCache(const TextureCache&) = delete;
+		TextureCache& operator=(const TextureCache&) = delete;
+
+		~TextureCache();
+
+		// Tiles loaded from slots while a guard is alive on the calling thread stay
+		// valid. Keep the scope short, nothing evicted meanwhile can be freed
+		class ReadGuard
+		{
+		public:
+			ReadGuard();
+
+			ReadGuard(const ReadGuard&) = delete;
+			ReadGuard& operator=(const ReadGuard&) = delete;
+
+			~ReadGuard();
+		};
+
+		// Publishes a decoded tile unless another thread got there first
+		void Insert(TextureTileSlot& Slot, std::unique_ptr<TextureTile> Tile);
+
+		// Frees every tile of a texture that is being destroyed
+		void Release(TextureTileSlot* pSlots, size_t NumSlots);
+
+		size_t GetResidentBytes() const;
+
+		size_t GetNumDecodes() const { return mNumDecodes; }
+
+	private:
+		void EvictLocked(const TextureTileSlot* pKeep);
+
+		void ReclaimLocked();
+
+		mutable std::mutex mMutex;
+		std::vector<TextureTileSlot*> mResident;
+		std::vector<std::pair<uint64_t, const TextureTile*>> mRetired;
+		size_t mClockHand = 0;
+		size_t mBudget;
+		size_t mResidentBytes = 0;
+		std::atomic<size_t> mNumDecodes = 0;
+	};
+
+	// Mip-mapped texture decoded tile by tile on first use. Reads binary PPM (P6,
+	// 8 or 16 bit, sRGB) and PFM (linear), the file stays open for lazy decoding
+	class Texture
+	{
+	public:
+		Texture(std::string_view FileName, TextureCache& Cache);
+
+		Texture(const Texture&) = delete;
+		Texture& operator=(const Texture&) = delete;
+
+		~Texture();
+
+		// Trilinear lookup with repeat wrapping, Width is the filter footprint in UV units
+		Eigen::Vector3f Sample(const Eigen::Vector2f& UV, Float Width) const;
+
+		Eigen::Vector3f Texel(unsigned Level, int X, int Y) const;
+
+		unsigned GetWidth() const { return mLevels[0].Width; }
+
+		unsigned GetHeight() const { return mLevels[0].Height; }
+
+		unsigned GetNumLevels() const { return static_cast<unsigned>(mLevels.size()); }
+
+	private:
+		struct MipLevel
+		{
+			unsigned Width, Height;
+			unsigned TilesX, TilesY;
+			size_t FirstSlot;
+		};
+
+		enum class FileFormat
+		{
+			Ppm = 1,
+			Pfm = 2,
+		};
+
+		Eigen::Vector3f Bilinear(unsigned Level, const Eigen::Vector2f& UV) const;
+
+		Eigen::Vector3f FetchTexel(unsigned Level, int X, int Y) const;
+
+		TextureTileSlot& GetSlot(unsigned Level, unsigned TileX, unsigned TileY) const;
+
+		// Copies a tile out, decoding it on a miss
+		void CopyTile(unsigned Level, unsigned TileX, unsigned TileY, TextureTile& Tile) const;
+
+		std::unique_ptr<TextureTile> DecodeTile(unsigned Level, unsigned TileX, unsigned TileY) const;
+
+		void ReadBaseTile(unsigned TileX, unsigned TileY, TextureTile& Tile) const;
+
+		void ReadHeader();
+
+		TextureCache* pCache;
+		std::string mFileName;
+		FileFormat mFormat;
+		unsigned mMaxValue = 255;
+		bool mLittleEndian = false;
+		std::streamoff mDataOffset = 0;
+		mutable std::mutex mFileMutex;
+		mutable std::ifstream mFile;
+		std::vector<MipLevel> mLevels;
+		std::unique_ptr<TextureTileSlot[]> mSlots;
+		size_t mNumSlots = 0;
+		std::vector<float> mSrgbTable;
+	};
+
+} // namespace PathTracer
@@ -0,0 +1,268 @@
+#include <VisibilityBuffer.h>
+#include <Parallel.h>
+
+using namespace Eigen;
+
+namespace PathTracer
+{
+	constexpr int kBandRows = 8;
+
+	// Triangles projected per task while binning
+	constexpr size_t kBinningChunk = 4096;
+
+	// In pixels, the projection and the ray test round differently
+	constexpr Float kRasterMargin = 0.25f;
+
+	// In pixels, keeps a sample on a pixel border in the column or row range
+	constexpr Float kRangeSlack = 1.f / 64;
+
+	VisibilityBuffer::VisibilityBuffer(const Camera& aCamera, const Scene& aScene)
+	: mTriangles{aScene.GetBvhTriangles()}, mProjection{aCamera.GetProjection()}
+	{
+		mScreenX = mProjection.FieldOfView * mProjection.AspectRatio;
+		mScreenY = mProjection.FieldOfView;
+		mMargin = kRasterMargin * 2 * mScreenY / mProjection.Resolution.y();
+
+		const unsigned NumBands = (mProjection.Resolution.y() + kBandRows - 1) / kBandRows;
+
+		// bands of every triangle, empty for the ones no camera ray can reach
+		std::vector<std::pair<unsigned, unsigned>> Bands(mTriangles.size(), {0, 0});
+
+		ParallelFor((mTriangles.size() + kBinningChunk - 1) / kBinningChunk, [&](size_t Chunk)
+		{
+			const size_t End = std::min(mTriangles.size(), (Chunk + 1) * kBinningChunk);
+
+			for (size_t Index = Chunk * kBinningChunk; Index < End; Index++)
+			{
+				RasterTriangle Raster;
+
+				if (Project(static_cast<uint32_t>(Index), Raster))
+				{
+					Bands[Index] = { Raster.BeginRow / kBandRows, (Raster.EndRow - 1) / kBandRows + 1 };
+				}
+			}
+		});
+
+		mBandOffsets.assign(NumBands + 1, 0);
+
+		for (const auto& [BeginBand, EndBand] : Bands)
+		{
+			for (unsigned Band = BeginBand; Band < EndBand; Band++)
+			{
+				mBandOffsets[Band + 1]++;
+			}
+		}
+
+		std::partial_sum(mBandOffsets.begin(), mBandOffsets.end(), mBandOffsets.begin());
+
+		mBandTriangles.resize(mBandOffsets.back());
+
+		std::vector<unsigned> Cursors(mBandOffsets.begin(), mBandOffsets.end() - 1);
+
+		for (size_t Index = 0; Index < Bands.size(); Index++)
+		{
+			for (unsigned Band = Bands[Index].first; Band < Bands[Index].second; Band++)
+			{
+				mBandTriangles[Cursors[Band]++] = static_cast<uint32_t>(Index);
+			}
+		}
+	}
+
+	Vector2f VisibilityBuffer::ToScreen(const Vector3f& Local) const
+	{
+		return Vector2f(Local.x(), Local.y()) / -Local.z();
+	}
+
+	bool VisibilityBuffer::Project(uint32_t Index, RasterTriangle& Result) const
+	{
+		const Triangle& aTriangle = *mTriangles[Index];
+
+		Vector3f Local[3];
+		int NumBehind = 0;
+
+		for (int Corner = 0; Corner < 3; Corner++)
+		{
+			Local[Corner] = mProjection.Rotation.transpose() * (aTriangle.GetPosition(Corner) - mProjection.Origin);
+			NumBehind += Local[Corner].z() >= 0;
+		}
+
+		// camera rays all run towards -z
+		if (NumBehind == 3)
+		{
+			return false;
+		}
+
+		Result.Index = Index;
+
+		for (Vector3f& Edge : Result.Edges)
+		{
+			Edge = Vector3f(0, 0, 1);
+		}
+
+		if (NumBehind > 0)
+		{
+			Result.MinX = Result.MinY = -kInfinity;
+			Result.MaxX = Result.MaxY = kInfinity;
+		}
+		else
+		{
+			const Vector2f Screen[3] = { ToScreen(Local[0]), ToScreen(Local[1]), ToScreen(Local[2]) };
+
+			Result.MinX = std::min({ Screen[0].x(), Screen[1].x(), Screen[2].x() }) - mMargin;
+			Result.MaxX = std::max({ Screen[0].x(), Screen[1].x(), Screen[2].x() }) + mMargin;
+			Result.MinY = std::min({ Screen[0].y(), Screen[1].y(), Screen[2].y() }) - mMargin;
+			Result.MaxY = std::max({ Screen[0].y(), Screen[1].y(), Screen[2].y() }) + mMargin;
+
+			const Vector2f Side1 = Screen[1] - Screen[0];
+			const Vector2f Side2 = Screen[2] - Screen[0];
+			const Float Area = Side1.x() * Side2.y() - Side1.y() * Side2.x();
+
+			// seen edge on the bounds alone are tight enough
+			if (Area != 0 && std::isfinite(Area))
+			{
+				const Float Winding = Area > 0 ? 1.f : -1.f;
+
+				for (int Corner = 0; Corner < 3; Corner++)
+				{
+					const Vector2f& Start = Screen[Corner];
+					const Vector2f Side = Screen[(Corner + 1) % 3] - Start;
+					const Vector2f Normal = Winding * Vector2f(-Side.y(), Side.x()) / Side.norm();
+
+					Result.Edges[Corner] = Vector3f(Normal.x(), Normal.y(), mMargin - Normal.dot(Start));
+				}
+			}
+		}
+
+		const Vector2i& Resolution = mProjection.Resolution;
+		const Float PixelSize = 2 * mScreenY / Resolution.y();
+
+		auto ToRange = [&](Float Min, Float Max, int Count, int& Begin, int& End)
+		{
+			Begin = static_cast<int>(std::floor(std::clamp<Float>(Min / PixelSize - kRangeSlack, 0, Float(Count))));
+			End = static_cast<int>(std::floor(std::clamp<Float>(Max / PixelSize + kRangeSlack, -1, Float(Count - 1)))) + 1;
+		};
+
+		// rows count down the screen
+		ToRange(Result.MinX + mScreenX, Result.MaxX + mScreenX, Resolution.x(), Result.BeginCol, Result.EndCol);
+		ToRange(mScreenY - Result.MaxY, mScreenY - Result.MinY, Resolution.y(), Result.BeginRow, Result.EndRow);
+
+		return Result.BeginCol < Result.EndCol && Result.BeginRow < Result.EndRow;
+	}
+
+	void VisibilityBuffer::PrepareBand(unsigned Band, VisibilityBand& Result) const
+	{
+		Result.BeginRow = Band * kBandRows;
+		Result.EndRow = std::min<int>(Result.BeginRow + kBandRows, mProjection.Resolution.y());
+
+		Result.Triangles.clear();
+
+		for (unsigned Entry = mBandOffsets[Band]; Entry < mBandOffsets[Band + 1]; Entry++)
+		{
+			RasterTriangle Raster;
+
+			if (Project(mBandTriangles[Entry], Raster))
+			{
+				Result.Triangles.push_back(Raster);
+			}
+		}
+
+		const int NumRows = Result.EndRow - Result.BeginRow;
+
+		Result.RowOffsets.assign(NumRows + 1, 0);
+
+		for (const RasterTriangle& Raster : Result.Triangles)
+		{
+			for (int Row = std::max(Raster.BeginRow, Result.BeginRow); Row < std::min(Raster.EndRow, Result.EndRow); Row++)
+			{
+				Result.RowOffsets[Row - Result.BeginRow + 1]++;
+			}
+		}
+
+		std::partial_sum(Result.RowOffsets.begin(), Result.RowOffsets.end(), Result.RowOffsets.begin());
+
+		Result.RowTriangles.resize(Result.RowOffsets.back());
+
+		std::vector<unsigned> Cursors(Result.RowOffsets.begin(), Result.RowOffsets.end() - 1);
+
+		for (unsigned Entry = 0; Entry < Result.Triangles.size(); Entry++)
+		{
+			const RasterTriangle& Raster = Result.Triangles[Entry];
+
+			for (int Row = std::max(Raster.BeginRow, Result.BeginRow); Row < std::min(Raster.EndRow, Result.EndRow); Row++)
+			{
+				Result.RowTriangles[Cursors[Row - Result.BeginRow]++] = Entry;
+			}
+		}
+	}
+
+	void VisibilityBuffer::Rasterize(const VisibilityBand& Band, int Row, const CameraRayBatch& Batch, std::vector<VisibilitySample>& Samples) const
+	{
+		const int Width = mProjection.Resolution.x();
+
+		static thread_local std::vector<Ray> tRays;
+
+		tRays.resize(Width);
+
+		for (int Col = 0; Col < Width; Col++)
+		{
+			tRays[Col] = Batch.GetRay(Col);
+		}
+
+		Samples.assign(Width, VisibilitySample{});
+
+		const int LocalRow = Row - Band.BeginRow;
+
+		for (unsigned Entry = Band.RowOffsets[LocalRow]; Entry < Band.RowOffsets[LocalRow + 1]; Entry++)
+		{
+			const RasterTriangle& Raster = Band.Triangles[Band.RowTriangles[Entry]];
+			const Triangle& aTriangle = *mTriangles[Raster.Index];
+
+			for (int Col = Raster.BeginCol; Col < Raster.EndCol; Col++)
+			{
+				const Float X = Batch.ScreenX[Col];
+				const Float Y = Batch.ScreenY[Col];
+
+				if (X < Raster.MinX || X > Raster.MaxX || Y < Raster.MinY || Y > Raster.MaxY)
+				{
+					continue;
+				}
+
+				const Vector3f& E0 = Raster.Edges[0];
+				const Vector3f& E1 = Raster.Edges[1];
+				const Vector3f& E2 = Raster.Edges[2];
+
+				if (X * E0.x() + Y * E0.y() + E0.z() < 0 || X * E1.x() + Y * E1.y() + E1.z() < 0 || X * E2.x() + Y * E2.y() + E2.z() < 0)
+				{
+					continue;
+				}
+
+				VisibilitySample& Sample = Samples[Col];
+				const Ray& aRay = tRays[Col];
+
+				aRay.tMax = Sample.t;
+
+				Float U, V;
+
+				if (!aTriangle.IntersectBarycentric(aRay, U, V))
+				{
+					continue;
+				}
+
+				if (aRay.tMax == Sample.t)
+				{
+					Sample.Triangle |= VisibilitySample::kTraceBit;
+
+					continue;
+				}
+
+				Sample = { Raster.Index, U, V, aRay.tMax };
+			}
+		}
+	}
+
+	size_t VisibilityBuffer::GetSizeInBytes() const
+	{
+		return sizeof(VisibilityBuffer) + GetVectorBytes(mBandOffsets) + GetVectorBytes(mBandTriangles);
+	}
+
+} // namespace PathTracer
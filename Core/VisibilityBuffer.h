@@ -0,0 +1,82 @@
+#pragma once
+
+#include <Pch.h>
+#include <Camera.h>
+#include <Scene.h>
+
+namespace PathTracer
+{
+	// First hit of one camera ray among the triangles of the scene's BVH
+	struct VisibilitySample
+	{
+		static constexpr uint32_t kNoHit = 0x7fffffffu;
+		static constexpr uint32_t kTraceBit = 0x80000000u;	// two triangles tied for the hit, traversal settles it
+
+		bool NeedsTrace() const { return (Triangle & kTraceBit) != 0; }
+
+		uint32_t Triangle = kNoHit;		// index into Scene::GetBvhTriangles
+		Float U = 0, V = 0;
+		Float t = kInfinity;
+	};
+
+	// A triangle projected to screen space, every edge line is scaled to a unit
+	// normal so the margin is a distance. Triangles crossing the camera plane
+	// cover the whole screen and get edges that pass everything
+	struct RasterTriangle
+	{
+		uint32_t Index;
+		int BeginCol, EndCol;
+		int BeginRow, EndRow;
+		Float MinX, MaxX, MinY, MaxY;
+		Eigen::Vector3f Edges[3];	// inside where x * E.x() + y * E.y() + E.z() >= 0 for all three
+	};
+
+	// The triangles of a band of rows with a list per row
+	struct VisibilityBand
+	{
+		int BeginRow = 0, EndRow = 0;
+		std::vector<RasterTriangle> Triangles;
+		std::vector<unsigned> RowOffsets;
+		std::vector<unsigned> RowTriangles;
+	};
+
+	// Rasterizes the primary hits of a pinhole camera. The triangles are binned
+	// to bands of rows once, a band is projected when it is rendered, and every
+	// sample covered by a triangle runs the same ray test as the BVH on the ray
+	// GenerateRays made for it. The closest hit is thus the one traversal would
+	// find, only exact ties between triangles are left to traversal since its
+	// visiting order picks the winner
+	class VisibilityBuffer
+	{
+	public:
+		VisibilityBuffer(const Camera& aCamera, const Scene& aScene);
+
+		VisibilityBuffer(const VisibilityBuffer&) = delete;
+		VisibilityBuffer& operator=(const VisibilityBuffer&) = delete;
+
+		~VisibilityBuffer() = default;
+
+		unsigned GetNumBands() const { return static_cast<unsigned>(mBandOffsets.size() - 1); }
+
+		void PrepareBand(unsigned Band, VisibilityBand& Result) const;
+
+		// Samples of the rays GenerateRays made for the single row tile of Row
+		void Rasterize(const VisibilityBand& Band, int Row, const CameraRayBatch& Batch, std::vector<VisibilitySample>& Samples) const;
+
+		size_t GetSizeInBytes() const;
+
+	private:
+		// Screen space position of a point in camera space
+		Eigen::Vector2f ToScreen(const Eigen::Vector3f& Local) const;
+
+		bool Project(uint32_t Index, RasterTriangle& Result) const;
+
+		const std::vector<Triangle*>& mTriangles;
+		CameraProjection mProjection;
+		Float mScreenX, mScreenY;	// half extents of the screen
+		Float mMargin;
+		std::vector<unsigned> mBandOffsets;
+		std::vector<uint32_t> mBandTriangles;
+	};
+
+} // namespace PathTracer
@@ -1,57 +1,89 @@
 #include <Scene.h>
 #include <Camera.h>
 #include <Sampler.h>
+#include <Render.h>
+#include <Benchmark.h>
+#include <RenderServer.h>
 
 using namespace PathTracer;
 using namespace Eigen;
 
-void Render(Camera& Camera, Scene& Scene)
+// PathTracer --benchmark Results.json [--max-triangles N] [--threads 1,2,4]
+static int RunBenchmark(int argc, char** argv)
 {
-	const Vector2i CamResolution = Camera.GetImageResolution();
+	BenchmarkOptions Options;
 
-    const Float InvCamY = 1.f / (CamResolution.y() - 1);
-
-	const unsigned nSamples = 16;
-
-	HammersleySampler Sampler(nSamples);
-
-	std::cout << "\nStarting Rendering\n";
-
-	for (int Row = 0; Row < CamResolution.y(); Row++)
+	try
 	{
-		for (int Col = 0; Col < CamResolution.x(); Col++)
+		for (int Arg = 3; Arg + 1 < argc; Arg += 2)
 		{
-			Vector3f PixelColor(0, 0, 0);
+			const std::string_view Name = argv[Arg];
 
-			for (unsigned N = 0; N < nSamples; N++)
+			if (Name == "--max-triangles")
 			{
-				Vector2f CameraSample = Sampler.SampleUnitSquare();
+				const size_t MaxTriangles = std::stoull(argv[Arg + 1]);
 
-				const Ray aRay = Camera.GenerateRay(Row, Col, CameraSample);
-
-				Intersection HitResult;
+				std::erase_if(Options.TriangleCounts, [&](size_t Count) { return Count > MaxTriangles; });
+			}
+			else if (Name == "--threads")
+			{
+				std::stringstream List(argv[Arg + 1]);
+				std::string Count;
 
-				if (Scene.Intersect(aRay, HitResult))
+				while (std::getline(List, Count, ','))
 				{
-					PixelColor += HitResult.Normal;
+					const unsigned long NumThreads = std::stoul(Count);
+
+					if (NumThreads == 0 || NumThreads > std::numeric_limits<unsigned>::max())
+					{
+						throw std::out_of_range(Count);
+					}
+
+					Options.ThreadCounts.push_back(static_cast<unsigned>(NumThreads));
 				}
 			}
-
-			PixelColor /= static_cast<Float>(nSamples);
-			
-			Camera.SetPixelColour(Row, Col, PixelColor);
 		}
+	}
+	catch (const std::logic_error&)
+	{
+		// counts are positive integers
+		std::cerr << "Usage: PathTracer --benchmark Results.json [--max-triangles N] [--threads 1,2,4]\n";
 
-		std::cout << "\r( Rendering " << unsigned(Row * InvCamY * 100.0F) << " % Completed )";
+		return 2;
 	}
 
-	std::cout << "\n";
-	
-	Camera.WriteImageToPPM("Image");
+	const std::vector<BenchmarkResult> Results = RunScalingBenchmark(Options);
+
+	std::ofstream Json(argv[2]);
+
+	WriteBenchmarkJson(Options, Results, Json);
+
+	return Json ? 0 : 1;
 }
 
 int main(int argc, char** argv)
 {
+	if (argc > 2 && std::string_view(argv[1]) == "--benchmark")
+	{
+		return RunBenchmark(argc, argv);
+	}
+
+	// PathTracer --serve [SocketPath]
+	if (argc > 1 && std::string_view(argv[1]) == "--serve")
+	{
+		RenderServerOptions ServerOptions;
+
+		if (argc > 2)
+		{
+			ServerOptions.SocketPath = argv[2];
+		}
+
+		RenderServer Server(ServerOptions);
+		Server.Run();
+
+		return 0;
+	}
+
 	CamOptions Options;
 	Options.LookFrom = Vector3f(3, 2, 5);
 	Options.LookAt = Vector3f(0, 2, -1);
@@ -63,7 +95,15 @@ int main(int argc, char** argv)
 
     Scene Cube(R"(..\..\Models\Cube.obj)");
 
-	Render(NewCamera, Cube);
+	MemoryReport Usage = Cube.GetMemoryReport();
+	Usage.Add("Camera", NewCamera.GetSizeInBytes());
+	Usage.Print(std::cout);
+
+	// the cube has no emitters, a white sky keeps it visible
+	RenderOptions aRenderOptions;
+	aRenderOptions.Background = Vector3f(1, 1, 1);
+
+	Render(NewCamera, Cube, aRenderOptions);
 
 	return 0;
 }